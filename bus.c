@@ -28,6 +28,7 @@
 #include "domain.h"
 #include "endpoint.h"
 #include "item.h"
+#include "match.h"
 #include "metadata.h"
 #include "names.h"
 #include "policy.h"
@@ -89,11 +90,13 @@ static void __kdbus_bus_free(struct kref *kref)
 	BUG_ON(!list_empty(&bus->ep_list));
 	BUG_ON(!list_empty(&bus->monitors_list));
 	BUG_ON(!hash_empty(bus->conn_hash));
+	BUG_ON(!list_empty(&bus->conn_list));
 
 	kdbus_notify_free(bus);
 	atomic_dec(&bus->user->buses);
 	kdbus_domain_user_unref(bus->user);
 	kdbus_name_registry_free(bus->name_registry);
+	kdbus_match_index_free(bus->match_index);
 	kdbus_domain_unref(bus->domain);
 	kdbus_policy_db_clear(&bus->policy_db);
 	kdbus_meta_free(bus->meta);
@@ -143,6 +146,83 @@ struct kdbus_conn *kdbus_bus_find_conn_by_id(struct kdbus_bus *bus, u64 id)
 	return found;
 }
 
+/**
+ * kdbus_bus_find_conns_by_id() - find the connections of several ids at once
+ * @bus:		The bus to look for the connections
+ * @ids:		The 64-bit connection ids, 0 entries are skipped
+ * @conns:		Array to store a reference to each connection found in,
+ *			at the same index
+ * @count:		Number of entries in @ids and @conns
+ *
+ * Like kdbus_bus_find_conn_by_id(), but the bus lock is only taken once.
+ * Entries of @conns for ids which are skipped or not found are left
+ * untouched.
+ */
+void kdbus_bus_find_conns_by_id(struct kdbus_bus *bus, const u64 *ids,
+				struct kdbus_conn **conns, unsigned int count)
+{
+	struct kdbus_conn *conn;
+	unsigned int i;
+
+	down_read(&bus->conn_rwlock);
+	for (i = 0; i < count; i++) {
+		if (ids[i] == 0)
+			continue;
+
+		hash_for_each_possible(bus->conn_hash, conn, hentry, ids[i])
+			if (conn->id == ids[i]) {
+				conns[i] = kdbus_conn_ref(conn);
+				break;
+			}
+	}
+	up_read(&bus->conn_rwlock);
+}
+
+/**
+ * kdbus_bus_attach_flags_update() - account the attach flags of a connection
+ * @bus:		The bus the connection is on
+ * @old:		Previous KDBUS_ATTACH_* flags of the connection
+ * @new:		New KDBUS_ATTACH_* flags of the connection
+ *
+ * The bus counts the connections which can receive broadcasts for each
+ * attach flag, so a broadcast can collect all the metadata its receivers
+ * may ask for at once. The caller must hold the bus' conn_rwlock.
+ */
+void kdbus_bus_attach_flags_update(struct kdbus_bus *bus, u64 old, u64 new)
+{
+	u64 changed = (old ^ new) & _KDBUS_ATTACH_ALL;
+	unsigned int i;
+
+	for (i = 0; changed >> i; i++) {
+		if (!(changed & (1ULL << i)))
+			continue;
+
+		if (new & (1ULL << i))
+			atomic_inc(&bus->attach_flags_refs[i]);
+		else
+			atomic_dec(&bus->attach_flags_refs[i]);
+	}
+}
+
+/**
+ * kdbus_bus_attach_flags() - union of the attach flags of all receivers
+ * @bus:		The bus
+ *
+ * Return: the KDBUS_ATTACH_* flags requested by any connection on the bus
+ * which can receive broadcasts
+ */
+u64 kdbus_bus_attach_flags(struct kdbus_bus *bus)
+{
+	u64 flags = 0;
+	unsigned int i;
+
+	for (i = 0; _KDBUS_ATTACH_ALL >> i; i++)
+		if (atomic_read(&bus->attach_flags_refs[i]) > 0)
+			flags |= 1ULL << i;
+
+	return flags;
+}
+
 /**
  * kdbus_bus_disconnect() - disconnect a bus
  * @bus:		The kdbus reference
@@ -300,6 +380,12 @@ struct kdbus_bus *kdbus_bus_new(struct kdbus_domain *domain,
 	if (!b)
 		return ERR_PTR(-ENOMEM);
 
+	ret = kdbus_notify_init(b);
+	if (ret < 0) {
+		kfree(b);
+		return ERR_PTR(ret);
+	}
+
 	kref_init(&b->kref);
 	b->uid_owner = uid;
 	b->bus_flags = make->flags;
@@ -307,11 +393,9 @@ struct kdbus_bus *kdbus_bus_new(struct kdbus_domain *domain,
 	mutex_init(&b->lock);
 	init_rwsem(&b->conn_rwlock);
 	hash_init(b->conn_hash);
+	INIT_LIST_HEAD(&b->conn_list);
 	INIT_LIST_HEAD(&b->ep_list);
 	INIT_LIST_HEAD(&b->monitors_list);
-	INIT_LIST_HEAD(&b->notify_list);
-	spin_lock_init(&b->notify_lock);
-	mutex_init(&b->notify_flush_lock);
 	atomic64_set(&b->conn_seq_last, 0);
 	b->domain = kdbus_domain_ref(domain);
 	kdbus_policy_db_init(&b->policy_db);
@@ -349,10 +433,16 @@ struct kdbus_bus *kdbus_bus_new(struct kdbus_domain *domain,
 		goto exit_free_name;
 	}
 
+	b->match_index = kdbus_match_index_new();
+	if (IS_ERR(b->match_index)) {
+		ret = PTR_ERR(b->match_index);
+		goto exit_free_reg;
+	}
+
 	b->ep = kdbus_ep_new(b, "bus", mode, uid, gid, false);
 	if (IS_ERR(b->ep) < 0) {
 		ret = PTR_ERR(b->ep);
-		goto exit_free_reg;
+		goto exit_free_index;
 	}
 
 	/* link into domain */
@@ -387,12 +477,15 @@ exit_unref_user_unlock:
 	kdbus_domain_user_unref(b->user);
 	kdbus_ep_disconnect(b->ep);
 	kdbus_ep_unref(b->ep);
+exit_free_index:
+	kdbus_match_index_free(b->match_index);
 exit_free_reg:
 	kdbus_name_registry_free(b->name_registry);
 exit_free_name:
 	kfree(b->name);
 exit_free:
 	kdbus_meta_free(b->meta);
+	kdbus_notify_free(b);
 	kdbus_policy_db_clear(&b->policy_db);
 	kdbus_domain_unref(b->domain);
 	kfree(b);
@@ -17,7 +17,9 @@
 #include <linux/hashtable.h>
 #include <linux/spinlock.h>
 #include <linux/kref.h>
+#include <linux/percpu.h>
 #include <linux/rwsem.h>
+#include <linux/wait.h>
 
 #include "policy.h"
 #include "util.h"
@@ -37,17 +39,27 @@
  * @ep_list:		Endpoints on this bus
  * @bus_flags:		Simple pass-through flags from userspace to userspace
  * @name_registry:	Name registry of this bus
+ * @match_index:	Index of the match entries of all connections which
+ *			may match kernel notifications
  * @domain_entry:	Entry in domain
  * @bloom:		Bloom parameters
  * @id128:		Unique random 128 bit ID of this bus
  * @user:		Owner of the bus
  * @policy_db:		Policy database for this bus
- * @notify_list:	List of pending kernel-generated messages
- * @notify_lock:	Notification list lock
+ * @notify_cpu:	Per-CPU lists of pending kernel-generated messages
+ * @notify_seq_last:	Last used notification sequence number
+ * @notify_seq_next:	Sequence number of the next notification to send
+ * @notify_pending:	Number of queued notifications not sent yet
+ * @notify_backlog:	Collected notifications waiting for an earlier one
  * @notify_flush_lock:	Notification flushing lock
+ * @notify_flush_count:	Number of completed flushes
+ * @notify_flush_wait:	Threads waiting for a flush to complete
  * @conn_rwlock:	Read/Write lock for all lists of child connections
  * @conn_hash:		Map of connection IDs
+ * @conn_list:		Connections of this bus, ordered by ID
  * @monitors_list:	Connections that monitor this bus
+ * @attach_flags_refs:	Number of connections receiving broadcasts, per
+ *			KDBUS_ATTACH_* flag they requested
  * @meta:		Meta information about the bus creator
  *
  * A bus provides a "bus" endpoint / device node.
@@ -70,18 +82,26 @@ struct kdbus_bus {
 	struct list_head ep_list;
 	u64 bus_flags;
 	struct kdbus_name_registry *name_registry;
+	struct kdbus_match_index *match_index;
 	struct list_head domain_entry;
 	struct kdbus_bloom_parameter bloom;
 	u8 id128[16];
 	struct kdbus_domain_user *user;
 	struct kdbus_policy_db policy_db;
-	struct list_head notify_list;
-	spinlock_t notify_lock;
+	struct kdbus_notify_cpu __percpu *notify_cpu;
+	atomic64_t notify_seq_last;
+	u64 notify_seq_next;
+	atomic_t notify_pending;
+	struct list_head notify_backlog;
 	struct mutex notify_flush_lock;
+	atomic64_t notify_flush_count;
+	wait_queue_head_t notify_flush_wait;
 
 	struct rw_semaphore conn_rwlock;
 	DECLARE_HASHTABLE(conn_hash, 8);
+	struct list_head conn_list;
 	struct list_head monitors_list;
+	atomic_t attach_flags_refs[BITS_PER_LONG_LONG];
 
 	struct kdbus_meta *meta;
 };
@@ -103,4 +123,8 @@ bool kdbus_bus_cred_is_privileged(const struct kdbus_bus *bus,
 				  const struct cred *cred);
 bool kdbus_bus_uid_is_privileged(const struct kdbus_bus *bus);
 struct kdbus_conn *kdbus_bus_find_conn_by_id(struct kdbus_bus *bus, u64 id);
+void kdbus_bus_find_conns_by_id(struct kdbus_bus *bus, const u64 *ids,
+				struct kdbus_conn **conns, unsigned int count);
+void kdbus_bus_attach_flags_update(struct kdbus_bus *bus, u64 old, u64 new);
+u64 kdbus_bus_attach_flags(struct kdbus_bus *bus);
 #endif
@@ -16,9 +16,11 @@
 #include <linux/device.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/hash.h>
 #include <linux/hashtable.h>
 #include <linux/idr.h>
 #include <linux/init.h>
+#include <linux/llist.h>
 #include <linux/math64.h>
 #include <linux/mm.h>
 #include <linux/module.h>
@@ -36,6 +38,7 @@
 #include "match.h"
 #include "message.h"
 #include "metadata.h"
+#include "monitor.h"
 #include "names.h"
 #include "domain.h"
 #include "item.h"
@@ -43,6 +46,7 @@
 #include "policy.h"
 #include "util.h"
 #include "queue.h"
+#include "trace.h"
 
 struct kdbus_conn_reply;
 
@@ -151,6 +155,7 @@ static void kdbus_conn_reply_sync(struct kdbus_conn_reply *reply, int err)
 	list_del_init(&reply->entry);
 	reply->waiting = false;
 	reply->err = err;
+	trace_kdbus_reply_wake(reply->reply_dst->id, reply->cookie, err);
 	wake_up_interruptible(&reply->reply_dst->wait);
 }
 
@@ -176,7 +181,7 @@ static int kdbus_conn_queue_user_quota(struct kdbus_conn *conn,
 	 * per individual user, we start to count all further messages
 	 * from the sending users.
 	 */
-	if (conn->queue.msg_count < KDBUS_CONN_MAX_MSGS_PER_USER)
+	if (kdbus_conn_msg_load(conn) < KDBUS_CONN_MAX_MSGS_PER_USER)
 		return 0;
 
 	user = conn_src->user->idr;
@@ -197,7 +202,7 @@ static int kdbus_conn_queue_user_quota(struct kdbus_conn *conn,
 		 * array has now exceeded its limit.
 		 */
 		if (conn->msg_users_max == 0)
-			conn->msg_users[user] = conn->queue.msg_count;
+			conn->msg_users[user] = kdbus_conn_msg_load(conn);
 
 		conn->msg_users_max = i;
 	}
@@ -210,6 +215,112 @@ static int kdbus_conn_queue_user_quota(struct kdbus_conn *conn,
 	return 0;
 }
 
+/*
+ * Check the queue limit of the receiver before a message is copied into
+ * its pool, so a message to a full queue does not pay for the pool
+ * allocation and the copy. This only reads the message counters, without
+ * the connection lock; the limits are checked for real, and the user
+ * quota accounted, under the lock when the entry is linked.
+ */
+static int kdbus_conn_queue_check(struct kdbus_conn *conn, bool privileged)
+{
+	if (privileged)
+		return 0;
+
+	if (kdbus_conn_msg_load(conn) > KDBUS_CONN_MAX_MSGS)
+		return -ENOBUFS;
+
+	return 0;
+}
+
+/*
+ * Link the entries pushed to a queue without the connection lock; the
+ * caller must hold it.
+ */
+static void kdbus_conn_queue_drain(struct kdbus_conn *conn,
+				   struct kdbus_queue *queue)
+{
+	atomic_sub(kdbus_queue_drain(queue), &conn->msg_pending);
+}
+
+/* link an entry into a queue, behind all entries pushed before */
+static void kdbus_conn_queue_add(struct kdbus_conn *conn,
+				 struct kdbus_queue *queue,
+				 struct kdbus_queue_entry *entry)
+{
+	atomic_sub(kdbus_queue_entry_add(queue, entry), &conn->msg_pending);
+}
+
+/*
+ * Receive an entry taken off the queue by kdbus_queue_entry_pop(), without
+ * the connection lock. Pushed entries carry neither a reply tracker nor a
+ * user quota, so there is nothing to account under the lock.
+ */
+static int kdbus_conn_entry_recv_pushed(struct kdbus_conn *conn,
+					struct kdbus_cmd_recv *recv,
+					struct kdbus_queue_entry *entry)
+{
+	int ret = 0;
+
+	atomic_dec(&conn->msg_pending);
+	trace_kdbus_queue_entry_remove(entry->src_id, conn->id, entry->cookie,
+				       entry->priority,
+				       kdbus_conn_msg_load(conn));
+
+	if (recv->flags & KDBUS_RECV_DROP) {
+		kdbus_pool_slice_free(entry->slice);
+		kdbus_queue_entry_free(entry);
+		return 0;
+	}
+
+	recv->offset = kdbus_pool_slice_offset(entry->slice);
+
+	ret = kdbus_queue_entry_install(conn, entry);
+	if (ret == 0 && entry->meta_epoch_flags)
+		kdbus_conn_meta_epoch_update(conn, entry->src_id,
+					     entry->meta_epoch,
+					     entry->meta_epoch_flags);
+	kdbus_pool_slice_make_public(entry->slice);
+	kdbus_queue_entry_free(entry);
+
+	return ret;
+}
+
+/* pick the receive queue for an entry, according to the steering method */
+static struct kdbus_queue *
+kdbus_conn_queue_steer(struct kdbus_conn *conn,
+		       const struct kdbus_queue_entry *entry)
+{
+	u32 hash;
+
+	if (conn->queues_count == 1)
+		return &conn->queues[0];
+
+	switch (conn->queue_steering) {
+	case KDBUS_QUEUE_STEER_SRC_ID:
+		hash = hash_64(entry->src_id, 32);
+		break;
+
+	case KDBUS_QUEUE_STEER_COOKIE:
+		hash = hash_64(entry->cookie, 32);
+		break;
+
+	case KDBUS_QUEUE_STEER_DST_NAME:
+		/* messages addressed to the unique ID go to the first queue */
+		if (entry->dst_name_id == 0)
+			return &conn->queues[0];
+
+		hash = entry->dst_name_hash;
+		break;
+
+	default:
+		hash = 0;
+		break;
+	}
+
+	return &conn->queues[hash % conn->queues_count];
+}
+
 static void kdbus_conn_work(struct work_struct *work)
 {
 	struct kdbus_conn *conn;
@@ -251,10 +362,14 @@ static void kdbus_conn_work(struct work_struct *work)
 		 * Don't send notifications for reply trackers that were
 		 * left in an interrupted syscall state.
 		 */
-		if (reply->deadline_ns != 0 && !reply->interrupted)
+		if (reply->deadline_ns != 0 && !reply->interrupted) {
+			trace_kdbus_reply_timeout(conn->id,
+						  reply->reply_dst->id,
+						  reply->cookie, false);
 			kdbus_notify_reply_timeout(conn->bus,
 						   reply->reply_dst->id,
 						   reply->cookie);
+		}
 
 		list_del_init(&reply->entry);
 		kdbus_conn_reply_unref(reply);
@@ -274,22 +389,76 @@ static void kdbus_conn_work(struct work_struct *work)
  * kdbus_cmd_msg_recv() - receive a message from the queue
  * @conn:		Connection to work on
  * @recv:		The command as passed in by the ioctl
+ * @index:		Index of the receive queue to de-queue from
  *
  * Return: 0 on success, negative errno on failure
  */
 int kdbus_cmd_msg_recv(struct kdbus_conn *conn,
-		       struct kdbus_cmd_recv *recv)
+		       struct kdbus_cmd_recv *recv, u64 index)
 {
 	struct kdbus_queue_entry *entry = NULL;
+	struct kdbus_queue *queue;
 	int ret;
 
 	if (recv->offset > 0)
 		return -EINVAL;
 
-	mutex_lock(&conn->lock);
-	ret = kdbus_queue_entry_peek(&conn->queue, recv->priority,
-				     recv->flags & KDBUS_RECV_USE_PRIORITY,
-				     &entry);
+	if (index >= conn->queues_count)
+		return -EINVAL;
+
+	queue = &conn->queues[index];
+
+	for (;;) {
+		/* nothing queued, don't bother taking the lock */
+		while (kdbus_queue_empty(queue)) {
+			if (!(recv->flags & KDBUS_RECV_WAIT))
+				return -EAGAIN;
+
+			/* kdbus_conn_disconnect() wakes us up */
+			ret = wait_event_interruptible(queue->wait,
+					!kdbus_queue_empty(queue) ||
+					!kdbus_conn_active(conn));
+			if (ret < 0)
+				return ret;
+
+			if (!kdbus_conn_active(conn))
+				return -ECONNRESET;
+		}
+
+		/*
+		 * FIFO receivers take messages which were pushed without the
+		 * connection lock without taking it either, as long as no
+		 * message had to be linked into the queue's lists.
+		 */
+		if (!(recv->flags & (KDBUS_RECV_USE_PRIORITY |
+				     KDBUS_RECV_PEEK))) {
+			entry = kdbus_queue_entry_pop(queue);
+			if (entry)
+				return kdbus_conn_entry_recv_pushed(conn, recv,
+								    entry);
+		}
+
+		mutex_lock(&conn->lock);
+		kdbus_conn_queue_drain(conn, queue);
+		ret = kdbus_queue_entry_peek(queue, recv->priority,
+					     recv->flags &
+					     KDBUS_RECV_USE_PRIORITY,
+					     &entry);
+
+		/*
+		 * All receivers waiting on a queue are woken up for a new
+		 * message, and another one might have taken it before we
+		 * got the lock, or a lock-free receiver might have taken
+		 * the pushed messages just after we drained the queue. Check
+		 * the queue again; a blocking receiver goes back to sleep if
+		 * it is empty, a pending signal interrupts the wait.
+		 */
+		if (ret != -EAGAIN)
+			break;
+
+		mutex_unlock(&conn->lock);
+	}
+
 	if (ret < 0)
 		goto exit_unlock;
 
@@ -356,7 +525,11 @@ int kdbus_cmd_msg_recv(struct kdbus_conn *conn,
 		goto exit_unlock;
 	}
 
-	ret = kdbus_queue_entry_install(entry);
+	ret = kdbus_queue_entry_install(conn, entry);
+	if (ret == 0 && entry->meta_epoch_flags)
+		kdbus_conn_meta_epoch_update(conn, entry->src_id,
+					     entry->meta_epoch,
+					     entry->meta_epoch_flags);
 	kdbus_pool_slice_make_public(entry->slice);
 	kdbus_queue_entry_remove(conn, entry);
 	kdbus_queue_entry_free(entry);
@@ -391,6 +564,42 @@ static int kdbus_conn_find_reply(struct kdbus_conn *conn_replying,
 	return ret;
 }
 
+static bool kdbus_conn_has_interrupted_reply(struct kdbus_conn *conn,
+					     struct kdbus_conn *conn_src,
+					     u64 cookie)
+{
+	struct kdbus_conn_reply *r;
+	bool found;
+
+	mutex_lock(&conn->lock);
+	found = kdbus_conn_find_reply(conn, conn_src, cookie, &r) == 0 &&
+		r->interrupted;
+	mutex_unlock(&conn->lock);
+
+	return found;
+}
+
+/*
+ * Find the owner of a shared name which holds an interrupted synchronous
+ * call of @conn_src. The caller must hold the name lock.
+ */
+static struct kdbus_conn *
+kdbus_conn_find_shared_reply(struct kdbus_name_entry *e,
+			     struct kdbus_conn *conn_src, u64 cookie)
+{
+	struct kdbus_name_queue_item *q;
+
+	if (kdbus_conn_has_interrupted_reply(e->conn, conn_src, cookie))
+		return e->conn;
+
+	list_for_each_entry(q, &e->shared_list, entry_entry)
+		if (kdbus_conn_has_interrupted_reply(q->conn, conn_src,
+						     cookie))
+			return q->conn;
+
+	return NULL;
+}
+
 /**
  * kdbus_cmd_msg_cancel() - cancel all pending sync requests
  *			    with the given cookie
@@ -472,43 +681,77 @@ static int kdbus_conn_check_access(struct kdbus_ep *ep,
 	return 0;
 }
 
-/* enqueue a message into the receiver's pool */
-static int kdbus_conn_entry_insert(struct kdbus_conn *conn,
-				   struct kdbus_conn *conn_src,
-				   const struct kdbus_kmsg *kmsg,
-				   struct kdbus_conn_reply *reply)
+/*
+ * Push an entry to the lock-free pending list of its queue, as long as all
+ * receive queues of the connection together hold so few messages that
+ * neither the queue limit nor the per-user quota can apply. The pending
+ * messages are counted per connection, so senders cannot get around the
+ * limits by spreading messages over several queues.
+ */
+static bool kdbus_conn_entry_push(struct kdbus_conn *conn,
+				  struct kdbus_queue *queue,
+				  struct kdbus_queue_entry *entry)
 {
-	struct kdbus_queue_entry *entry;
+	size_t linked = 0;
+	unsigned int i;
+
+	for (i = 0; i < conn->queues_count; i++)
+		linked += ACCESS_ONCE(conn->queues[i].msg_count);
+
+	if (linked + atomic_inc_return(&conn->msg_pending) >
+	    KDBUS_CONN_MAX_MSGS_PER_USER) {
+		atomic_dec(&conn->msg_pending);
+		return false;
+	}
+
+	kdbus_queue_entry_push(queue, entry);
+	return true;
+}
+
+/*
+ * Link a prepared entry into the receiver's queue; the caller must have
+ * acquired the receiver. On failure, the entry and its slice are freed.
+ * @privileged tells whether the sender had CAP_IPC_OWNER, which lifts the
+ * queue limit; it is passed in, as this might not run in the context of
+ * the sender.
+ */
+static int kdbus_conn_entry_link(struct kdbus_conn *conn,
+				 struct kdbus_conn *conn_src,
+				 struct kdbus_queue_entry *entry,
+				 struct kdbus_conn_reply *reply,
+				 bool privileged)
+{
+	/* a pushed entry can be received and freed before we trace it */
+	s64 priority = entry->priority;
+	u64 src_id = entry->src_id;
+	u64 cookie = entry->cookie;
+	struct kdbus_queue *queue;
 	int ret;
 
+	queue = kdbus_conn_queue_steer(conn, entry);
+
+	/*
+	 * Messages without a reply tracker are appended to the lock-free
+	 * pending list, as long as the connection's queues are short enough
+	 * to not need any per-user accounting. A FIFO receiver takes them
+	 * off that list without the connection lock; all others link them
+	 * into the queue before they look at it.
+	 */
+	if (!reply && kdbus_conn_entry_push(conn, queue, entry))
+		goto exit_wakeup;
+
 	mutex_lock(&conn->lock);
 
 	/* limit the maximum number of queued messages */
-	if (!ns_capable(&init_user_ns, CAP_IPC_OWNER) &&
-	    conn->queue.msg_count > KDBUS_CONN_MAX_MSGS) {
+	if (!privileged && kdbus_conn_msg_load(conn) > KDBUS_CONN_MAX_MSGS) {
 		ret = -ENOBUFS;
 		goto exit_unlock;
 	}
 
-	if (!kdbus_conn_active(conn)) {
-		ret = -ECONNRESET;
-		goto exit_unlock;
-	}
-
-	/* The connection does not accept file descriptors */
-	if (!(conn->flags & KDBUS_HELLO_ACCEPT_FD) && kmsg->fds_count > 0) {
-		ret = -ECOMM;
-		goto exit_unlock;
-	}
-
-	ret = kdbus_queue_entry_alloc(conn, kmsg, &entry);
-	if (ret < 0)
-		goto exit_unlock;
-
 	/* limit the number of queued messages from the same individual user */
 	ret = kdbus_conn_queue_user_quota(conn, conn_src, entry);
 	if (ret < 0)
-		goto exit_queue_free;
+		goto exit_unlock;
 
 	/*
 	 * Remember the the reply associated with this queue entry, so we can
@@ -523,41 +766,348 @@ static int kdbus_conn_entry_insert(struct kdbus_conn *conn,
 			schedule_delayed_work(&conn->work, 0);
 	}
 
-	/* link the message into the receiver's entry */
-	kdbus_queue_entry_add(&conn->queue, entry);
+	/* link the message into the receiver's queue, behind pushed ones */
+	kdbus_conn_queue_add(conn, queue, entry);
 	mutex_unlock(&conn->lock);
 
-	/* wake up poll() */
+exit_wakeup:
+	trace_kdbus_queue_entry_add(src_id, conn->id, cookie, priority,
+				    kdbus_conn_msg_load(conn));
+
+	/* wake up poll() and the receiver waiting on this queue */
 	wake_up_interruptible(&conn->wait);
+	wake_up_interruptible(&queue->wait);
 	return 0;
 
-exit_queue_free:
-	kdbus_queue_entry_free(entry);
 exit_unlock:
 	mutex_unlock(&conn->lock);
+	kdbus_pool_slice_free(entry->slice);
+	kdbus_queue_entry_free(entry);
+	return ret;
+}
+
+/* enqueue a message into the receiver's pool */
+static int kdbus_conn_entry_insert(struct kdbus_conn *conn,
+				   struct kdbus_conn *conn_src,
+				   const struct kdbus_kmsg *kmsg,
+				   struct kdbus_conn_reply *reply)
+{
+	struct kdbus_queue_entry *entry;
+	bool privileged;
+	int ret;
+
+	/* The connection does not accept file descriptors */
+	if (!(conn->flags & KDBUS_HELLO_ACCEPT_FD) && kmsg->fds_count > 0)
+		return -ECOMM;
+
+	/* prevent the connection from being shut down while we insert */
+	ret = kdbus_conn_acquire(conn);
+	if (ret < 0)
+		return ret;
+
+	privileged = ns_capable(&init_user_ns, CAP_IPC_OWNER);
+	ret = kdbus_conn_queue_check(conn, privileged);
+	if (ret < 0)
+		goto exit_release;
+
+	/*
+	 * Reserve the slice and copy the message into the receiver's pool
+	 * without holding the connection lock; the pool has its own lock,
+	 * and the slice is not public, so userspace cannot free it before
+	 * we linked it. The connection lock is only taken to link the
+	 * prepared entry, so concurrent senders and the receiver do not
+	 * stall behind large payload copies.
+	 */
+	ret = kdbus_queue_entry_alloc(conn, kmsg, &entry);
+	if (ret < 0)
+		goto exit_release;
+
+	ret = kdbus_conn_entry_link(conn, conn_src, entry, reply, privileged);
+
+exit_release:
+	kdbus_conn_release(conn);
 	return ret;
 }
 
+/**
+ * kdbus_conn_queue_entry() - queue a prepared entry
+ * @conn:		The receiving connection
+ * @entry:		The entry, with its slice allocated and filled
+ * @privileged:		Whether the sender of the message had CAP_IPC_OWNER
+ *			when it was sent
+ *
+ * The caller must have acquired @conn. On failure, the entry and its slice
+ * are freed. This might be called from a worker, so the capabilities of
+ * the current task do not tell anything about the sender.
+ *
+ * Return: 0 on success, negative errno on failure.
+ */
+int kdbus_conn_queue_entry(struct kdbus_conn *conn,
+			   struct kdbus_queue_entry *entry,
+			   bool privileged)
+{
+	return kdbus_conn_entry_link(conn, NULL, entry, NULL, privileged);
+}
+
 static int kdbus_kmsg_attach_metadata(struct kdbus_kmsg *kmsg,
 				      struct kdbus_conn *conn_src,
-				      struct kdbus_conn *conn_dst)
+				      u64 attach_flags)
 {
-	u64 attach_flags;
+	int ret;
 
 	/*
-	 * Append metadata items according to the destination connection's
-	 * attach flags. If the source connection has faked credentials, the
+	 * Append metadata items according to the given attach flags of the
+	 * receivers. If the source connection has faked credentials, the
 	 * metadata object associated with the kmsg has been pre-filled with
 	 * conn_src->owner_meta, and we only attach the connection's name and
 	 * currently owned names on top of that.
 	 */
-	attach_flags = atomic64_read(&conn_dst->attach_flags);
-
 	if (conn_src->owner_meta)
 		attach_flags &= KDBUS_ATTACH_NAMES |
 				KDBUS_ATTACH_CONN_DESCRIPTION;
 
-	return kdbus_meta_append(kmsg->meta, conn_src, kmsg->seq, attach_flags);
+	ret = kdbus_meta_append_cached(kmsg->meta, conn_src->meta_cache,
+				       conn_src, kmsg->seq, attach_flags);
+
+	trace_kdbus_kmsg_attach_metadata(kmsg->msg.src_id, kmsg->msg.cookie,
+					 attach_flags, ret);
+	return ret;
+}
+
+static bool kdbus_conn_broadcast_match(struct kdbus_conn *conn_dst,
+				       struct kdbus_conn *conn_src,
+				       struct kdbus_kmsg *kmsg)
+{
+	/* name change subscribers get them regardless of their matches */
+	if (!conn_src && conn_dst->name_subscribed) {
+		switch (kmsg->notify_type) {
+		case KDBUS_ITEM_NAME_ADD:
+		case KDBUS_ITEM_NAME_REMOVE:
+		case KDBUS_ITEM_NAME_CHANGE:
+			return true;
+		}
+	}
+
+	return kdbus_match_db_match_kmsg(conn_dst->match_db, conn_src, kmsg);
+}
+
+/* whether a kernel notification is to be delivered to @conn_dst */
+static bool kdbus_conn_notify_wanted(struct kdbus_conn *conn_dst,
+				     struct kdbus_kmsg *kmsg)
+{
+	if (!kdbus_conn_broadcast_match(conn_dst, NULL, kmsg))
+		return false;
+
+	return kdbus_ep_policy_check_notification(conn_dst->ep,
+						  conn_dst, kmsg) == 0;
+}
+
+/* connections found in the match index, which may receive notifications */
+static bool kdbus_conn_notify_receiver(struct kdbus_conn *conn_dst)
+{
+	/* unlinked from the bus, but not yet freed */
+	if (hlist_unhashed(&conn_dst->hentry))
+		return false;
+
+	return kdbus_conn_is_ordinary(conn_dst) ||
+	       kdbus_conn_is_monitor(conn_dst);
+}
+
+/* kdbus_match_index_walk() callback for a single notification */
+static void kdbus_conn_notify_one(struct kdbus_conn *conn_dst, void *data)
+{
+	struct kdbus_kmsg *kmsg = data;
+
+	if (!kdbus_conn_notify_receiver(conn_dst))
+		return;
+
+	if (kdbus_ep_policy_check_notification(conn_dst->ep,
+					       conn_dst, kmsg) < 0)
+		return;
+
+	kdbus_conn_entry_insert(conn_dst, NULL, kmsg, NULL);
+}
+
+/*
+ * Assemble the notifications of @kmsgs that @conn_dst wants into @batch,
+ * and queue it. A single match is queued as it is.
+ */
+static void kdbus_conn_notify_batch(struct kdbus_conn *conn_dst,
+				    struct list_head *kmsgs,
+				    struct kdbus_kmsg *batch)
+{
+	struct kdbus_item *item = batch->msg.items;
+	struct kdbus_kmsg *kmsg, *last = NULL;
+	unsigned int count = 0;
+	u8 *p = item->data;
+
+	list_for_each_entry(kmsg, kmsgs, queue_entry) {
+		size_t size = KDBUS_ITEMS_SIZE(&kmsg->msg, items);
+
+		if (!kdbus_conn_notify_wanted(conn_dst, kmsg))
+			continue;
+
+		memcpy(p, kmsg->msg.items, size);
+		p += size;
+		last = kmsg;
+		count++;
+	}
+
+	if (count == 0)
+		return;
+
+	if (count == 1) {
+		kdbus_conn_entry_insert(conn_dst, NULL, last, NULL);
+		return;
+	}
+
+	item->size = p - (u8 *)item;
+	batch->msg.size = p - (u8 *)&batch->msg;
+	kdbus_conn_entry_insert(conn_dst, NULL, batch, NULL);
+}
+
+/* the notifications of a kdbus_conn_kmsg_send_batch() walk */
+struct kdbus_conn_batch_walk {
+	struct list_head *kmsgs;
+	struct kdbus_kmsg *batch;
+};
+
+/* kdbus_match_index_walk() callback for a list of notifications */
+static void kdbus_conn_notify_list(struct kdbus_conn *conn_dst, void *data)
+{
+	struct kdbus_conn_batch_walk *l = data;
+	struct kdbus_kmsg *kmsg;
+
+	if (!kdbus_conn_notify_receiver(conn_dst))
+		return;
+
+	if (l->batch && (conn_dst->flags & KDBUS_HELLO_NOTIFY_BATCH)) {
+		kdbus_conn_notify_batch(conn_dst, l->kmsgs, l->batch);
+		return;
+	}
+
+	list_for_each_entry(kmsg, l->kmsgs, queue_entry)
+		if (kdbus_conn_notify_wanted(conn_dst, kmsg))
+			kdbus_conn_entry_insert(conn_dst, NULL, kmsg, NULL);
+}
+
+/**
+ * kdbus_conn_kmsg_send_batch() - send a list of kernel notifications
+ * @ep:			Endpoint to send from
+ * @kmsgs:		Kernel-generated broadcast name change notifications,
+ *			linked by their queue_entry
+ *
+ * All notifications are delivered in a single walk over the receivers found
+ * in the match index of the bus. Connections created with
+ * KDBUS_HELLO_NOTIFY_BATCH get the ones they match as one message with a
+ * KDBUS_ITEM_NAME_BATCH item, all others get them one by one.
+ */
+void kdbus_conn_kmsg_send_batch(struct kdbus_ep *ep, struct list_head *kmsgs)
+{
+	struct kdbus_conn_batch_walk l = { .kmsgs = kmsgs };
+	struct kdbus_kmsg *kmsg, *batch;
+	struct kdbus_bus *bus = ep->bus;
+	size_t size = 0;
+	u64 stamp;
+
+	list_for_each_entry(kmsg, kmsgs, queue_entry) {
+		BUG_ON(kmsg->seq > 0);
+		kmsg->seq = atomic64_inc_return(&bus->domain->msg_seq_last);
+		size += KDBUS_ITEMS_SIZE(&kmsg->msg, items);
+	}
+
+	/* the batch is rebuilt for each receiver; fall back to single ones */
+	batch = kdbus_kmsg_new(size);
+	if (!IS_ERR(batch)) {
+		batch->msg.dst_id = KDBUS_DST_ID_BROADCAST;
+		batch->msg.src_id = KDBUS_SRC_ID_KERNEL;
+		batch->msg.payload_type = KDBUS_PAYLOAD_KERNEL;
+		batch->msg.items[0].type = KDBUS_ITEM_NAME_BATCH;
+		batch->notify_type = KDBUS_ITEM_NAME_BATCH;
+		batch->seq = atomic64_inc_return(&bus->domain->msg_seq_last);
+	} else {
+		batch = NULL;
+	}
+
+	/* every receiver is visited once, for the first message it matches */
+	l.batch = batch;
+	stamp = list_first_entry(kmsgs, struct kdbus_kmsg, queue_entry)->seq;
+
+	down_read(&bus->conn_rwlock);
+	list_for_each_entry(kmsg, kmsgs, queue_entry)
+		kdbus_match_index_walk(bus->match_index, kmsg, stamp,
+				       kdbus_conn_notify_list, &l);
+	up_read(&bus->conn_rwlock);
+
+	if (batch)
+		kdbus_kmsg_free(batch);
+}
+
+/* 1-in-N sampling of the messages a monitor is about to get */
+static bool kdbus_conn_monitor_sample(struct kdbus_conn *conn)
+{
+	u64 sample = conn->monitor_filter.sample;
+
+	if (sample <= 1)
+		return true;
+
+	return (unsigned int)atomic_inc_return(&conn->monitor_sampled) %
+	       sample == 0;
+}
+
+/* whether the monitor @conn wants to see the unicast message @kmsg */
+static bool kdbus_conn_monitor_wants(struct kdbus_conn *conn,
+				     struct kdbus_conn *conn_src,
+				     struct kdbus_kmsg *kmsg)
+{
+	if ((conn->monitor_filter.flags & KDBUS_MONITOR_FILTER_MATCH) &&
+	    !kdbus_match_db_match_kmsg(conn->match_db, conn_src, kmsg))
+		return false;
+
+	return kdbus_conn_monitor_sample(conn);
+}
+
+/*
+ * Build the record asynchronous monitors share for @kmsg, carrying the
+ * metadata any of them asked for, and the payload up to the largest
+ * snapshot length of them. Returns NULL if there are none, or if the
+ * record cannot be built; in the latter case, the drop is accounted to each
+ * of them. The caller must hold the conn_rwlock of the bus.
+ */
+static struct kdbus_monitor_record *
+kdbus_conn_monitor_record(struct kdbus_bus *bus, struct kdbus_kmsg *kmsg)
+{
+	struct kdbus_monitor_record *rec;
+	bool unlimited = false;
+	u64 attach_flags = 0;
+	bool async = false;
+	struct kdbus_conn *c;
+	u64 snaplen = 0;
+
+	list_for_each_entry(c, &bus->monitors_list, monitor_entry) {
+		if (!c->monitor)
+			continue;
+
+		attach_flags |= atomic64_read(&c->attach_flags);
+		if (c->monitor_filter.snaplen == 0)
+			unlimited = true;
+		snaplen = max(snaplen, c->monitor_filter.snaplen);
+		async = true;
+	}
+
+	if (!async)
+		return NULL;
+
+	rec = kdbus_monitor_record_new(kmsg, attach_flags,
+				       unlimited ? 0 : snaplen);
+	if (!IS_ERR(rec))
+		return rec;
+
+	list_for_each_entry(c, &bus->monitors_list, monitor_entry)
+		if (c->monitor)
+			kdbus_monitor_drop(c->monitor);
+
+	return NULL;
 }
 
 static void kdbus_conn_broadcast(struct kdbus_ep *ep,
@@ -565,13 +1115,32 @@ static void kdbus_conn_broadcast(struct kdbus_ep *ep,
 				 struct kdbus_kmsg *kmsg)
 {
 	const struct kdbus_msg *msg = &kmsg->msg;
+	struct kdbus_monitor_record *rec = NULL;
 	struct kdbus_bus *bus = ep->bus;
 	struct kdbus_conn *conn_dst;
+	bool rec_built = false;
 	unsigned int i;
 	int ret = 0;
 
 	down_read(&bus->conn_rwlock);
 
+	/* kernel notifications only visit the connections matching them */
+	if (!conn_src) {
+		kdbus_match_index_walk(bus->match_index, kmsg, kmsg->seq,
+				       kdbus_conn_notify_one, kmsg);
+		goto exit_unlock;
+	}
+
+	/*
+	 * Collect the metadata any of the receivers may ask for at once;
+	 * each receiver only gets the items it requested copied into its
+	 * pool.
+	 */
+	ret = kdbus_kmsg_attach_metadata(kmsg, conn_src,
+					 kdbus_bus_attach_flags(bus));
+	if (ret < 0)
+		goto exit_unlock;
+
 	hash_for_each(bus->conn_hash, i, conn_dst, hentry) {
 		if (conn_dst->id == msg->src_id)
 			continue;
@@ -585,44 +1154,41 @@ static void kdbus_conn_broadcast(struct kdbus_ep *ep,
 		    !kdbus_conn_is_monitor(conn_dst))
 			continue;
 
-		if (!kdbus_match_db_match_kmsg(conn_dst->match_db, conn_src,
-					       kmsg))
+		if (!kdbus_conn_broadcast_match(conn_dst, conn_src, kmsg))
 			continue;
 
-		ret = kdbus_ep_policy_check_notification(conn_dst->ep,
-							 conn_dst, kmsg);
+		/* Check if conn_src is allowed to signal */
+		ret = kdbus_ep_policy_check_broadcast(conn_dst->ep, conn_src,
+						      conn_dst);
 		if (ret < 0)
 			continue;
 
-		/*
-		 * The first receiver which requests additional
-		 * metadata causes the message to carry it; all
-		 * receivers after that will see all of the added
-		 * data, even when they did not ask for it.
-		 */
-		if (conn_src) {
-			/* Check if conn_src is allowed to signal */
-			ret = kdbus_ep_policy_check_broadcast(conn_dst->ep,
-							      conn_src,
-							      conn_dst);
-			if (ret < 0)
-				continue;
+		ret = kdbus_ep_policy_check_src_names(conn_dst->ep, conn_src,
+						      conn_dst);
+		if (ret < 0)
+			continue;
 
-			ret = kdbus_ep_policy_check_src_names(conn_dst->ep,
-							      conn_src,
-							      conn_dst);
-			if (ret < 0)
-				continue;
+		if (kdbus_conn_is_monitor(conn_dst) &&
+		    !kdbus_conn_monitor_sample(conn_dst))
+			continue;
 
-			ret = kdbus_kmsg_attach_metadata(kmsg, conn_src,
-							 conn_dst);
-			if (ret < 0)
-				goto exit_unlock;
+		if (!conn_dst->monitor) {
+			kdbus_conn_entry_insert(conn_dst, conn_src, kmsg, NULL);
+			continue;
+		}
+
+		/* built on the first asynchronous monitor that matches */
+		if (!rec_built) {
+			rec = kdbus_conn_monitor_record(bus, kmsg);
+			rec_built = true;
 		}
 
-		kdbus_conn_entry_insert(conn_dst, conn_src, kmsg, NULL);
+		if (rec)
+			kdbus_monitor_push(conn_dst->monitor, rec);
 	}
 
+	kdbus_monitor_record_put(rec);
+
 exit_unlock:
 	up_read(&bus->conn_rwlock);
 }
@@ -630,30 +1196,57 @@ exit_unlock:
 static void kdbus_conn_eavesdrop(struct kdbus_ep *ep, struct kdbus_conn *conn,
 				 struct kdbus_kmsg *kmsg)
 {
+	struct kdbus_monitor_record *rec = NULL;
+	bool rec_built = false;
 	struct kdbus_conn *c;
 	int ret;
 
 	/*
-	 * Monitor connections get all messages; ignore possible errors
-	 * when sending messages to monitor connections.
+	 * Monitor connections get all messages they did not filter out;
+	 * ignore possible errors when sending messages to monitor
+	 * connections.
 	 */
 
 	down_read(&ep->bus->conn_rwlock);
+	if (list_empty(&ep->bus->monitors_list))
+		goto exit_unlock;
+
+	/*
+	 * Collect all metadata the monitors may ask for at once; each
+	 * monitor only gets the items it requested.
+	 */
+	if (conn) {
+		ret = kdbus_kmsg_attach_metadata(kmsg, conn,
+					kdbus_bus_attach_flags(ep->bus));
+		if (ret < 0)
+			goto exit_unlock;
+	}
+
 	list_for_each_entry(c, &ep->bus->monitors_list, monitor_entry) {
+		if (!kdbus_conn_monitor_wants(c, conn, kmsg))
+			continue;
+
+		if (!c->monitor) {
+			kdbus_conn_entry_insert(c, NULL, kmsg, NULL);
+			continue;
+		}
+
 		/*
-		 * The first monitor which requests additional
-		 * metadata causes the message to carry it; all
-		 * monitors after that will see all of the added
-		 * data, even when they did not ask for it.
+		 * Asynchronous monitors share one copy of the message; the
+		 * sender only appends it to their rings.
 		 */
-		if (conn) {
-			ret = kdbus_kmsg_attach_metadata(kmsg, conn, c);
-			if (ret < 0)
-				break;
+		if (!rec_built) {
+			rec = kdbus_conn_monitor_record(ep->bus, kmsg);
+			rec_built = true;
 		}
 
-		kdbus_conn_entry_insert(c, NULL, kmsg, NULL);
+		if (rec)
+			kdbus_monitor_push(c->monitor, rec);
 	}
+
+	kdbus_monitor_record_put(rec);
+
+exit_unlock:
 	up_read(&ep->bus->conn_rwlock);
 }
 
@@ -691,12 +1284,15 @@ static int kdbus_conn_wait_reply(struct kdbus_ep *ep,
 		return r;
 	}
 
-	if (r == 0)
+	if (r == 0) {
+		trace_kdbus_reply_timeout(conn_dst->id, conn_src->id,
+					  msg->cookie, true);
 		ret = -ETIMEDOUT;
-	else if (!kdbus_conn_active(conn_src))
+	} else if (!kdbus_conn_active(conn_src)) {
 		ret = -ECONNRESET;
-	else
+	} else {
 		ret = reply_wait->err;
+	}
 
 	mutex_lock(&conn_dst->lock);
 	list_del_init(&reply_wait->entry);
@@ -707,7 +1303,11 @@ static int kdbus_conn_wait_reply(struct kdbus_ep *ep,
 	entry = reply_wait->queue_entry;
 	if (entry) {
 		if (ret == 0)
-			ret = kdbus_queue_entry_install(entry);
+			ret = kdbus_queue_entry_install(conn_src, entry);
+		if (ret == 0 && entry->meta_epoch_flags)
+			kdbus_conn_meta_epoch_update(conn_src, entry->src_id,
+						     entry->meta_epoch,
+						     entry->meta_epoch_flags);
 
 		msg->offset_reply = kdbus_pool_slice_offset(entry->slice);
 		kdbus_pool_slice_make_public(entry->slice);
@@ -783,17 +1383,21 @@ int kdbus_conn_kmsg_send(struct kdbus_ep *ep,
 		 * This way, we allow userspace to send the message to a
 		 * specific connection by ID only if the connection currently
 		 * owns the given name.
+		 * Shared names select one of their owners here; the message
+		 * and the reply tracking both go to the selected connection.
 		 */
-		if (msg->dst_id != KDBUS_DST_ID_NAME &&
-		    msg->dst_id != name_entry->conn->id) {
-			ret = -EREMCHG;
-			goto exit_name_unlock;
-		}
-
-		if (!name_entry->conn && name_entry->activator)
+		if (!name_entry->conn && name_entry->activator) {
 			conn_dst = kdbus_conn_ref(name_entry->activator);
-		else
-			conn_dst = kdbus_conn_ref(name_entry->conn);
+		} else {
+			conn_dst = kdbus_name_pick_owner(name_entry,
+							 msg->dst_id);
+			if (!conn_dst) {
+				ret = -EREMCHG;
+				goto exit_name_unlock;
+			}
+
+			conn_dst = kdbus_conn_ref(conn_dst);
+		}
 
 		if ((msg->flags & KDBUS_MSG_FLAGS_NO_AUTO_START) &&
 		     kdbus_conn_is_activator(conn_dst)) {
@@ -825,6 +1429,9 @@ int kdbus_conn_kmsg_send(struct kdbus_ep *ep,
 	if (name_entry)
 		kmsg->dst_name_id = name_entry->name_id;
 
+	trace_kdbus_msg_resolve(msg->src_id, conn_dst->id, msg->cookie,
+				kmsg->dst_name_id);
+
 	if (conn_src) {
 		/*
 		 * If we got here due to an interrupted system call, our reply
@@ -833,6 +1440,23 @@ int kdbus_conn_kmsg_send(struct kdbus_ep *ep,
 		 * away again, and don't queue the message again.
 		 */
 		if (sync) {
+			/*
+			 * With a shared name, the call might have been
+			 * queued on another owner than the selected one.
+			 */
+			if (name_entry && name_entry->shared_count > 0 &&
+			    msg->dst_id == KDBUS_DST_ID_NAME) {
+				struct kdbus_conn *c;
+
+				c = kdbus_conn_find_shared_reply(name_entry,
+								 conn_src,
+								 msg->cookie);
+				if (c && c != conn_dst) {
+					kdbus_conn_unref(conn_dst);
+					conn_dst = kdbus_conn_ref(c);
+				}
+			}
+
 			mutex_lock(&conn_dst->lock);
 			ret = kdbus_conn_find_reply(conn_dst, conn_src,
 						    kmsg->msg.cookie,
@@ -849,7 +1473,8 @@ int kdbus_conn_kmsg_send(struct kdbus_ep *ep,
 				goto wait_sync;
 		}
 
-		ret = kdbus_kmsg_attach_metadata(kmsg, conn_src, conn_dst);
+		ret = kdbus_kmsg_attach_metadata(kmsg, conn_src,
+				atomic64_read(&conn_dst->attach_flags));
 		if (ret < 0)
 			goto exit_unref;
 
@@ -879,17 +1504,29 @@ int kdbus_conn_kmsg_send(struct kdbus_ep *ep,
 		 * queue item and attach it to the reply tracking object.
 		 * The connection's queue will never get to see it.
 		 */
+		struct kdbus_queue_entry *entry = NULL;
+
+		/* copy the reply into the pool before taking the lock */
+		ret = kdbus_queue_entry_alloc(conn_dst, kmsg, &entry);
+
 		mutex_lock(&conn_dst->lock);
-		if (reply_wake->waiting && kdbus_conn_active(conn_dst))
-			ret = kdbus_queue_entry_alloc(conn_dst, kmsg,
-						      &reply_wake->queue_entry);
-		else
+		if (reply_wake->waiting && kdbus_conn_active(conn_dst)) {
+			reply_wake->queue_entry = entry;
+			entry = NULL;
+		} else {
 			ret = -ECONNRESET;
+		}
 
 		kdbus_conn_reply_sync(reply_wake, ret);
 		kdbus_conn_reply_unref(reply_wake);
 		mutex_unlock(&conn_dst->lock);
 
+		/* the waiter went away while we copied the reply */
+		if (entry) {
+			kdbus_pool_slice_free(entry->slice);
+			kdbus_queue_entry_free(entry);
+		}
+
 		if (ret < 0)
 			goto exit_unref;
 	} else {
@@ -956,6 +1593,7 @@ int kdbus_conn_disconnect(struct kdbus_conn *conn, bool ensure_queue_empty)
 	struct kdbus_conn_reply *reply, *reply_tmp;
 	struct kdbus_queue_entry *entry, *tmp;
 	LIST_HEAD(reply_list);
+	unsigned int i;
 
 	mutex_lock(&conn->lock);
 	if (!kdbus_conn_active(conn)) {
@@ -963,7 +1601,7 @@ int kdbus_conn_disconnect(struct kdbus_conn *conn, bool ensure_queue_empty)
 		return -EALREADY;
 	}
 
-	if (ensure_queue_empty && !list_empty(&conn->queue.msg_list)) {
+	if (ensure_queue_empty && !kdbus_conn_queues_empty(conn)) {
 		mutex_unlock(&conn->lock);
 		return -EBUSY;
 	}
@@ -972,6 +1610,8 @@ int kdbus_conn_disconnect(struct kdbus_conn *conn, bool ensure_queue_empty)
 	mutex_unlock(&conn->lock);
 
 	wake_up_interruptible(&conn->wait);
+	for (i = 0; i < conn->queues_count; i++)
+		wake_up_interruptible(&conn->queues[i].wait);
 
 #ifdef CONFIG_DEBUG_LOCK_ALLOC
 	rwsem_acquire(&conn->dep_map, 0, 0, _RET_IP_);
@@ -995,8 +1635,14 @@ int kdbus_conn_disconnect(struct kdbus_conn *conn, bool ensure_queue_empty)
 
 	/* remove from bus and endpoint */
 	hash_del(&conn->hentry);
+	list_del(&conn->bus_entry);
 	list_del(&conn->monitor_entry);
 	list_del(&conn->ep_entry);
+	atomic64_inc(&conn->bus->name_registry->generation);
+
+	if (kdbus_conn_is_ordinary(conn) || kdbus_conn_is_monitor(conn))
+		kdbus_bus_attach_flags_update(conn->bus,
+				atomic64_read(&conn->attach_flags), 0);
 
 	up_write(&conn->bus->conn_rwlock);
 	mutex_unlock(&conn->ep->lock);
@@ -1007,61 +1653,238 @@ int kdbus_conn_disconnect(struct kdbus_conn *conn, bool ensure_queue_empty)
 	 */
 	kdbus_name_remove_by_conn(conn->bus->name_registry, conn);
 
-	/* if we die while other connections wait for our reply, notify them */
-	mutex_lock(&conn->lock);
-	list_for_each_entry_safe(entry, tmp, &conn->queue.msg_list, entry) {
-		if (entry->reply)
-			kdbus_notify_reply_dead(conn->bus, entry->src_id,
-						entry->cookie);
+	/* if we die while other connections wait for our reply, notify them */
+	mutex_lock(&conn->lock);
+	for (i = 0; i < conn->queues_count; i++) {
+		struct kdbus_queue *queue = &conn->queues[i];
+
+		kdbus_conn_queue_drain(conn, queue);
+		list_for_each_entry_safe(entry, tmp, &queue->msg_list, entry) {
+			if (entry->reply)
+				kdbus_notify_reply_dead(conn->bus,
+							entry->src_id,
+							entry->cookie);
+
+			kdbus_queue_entry_remove(conn, entry);
+			kdbus_pool_slice_free(entry->slice);
+			kdbus_queue_entry_free(entry);
+		}
+	}
+	list_splice_init(&conn->reply_list, &reply_list);
+	mutex_unlock(&conn->lock);
+
+	list_for_each_entry_safe(reply, reply_tmp, &reply_list, entry) {
+		if (reply->sync) {
+			kdbus_conn_reply_sync(reply, -EPIPE);
+			continue;
+		}
+
+		/* send a 'connection dead' notification */
+		kdbus_notify_reply_dead(conn->bus, reply->reply_dst->id,
+					reply->cookie);
+
+		list_del(&reply->entry);
+		kdbus_conn_reply_unref(reply);
+	}
+
+	kdbus_notify_id_change(conn->bus, KDBUS_ITEM_ID_REMOVE,
+			       conn->id, conn->flags);
+
+	kdbus_notify_flush(conn->bus);
+
+	return 0;
+}
+
+/**
+ * kdbus_conn_active() - connection is not disconnected
+ * @conn:		Connection to check
+ *
+ * Return true if the connection was not disconnected, yet. Note that a
+ * connection might be disconnected asynchronously, unless you hold the
+ * connection lock. If that's not suitable for you, see kdbus_conn_acquire() to
+ * suppress connection shutdown for a short period.
+ *
+ * Return: true if the connection is still active
+ */
+bool kdbus_conn_active(const struct kdbus_conn *conn)
+{
+	return atomic_read(&conn->active) >= 0;
+}
+
+/**
+ * kdbus_conn_queues_empty() - check whether a connection has any messages
+ * @conn:		Connection to check
+ *
+ * This does not require the connection lock, but the result is only a
+ * snapshot unless the lock is held.
+ *
+ * Return: true if none of the connection's receive queues holds a message
+ */
+bool kdbus_conn_queues_empty(struct kdbus_conn *conn)
+{
+	unsigned int i;
+
+	for (i = 0; i < conn->queues_count; i++)
+		if (!kdbus_queue_empty(&conn->queues[i]))
+			return false;
+
+	return true;
+}
+
+/**
+ * kdbus_conn_msg_count() - number of linked messages of a connection
+ * @conn:		Connection
+ *
+ * The caller must hold the connection lock.
+ *
+ * Return: the number of messages in all receive queues of the connection
+ */
+size_t kdbus_conn_msg_count(const struct kdbus_conn *conn)
+{
+	size_t count = 0;
+	unsigned int i;
+
+	for (i = 0; i < conn->queues_count; i++)
+		count += conn->queues[i].msg_count;
+
+	return count;
+}
+
+/**
+ * kdbus_conn_msg_load() - estimate the number of messages of a connection
+ * @conn:		Connection
+ *
+ * This reads the message counters of all receive queues, including the
+ * entries not yet moved off the lock-free pending lists, without taking
+ * the connection lock. The result is only useful as a hint, for instance
+ * to balance messages over the owners of a shared name.
+ *
+ * Return: the approximate number of messages waiting for the connection
+ */
+size_t kdbus_conn_msg_load(const struct kdbus_conn *conn)
+{
+	size_t count = 0;
+	unsigned int i;
+
+	for (i = 0; i < conn->queues_count; i++)
+		count += ACCESS_ONCE(conn->queues[i].msg_count);
 
-		kdbus_queue_entry_remove(conn, entry);
-		kdbus_pool_slice_free(entry->slice);
-		kdbus_queue_entry_free(entry);
-	}
-	list_splice_init(&conn->reply_list, &reply_list);
-	mutex_unlock(&conn->lock);
+	return count + atomic_read(&conn->msg_pending);
+}
 
-	list_for_each_entry_safe(reply, reply_tmp, &reply_list, entry) {
-		if (reply->sync) {
-			kdbus_conn_reply_sync(reply, -EPIPE);
-			continue;
-		}
+/**
+ * struct kdbus_conn_meta_epoch - metadata snapshot a peer sent last
+ * @id:			ID of the sending connection
+ * @epoch:		Epoch of the sender's metadata snapshot
+ * @flags:		KDBUS_ATTACH_* flags of the snapshot items received
+ * @hentry:		Entry in kdbus_conn's meta_epoch_hash
+ * @lru_entry:		Entry in kdbus_conn's meta_epoch_lru
+ */
+struct kdbus_conn_meta_epoch {
+	u64 id;
+	u64 epoch;
+	u64 flags;
+	struct hlist_node hentry;
+	struct list_head lru_entry;
+};
 
-		/* send a 'connection dead' notification */
-		kdbus_notify_reply_dead(conn->bus, reply->reply_dst->id,
-					reply->cookie);
+static struct kdbus_conn_meta_epoch *
+kdbus_conn_meta_epoch_find(struct kdbus_conn *conn, u64 id)
+{
+	struct kdbus_conn_meta_epoch *e;
 
-		list_del(&reply->entry);
-		kdbus_conn_reply_unref(reply);
-	}
+	hash_for_each_possible(conn->meta_epoch_hash, e, hentry, id)
+		if (e->id == id)
+			return e;
 
-	kdbus_notify_id_change(conn->bus, KDBUS_ITEM_ID_REMOVE,
-			       conn->id, conn->flags);
+	return NULL;
+}
 
-	kdbus_notify_flush(conn->bus);
+/**
+ * kdbus_conn_meta_epoch_seen() - check whether a metadata snapshot is known
+ * @conn:		Receiving connection
+ * @id:			ID of the sending connection
+ * @epoch:		Epoch of the sender's metadata snapshot
+ * @flags:		KDBUS_ATTACH_* flags of the snapshot items to deliver
+ *
+ * Return: true if @conn already received all items in @flags of the
+ * snapshot @epoch of the connection @id, false otherwise
+ */
+bool kdbus_conn_meta_epoch_seen(struct kdbus_conn *conn, u64 id,
+				u64 epoch, u64 flags)
+{
+	struct kdbus_conn_meta_epoch *e;
+	bool seen = false;
 
-	return 0;
+	spin_lock(&conn->meta_epoch_lock);
+	e = kdbus_conn_meta_epoch_find(conn, id);
+	if (e && e->epoch == epoch && (flags & ~e->flags) == 0)
+		seen = true;
+	spin_unlock(&conn->meta_epoch_lock);
+
+	return seen;
 }
 
 /**
- * kdbus_conn_active() - connection is not disconnected
- * @conn:		Connection to check
- *
- * Return true if the connection was not disconnected, yet. Note that a
- * connection might be disconnected asynchronously, unless you hold the
- * connection lock. If that's not suitable for you, see kdbus_conn_acquire() to
- * suppress connection shutdown for a short period.
+ * kdbus_conn_meta_epoch_update() - remember a received metadata snapshot
+ * @conn:		Receiving connection
+ * @id:			ID of the sending connection
+ * @epoch:		Epoch of the sender's metadata snapshot
+ * @flags:		KDBUS_ATTACH_* flags of the snapshot items received
  *
- * Return: true if the connection is still active
+ * This is called once a message carrying the snapshot items in full was
+ * dequeued, so a later message only refers to data the receiver has
+ * actually seen. At most KDBUS_CONN_MAX_META_EPOCHS peers are remembered,
+ * the least recently updated one is forgotten first. A failed allocation
+ * just means the next message carries the items in full again.
  */
-bool kdbus_conn_active(const struct kdbus_conn *conn)
+void kdbus_conn_meta_epoch_update(struct kdbus_conn *conn, u64 id,
+				  u64 epoch, u64 flags)
 {
-	return atomic_read(&conn->active) >= 0;
+	struct kdbus_conn_meta_epoch *e, *new;
+
+	new = kmalloc(sizeof(*new), GFP_KERNEL);
+
+	spin_lock(&conn->meta_epoch_lock);
+	e = kdbus_conn_meta_epoch_find(conn, id);
+	if (e) {
+		if (e->epoch == epoch)
+			flags |= e->flags;
+		list_del(&e->lru_entry);
+	} else {
+		if (new &&
+		    conn->meta_epoch_count < KDBUS_CONN_MAX_META_EPOCHS) {
+			e = new;
+			new = NULL;
+			conn->meta_epoch_count++;
+		} else if (conn->meta_epoch_count > 0) {
+			/* recycle the least recently updated entry */
+			e = list_last_entry(&conn->meta_epoch_lru,
+					    struct kdbus_conn_meta_epoch,
+					    lru_entry);
+			list_del(&e->lru_entry);
+			hash_del(&e->hentry);
+		} else {
+			goto exit_unlock;
+		}
+
+		e->id = id;
+		hash_add(conn->meta_epoch_hash, &e->hentry, id);
+	}
+
+	e->epoch = epoch;
+	e->flags = flags;
+	list_add(&e->lru_entry, &conn->meta_epoch_lru);
+
+exit_unlock:
+	spin_unlock(&conn->meta_epoch_lock);
+
+	kfree(new);
 }
 
 /**
- * kdbus_conn_flush_policy() - flush all cached policy entries that
- *			       refer to a connecion
+ * kdbus_conn_purge_policy_cache() - flush all cached policy entries that
+ *				     refer to a connecion
  * @conn:	Connection to check
  */
 void kdbus_conn_purge_policy_cache(struct kdbus_conn *conn)
@@ -1070,13 +1893,47 @@ void kdbus_conn_purge_policy_cache(struct kdbus_conn *conn)
 	kdbus_policy_purge_cache(&conn->bus->policy_db, conn);
 }
 
+/* items of KDBUS_CMD_CONN_INFO which change during a connection's lifetime */
+#define KDBUS_CONN_INFO_CACHE_FLAGS	(KDBUS_ATTACH_NAMES |		\
+					 KDBUS_ATTACH_CONN_DESCRIPTION)
+
+/*
+ * A KDBUS_CMD_CONN_INFO record of a connection, built for one set of
+ * requested flags. Records are never modified once built, so a reference
+ * is all a caller needs to copy one out.
+ */
+struct kdbus_conn_info {
+	struct kref kref;
+	int gen;
+	struct kdbus_info info;
+};
+
+static void __kdbus_conn_info_free(struct kref *kref)
+{
+	kfree(container_of(kref, struct kdbus_conn_info, kref));
+}
+
+/* drop a record returned by kdbus_conn_info_build() */
+static void kdbus_conn_info_put(const struct kdbus_info *info)
+{
+	struct kdbus_conn_info *ci;
+
+	if (!info)
+		return;
+
+	ci = container_of(info, struct kdbus_conn_info, info);
+	kref_put(&ci->kref, __kdbus_conn_info_free);
+}
+
 static void __kdbus_conn_free(struct kref *kref)
 {
 	struct kdbus_conn *conn = container_of(kref, struct kdbus_conn, kref);
+	struct kdbus_conn_meta_epoch *e, *tmp;
+	unsigned int i;
 
 	BUG_ON(kdbus_conn_active(conn));
 	BUG_ON(delayed_work_pending(&conn->work));
-	BUG_ON(!list_empty(&conn->queue.msg_list));
+	BUG_ON(!kdbus_conn_queues_empty(conn));
 	BUG_ON(!list_empty(&conn->names_list));
 	BUG_ON(!list_empty(&conn->names_queue_list));
 	BUG_ON(!list_empty(&conn->reply_list));
@@ -1087,12 +1944,23 @@ static void __kdbus_conn_free(struct kref *kref)
 	kdbus_conn_purge_policy_cache(conn);
 	kdbus_policy_remove_owner(&conn->bus->policy_db, conn);
 
+	list_for_each_entry_safe(e, tmp, &conn->meta_epoch_lru, lru_entry)
+		kfree(e);
+
+	for (i = 0; i < ARRAY_SIZE(conn->info_cache); i++)
+		if (conn->info_cache[i])
+			kref_put(&conn->info_cache[i]->kref,
+				 __kdbus_conn_info_free);
+
 	kdbus_meta_free(conn->owner_meta);
+	kdbus_meta_cache_free(conn->meta_cache);
+	kdbus_monitor_free(conn->monitor);
 	kdbus_match_db_free(conn->match_db);
 	kdbus_pool_free(conn->pool);
 	kdbus_ep_unref(conn->ep);
 	kdbus_bus_unref(conn->bus);
 	put_cred(conn->cred);
+	kfree(conn->queues);
 	kfree(conn->name);
 	kfree(conn);
 }
@@ -1209,6 +2077,7 @@ int kdbus_conn_move_messages(struct kdbus_conn *conn_dst,
 	struct kdbus_conn_reply *r, *r_tmp;
 	LIST_HEAD(reply_list);
 	LIST_HEAD(msg_list);
+	unsigned int i;
 	int ret = 0;
 
 	BUG_ON(!mutex_is_locked(&conn_dst->bus->lock));
@@ -1223,13 +2092,18 @@ int kdbus_conn_move_messages(struct kdbus_conn *conn_dst,
 
 		list_move_tail(&r->entry, &reply_list);
 	}
-	list_for_each_entry_safe(q, q_tmp, &conn_src->queue.msg_list, entry) {
-		/* filter messages for a specific name */
-		if (name_id > 0 && q->dst_name_id != name_id)
-			continue;
+	for (i = 0; i < conn_src->queues_count; i++) {
+		struct kdbus_queue *queue = &conn_src->queues[i];
+
+		kdbus_conn_queue_drain(conn_src, queue);
+		list_for_each_entry_safe(q, q_tmp, &queue->msg_list, entry) {
+			/* filter messages for a specific name */
+			if (name_id > 0 && q->dst_name_id != name_id)
+				continue;
 
-		kdbus_queue_entry_remove(conn_src, q);
-		list_add_tail(&q->entry, &msg_list);
+			kdbus_queue_entry_remove(conn_src, q);
+			list_add_tail(&q->entry, &msg_list);
+		}
 	}
 	mutex_unlock(&conn_src->lock);
 
@@ -1253,17 +2127,142 @@ int kdbus_conn_move_messages(struct kdbus_conn *conn_dst,
 		if (ret < 0)
 			kdbus_queue_entry_free(q);
 		else
-			kdbus_queue_entry_add(&conn_dst->queue, q);
+			kdbus_conn_queue_add(conn_dst,
+					     kdbus_conn_queue_steer(conn_dst, q),
+					     q);
 	}
 	list_splice(&reply_list, &conn_dst->reply_list);
 	mutex_unlock(&conn_dst->lock);
 
-	/* wake up poll() */
+	/* wake up poll() and all receivers */
 	wake_up_interruptible(&conn_dst->wait);
+	for (i = 0; i < conn_dst->queues_count; i++)
+		wake_up_interruptible(&conn_dst->queues[i].wait);
 
 	return ret;
 }
 
+/*
+ * Slot of kdbus_conn.info_cache for a record with the given flags, which must
+ * be masked with KDBUS_CONN_INFO_CACHE_FLAGS, and with or without the
+ * creator's metadata.
+ */
+static unsigned int kdbus_conn_info_slot(u64 flags, bool creds)
+{
+	unsigned int slot = creds ? 1 : 0;
+
+	if (flags & KDBUS_ATTACH_NAMES)
+		slot |= 2;
+	if (flags & KDBUS_ATTACH_CONN_DESCRIPTION)
+		slot |= 4;
+
+	return slot;
+}
+
+/*
+ * Serialize the KDBUS_CMD_CONN_INFO record of @owner, as seen by @conn. The
+ * record only depends on the requested flags, on whether @conn may see the
+ * creator's metadata, and on the names and description of @owner, so it is
+ * cached in @owner until kdbus_conn_info_invalidate() is called. Release
+ * it with kdbus_conn_info_put().
+ */
+static struct kdbus_info *kdbus_conn_info_build(struct kdbus_conn *conn,
+						struct kdbus_conn *owner,
+						u64 flags)
+{
+	struct kdbus_meta *meta = NULL;
+	struct kdbus_conn_info *ci;
+	size_t meta_size = 0;
+	unsigned int slot;
+	size_t size;
+	bool creds;
+	u8 *pos;
+	int gen;
+	int ret;
+
+	/* do not leak domain-specific credentials */
+	creds = kdbus_meta_ns_eq(conn->meta, owner->meta);
+	if (creds) {
+		ret = kdbus_meta_collect(owner->meta);
+		if (ret < 0)
+			return ERR_PTR(ret);
+	}
+
+	flags &= KDBUS_CONN_INFO_CACHE_FLAGS;
+	slot = kdbus_conn_info_slot(flags, creds);
+
+	mutex_lock(&owner->info_lock);
+
+	/* sampled before the names are read, a racing change is not lost */
+	gen = atomic_read(&owner->info_gen);
+	ci = owner->info_cache[slot];
+	if (ci && ci->gen == gen) {
+		kref_get(&ci->kref);
+		goto exit_unlock;
+	}
+
+	/*
+	 * Unlike the rest of the values which are cached at connection
+	 * creation time, some values need to be appended here because
+	 * at creation time a connection does not have names and other
+	 * properties.
+	 */
+	if (flags) {
+		meta = kdbus_meta_new();
+		if (IS_ERR(meta)) {
+			ci = ERR_CAST(meta);
+			meta = NULL;
+			goto exit_unlock;
+		}
+
+		ret = kdbus_meta_append(meta, owner, 0, flags);
+		if (ret < 0) {
+			ci = ERR_PTR(ret);
+			goto exit_unlock;
+		}
+
+		meta_size = kdbus_meta_size(meta, flags);
+	}
+
+	size = sizeof(ci->info) + meta_size;
+	if (creds)
+		size += owner->meta->size;
+
+	ci = kmalloc(offsetof(struct kdbus_conn_info, info) + size,
+		     GFP_KERNEL);
+	if (!ci) {
+		ci = ERR_PTR(-ENOMEM);
+		goto exit_unlock;
+	}
+
+	kref_init(&ci->kref);
+	ci->gen = gen;
+	ci->info.size = size;
+	ci->info.id = owner->id;
+	ci->info.flags = owner->flags;
+	pos = (u8 *)ci->info.items;
+
+	if (creds && owner->meta->size > 0) {
+		memcpy(pos, owner->meta->data, owner->meta->size);
+		pos += owner->meta->size;
+	}
+
+	if (meta)
+		kdbus_meta_write(meta, flags, pos);
+
+	if (owner->info_cache[slot])
+		kref_put(&owner->info_cache[slot]->kref,
+			 __kdbus_conn_info_free);
+	kref_get(&ci->kref);
+	owner->info_cache[slot] = ci;
+
+exit_unlock:
+	mutex_unlock(&owner->info_lock);
+	kdbus_meta_free(meta);
+
+	return IS_ERR(ci) ? ERR_CAST(ci) : &ci->info;
+}
+
 /**
  * kdbus_cmd_info() - retrieve info about a connection
  * @conn:		Connection
@@ -1276,12 +2275,9 @@ int kdbus_cmd_info(struct kdbus_conn *conn,
 {
 	struct kdbus_name_entry *entry = NULL;
 	struct kdbus_conn *owner_conn = NULL;
-	struct kdbus_info info = {};
-	struct kdbus_meta *meta = NULL;
+	struct kdbus_info *info = NULL;
 	struct kdbus_pool_slice *slice;
-	size_t pos;
 	int ret = 0;
-	u64 flags;
 
 	if (cmd_info->id == 0) {
 		const char *name;
@@ -1319,75 +2315,172 @@ int kdbus_cmd_info(struct kdbus_conn *conn,
 			return ret;
 	}
 
-	info.size = sizeof(info);
-	info.id = owner_conn->id;
-	info.flags = owner_conn->flags;
+	info = kdbus_conn_info_build(conn, owner_conn, cmd_info->flags);
+	if (IS_ERR(info)) {
+		ret = PTR_ERR(info);
+		info = NULL;
+		goto exit;
+	}
 
-	/* do not leak domain-specific credentials */
-	if (kdbus_meta_ns_eq(conn->meta, owner_conn->meta))
-		info.size += owner_conn->meta->size;
+	slice = kdbus_pool_slice_alloc(conn->pool, info->size);
+	if (IS_ERR(slice)) {
+		ret = PTR_ERR(slice);
+		goto exit;
+	}
+
+	ret = kdbus_pool_slice_copy(slice, 0, info, info->size);
+	if (ret < 0) {
+		kdbus_pool_slice_free(slice);
+		goto exit;
+	}
+
+	/* write back the offset */
+	cmd_info->offset = kdbus_pool_slice_offset(slice);
+	kdbus_pool_slice_flush(slice);
+	kdbus_pool_slice_make_public(slice);
+	ret = 0;
+
+exit:
+	kdbus_conn_info_put(info);
+	kdbus_conn_unref(owner_conn);
+	kdbus_name_unlock(conn->bus->name_registry, entry);
+
+	return ret;
+}
+
+/**
+ * kdbus_cmd_info_list() - retrieve info about several connections at once
+ * @conn:		Connection
+ * @cmd:		The command as passed in by the ioctl
+ *
+ * The connections are looked up by ID and by name, and checked against the
+ * policy, with each lock taken only once for all of them. The records are
+ * returned in a single slice of @conn's pool.
+ *
+ * Return: 0 on success, negative errno on failure.
+ */
+int kdbus_cmd_info_list(struct kdbus_conn *conn,
+			struct kdbus_cmd_info_list *cmd)
+{
+	const struct kdbus_info unknown = { .size = sizeof(unknown) };
+	struct kdbus_info_list list = { .size = sizeof(list) };
+	struct kdbus_conn **owners = NULL;
+	struct kdbus_info **infos = NULL;
+	struct kdbus_pool_slice *slice;
+	const struct kdbus_item *item;
+	const char **names = NULL;
+	unsigned int i, n = 0;
+	u64 *ids = NULL;
+	size_t pos;
+	int ret;
+
+	KDBUS_ITEMS_FOREACH(item, cmd->items, KDBUS_ITEMS_SIZE(cmd, items)) {
+		switch (item->type) {
+		case KDBUS_ITEM_ID:
+			if (item->id == 0)
+				return -EINVAL;
+			break;
+
+		case KDBUS_ITEM_NAME:
+			if (!kdbus_name_is_valid(item->str, false))
+				return -EINVAL;
+			break;
+
+		default:
+			return -EINVAL;
+		}
+
+		if (++n > KDBUS_CONN_INFO_LIST_MAX)
+			return -E2BIG;
+	}
+
+	if (n == 0)
+		return -EINVAL;
+
+	names = kcalloc(n, sizeof(*names), GFP_KERNEL);
+	ids = kcalloc(n, sizeof(*ids), GFP_KERNEL);
+	owners = kcalloc(n, sizeof(*owners), GFP_KERNEL);
+	infos = kcalloc(n, sizeof(*infos), GFP_KERNEL);
+	if (!names || !ids || !owners || !infos) {
+		ret = -ENOMEM;
+		goto exit_free;
+	}
+
+	i = 0;
+	KDBUS_ITEMS_FOREACH(item, cmd->items, KDBUS_ITEMS_SIZE(cmd, items)) {
+		if (item->type == KDBUS_ITEM_ID)
+			ids[i] = item->id;
+		else
+			names[i] = item->str;
+		i++;
+	}
 
 	/*
-	 * Unlike the rest of the values which are cached at connection
-	 * creation time, some values need to be appended here because
-	 * at creation time a connection does not have names and other
-	 * properties.
+	 * Connections queried by ID need to own a name visible to @conn,
+	 * names need to be visible themselves; so look up the IDs first,
+	 * drop everything @conn may not see, then look up the names.
 	 */
-	flags = cmd_info->flags & (KDBUS_ATTACH_NAMES |
-				   KDBUS_ATTACH_CONN_DESCRIPTION);
-	if (flags) {
-		meta = kdbus_meta_new();
-		if (IS_ERR(meta)) {
-			ret = PTR_ERR(meta);
-			goto exit;
+	kdbus_bus_find_conns_by_id(conn->bus, ids, owners, n);
+	kdbus_ep_policy_filter_see_access(conn->ep, conn, names, owners, n);
+	kdbus_name_get_owners(conn->bus->name_registry, names, owners, n);
+
+	for (i = 0; i < n; i++) {
+		if (!owners[i]) {
+			list.size += unknown.size;
+			continue;
 		}
 
-		ret = kdbus_meta_append(meta, owner_conn, 0, flags);
-		if (ret < 0)
+		infos[i] = kdbus_conn_info_build(conn, owners[i], cmd->flags);
+		if (IS_ERR(infos[i])) {
+			ret = PTR_ERR(infos[i]);
+			infos[i] = NULL;
 			goto exit;
+		}
 
-		info.size += meta->size;
+		list.size += infos[i]->size;
 	}
 
-	slice = kdbus_pool_slice_alloc(conn->pool, info.size);
+	slice = kdbus_pool_slice_alloc(conn->pool, list.size);
 	if (IS_ERR(slice)) {
 		ret = PTR_ERR(slice);
 		goto exit;
 	}
 
-	ret = kdbus_pool_slice_copy(slice, 0, &info, sizeof(info));
+	ret = kdbus_pool_slice_copy(slice, 0, &list, sizeof(list));
 	if (ret < 0)
-		goto exit_free;
-	pos = sizeof(info);
+		goto exit_free_slice;
+	pos = sizeof(list);
 
-	if (kdbus_meta_ns_eq(conn->meta, owner_conn->meta)) {
-		ret = kdbus_pool_slice_copy(slice, pos, owner_conn->meta->data,
-					    owner_conn->meta->size);
-		if (ret < 0)
-			goto exit_free;
-
-		pos += owner_conn->meta->size;
-	}
+	for (i = 0; i < n; i++) {
+		const struct kdbus_info *info = infos[i] ?: &unknown;
 
-	if (meta) {
-		ret = kdbus_pool_slice_copy(slice, pos, meta->data, meta->size);
+		ret = kdbus_pool_slice_copy(slice, pos, info, info->size);
 		if (ret < 0)
-			goto exit_free;
+			goto exit_free_slice;
+		pos += info->size;
 	}
 
 	/* write back the offset */
-	cmd_info->offset = kdbus_pool_slice_offset(slice);
+	cmd->offset = kdbus_pool_slice_offset(slice);
 	kdbus_pool_slice_flush(slice);
 	kdbus_pool_slice_make_public(slice);
+	ret = 0;
 
-exit_free:
+exit_free_slice:
 	if (ret < 0)
 		kdbus_pool_slice_free(slice);
 
 exit:
-	kdbus_meta_free(meta);
-	kdbus_conn_unref(owner_conn);
-	kdbus_name_unlock(conn->bus->name_registry, entry);
+	for (i = 0; i < n; i++) {
+		kdbus_conn_info_put(infos[i]);
+		kdbus_conn_unref(owners[i]);
+	}
+
+exit_free:
+	kfree(infos);
+	kfree(owners);
+	kfree(ids);
+	kfree(names);
 
 	return ret;
 }
@@ -1445,8 +2538,18 @@ int kdbus_cmd_conn_update(struct kdbus_conn *conn,
 			return ret;
 	}
 
-	if (flags_provided)
-		atomic64_set(&conn->attach_flags, attach_flags);
+	if (flags_provided) {
+		u64 old_flags;
+
+		/* a connection which already left the bus is not accounted */
+		down_read(&conn->bus->conn_rwlock);
+		kdbus_conn_info_invalidate(conn);
+		old_flags = atomic64_xchg(&conn->attach_flags, attach_flags);
+		if (!hash_unhashed(&conn->hentry))
+			kdbus_bus_attach_flags_update(conn->bus, old_flags,
+						      attach_flags);
+		up_read(&conn->bus->conn_rwlock);
+	}
 
 	return 0;
 }
@@ -1466,15 +2569,18 @@ struct kdbus_conn *kdbus_conn_new(struct kdbus_ep *ep,
 #ifdef CONFIG_DEBUG_LOCK_ALLOC
 	static struct lock_class_key __key;
 #endif
+	const struct kdbus_monitor_filter *monitor_filter = NULL;
+	const struct kdbus_recv_queues *recv_queues = NULL;
 	const struct kdbus_creds *creds = NULL;
 	const struct kdbus_item *item;
 	const char *conn_name = NULL;
 	const char *seclabel = NULL;
 	const char *name = NULL;
-	struct kdbus_conn *conn;
+	struct kdbus_conn *conn, *c;
 	struct kdbus_bus *bus = ep->bus;
 	size_t seclabel_len = 0;
 	bool is_policy_holder;
+	unsigned int i;
 	bool is_activator;
 	bool is_monitor;
 	int ret;
@@ -1487,6 +2593,10 @@ struct kdbus_conn *kdbus_conn_new(struct kdbus_ep *ep,
 	if (is_monitor && (is_activator || is_policy_holder))
 		return ERR_PTR(-EINVAL);
 
+	/* only monitors can be asynchronous ones */
+	if (!is_monitor && (hello->flags & KDBUS_HELLO_MONITOR_ASYNC))
+		return ERR_PTR(-EINVAL);
+
 	/* can't be policy holder and activator at the same time */
 	if (is_activator && is_policy_holder)
 		return ERR_PTR(-EINVAL);
@@ -1539,6 +2649,31 @@ struct kdbus_conn *kdbus_conn_new(struct kdbus_ep *ep,
 
 			conn_name = item->str;
 			break;
+
+		case KDBUS_ITEM_RECV_QUEUES:
+			if (recv_queues)
+				return ERR_PTR(-EINVAL);
+
+			recv_queues = &item->recv_queues;
+			if (recv_queues->count == 0 ||
+			    recv_queues->count > KDBUS_CONN_MAX_QUEUES)
+				return ERR_PTR(-EINVAL);
+
+			if (recv_queues->steering > KDBUS_QUEUE_STEER_DST_NAME)
+				return ERR_PTR(-EINVAL);
+			break;
+
+		case KDBUS_ITEM_MONITOR_FILTER:
+			if (!is_monitor || monitor_filter)
+				return ERR_PTR(-EINVAL);
+
+			monitor_filter = &item->monitor_filter;
+			if (monitor_filter->flags & ~KDBUS_MONITOR_FILTER_MATCH)
+				return ERR_PTR(-EINVAL);
+
+			if (monitor_filter->sample > UINT_MAX)
+				return ERR_PTR(-EINVAL);
+			break;
 		}
 	}
 
@@ -1549,6 +2684,23 @@ struct kdbus_conn *kdbus_conn_new(struct kdbus_ep *ep,
 	if (!conn)
 		return ERR_PTR(-ENOMEM);
 
+	if (monitor_filter)
+		conn->monitor_filter = *monitor_filter;
+
+	if (recv_queues) {
+		conn->queues_count = recv_queues->count;
+		conn->queue_steering = recv_queues->steering;
+	} else {
+		conn->queues_count = 1;
+	}
+
+	conn->queues = kcalloc(conn->queues_count, sizeof(*conn->queues),
+			       GFP_KERNEL);
+	if (!conn->queues) {
+		ret = -ENOMEM;
+		goto exit_free_conn;
+	}
+
 	if (is_activator || is_policy_holder) {
 		/*
 		 * Policy holders may install one name, and are
@@ -1578,12 +2730,20 @@ struct kdbus_conn *kdbus_conn_new(struct kdbus_ep *ep,
 	INIT_LIST_HEAD(&conn->names_list);
 	INIT_LIST_HEAD(&conn->names_queue_list);
 	INIT_LIST_HEAD(&conn->reply_list);
+	spin_lock_init(&conn->meta_epoch_lock);
+	hash_init(conn->meta_epoch_hash);
+	INIT_LIST_HEAD(&conn->meta_epoch_lru);
+	mutex_init(&conn->info_lock);
+	atomic_set(&conn->info_gen, 0);
 	atomic_set(&conn->name_count, 0);
 	atomic_set(&conn->reply_count, 0);
+	atomic_set(&conn->msg_pending, 0);
+	atomic_set(&conn->monitor_sampled, 0);
 	INIT_DELAYED_WORK(&conn->work, kdbus_conn_work);
 	conn->cred = get_current_cred();
 	init_waitqueue_head(&conn->wait);
-	kdbus_queue_init(&conn->queue);
+	for (i = 0; i < conn->queues_count; i++)
+		kdbus_queue_init(&conn->queues[i]);
 
 	/* init entry, so we can unconditionally remove it */
 	INIT_LIST_HEAD(&conn->monitor_entry);
@@ -1594,12 +2754,18 @@ struct kdbus_conn *kdbus_conn_new(struct kdbus_ep *ep,
 		goto exit_unref_cred;
 	}
 
-	conn->match_db = kdbus_match_db_new();
+	conn->match_db = kdbus_match_db_new(conn);
 	if (IS_ERR(conn->match_db)) {
 		ret = PTR_ERR(conn->match_db);
 		goto exit_free_pool;
 	}
 
+	conn->meta_cache = kdbus_meta_cache_new();
+	if (IS_ERR(conn->meta_cache)) {
+		ret = PTR_ERR(conn->meta_cache);
+		goto exit_free_match;
+	}
+
 	conn->bus = kdbus_bus_ref(ep->bus);
 	conn->ep = kdbus_ep_ref(ep);
 
@@ -1626,6 +2792,15 @@ struct kdbus_conn *kdbus_conn_new(struct kdbus_ep *ep,
 			goto exit_unref_ep;
 	}
 
+	if (is_monitor && (hello->flags & KDBUS_HELLO_MONITOR_ASYNC)) {
+		conn->monitor = kdbus_monitor_new(conn);
+		if (IS_ERR(conn->monitor)) {
+			ret = PTR_ERR(conn->monitor);
+			conn->monitor = NULL;
+			goto exit_release_names;
+		}
+	}
+
 	if (is_monitor) {
 		down_write(&bus->conn_rwlock);
 		list_add_tail(&conn->monitor_entry, &bus->monitors_list);
@@ -1699,6 +2874,20 @@ struct kdbus_conn *kdbus_conn_new(struct kdbus_ep *ep,
 	list_add_tail(&conn->ep_entry, &ep->conn_list);
 	hash_add(bus->conn_hash, &conn->hentry, conn->id);
 
+	/*
+	 * IDs are allocated before the bus is locked, so a racing HELLO
+	 * may have been linked already with a higher ID. Keep the list
+	 * sorted, KDBUS_CMD_NAME_LIST resumes its walk by ID.
+	 */
+	list_for_each_entry_reverse(c, &bus->conn_list, bus_entry)
+		if (c->id < conn->id)
+			break;
+	list_add(&conn->bus_entry, &c->bus_entry);
+	atomic64_inc(&bus->name_registry->generation);
+
+	if (kdbus_conn_is_ordinary(conn) || kdbus_conn_is_monitor(conn))
+		kdbus_bus_attach_flags_update(bus, 0, hello->attach_flags);
+
 	up_write(&bus->conn_rwlock);
 	mutex_unlock(&ep->lock);
 	mutex_unlock(&bus->lock);
@@ -1724,16 +2913,20 @@ exit_domain_user_unref:
 exit_free_meta:
 	kdbus_meta_free(conn->owner_meta);
 exit_release_names:
+	kdbus_monitor_free(conn->monitor);
 	kdbus_name_remove_by_conn(bus->name_registry, conn);
 exit_unref_ep:
 	kdbus_ep_unref(conn->ep);
 	kdbus_bus_unref(conn->bus);
+	kdbus_meta_cache_free(conn->meta_cache);
+exit_free_match:
 	kdbus_match_db_free(conn->match_db);
 exit_free_pool:
 	kdbus_pool_free(conn->pool);
 exit_unref_cred:
 	put_cred(conn->cred);
 exit_free_conn:
+	kfree(conn->queues);
 	kfree(conn->name);
 	kfree(conn);
 
@@ -16,6 +16,7 @@
 #define __KDBUS_CONNECTION_H
 
 #include <linux/atomic.h>
+#include <linux/hashtable.h>
 #include <linux/lockdep.h>
 #include "limits.h"
 #include "metadata.h"
@@ -27,6 +28,8 @@
 					 KDBUS_HELLO_POLICY_HOLDER | \
 					 KDBUS_HELLO_MONITOR)
 
+struct kdbus_conn_info;
+
 /**
  * struct kdbus_conn - connection to a bus
  * @kref:		Reference count
@@ -41,7 +44,11 @@
  * @msg_users:		Array to account the number of queued messages per
  *			individual user
  * @msg_users_max:	Size of the users array
+ * @msg_pending:	Number of messages pushed to the lock-free pending
+ *			lists of all receive queues, and neither linked nor
+ *			received yet
  * @hentry:		Entry in ID <-> connection map
+ * @bus_entry:		Entry in the bus' connection list, ordered by ID
  * @ep_entry:		Entry in endpoint
  * @monitor_entry:	Entry in monitor, if the connection is a monitor
  * @names_list:		List of well-known names
@@ -52,18 +59,42 @@
  * @activator_of:	Well-known name entry this connection acts as an
  *			activator for
  * @match_db:		Subscription filter to broadcast messages
+ * @monitor:		Asynchronous delivery state of a monitor connection
+ *			created with KDBUS_HELLO_MONITOR_ASYNC, or NULL
+ * @monitor_filter:	Match, sampling and snapshot length setup of a
+ *			monitor connection, see KDBUS_ITEM_MONITOR_FILTER
+ * @monitor_sampled:	Number of messages that passed the monitor's match
+ *			rules, used for sampling
  * @meta:		Active connection creator's metadata/credentials,
  *			either from the handle or from HELLO
  * @owner_meta:		The connection's metadata/credentials supplied by
  *			HELLO
+ * @meta_cache:		Metadata snapshot of the last process which sent a
+ *			message on this connection
  * @pool:		The user's buffer to receive messages
  * @user:		Owner of the connection
  * @cred:		The credentials of the connection at creation time
  * @name_count:		Number of owned well-known names
+ * @name_subscribed:	The connection receives all name change
+ *			notifications, see KDBUS_NAME_LIST_SUBSCRIBE
  * @reply_count:	Number of requests this connection has issued, and
  *			waits for replies from the peer
  * @wait:		Wake up this endpoint
- * @queue:		The message queue associcated with this connection
+ * @queues:		The receive queues associated with this connection
+ * @queues_count:	Number of receive queues, at least 1
+ * @queue_steering:	KDBUS_QUEUE_STEER_* method to pick the receive queue
+ *			of an incoming message
+ * @meta_epoch_lock:	Protects the meta_epoch_* fields
+ * @meta_epoch_hash:	Map of peer IDs to the metadata snapshot epoch they
+ *			sent last, for KDBUS_HELLO_META_EPOCH connections
+ * @meta_epoch_lru:	The entries of @meta_epoch_hash, most recent first
+ * @meta_epoch_count:	Number of entries in @meta_epoch_hash
+ * @info_lock:		Protects @info_cache
+ * @info_gen:		Incremented whenever the data of the connection
+ *			reported by KDBUS_CMD_CONN_INFO changes
+ * @info_cache:		Serialized KDBUS_CMD_CONN_INFO records of the
+ *			connection, one per combination of requested
+ *			flags and visibility of the creator's metadata
  */
 struct kdbus_conn {
 	struct kref kref;
@@ -80,7 +111,9 @@ struct kdbus_conn {
 	struct mutex lock;
 	unsigned int *msg_users;
 	unsigned int msg_users_max;
+	atomic_t msg_pending;
 	struct hlist_node hentry;
+	struct list_head bus_entry;
 	struct list_head ep_entry;
 	struct list_head monitor_entry;
 	struct list_head names_list;
@@ -89,19 +122,34 @@ struct kdbus_conn {
 	struct delayed_work work;
 	struct kdbus_name_entry *activator_of;
 	struct kdbus_match_db *match_db;
+	struct kdbus_monitor *monitor;
+	struct kdbus_monitor_filter monitor_filter;
+	atomic_t monitor_sampled;
 	struct kdbus_meta *meta;
 	struct kdbus_meta *owner_meta;
+	struct kdbus_meta_cache *meta_cache;
 	struct kdbus_pool *pool;
 	struct kdbus_domain_user *user;
 	const struct cred *cred;
 	atomic_t name_count;
+	bool name_subscribed;
 	atomic_t reply_count;
 	wait_queue_head_t wait;
-	struct kdbus_queue queue;
+	struct kdbus_queue *queues;
+	unsigned int queues_count;
+	u64 queue_steering;
+	spinlock_t meta_epoch_lock;
+	DECLARE_HASHTABLE(meta_epoch_hash, 4);
+	struct list_head meta_epoch_lru;
+	unsigned int meta_epoch_count;
+	struct mutex info_lock;
+	atomic_t info_gen;
+	struct kdbus_conn_info *info_cache[8];
 };
 
 struct kdbus_kmsg;
 struct kdbus_name_registry;
+struct kdbus_queue_entry;
 
 struct kdbus_conn *kdbus_conn_new(struct kdbus_ep *ep,
 				  struct kdbus_cmd_hello *hello,
@@ -112,16 +160,29 @@ int kdbus_conn_acquire(struct kdbus_conn *conn);
 void kdbus_conn_release(struct kdbus_conn *conn);
 int kdbus_conn_disconnect(struct kdbus_conn *conn, bool ensure_queue_empty);
 bool kdbus_conn_active(const struct kdbus_conn *conn);
+bool kdbus_conn_queues_empty(struct kdbus_conn *conn);
+size_t kdbus_conn_msg_count(const struct kdbus_conn *conn);
+size_t kdbus_conn_msg_load(const struct kdbus_conn *conn);
+bool kdbus_conn_meta_epoch_seen(struct kdbus_conn *conn, u64 id,
+				u64 epoch, u64 flags);
+void kdbus_conn_meta_epoch_update(struct kdbus_conn *conn, u64 id,
+				  u64 epoch, u64 flags);
 void kdbus_conn_purge_policy_cache(struct kdbus_conn *conn);
 
 int kdbus_cmd_msg_recv(struct kdbus_conn *conn,
-		       struct kdbus_cmd_recv *recv);
+		       struct kdbus_cmd_recv *recv, u64 index);
 int kdbus_cmd_msg_cancel(struct kdbus_conn *conn,
 			 u64 cookie);
 int kdbus_cmd_info(struct kdbus_conn *conn,
 			struct kdbus_cmd_info *cmd_info);
+int kdbus_cmd_info_list(struct kdbus_conn *conn,
+			struct kdbus_cmd_info_list *cmd);
 int kdbus_cmd_conn_update(struct kdbus_conn *conn,
 			  const struct kdbus_cmd_update *cmd_update);
+int kdbus_conn_queue_entry(struct kdbus_conn *conn,
+			   struct kdbus_queue_entry *entry,
+			   bool privileged);
+void kdbus_conn_kmsg_send_batch(struct kdbus_ep *ep, struct list_head *kmsgs);
 int kdbus_conn_kmsg_send(struct kdbus_ep *ep,
 			 struct kdbus_conn *conn_src,
 			 struct kdbus_kmsg *kmsg);
@@ -130,6 +191,18 @@ int kdbus_conn_move_messages(struct kdbus_conn *conn_dst,
 			     u64 name_id);
 bool kdbus_conn_has_name(struct kdbus_conn *conn, const char *name);
 
+/**
+ * kdbus_conn_info_invalidate() - Drop the cached info of a connection
+ * @conn:		The connection whose info changed
+ *
+ * This must be called before the change is made visible under the
+ * connection lock.
+ */
+static inline void kdbus_conn_info_invalidate(struct kdbus_conn *conn)
+{
+	atomic_inc(&conn->info_gen);
+}
+
 /**
  * kdbus_conn_is_ordinary() - Check if connection is ordinary
  * @conn:		The connection to check
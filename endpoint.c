@@ -11,6 +11,7 @@
  * your option) any later version.
  */
 
+#include <linux/bitmap.h>
 #include <linux/device.h>
 #include <linux/fs.h>
 #include <linux/idr.h>
@@ -279,8 +280,8 @@ int kdbus_ep_policy_check_see_access_unlocked(struct kdbus_ep *ep,
 	 * don't have SEE rules, so it's sufficient to check the
 	 * endpoint's database.
 	 *
-	 * The lock for the policy db is held across all calls of
-	 * kdbus_name_list_all(), so the entries in both writing
+	 * The lock for the policy db is held across both passes of
+	 * kdbus_cmd_name_list(), so the entries in both writing
 	 * and non-writing runs of kdbus_name_list_write() are the
 	 * same.
 	 */
@@ -403,6 +404,81 @@ int kdbus_ep_policy_check_src_names(struct kdbus_ep *ep,
 	return ret;
 }
 
+/**
+ * kdbus_ep_policy_filter_see_access() - drop names and connections another
+ *					 connection is not allowed to see
+ * @ep:			Endpoint to operate on
+ * @conn:		Connection that queries the names and connections
+ * @names:		Names to check, entries not visible to @conn are set
+ *			to NULL
+ * @conns:		Connections to check, the reference to each one none
+ *			of whose names is visible to @conn is dropped and its
+ *			entry set to NULL
+ * @count:		Number of entries in @names and @conns, at most
+ *			KDBUS_CONN_INFO_LIST_MAX
+ *
+ * This does the checks of kdbus_ep_policy_check_see_access() and
+ * kdbus_ep_policy_check_src_names() for many names and connections, while
+ * taking the policy lock only once.
+ */
+void kdbus_ep_policy_filter_see_access(struct kdbus_ep *ep,
+				       struct kdbus_conn *conn,
+				       const char **names,
+				       struct kdbus_conn **conns,
+				       unsigned int count)
+{
+	DECLARE_BITMAP(hidden, KDBUS_CONN_INFO_LIST_MAX);
+	struct kdbus_name_entry *e;
+	unsigned int i;
+	int ret;
+
+	if (!ep->has_policy)
+		return;
+
+	if (WARN_ON(count > KDBUS_CONN_INFO_LIST_MAX))
+		count = KDBUS_CONN_INFO_LIST_MAX;
+
+	bitmap_zero(hidden, KDBUS_CONN_INFO_LIST_MAX);
+
+	down_read(&ep->policy_db.entries_rwlock);
+
+	mutex_lock(&conn->lock);
+	for (i = 0; i < count; i++) {
+		if (!names[i])
+			continue;
+
+		ret = kdbus_ep_policy_check_see_access_unlocked(ep, conn,
+								names[i]);
+		if (ret < 0)
+			names[i] = NULL;
+	}
+	mutex_unlock(&conn->lock);
+
+	for (i = 0; i < count; i++) {
+		if (!conns[i])
+			continue;
+
+		ret = -ENOENT;
+		mutex_lock(&conns[i]->lock);
+		list_for_each_entry(e, &conns[i]->names_list, conn_entry) {
+			ret = kdbus_ep_policy_check_see_access_unlocked(ep,
+								conn, e->name);
+			if (ret == 0)
+				break;
+		}
+		mutex_unlock(&conns[i]->lock);
+
+		if (ret < 0)
+			set_bit(i, hidden);
+	}
+
+	up_read(&ep->policy_db.entries_rwlock);
+
+	/* the last reference might be dropped, do it without the lock */
+	for_each_set_bit(i, hidden, count)
+		conns[i] = kdbus_conn_unref(conns[i]);
+}
+
 static int
 kdbus_custom_ep_check_talk_access(struct kdbus_ep *ep,
 				  struct kdbus_conn *conn_src,
@@ -81,6 +81,11 @@ int kdbus_ep_policy_check_notification(struct kdbus_ep *ep,
 int kdbus_ep_policy_check_src_names(struct kdbus_ep *ep,
 				    struct kdbus_conn *conn_src,
 				    struct kdbus_conn *conn_dst);
+void kdbus_ep_policy_filter_see_access(struct kdbus_ep *ep,
+				       struct kdbus_conn *conn,
+				       const char **names,
+				       struct kdbus_conn **conns,
+				       unsigned int count);
 int kdbus_ep_policy_check_talk_access(struct kdbus_ep *ep,
 				      struct kdbus_conn *conn_src,
 				      struct kdbus_conn *conn_dst);
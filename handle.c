@@ -289,24 +289,27 @@ static int kdbus_handle_open(struct inode *inode, struct file *file)
 		handle->ep = minor_ptr;
 		handle->domain = kdbus_domain_ref(handle->ep->bus->domain);
 
-		/* cache the metadata/credentials of the creator */
+		/*
+		 * Capture the metadata/credentials of the creator; most of
+		 * it is only serialized once the connection is queried.
+		 */
 		handle->meta = kdbus_meta_new();
 		if (IS_ERR(handle->meta)) {
 			ret = PTR_ERR(handle->meta);
 			goto exit_free;
 		}
 
-		ret = kdbus_meta_append(handle->meta, NULL, 0,
-					KDBUS_ATTACH_CREDS	|
-					KDBUS_ATTACH_AUXGROUPS	|
-					KDBUS_ATTACH_TID_COMM	|
-					KDBUS_ATTACH_PID_COMM	|
-					KDBUS_ATTACH_EXE	|
-					KDBUS_ATTACH_CMDLINE	|
-					KDBUS_ATTACH_CGROUP	|
-					KDBUS_ATTACH_CAPS	|
-					KDBUS_ATTACH_SECLABEL	|
-					KDBUS_ATTACH_AUDIT);
+		ret = kdbus_meta_capture(handle->meta,
+					 KDBUS_ATTACH_CREDS	|
+					 KDBUS_ATTACH_AUXGROUPS	|
+					 KDBUS_ATTACH_TID_COMM	|
+					 KDBUS_ATTACH_PID_COMM	|
+					 KDBUS_ATTACH_EXE	|
+					 KDBUS_ATTACH_CMDLINE	|
+					 KDBUS_ATTACH_CGROUP	|
+					 KDBUS_ATTACH_CAPS	|
+					 KDBUS_ATTACH_SECLABEL	|
+					 KDBUS_ATTACH_AUDIT);
 		if (ret < 0)
 			goto exit_free;
 
@@ -688,7 +691,10 @@ static long kdbus_handle_ioctl_ep(struct file *file, unsigned int cmd,
 					    KDBUS_HELLO_ACCEPT_FD |
 					    KDBUS_HELLO_ACTIVATOR |
 					    KDBUS_HELLO_POLICY_HOLDER |
-					    KDBUS_HELLO_MONITOR);
+					    KDBUS_HELLO_MONITOR |
+					    KDBUS_HELLO_META_EPOCH |
+					    KDBUS_HELLO_NOTIFY_BATCH |
+					    KDBUS_HELLO_MONITOR_ASYNC);
 		if (ret < 0)
 			break;
 
@@ -785,7 +791,8 @@ static long kdbus_handle_ioctl_ep_connected(struct file *file, unsigned int cmd,
 		ret = kdbus_negotiate_flags(cmd_name, buf, typeof(*cmd_name),
 					    KDBUS_NAME_REPLACE_EXISTING |
 					    KDBUS_NAME_ALLOW_REPLACEMENT |
-					    KDBUS_NAME_QUEUE);
+					    KDBUS_NAME_QUEUE |
+					    KDBUS_NAME_SHARED);
 		if (ret < 0)
 			break;
 
@@ -842,15 +849,17 @@ static long kdbus_handle_ioctl_ep_connected(struct file *file, unsigned int cmd,
 	}
 
 	case KDBUS_CMD_NAME_LIST: {
-		struct kdbus_cmd_name_list cmd_list;
+		struct kdbus_cmd_name_list_chunk cmd_list = {};
 
 		/* query current IDs and names */
-		if (kdbus_copy_from_user(&cmd_list, buf, sizeof(cmd_list))) {
+		if (kdbus_copy_from_user(&cmd_list.list, buf,
+					 sizeof(cmd_list.list))) {
 			ret = -EFAULT;
 			break;
 		}
 
-		ret = kdbus_negotiate_flags(&cmd_list, buf, typeof(cmd_list),
+		ret = kdbus_negotiate_flags(&cmd_list.list, buf,
+					    struct kdbus_cmd_name_list,
 					    KDBUS_NAME_LIST_UNIQUE |
 					    KDBUS_NAME_LIST_NAMES |
 					    KDBUS_NAME_LIST_ACTIVATORS |
@@ -864,13 +873,52 @@ static long kdbus_handle_ioctl_ep_connected(struct file *file, unsigned int cmd,
 			break;
 
 		/* return allocated data */
-		if (kdbus_offset_set_user(&cmd_list.offset, buf,
+		if (kdbus_offset_set_user(&cmd_list.list.offset, buf,
 					  struct kdbus_cmd_name_list))
 			ret = -EFAULT;
 
 		break;
 	}
 
+	case KDBUS_CMD_NAME_LIST_CHUNK: {
+		struct kdbus_cmd_name_list_chunk cmd_list;
+
+		if (kdbus_copy_from_user(&cmd_list, buf, sizeof(cmd_list))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		/* the list command is at the start of the struct */
+		ret = kdbus_negotiate_flags(&cmd_list.list, buf,
+					    struct kdbus_cmd_name_list,
+					    KDBUS_NAME_LIST_UNIQUE |
+					    KDBUS_NAME_LIST_NAMES |
+					    KDBUS_NAME_LIST_ACTIVATORS |
+					    KDBUS_NAME_LIST_QUEUED |
+					    KDBUS_NAME_LIST_CURSOR |
+					    KDBUS_NAME_LIST_SUBSCRIBE);
+		if (ret < 0)
+			break;
+
+		ret = kdbus_cmd_name_list(conn->bus->name_registry,
+					  conn, &cmd_list);
+		if (ret < 0)
+			break;
+
+		/* return allocated data, and where to continue */
+		if (kdbus_offset_set_user(&cmd_list.list.offset, buf,
+					  struct kdbus_cmd_name_list) ||
+		    kdbus_member_set_user(&cmd_list.cursor, buf,
+					  struct kdbus_cmd_name_list_chunk,
+					  cursor) ||
+		    kdbus_member_set_user(&cmd_list.generation, buf,
+					  struct kdbus_cmd_name_list_chunk,
+					  generation))
+			ret = -EFAULT;
+
+		break;
+	}
+
 	case KDBUS_CMD_CONN_INFO:
 	case KDBUS_CMD_BUS_CREATOR_INFO: {
 		struct kdbus_cmd_info *cmd_info;
@@ -911,6 +959,40 @@ static long kdbus_handle_ioctl_ep_connected(struct file *file, unsigned int cmd,
 		break;
 	}
 
+	case KDBUS_CMD_CONN_INFO_LIST: {
+		struct kdbus_cmd_info_list *cmd_list;
+
+		/* return the properties of several connections at once */
+		cmd_list = kdbus_memdup_user(buf, sizeof(*cmd_list),
+					     KDBUS_CONN_INFO_LIST_MAX_SIZE);
+		if (IS_ERR(cmd_list)) {
+			ret = PTR_ERR(cmd_list);
+			break;
+		}
+
+		free_ptr = cmd_list;
+
+		ret = kdbus_negotiate_flags(cmd_list, buf, typeof(*cmd_list),
+					    _KDBUS_ATTACH_ALL);
+		if (ret < 0)
+			break;
+
+		ret = kdbus_items_validate(cmd_list->items,
+					   KDBUS_ITEMS_SIZE(cmd_list, items));
+		if (ret < 0)
+			break;
+
+		ret = kdbus_cmd_info_list(conn, cmd_list);
+		if (ret < 0)
+			break;
+
+		if (kdbus_offset_set_user(&cmd_list->offset, buf,
+					  struct kdbus_cmd_info_list))
+			ret = -EFAULT;
+
+		break;
+	}
+
 	case KDBUS_CMD_CONN_UPDATE: {
 		/* update the properties of a connection */
 		struct kdbus_cmd_update *cmd_update;
@@ -1061,11 +1143,12 @@ static long kdbus_handle_ioctl_ep_connected(struct file *file, unsigned int cmd,
 
 		ret = kdbus_negotiate_flags(&cmd_recv, buf, typeof(cmd_recv),
 					    KDBUS_RECV_PEEK | KDBUS_RECV_DROP |
-					    KDBUS_RECV_USE_PRIORITY);
+					    KDBUS_RECV_USE_PRIORITY |
+					    KDBUS_RECV_WAIT);
 		if (ret < 0)
 			break;
 
-		ret = kdbus_cmd_msg_recv(conn, &cmd_recv);
+		ret = kdbus_cmd_msg_recv(conn, &cmd_recv, 0);
 		if (ret < 0)
 			break;
 
@@ -1077,6 +1160,39 @@ static long kdbus_handle_ioctl_ep_connected(struct file *file, unsigned int cmd,
 		break;
 	}
 
+	case KDBUS_CMD_MSG_RECV_QUEUE: {
+		struct kdbus_cmd_recv_queue cmd_recv;
+
+		if (!kdbus_conn_is_ordinary(conn) &&
+		    !kdbus_conn_is_monitor(conn)) {
+			ret = -EOPNOTSUPP;
+			break;
+		}
+
+		ret = kdbus_copy_from_user(&cmd_recv, buf, sizeof(cmd_recv));
+		if (ret < 0)
+			break;
+
+		/* the receive command is at the start of the struct */
+		ret = kdbus_negotiate_flags(&cmd_recv.recv, buf,
+					    struct kdbus_cmd_recv,
+					    KDBUS_RECV_PEEK | KDBUS_RECV_DROP |
+					    KDBUS_RECV_USE_PRIORITY |
+					    KDBUS_RECV_WAIT);
+		if (ret < 0)
+			break;
+
+		ret = kdbus_cmd_msg_recv(conn, &cmd_recv.recv, cmd_recv.queue);
+		if (ret < 0)
+			break;
+
+		if (kdbus_offset_set_user(&cmd_recv.recv.offset, buf,
+					  struct kdbus_cmd_recv))
+			ret = -EFAULT;
+
+		break;
+	}
+
 	case KDBUS_CMD_MSG_CANCEL: {
 		struct kdbus_cmd_cancel cmd_cancel;
 
@@ -1223,12 +1339,16 @@ static unsigned int kdbus_handle_poll(struct file *file,
 
 	poll_wait(file, &conn->wait, wait);
 
-	mutex_lock(&conn->lock);
+	/*
+	 * Both checks are lockless snapshots. Senders and
+	 * kdbus_conn_disconnect() wake up conn->wait after they changed
+	 * the state, and we are on the wait queue before we look at it,
+	 * so no change is missed.
+	 */
 	if (!kdbus_conn_active(conn))
 		mask = POLLERR | POLLHUP;
-	else if (!list_empty(&conn->queue.msg_list))
+	else if (!kdbus_conn_queues_empty(conn))
 		mask |= POLLIN | POLLRDNORM;
-	mutex_unlock(&conn->lock);
 
 	return mask;
 }
@@ -1243,6 +1363,19 @@ static int kdbus_handle_mmap(struct file *file, struct vm_area_struct *vma)
 	/* make sure handle->conn is set if handle->type is */
 	smp_rmb();
 
+	/*
+	 * The name table is shared by all connections of the bus, so it
+	 * is not available on endpoints that restrict which names are
+	 * visible.
+	 */
+	if (vma->vm_pgoff == KDBUS_NAME_TABLE_OFFSET >> PAGE_SHIFT) {
+		if (handle->conn->ep->has_policy)
+			return -EPERM;
+
+		return kdbus_name_table_mmap(handle->conn->bus->name_registry,
+					     vma);
+	}
+
 	return kdbus_pool_mmap(handle->conn->pool, vma);
 }
 
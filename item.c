@@ -110,6 +110,9 @@ static int kdbus_item_validate(const struct kdbus_item *item)
 
 	case KDBUS_ITEM_ATTACH_FLAGS:
 	case KDBUS_ITEM_ID:
+	case KDBUS_ITEM_DST_ID:
+	case KDBUS_ITEM_META_EPOCH:
+	case KDBUS_ITEM_NAME_GENERATION:
 		if (payload_size != sizeof(u64))
 			return -EINVAL;
 		break;
@@ -155,6 +158,16 @@ static int kdbus_item_validate(const struct kdbus_item *item)
 			return -EINVAL;
 		break;
 
+	case KDBUS_ITEM_RECV_QUEUES:
+		if (payload_size != sizeof(struct kdbus_recv_queues))
+			return -EINVAL;
+		break;
+
+	case KDBUS_ITEM_MONITOR_FILTER:
+		if (payload_size != sizeof(struct kdbus_monitor_filter))
+			return -EINVAL;
+		break;
+
 	case KDBUS_ITEM_NAME_ADD:
 	case KDBUS_ITEM_NAME_REMOVE:
 	case KDBUS_ITEM_NAME_CHANGE:
@@ -188,6 +188,63 @@ struct kdbus_name {
 	char name[0];
 };
 
+/**
+ * enum kdbus_queue_steering - how messages are steered to receive queues
+ * @KDBUS_QUEUE_STEER_SRC_ID:	By the ID of the sending connection; all
+ *				messages of one sender end up in the same
+ *				queue
+ * @KDBUS_QUEUE_STEER_COOKIE:	By a hash of the message cookie
+ * @KDBUS_QUEUE_STEER_DST_NAME:	By the well-known name the message was
+ *				addressed to; messages addressed to the
+ *				unique ID end up in queue 0
+ */
+enum kdbus_queue_steering {
+	KDBUS_QUEUE_STEER_SRC_ID,
+	KDBUS_QUEUE_STEER_COOKIE,
+	KDBUS_QUEUE_STEER_DST_NAME,
+};
+
+/**
+ * struct kdbus_recv_queues - receive queue layout of a connection
+ * @count:		Number of receive queues, at least 1
+ * @steering:		KDBUS_QUEUE_STEER_* method used to pick the queue
+ *			for an incoming message
+ *
+ * Attached to:
+ *   KDBUS_ITEM_RECV_QUEUES
+ */
+struct kdbus_recv_queues {
+	__u64 count;
+	__u64 steering;
+};
+
+/**
+ * enum kdbus_monitor_filter_flags - flags of a monitor filter
+ * @KDBUS_MONITOR_FILTER_MATCH:	Only pass unicast messages that match
+ *				one of the monitor's match rules, like
+ *				broadcasts
+ */
+enum kdbus_monitor_filter_flags {
+	KDBUS_MONITOR_FILTER_MATCH	= 1ULL << 0,
+};
+
+/**
+ * struct kdbus_monitor_filter - what a monitor connection gets to see
+ * @flags:		KDBUS_MONITOR_FILTER_* flags
+ * @sample:		Only pass one in this many of the messages that
+ *			made it through the match rules; 0 and 1 pass all
+ * @snaplen:		Maximum number of bytes of PAYLOAD_VEC data copied
+ *			per message; 0 for no limit
+ *
+ * Attached to:
+ *   KDBUS_ITEM_MONITOR_FILTER
+ */
+struct kdbus_monitor_filter {
+	__u64 flags;
+	__u64 sample;
+	__u64 snaplen;
+};
+
 /**
  * struct kdbus_policy_access - policy access item
  * @type:		One of KDBUS_POLICY_ACCESS_* types
@@ -221,6 +278,13 @@ struct kdbus_policy_access {
  * @KDBUS_ITEM_MAKE_NAME:	Name of domain, bus, endpoint
  * @KDBUS_ITEM_ATTACH_FLAGS:	Attach-flags, used for updating which metadata
  *				a connection subscribes to
+ * @KDBUS_ITEM_RECV_QUEUES:	Number of receive queues of a connection and
+ *				how messages are steered to them, used with
+ *				KDBUS_CMD_HELLO
+ * @KDBUS_ITEM_MONITOR_FILTER:	Match, sampling and snapshot length setup
+ *				of a monitor, used with KDBUS_CMD_HELLO
+ * @KDBUS_ITEM_DST_ID:		Destination's connection ID, used in match
+ *				rules
  * @_KDBUS_ITEM_ATTACH_BASE:	Start of metadata attach items
  * @KDBUS_ITEM_NAME:		Well-know name with flags
  * @KDBUS_ITEM_ID:		Connection ID
@@ -236,6 +300,7 @@ struct kdbus_policy_access {
  * @KDBUS_ITEM_SECLABEL:	The security label
  * @KDBUS_ITEM_AUDIT:		The audit IDs
  * @KDBUS_ITEM_CONN_DESCRIPTION:The connection's human-readable name (debugging)
+ * @KDBUS_ITEM_META_EPOCH:	Epoch of the sender's task metadata snapshot
  * @_KDBUS_ITEM_POLICY_BASE:	Start of policy items
  * @KDBUS_ITEM_POLICY_ACCESS:	Policy access block
  * @_KDBUS_ITEM_KERNEL_BASE:	Start of kernel-generated message items
@@ -246,6 +311,14 @@ struct kdbus_policy_access {
  * @KDBUS_ITEM_ID_REMOVE:	Notify in struct kdbus_notify_id_change
  * @KDBUS_ITEM_REPLY_TIMEOUT:	Timeout has been reached
  * @KDBUS_ITEM_REPLY_DEAD:	Destination died
+ * @KDBUS_ITEM_NAME_GENERATION:	Name registry generation a name change
+ *				notification was queued at
+ * @KDBUS_ITEM_NAME_BATCH:	Several name change notifications, carried
+ *				as a list of their items
+ * @KDBUS_ITEM_MONITOR_DROPPED:	Number of messages an asynchronous
+ *				monitor missed before this one
+ * @KDBUS_ITEM_MONITOR_TRUNCATED:	Size of the PAYLOAD_VEC data of a
+ *				message a monitor received truncated
  */
 enum kdbus_item_type {
 	_KDBUS_ITEM_NULL,
@@ -260,6 +333,9 @@ enum kdbus_item_type {
 	KDBUS_ITEM_DST_NAME,
 	KDBUS_ITEM_MAKE_NAME,
 	KDBUS_ITEM_ATTACH_FLAGS,
+	KDBUS_ITEM_RECV_QUEUES,
+	KDBUS_ITEM_MONITOR_FILTER,
+	KDBUS_ITEM_DST_ID,
 
 	_KDBUS_ITEM_ATTACH_BASE	= 0x1000,
 	KDBUS_ITEM_NAME		= _KDBUS_ITEM_ATTACH_BASE,
@@ -276,6 +352,7 @@ enum kdbus_item_type {
 	KDBUS_ITEM_SECLABEL,
 	KDBUS_ITEM_AUDIT,
 	KDBUS_ITEM_CONN_DESCRIPTION,
+	KDBUS_ITEM_META_EPOCH,
 
 	_KDBUS_ITEM_POLICY_BASE	= 0x2000,
 	KDBUS_ITEM_POLICY_ACCESS = _KDBUS_ITEM_POLICY_BASE,
@@ -288,6 +365,10 @@ enum kdbus_item_type {
 	KDBUS_ITEM_ID_REMOVE,
 	KDBUS_ITEM_REPLY_TIMEOUT,
 	KDBUS_ITEM_REPLY_DEAD,
+	KDBUS_ITEM_NAME_GENERATION,
+	KDBUS_ITEM_NAME_BATCH,
+	KDBUS_ITEM_MONITOR_DROPPED,
+	KDBUS_ITEM_MONITOR_TRUNCATED,
 };
 
 /**
@@ -313,6 +394,12 @@ enum kdbus_item_type {
  * @id_change:		KDBUS_ITEM_ID_ADD
  *			KDBUS_ITEM_ID_REMOVE
  * @policy:		KDBUS_ITEM_POLICY_ACCESS
+ * @recv_queues:	KDBUS_ITEM_RECV_QUEUES
+ * @monitor_filter:	KDBUS_ITEM_MONITOR_FILTER
+ * @meta_epoch:		KDBUS_ITEM_META_EPOCH
+ * @name_generation:	KDBUS_ITEM_NAME_GENERATION
+ * @monitor_dropped:	KDBUS_ITEM_MONITOR_DROPPED
+ * @monitor_truncated:	KDBUS_ITEM_MONITOR_TRUNCATED
  */
 struct kdbus_item {
 	__u64 size;
@@ -337,6 +424,12 @@ struct kdbus_item {
 		struct kdbus_notify_name_change name_change;
 		struct kdbus_notify_id_change id_change;
 		struct kdbus_policy_access policy_access;
+		struct kdbus_recv_queues recv_queues;
+		struct kdbus_monitor_filter monitor_filter;
+		__u64 meta_epoch;
+		__u64 name_generation;
+		__u64 monitor_dropped;
+		__u64 monitor_truncated;
 	};
 };
 
@@ -429,11 +522,15 @@ struct kdbus_msg {
  * @KDBUS_RECV_USE_PRIORITY:	Only de-queue messages with the specified or
  *				higher priority (lowest values); if not set,
  *				the priority value is ignored.
+ * @KDBUS_RECV_WAIT:		Block until a message is available in the
+ *				requested receive queue, instead of returning
+ *				-EAGAIN.
  */
 enum kdbus_recv_flags {
 	KDBUS_RECV_PEEK		= 1ULL <<  0,
 	KDBUS_RECV_DROP		= 1ULL <<  1,
 	KDBUS_RECV_USE_PRIORITY	= 1ULL <<  2,
+	KDBUS_RECV_WAIT		= 1ULL <<  3,
 };
 
 /**
@@ -455,6 +552,20 @@ struct kdbus_cmd_recv {
 	__u64 offset;
 } __attribute__((aligned(8)));
 
+/**
+ * struct kdbus_cmd_recv_queue - de-queue a message from a given queue
+ * @recv:		The receive command, like for KDBUS_CMD_MSG_RECV
+ * @queue:		Index of the receive queue to de-queue from, see
+ *			KDBUS_ITEM_RECV_QUEUES
+ *
+ * This struct is used with the KDBUS_CMD_MSG_RECV_QUEUE ioctl.
+ * KDBUS_CMD_MSG_RECV always de-queues from queue 0.
+ */
+struct kdbus_cmd_recv_queue {
+	struct kdbus_cmd_recv recv;
+	__u64 queue;
+} __attribute__((aligned(8)));
+
 /**
  * struct kdbus_cmd_cancel - struct to cancel a synchronously pending message
  * @cookie		The cookie of the pending message
@@ -525,12 +636,26 @@ enum kdbus_policy_type {
  *				a service
  * @KDBUS_HELLO_MONITOR:	Special-purpose connection to monitor
  *				bus traffic
+ * @KDBUS_HELLO_META_EPOCH:	Deliver the metadata of a sender's unchanged
+ *				task snapshot only once, and refer to it by a
+ *				KDBUS_ITEM_META_EPOCH item afterwards
+ * @KDBUS_HELLO_NOTIFY_BATCH:	Receive name changes that are queued in a
+ *				row as one message with a
+ *				KDBUS_ITEM_NAME_BATCH item
+ * @KDBUS_HELLO_MONITOR_ASYNC:	Deliver to a monitor from a bounded ring,
+ *				decoupled from the sender; messages are
+ *				dropped when the ring is full, and messages
+ *				sent concurrently on different CPUs may be
+ *				received out of sequence number order
  */
 enum kdbus_hello_flags {
 	KDBUS_HELLO_ACCEPT_FD		=  1ULL <<  0,
 	KDBUS_HELLO_ACTIVATOR		=  1ULL <<  1,
 	KDBUS_HELLO_POLICY_HOLDER	=  1ULL <<  2,
 	KDBUS_HELLO_MONITOR		=  1ULL <<  3,
+	KDBUS_HELLO_META_EPOCH		=  1ULL <<  4,
+	KDBUS_HELLO_NOTIFY_BATCH	=  1ULL <<  5,
+	KDBUS_HELLO_MONITOR_ASYNC	=  1ULL <<  6,
 };
 
 /**
@@ -636,6 +761,9 @@ struct kdbus_cmd_make {
  * @KDBUS_NAME_QUEUE:			Name should be queued if busy
  * @KDBUS_NAME_IN_QUEUE:		Name is queued
  * @KDBUS_NAME_ACTIVATOR:		Name is owned by a activator connection
+ * @KDBUS_NAME_SHARED:			Name may be owned by several connections
+ *					at once, messages are delivered to the
+ *					least busy one
  */
 enum kdbus_name_flags {
 	KDBUS_NAME_REPLACE_EXISTING	= 1ULL <<  0,
@@ -643,6 +771,7 @@ enum kdbus_name_flags {
 	KDBUS_NAME_QUEUE		= 1ULL <<  2,
 	KDBUS_NAME_IN_QUEUE		= 1ULL <<  3,
 	KDBUS_NAME_ACTIVATOR		= 1ULL <<  4,
+	KDBUS_NAME_SHARED		= 1ULL <<  5,
 };
 
 /**
@@ -688,12 +817,20 @@ struct kdbus_name_info {
  * @KDBUS_NAME_LIST_NAMES:	All known well-known names
  * @KDBUS_NAME_LIST_ACTIVATORS:	All activator connections
  * @KDBUS_NAME_LIST_QUEUED:	All queued-up names
+ * @KDBUS_NAME_LIST_CURSOR:	Return the list in chunks, resuming after
+ *				the cursor passed in; only valid with
+ *				KDBUS_CMD_NAME_LIST_CHUNK
+ * @KDBUS_NAME_LIST_SUBSCRIBE:	Receive all name change notifications
+ *				queued after the list was taken; only valid
+ *				with KDBUS_CMD_NAME_LIST_CHUNK
  */
 enum kdbus_name_list_flags {
 	KDBUS_NAME_LIST_UNIQUE		= 1ULL <<  0,
 	KDBUS_NAME_LIST_NAMES		= 1ULL <<  1,
 	KDBUS_NAME_LIST_ACTIVATORS	= 1ULL <<  2,
 	KDBUS_NAME_LIST_QUEUED		= 1ULL <<  3,
+	KDBUS_NAME_LIST_CURSOR		= 1ULL <<  4,
+	KDBUS_NAME_LIST_SUBSCRIBE	= 1ULL <<  5,
 };
 
 /**
@@ -713,6 +850,32 @@ struct kdbus_cmd_name_list {
 	__u64 offset;
 } __attribute__((aligned(8)));
 
+/**
+ * struct kdbus_cmd_name_list_chunk - request a part of the list of names
+ * @list:		The list command, like for KDBUS_CMD_NAME_LIST
+ * @cursor:		With KDBUS_NAME_LIST_CURSOR, the position to resume
+ *			the listing at, 0 to start at the beginning,
+ *			userspace → kernel. The position of the next chunk,
+ *			or 0 if the listing is complete, kernel → userspace
+ * @generation:		Registry generation at the time the chunk was
+ *			taken, kernel → userspace. If it differs between
+ *			chunks, names changed in between.
+ * @chunk_size:		With KDBUS_NAME_LIST_CURSOR, the size at which a
+ *			chunk is cut, 0 for the kernel's maximum,
+ *			userspace → kernel. Chunks are only cut between
+ *			connections, so a chunk may exceed it by the
+ *			entries of one connection.
+ *
+ * This structure is used with the KDBUS_CMD_NAME_LIST_CHUNK ioctl. Without
+ * KDBUS_NAME_LIST_CURSOR, the whole list is returned as a single chunk.
+ */
+struct kdbus_cmd_name_list_chunk {
+	struct kdbus_cmd_name_list list;
+	__u64 cursor;
+	__u64 generation;
+	__u64 chunk_size;
+} __attribute__((aligned(8)));
+
 /**
  * struct kdbus_name_list - information returned by KDBUS_CMD_NAME_LIST
  * @size:		The total size of the structure
@@ -726,6 +889,54 @@ struct kdbus_name_list {
 	struct kdbus_name_info names[0];
 };
 
+/* mmap() offset of the name table on a connection's file descriptor */
+#define KDBUS_NAME_TABLE_OFFSET		(1ULL << 40)
+
+/**
+ * enum kdbus_name_table_flags - state of the name table
+ * @KDBUS_NAME_TABLE_INCOMPLETE:	Some names did not fit into the
+ *					table; a name that is not found
+ *					has to be resolved with an ioctl
+ */
+enum kdbus_name_table_flags {
+	KDBUS_NAME_TABLE_INCOMPLETE	= 1ULL <<  0,
+};
+
+/**
+ * struct kdbus_name_table_slot - entry of the name table
+ * @owner_id:		ID of the primary owner of the name, 0 if the slot
+ *			is empty
+ * @flags:		KDBUS_NAME_* flags of the name
+ * @name:		The well-known name, 0-terminated
+ */
+struct kdbus_name_table_slot {
+	__u64 owner_id;
+	__u64 flags;
+	char name[256];
+} __attribute__((aligned(8)));
+
+/**
+ * struct kdbus_name_table - read-only table of well-known names of a bus
+ * @seq:		Sequence counter; odd while the kernel updates the
+ *			table. Readers retry if it is odd, or changed
+ *			while they read.
+ * @flags:		KDBUS_NAME_TABLE_* flags
+ * @n_slots:		Number of slots, a power of two
+ * @slot_size:		Size of one slot
+ * @slots:		Open-addressed hash table of names, indexed by the
+ *			32-bit FNV-1a hash of the name, with linear probing
+ *
+ * The table is mapped read-only at KDBUS_NAME_TABLE_OFFSET of a connection's
+ * file descriptor.
+ */
+struct kdbus_name_table {
+	__u64 seq;
+	__u64 flags;
+	__u64 n_slots;
+	__u64 slot_size;
+	struct kdbus_name_table_slot slots[0];
+} __attribute__((aligned(8)));
+
 /**
  * struct kdbus_cmd_info - struct used for KDBUS_CMD_CONN_INFO ioctl
  * @size:		The total size of the struct
@@ -754,6 +965,30 @@ struct kdbus_cmd_info {
 	struct kdbus_item items[0];
 } __attribute__((aligned(8)));
 
+/**
+ * struct kdbus_cmd_info_list - struct used for KDBUS_CMD_CONN_INFO_LIST ioctl
+ * @size:		The total size of the struct
+ * @flags:		KDBUS_ATTACH_* flags, userspace → kernel
+ * @kernel_flags:	Supported KDBUS_ATTACH_* flags, kernel → userspace
+ * @offset:		Returned offset in the caller's pool buffer where the
+ *			kdbus_info_list struct result is stored. The user must
+ *			use KDBUS_CMD_FREE to free the allocated memory.
+ * @items:		The connections to query, each one either by its ID
+ *			as KDBUS_ITEM_ID, or by a well-known name as
+ *			KDBUS_ITEM_NAME
+ *
+ * On success, the KDBUS_CMD_CONN_INFO_LIST ioctl will return 0 and @offset
+ * will tell the user the offset in the connection pool buffer at which to
+ * find the result in a struct kdbus_info_list.
+ */
+struct kdbus_cmd_info_list {
+	__u64 size;
+	__u64 flags;
+	__u64 kernel_flags;
+	__u64 offset;
+	struct kdbus_item items[0];
+} __attribute__((aligned(8)));
+
 /**
  * struct kdbus_info - information returned by KDBUS_CMD_*_INFO
  * @size:		The total size of the struct
@@ -771,6 +1006,22 @@ struct kdbus_info {
 	struct kdbus_item items[0];
 };
 
+/**
+ * struct kdbus_info_list - information returned by KDBUS_CMD_CONN_INFO_LIST
+ * @size:		The total size of the structure
+ * @infos:		One kdbus_info record for each item of the query, in
+ *			the same order. Records of connections which do not
+ *			exist or are not visible to the caller have their @id
+ *			set to 0 and carry no items.
+ *
+ * Note that the user is responsible for freeing the allocated memory with
+ * the KDBUS_CMD_FREE ioctl.
+ */
+struct kdbus_info_list {
+	__u64 size;
+	struct kdbus_info infos[0];
+};
+
 /**
  * struct kdbus_cmd_update - update flags of a connection
  * @size:		The total size of the struct
@@ -843,6 +1094,8 @@ struct kdbus_cmd_match {
  *				the kernel.
  * KDBUS_CMD_MSG_RECV:		Receive a message from the kernel which is
  *				placed in the receiver's pool.
+ * KDBUS_CMD_MSG_RECV_QUEUE:	Like KDBUS_CMD_MSG_RECV, but from a given
+ *				receive queue of the connection.
  * KDBUS_CMD_MSG_CANCEL:	Cancel a pending request of a message that
  *				blocks while waiting for a reply. The parameter
  *				denotes the cookie of the message in flight.
@@ -855,11 +1108,16 @@ struct kdbus_cmd_match {
  *				currently owns.
  * KDBUS_CMD_NAME_LIST:		Retrieve the list of all currently registered
  *				well-known and unique names.
+ * KDBUS_CMD_NAME_LIST_CHUNK:	Like KDBUS_CMD_NAME_LIST, but the list may be
+ *				retrieved in several parts, and the registry
+ *				generation is returned.
  * KDBUS_CMD_CONN_INFO:		Retrieve credentials and properties of the
  *				initial creator of the connection. The data was
  *				stored at registration time and does not
  *				necessarily represent the connected process or
  *				the actual state of the process.
+ * KDBUS_CMD_CONN_INFO_LIST:	Like KDBUS_CMD_CONN_INFO, but for several
+ *				connections at once.
  * KDBUS_CMD_CONN_UPDATE:	Update the properties of a connection. Used to
  *				update the metadata subscription mask and
  *				policy.
@@ -890,6 +1148,8 @@ struct kdbus_cmd_match {
 					     struct kdbus_cmd_cancel)
 #define KDBUS_CMD_FREE			_IOW(KDBUS_IOCTL_MAGIC, 0x43,	\
 					     struct kdbus_cmd_free)
+#define KDBUS_CMD_MSG_RECV_QUEUE	_IOWR(KDBUS_IOCTL_MAGIC, 0x44,	\
+					      struct kdbus_cmd_recv_queue)
 
 #define KDBUS_CMD_NAME_ACQUIRE		_IOWR(KDBUS_IOCTL_MAGIC, 0x50,	\
 					      struct kdbus_cmd_name)
@@ -897,6 +1157,8 @@ struct kdbus_cmd_match {
 					     struct kdbus_cmd_name)
 #define KDBUS_CMD_NAME_LIST		_IOWR(KDBUS_IOCTL_MAGIC, 0x52,	\
 					      struct kdbus_cmd_name_list)
+#define KDBUS_CMD_NAME_LIST_CHUNK	_IOWR(KDBUS_IOCTL_MAGIC, 0x53,	\
+					      struct kdbus_cmd_name_list_chunk)
 
 #define KDBUS_CMD_CONN_INFO		_IOWR(KDBUS_IOCTL_MAGIC, 0x60,	\
 					      struct kdbus_cmd_info)
@@ -904,6 +1166,8 @@ struct kdbus_cmd_match {
 					     struct kdbus_cmd_update)
 #define KDBUS_CMD_BUS_CREATOR_INFO	_IOWR(KDBUS_IOCTL_MAGIC, 0x62,	\
 					      struct kdbus_cmd_info)
+#define KDBUS_CMD_CONN_INFO_LIST	_IOWR(KDBUS_IOCTL_MAGIC, 0x63,	\
+					      struct kdbus_cmd_info_list)
 
 #define KDBUS_CMD_ENDPOINT_UPDATE	_IOW(KDBUS_IOCTL_MAGIC, 0x71,	\
 					     struct kdbus_cmd_update)
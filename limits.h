@@ -59,12 +59,39 @@
 /* maximum number of queued messages in a connection */
 #define KDBUS_CONN_MAX_MSGS			256
 
+/* maximum number of receive queues per connection */
+#define KDBUS_CONN_MAX_QUEUES			64
+
+/* maximum number of peers a connection remembers the metadata epoch of */
+#define KDBUS_CONN_MAX_META_EPOCHS		256
+
 /* maximum number of queued messages from the same indvidual user */
 #define KDBUS_CONN_MAX_MSGS_PER_USER		16
 
 /* maximum number of well-known names per connection */
 #define KDBUS_CONN_MAX_NAMES			64
 
+/* maximum number of connections queried by one KDBUS_CMD_CONN_INFO_LIST */
+#define KDBUS_CONN_INFO_LIST_MAX		256
+
+/* maximum size of KDBUS_CMD_CONN_INFO_LIST data */
+#define KDBUS_CONN_INFO_LIST_MAX_SIZE		SZ_128K
+
+/* maximum size of one chunk of a paginated KDBUS_CMD_NAME_LIST */
+#define KDBUS_NAME_LIST_MAX_CHUNK		SZ_64K
+
+/* number of slots in the mmap()able name table of a bus, a power of two */
+#define KDBUS_NAME_TABLE_SLOTS			1024
+
+/* maximum number of names in the name table */
+#define KDBUS_NAME_TABLE_MAX_NAMES		(KDBUS_NAME_TABLE_SLOTS * 3 / 4)
+
+/* maximum number of name changes delivered in one KDBUS_ITEM_NAME_BATCH */
+#define KDBUS_NOTIFY_BATCH_MAX			64
+
+/* number of messages per CPU in the ring of an asynchronous monitor */
+#define KDBUS_MONITOR_RING_SIZE			256
+
 /* maximum number of queued requests waiting for a reply */
 #define KDBUS_CONN_MAX_REQUESTS_PENDING		128
 
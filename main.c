@@ -21,6 +21,9 @@
 #include "domain.h"
 #include "handle.h"
 
+#define CREATE_TRACE_POINTS
+#include "trace.h"
+
 /* kdbus initial domain */
 static struct kdbus_domain *kdbus_domain_init;
 
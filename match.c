@@ -15,7 +15,9 @@
 #include <linux/fs.h>
 #include <linux/hash.h>
 #include <linux/init.h>
+#include <linux/hashtable.h>
 #include <linux/mutex.h>
+#include <linux/rwsem.h>
 #include <linux/sched.h>
 #include <linux/sizes.h>
 #include <linux/slab.h>
@@ -27,17 +29,53 @@
 #include "item.h"
 #include "match.h"
 #include "message.h"
+#include "util.h"
+
+/* kernel notification types, KDBUS_ITEM_NAME_ADD to KDBUS_ITEM_ID_REMOVE */
+#define KDBUS_MATCH_NOTIFY_TYPES \
+	(KDBUS_ITEM_ID_REMOVE - KDBUS_ITEM_NAME_ADD + 1)
+
+/**
+ * struct kdbus_match_index - bus-wide index of notification matches
+ * @lock:		Index lock
+ * @any_list:		Entries without rules, matching every notification
+ * @type_list:		Entries matching one notification type, but no
+ *			specific name, indexed by type
+ * @name_hash:		Entries matching name changes of a specific name
+ * @subscriber_list:	Databases of connections which get all name
+ *			changes, see KDBUS_NAME_LIST_SUBSCRIBE
+ *
+ * Entries which can only match messages from userspace are not indexed;
+ * kernel notifications are delivered to the connections found here only.
+ */
+struct kdbus_match_index {
+	struct rw_semaphore lock;
+	struct hlist_head any_list;
+	struct hlist_head type_list[KDBUS_MATCH_NOTIFY_TYPES];
+	DECLARE_HASHTABLE(name_hash, 6);
+	struct hlist_head subscriber_list;
+};
 
 /**
  * struct kdbus_match_db - message filters
  * @entries_list:	List of matches
  * @entries_lock:	Match data lock
  * @entries:		Number of entries in database
+ * @conn:		Connection owning the database
+ * @index:		Bus-wide index the entries are linked into, or NULL
+ *			if nothing was indexed yet
+ * @subscriber_entry:	Entry in the index's subscriber list
+ * @stamp:		Sequence number of the last notification the
+ *			connection was visited for
  */
 struct kdbus_match_db {
 	struct list_head entries_list;
 	struct mutex entries_lock;
 	unsigned int entries;
+	struct kdbus_conn *conn;
+	struct kdbus_match_index *index;
+	struct hlist_node subscriber_entry;
+	u64 stamp;
 };
 
 /**
@@ -45,11 +83,15 @@ struct kdbus_match_db {
  * @cookie:		User-supplied cookie to lookup the entry
  * @list_entry:		The list entry element for the db list
  * @rules_list:		The list head for tracking rules of this entry
+ * @db:			Database the entry belongs to
+ * @index_entry:	Entry in the bus-wide notification index
  */
 struct kdbus_match_entry {
 	u64 cookie;
 	struct list_head list_entry;
 	struct list_head rules_list;
+	struct kdbus_match_db *db;
+	struct hlist_node index_entry;
 };
 
 /**
@@ -88,6 +130,7 @@ struct kdbus_match_rule {
 			u64 new_id;
 		};
 		u64 src_id;
+		u64 dst_id;
 	};
 	struct list_head rules_entry;
 };
@@ -100,6 +143,7 @@ static void kdbus_match_rule_free(struct kdbus_match_rule *rule)
 		break;
 
 	case KDBUS_ITEM_NAME:
+	case KDBUS_ITEM_DST_NAME:
 	case KDBUS_ITEM_NAME_ADD:
 	case KDBUS_ITEM_NAME_REMOVE:
 	case KDBUS_ITEM_NAME_CHANGE:
@@ -107,6 +151,7 @@ static void kdbus_match_rule_free(struct kdbus_match_rule *rule)
 		break;
 
 	case KDBUS_ITEM_ID:
+	case KDBUS_ITEM_DST_ID:
 	case KDBUS_ITEM_ID_ADD:
 	case KDBUS_ITEM_ID_REMOVE:
 		break;
@@ -119,10 +164,13 @@ static void kdbus_match_rule_free(struct kdbus_match_rule *rule)
 	kfree(rule);
 }
 
+/* the index lock must be held for writing, if the entry was indexed */
 static void kdbus_match_entry_free(struct kdbus_match_entry *entry)
 {
 	struct kdbus_match_rule *r, *tmp;
 
+	hlist_del_init(&entry->index_entry);
+
 	list_for_each_entry_safe(r, tmp, &entry->rules_list, rules_entry)
 		kdbus_match_rule_free(r);
 
@@ -130,6 +178,92 @@ static void kdbus_match_entry_free(struct kdbus_match_entry *entry)
 	kfree(entry);
 }
 
+/**
+ * kdbus_match_index_new() - create a new notification index
+ *
+ * Return: a new kdbus_match_index on success, ERR_PTR on failure.
+ */
+struct kdbus_match_index *kdbus_match_index_new(void)
+{
+	struct kdbus_match_index *index;
+	unsigned int i;
+
+	index = kzalloc(sizeof(*index), GFP_KERNEL);
+	if (!index)
+		return ERR_PTR(-ENOMEM);
+
+	init_rwsem(&index->lock);
+	INIT_HLIST_HEAD(&index->any_list);
+	for (i = 0; i < KDBUS_MATCH_NOTIFY_TYPES; i++)
+		INIT_HLIST_HEAD(&index->type_list[i]);
+	hash_init(index->name_hash);
+	INIT_HLIST_HEAD(&index->subscriber_list);
+
+	return index;
+}
+
+/**
+ * kdbus_match_index_free() - free a notification index
+ * @index:		The index to free
+ *
+ * All match databases of the bus must have been freed before.
+ */
+void kdbus_match_index_free(struct kdbus_match_index *index)
+{
+	if (!index)
+		return;
+
+	BUG_ON(!hash_empty(index->name_hash));
+	BUG_ON(!hlist_empty(&index->any_list));
+	BUG_ON(!hlist_empty(&index->subscriber_list));
+
+	kfree(index);
+}
+
+/*
+ * Link @entry into the list of the index which covers all notifications
+ * it can match. Entries which can only match messages from userspace, or
+ * which require different notification types in their rules and hence
+ * never match, are left out.
+ */
+static void kdbus_match_index_add(struct kdbus_match_index *index,
+				  struct kdbus_match_entry *entry)
+{
+	struct kdbus_match_rule *r;
+	const char *name = NULL;
+	u64 type = 0;
+
+	list_for_each_entry(r, &entry->rules_list, rules_entry) {
+		switch (r->type) {
+		case KDBUS_ITEM_NAME_ADD:
+		case KDBUS_ITEM_NAME_REMOVE:
+		case KDBUS_ITEM_NAME_CHANGE:
+			if (!name)
+				name = r->name;
+			/* fall through */
+		case KDBUS_ITEM_ID_ADD:
+		case KDBUS_ITEM_ID_REMOVE:
+			if (type != 0 && type != r->type)
+				return;
+
+			type = r->type;
+			break;
+
+		default:
+			return;
+		}
+	}
+
+	if (type == 0)
+		hlist_add_head(&entry->index_entry, &index->any_list);
+	else if (name)
+		hash_add(index->name_hash, &entry->index_entry,
+			 kdbus_str_hash(name));
+	else
+		hlist_add_head(&entry->index_entry,
+			       &index->type_list[type - KDBUS_ITEM_NAME_ADD]);
+}
+
 /**
  * kdbus_match_db_free() - free match db resources
  * @db:			The match database
@@ -138,20 +272,29 @@ void kdbus_match_db_free(struct kdbus_match_db *db)
 {
 	struct kdbus_match_entry *entry, *tmp;
 
+	if (db->index)
+		down_write(&db->index->lock);
+
 	mutex_lock(&db->entries_lock);
 	list_for_each_entry_safe(entry, tmp, &db->entries_list, list_entry)
 		kdbus_match_entry_free(entry);
 	mutex_unlock(&db->entries_lock);
 
+	hlist_del_init(&db->subscriber_entry);
+
+	if (db->index)
+		up_write(&db->index->lock);
+
 	kfree(db);
 }
 
 /**
  * kdbus_match_db_new() - create a new match database
+ * @conn:		Connection owning the database
  *
  * Return: a new kdbus_match_db on success, ERR_PTR on failure.
  */
-struct kdbus_match_db *kdbus_match_db_new(void)
+struct kdbus_match_db *kdbus_match_db_new(struct kdbus_conn *conn)
 {
 	struct kdbus_match_db *d;
 
@@ -161,10 +304,31 @@ struct kdbus_match_db *kdbus_match_db_new(void)
 
 	mutex_init(&d->entries_lock);
 	INIT_LIST_HEAD(&d->entries_list);
+	INIT_HLIST_NODE(&d->subscriber_entry);
+	d->conn = conn;
 
 	return d;
 }
 
+/**
+ * kdbus_match_db_subscribe_names() - deliver all name changes to a database
+ * @db:			The match database
+ *
+ * Links the database into the subscriber list of the bus' notification
+ * index, so its connection is visited for every name change, regardless of
+ * its matches. The subscription lasts for the lifetime of the database.
+ */
+void kdbus_match_db_subscribe_names(struct kdbus_match_db *db)
+{
+	struct kdbus_match_index *index = db->conn->bus->match_index;
+
+	down_write(&index->lock);
+	db->index = index;
+	if (hlist_unhashed(&db->subscriber_entry))
+		hlist_add_head(&db->subscriber_entry, &index->subscriber_list);
+	up_write(&index->lock);
+}
+
 static bool kdbus_match_bloom(const struct kdbus_bloom_filter *filter,
 			      const struct kdbus_bloom_mask *mask,
 			      const struct kdbus_conn *conn)
@@ -249,7 +413,9 @@ static bool kdbus_match_rules(const struct kdbus_match_entry *entry,
 
 			switch (r->type) {
 			case KDBUS_ITEM_BLOOM_MASK:
-				if (!kdbus_match_bloom(kmsg->bloom_filter,
+				/* unicast messages carry no bloom filter */
+				if (!kmsg->bloom_filter ||
+				    !kdbus_match_bloom(kmsg->bloom_filter,
 						       &r->bloom_mask,
 						       conn_src))
 					return false;
@@ -268,6 +434,20 @@ static bool kdbus_match_rules(const struct kdbus_match_entry *entry,
 
 				break;
 
+			case KDBUS_ITEM_DST_ID:
+				if (r->dst_id != kmsg->msg.dst_id &&
+				    r->dst_id != KDBUS_MATCH_ID_ANY)
+					return false;
+
+				break;
+
+			case KDBUS_ITEM_DST_NAME:
+				if (!kmsg->dst_name ||
+				    strcmp(r->name, kmsg->dst_name) != 0)
+					return false;
+
+				break;
+
 			default:
 				return false;
 			}
@@ -307,6 +487,74 @@ bool kdbus_match_db_match_kmsg(struct kdbus_match_db *db,
 	return matched;
 }
 
+static void kdbus_match_index_visit(struct kdbus_match_db *db, u64 stamp,
+				    void (*func)(struct kdbus_conn *conn,
+						 void *data),
+				    void *data)
+{
+	if (db->stamp == stamp)
+		return;
+
+	db->stamp = stamp;
+	func(db->conn, data);
+}
+
+/**
+ * kdbus_match_index_walk() - visit the receivers of a kernel notification
+ * @index:		The notification index of the bus
+ * @kmsg:		The kernel notification
+ * @stamp:		Unique number of this delivery, like the sequence
+ *			number of the message
+ * @func:		Function to call for each receiving connection
+ * @data:		Data to pass to @func
+ *
+ * Calls @func for every connection with a match entry satisfied by @kmsg,
+ * and, for name changes, for all connections subscribed to name changes.
+ * Each connection is visited only once per @stamp, so a batch of messages
+ * can be walked with the same one. Only the connections in the matching
+ * index lists are looked at, instead of all rules of all connections.
+ *
+ * Kernel notifications are only sent by kdbus_notify_flush(), one at a
+ * time, which makes it safe to record the stamp in the database.
+ */
+void kdbus_match_index_walk(struct kdbus_match_index *index,
+			    struct kdbus_kmsg *kmsg, u64 stamp,
+			    void (*func)(struct kdbus_conn *conn, void *data),
+			    void *data)
+{
+	struct kdbus_match_entry *entry;
+	struct kdbus_match_db *db;
+
+	if (kmsg->notify_type < KDBUS_ITEM_NAME_ADD ||
+	    kmsg->notify_type > KDBUS_ITEM_ID_REMOVE)
+		return;
+
+	down_read(&index->lock);
+
+	hlist_for_each_entry(entry, &index->any_list, index_entry)
+		kdbus_match_index_visit(entry->db, stamp, func, data);
+
+	hlist_for_each_entry(entry, &index->type_list[kmsg->notify_type -
+						      KDBUS_ITEM_NAME_ADD],
+			     index_entry)
+		if (kdbus_match_rules(entry, NULL, kmsg))
+			kdbus_match_index_visit(entry->db, stamp, func, data);
+
+	if (kmsg->notify_name) {
+		hash_for_each_possible(index->name_hash, entry, index_entry,
+				       kdbus_str_hash(kmsg->notify_name))
+			if (kdbus_match_rules(entry, NULL, kmsg))
+				kdbus_match_index_visit(entry->db, stamp,
+							func, data);
+
+		hlist_for_each_entry(db, &index->subscriber_list,
+				     subscriber_entry)
+			kdbus_match_index_visit(db, stamp, func, data);
+	}
+
+	up_read(&index->lock);
+}
+
 static int __kdbus_match_db_remove_unlocked(struct kdbus_match_db *db,
 					    uint64_t cookie)
 {
@@ -354,13 +602,16 @@ static int __kdbus_match_db_remove_unlocked(struct kdbus_match_db *db,
  *
  * Also note that KDBUS_ITEM_BLOOM_MASK, KDBUS_ITEM_NAME and KDBUS_ITEM_ID
  * are used to match messages from userspace, while the others apply to
- * kernel-generated notifications.
+ * kernel-generated notifications. Entries which can match notifications
+ * are linked into the notification index of the bus, by type, or by name
+ * for name changes of a specific name; see kdbus_match_index_walk().
  *
  * Return: 0 on success, negative errno on failure
  */
 int kdbus_match_db_add(struct kdbus_conn *conn,
 		       struct kdbus_cmd_match *cmd)
 {
+	struct kdbus_match_index *index = conn->bus->match_index;
 	struct kdbus_match_entry *entry = NULL;
 	struct kdbus_match_db *db = conn->match_db;
 	struct kdbus_item *item;
@@ -376,8 +627,10 @@ int kdbus_match_db_add(struct kdbus_conn *conn,
 	}
 
 	entry->cookie = cmd->cookie;
+	entry->db = db;
 	INIT_LIST_HEAD(&entry->list_entry);
 	INIT_LIST_HEAD(&entry->rules_list);
+	INIT_HLIST_NODE(&entry->index_entry);
 
 	KDBUS_ITEMS_FOREACH(item, cmd->items, KDBUS_ITEMS_SIZE(cmd, items)) {
 		struct kdbus_match_rule *rule;
@@ -415,6 +668,7 @@ int kdbus_match_db_add(struct kdbus_conn *conn,
 			break;
 		}
 		case KDBUS_ITEM_NAME:
+		case KDBUS_ITEM_DST_NAME:
 			ret = kdbus_item_validate_name(item);
 			if (ret < 0)
 				break;
@@ -429,6 +683,10 @@ int kdbus_match_db_add(struct kdbus_conn *conn,
 			rule->src_id = item->id;
 			break;
 
+		case KDBUS_ITEM_DST_ID:
+			rule->dst_id = item->id;
+			break;
+
 		case KDBUS_ITEM_NAME_ADD:
 		case KDBUS_ITEM_NAME_REMOVE:
 		case KDBUS_ITEM_NAME_CHANGE: {
@@ -469,6 +727,9 @@ int kdbus_match_db_add(struct kdbus_conn *conn,
 		list_add_tail(&rule->rules_entry, &entry->rules_list);
 	}
 
+	/* lock order: index -> entries */
+	down_write(&index->lock);
+	db->index = index;
 	mutex_lock(&db->entries_lock);
 
 	/* Remove any entry that has the same cookie as the current one. */
@@ -483,11 +744,14 @@ int kdbus_match_db_add(struct kdbus_conn *conn,
 		--db->entries;
 		ret = -EMFILE;
 	}
-	if (ret == 0)
+	if (ret == 0) {
 		list_add_tail(&entry->list_entry, &db->entries_list);
-	else
+		kdbus_match_index_add(index, entry);
+	} else {
 		kdbus_match_entry_free(entry);
+	}
 	mutex_unlock(&db->entries_lock);
+	up_write(&index->lock);
 
 exit_free:
 	return ret;
@@ -506,14 +770,17 @@ exit_free:
 int kdbus_match_db_remove(struct kdbus_conn *conn,
 			  struct kdbus_cmd_match *cmd)
 {
+	struct kdbus_match_index *index = conn->bus->match_index;
 	struct kdbus_match_db *db = conn->match_db;
 	int ret;
 
 	lockdep_assert_held(conn);
 
+	down_write(&index->lock);
 	mutex_lock(&db->entries_lock);
 	ret = __kdbus_match_db_remove_unlocked(db, cmd->cookie);
 	mutex_unlock(&db->entries_lock);
+	up_write(&index->lock);
 
 	return ret;
 }
@@ -17,9 +17,18 @@
 struct kdbus_conn;
 struct kdbus_kmsg;
 struct kdbus_match_db;
+struct kdbus_match_index;
 
-struct kdbus_match_db *kdbus_match_db_new(void);
+struct kdbus_match_index *kdbus_match_index_new(void);
+void kdbus_match_index_free(struct kdbus_match_index *index);
+void kdbus_match_index_walk(struct kdbus_match_index *index,
+			    struct kdbus_kmsg *kmsg, u64 stamp,
+			    void (*func)(struct kdbus_conn *conn, void *data),
+			    void *data);
+
+struct kdbus_match_db *kdbus_match_db_new(struct kdbus_conn *conn);
 void kdbus_match_db_free(struct kdbus_match_db *db);
+void kdbus_match_db_subscribe_names(struct kdbus_match_db *db);
 int kdbus_match_db_add(struct kdbus_conn *conn,
 		       struct kdbus_cmd_match *cmd);
 int kdbus_match_db_remove(struct kdbus_conn *conn,
@@ -36,6 +36,7 @@
 #include "message.h"
 #include "names.h"
 #include "policy.h"
+#include "trace.h"
 
 #define KDBUS_KMSG_HEADER_SIZE offsetof(struct kdbus_kmsg, msg)
 
@@ -403,6 +404,9 @@ struct kdbus_kmsg *kdbus_kmsg_new_from_user(struct kdbus_conn *conn,
 	}
 	m->msg.src_id = conn->id;
 
+	trace_kdbus_kmsg_new(m->msg.src_id, m->msg.dst_id, m->msg.cookie,
+			     m->msg.size, m->msg.flags);
+
 	return m;
 
 exit_free:
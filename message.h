@@ -24,6 +24,7 @@
  * @notify_old_id:	Short-cut for faster lookup
  * @notify_new_id:	Short-cut for faster lookup
  * @notify_name:	Short-cut for faster lookup
+ * @notify_seq:		Bus-local queueing order of a notification
  * @dst_name:		Short-cut to msg for faster lookup
  * @dst_name_id:	Short-cut to msg for faster lookup
  * @bloom_filter:	Bloom filter to match message properties
@@ -43,6 +44,7 @@ struct kdbus_kmsg {
 	u64 notify_old_id;
 	u64 notify_new_id;
 	const char *notify_name;
+	u64 notify_seq;
 
 	const char *dst_name;
 	u64 dst_name_id;
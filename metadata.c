@@ -17,7 +17,10 @@
 #include <linux/cred.h>
 #include <linux/file.h>
 #include <linux/init.h>
+#include <linux/kref.h>
 #include <linux/mutex.h>
+#include <linux/path.h>
+#include <linux/mm.h>
 #include <linux/pid_namespace.h>
 #include <linux/sched.h>
 #include <linux/security.h>
@@ -32,6 +35,54 @@
 #include "message.h"
 #include "metadata.h"
 #include "names.h"
+#include "pool.h"
+
+/*
+ * Metadata kdbus_meta_capture() only takes references for, and serializes
+ * on first use. The executable and command line are read from the address
+ * space of the task; only the mm_struct itself is pinned, not the address
+ * space or the executable file, so a reference to it does not keep a mount
+ * busy. The cgroup path is not deferred: the references to a task's
+ * css_set are private to the cgroup core.
+ */
+#define KDBUS_META_DEFERRED_FLAGS	(KDBUS_ATTACH_CREDS |		\
+					 KDBUS_ATTACH_AUXGROUPS |	\
+					 KDBUS_ATTACH_TID_COMM |	\
+					 KDBUS_ATTACH_PID_COMM |	\
+					 KDBUS_ATTACH_EXE |		\
+					 KDBUS_ATTACH_CMDLINE |		\
+					 KDBUS_ATTACH_CAPS |		\
+					 KDBUS_ATTACH_SECLABEL)
+
+/**
+ * struct kdbus_meta_deferred - task data not yet serialized into items
+ * @lock:		Serializes kdbus_meta_collect()
+ * @which:		KDBUS_ATTACH_* flags captured
+ * @cred:		Credentials of the task
+ * @pid:		PID of the task
+ * @tgid:		PID of the task's thread group leader
+ * @start_time:		Start time of the task
+ * @mm:			Memory descriptor of the task, grabbed but not
+ *			pinned, for the executable and command line
+ * @secid:		Security ID of the task
+ * @pid_comm:		The "comm" of the task
+ * @tid_comm:		The "comm" of the task's thread group leader
+ *
+ * The references are dropped once the items were serialized; the object
+ * itself lives as long as its kdbus_meta.
+ */
+struct kdbus_meta_deferred {
+	struct mutex lock;
+	u64 which;
+	const struct cred *cred;
+	struct pid *pid;
+	struct pid *tgid;
+	u64 start_time;
+	struct mm_struct *mm;
+	u32 secid;
+	char pid_comm[TASK_COMM_LEN];
+	char tid_comm[TASK_COMM_LEN];
+};
 
 /**
  * kdbus_meta_new() - create new metadata object
@@ -86,6 +137,8 @@ struct kdbus_meta *kdbus_meta_dup(const struct kdbus_meta *orig)
 	m->attached = orig->attached;
 	m->allocated_size = orig->allocated_size;
 	m->size = orig->size;
+	m->epoch = orig->epoch;
+	m->deferred = NULL;
 
 	return m;
 }
@@ -105,6 +158,24 @@ bool kdbus_meta_ns_eq(const struct kdbus_meta *meta_a,
 		meta_a->user_namespace == meta_b->user_namespace);
 }
 
+static void kdbus_meta_deferred_put(struct kdbus_meta_deferred *d)
+{
+	if (d->cred) {
+		put_cred(d->cred);
+		d->cred = NULL;
+	}
+
+	put_pid(d->pid);
+	d->pid = NULL;
+	put_pid(d->tgid);
+	d->tgid = NULL;
+
+	if (d->mm) {
+		mmdrop(d->mm);
+		d->mm = NULL;
+	}
+}
+
 /**
  * kdbus_meta_free() - release metadata
  * @meta:		Metadata object
@@ -117,6 +188,11 @@ void kdbus_meta_free(struct kdbus_meta *meta)
 	put_pid_ns(meta->pid_namespace);
 	put_user_ns(meta->user_namespace);
 
+	if (meta->deferred) {
+		kdbus_meta_deferred_put(meta->deferred);
+		kfree(meta->deferred);
+	}
+
 	kfree(meta->data);
 	kfree(meta);
 }
@@ -225,44 +301,43 @@ static int kdbus_meta_append_timestamp(struct kdbus_meta *meta,
 	return 0;
 }
 
-static int kdbus_meta_append_cred(struct kdbus_meta *meta)
+static int kdbus_meta_append_cred(struct kdbus_meta *meta,
+				  const struct cred *cred,
+				  struct pid *pid, struct pid *tgid,
+				  u64 start_time)
 {
 	struct kdbus_creds creds = {
-		.uid = from_kuid_munged(current_user_ns(), current_uid()),
-		.gid = from_kgid_munged(current_user_ns(), current_gid()),
-		.pid = task_pid_vnr(current),
-		.tid = task_tgid_vnr(current),
-		.starttime = current->start_time,
+		.uid = from_kuid_munged(meta->user_namespace, cred->uid),
+		.gid = from_kgid_munged(meta->user_namespace, cred->gid),
+		.pid = pid_nr_ns(pid, meta->pid_namespace),
+		.tid = pid_nr_ns(tgid, meta->pid_namespace),
+		.starttime = start_time,
 	};
 
 	return kdbus_meta_append_data(meta, KDBUS_ITEM_CREDS,
 				      &creds, sizeof(creds));
 }
 
-static int kdbus_meta_append_auxgroups(struct kdbus_meta *meta)
+static int kdbus_meta_append_auxgroups(struct kdbus_meta *meta,
+				       const struct cred *cred)
 {
-	struct group_info *info;
+	const struct group_info *info = cred->group_info;
 	struct kdbus_item *item;
-	int i, ret = 0;
 	u64 *gid;
+	int i;
 
-	info = get_current_groups();
 	item = kdbus_meta_append_item(meta, KDBUS_ITEM_AUXGROUPS,
 				      info->ngroups * sizeof(*gid));
-	if (IS_ERR(item)) {
-		ret = PTR_ERR(item);
-		goto exit_put_groups;
-	}
+	if (IS_ERR(item))
+		return PTR_ERR(item);
 
 	gid = (u64 *) item->data;
 
 	for (i = 0; i < info->ngroups; i++)
-		gid[i] = from_kgid_munged(current_user_ns(), GROUP_AT(info, i));
-
-exit_put_groups:
-	put_group_info(info);
+		gid[i] = from_kgid_munged(meta->user_namespace,
+					  GROUP_AT(info, i));
 
-	return ret;
+	return 0;
 }
 
 static int kdbus_meta_append_src_names(struct kdbus_meta *meta,
@@ -295,35 +370,30 @@ static int kdbus_meta_append_src_names(struct kdbus_meta *meta,
 	return ret;
 }
 
-static int kdbus_meta_append_exe(struct kdbus_meta *meta)
+/*
+ * Append the path of the executable of @mm, which must have users. Nothing
+ * is appended if it has none.
+ */
+static int kdbus_meta_append_exe(struct kdbus_meta *meta,
+				 struct mm_struct *mm)
 {
-	struct mm_struct *mm = get_task_mm(current);
-	struct path *exe_path = NULL;
+	struct file *exe_file;
 	char *pathname;
-	int ret = 0;
 	size_t len;
 	char *tmp;
+	int ret;
 
-	if (!mm)
-		return -EFAULT;
-
-	down_read(&mm->mmap_sem);
-	if (mm->exe_file) {
-		path_get(&mm->exe_file->f_path);
-		exe_path = &mm->exe_file->f_path;
-	}
-	up_read(&mm->mmap_sem);
-
-	if (!exe_path)
-		goto exit_mmput;
+	exe_file = get_mm_exe_file(mm);
+	if (!exe_file)
+		return 0;
 
 	tmp = (char *)__get_free_page(GFP_TEMPORARY | __GFP_ZERO);
 	if (!tmp) {
 		ret = -ENOMEM;
-		goto exit_path_put;
+		goto exit_fput;
 	}
 
-	pathname = d_path(exe_path, tmp, PAGE_SIZE);
+	pathname = d_path(&exe_file->f_path, tmp, PAGE_SIZE);
 	if (IS_ERR(pathname)) {
 		ret = PTR_ERR(pathname);
 		goto exit_free_page;
@@ -334,56 +404,54 @@ static int kdbus_meta_append_exe(struct kdbus_meta *meta)
 
 exit_free_page:
 	free_page((unsigned long) tmp);
-
-exit_path_put:
-	path_put(exe_path);
-
-exit_mmput:
-	mmput(mm);
+exit_fput:
+	fput(exe_file);
 
 	return ret;
 }
 
-static int kdbus_meta_append_cmdline(struct kdbus_meta *meta)
+/*
+ * Append the command line of @mm, which must have users. It is read from
+ * another task's address space if @mm is not the current one.
+ */
+static int kdbus_meta_append_cmdline(struct kdbus_meta *meta,
+				     struct mm_struct *mm)
 {
-	struct mm_struct *mm;
 	int ret = 0;
 	size_t len;
 	char *tmp;
 
+	if (!mm->arg_end)
+		return 0;
+
 	tmp = (char *)__get_free_page(GFP_TEMPORARY | __GFP_ZERO);
 	if (!tmp)
 		return -ENOMEM;
 
-	mm = get_task_mm(current);
-	if (!mm) {
-		ret = -EFAULT;
-		goto exit_free_page;
-	}
-
-	if (!mm->arg_end)
-		goto exit_mmput;
-
 	len = mm->arg_end - mm->arg_start;
 	if (len > PAGE_SIZE)
 		len = PAGE_SIZE;
 
-	ret = copy_from_user(tmp, (const char __user *)mm->arg_start, len);
-	if (ret < 0)
-		goto exit_mmput;
-
-	ret = kdbus_meta_append_data(meta, KDBUS_ITEM_CMDLINE, tmp, len);
+	if (mm == current->mm) {
+		if (copy_from_user(tmp, (const char __user *)mm->arg_start,
+				   len))
+			ret = -EFAULT;
+	} else {
+		if (access_remote_vm(mm, mm->arg_start, tmp, len, 0) != len)
+			ret = -EFAULT;
+	}
 
-exit_mmput:
-	mmput(mm);
+	if (ret == 0)
+		ret = kdbus_meta_append_data(meta, KDBUS_ITEM_CMDLINE,
+					     tmp, len);
 
-exit_free_page:
 	free_page((unsigned long) tmp);
 
 	return ret;
 }
 
-static int kdbus_meta_append_caps(struct kdbus_meta *meta)
+static int kdbus_meta_append_caps(struct kdbus_meta *meta,
+				  const struct cred *cred)
 {
 	struct caps {
 		u32 last_cap;
@@ -392,7 +460,6 @@ static int kdbus_meta_append_caps(struct kdbus_meta *meta)
 		} set[4];
 	} caps;
 	unsigned int i;
-	const struct cred *cred = current_cred();
 
 	caps.last_cap = CAP_LAST_CAP;
 
@@ -450,13 +517,12 @@ static int kdbus_meta_append_audit(struct kdbus_meta *meta)
 #endif
 
 #ifdef CONFIG_SECURITY
-static int kdbus_meta_append_seclabel(struct kdbus_meta *meta)
+static int kdbus_meta_append_seclabel(struct kdbus_meta *meta, u32 sid)
 {
-	u32 len, sid;
 	char *label;
+	u32 len;
 	int ret;
 
-	security_task_getsecid(current, &sid);
 	ret = security_secid_to_secctx(sid, &label, &len);
 	if (ret == -EOPNOTSUPP)
 		return 0;
@@ -505,7 +571,10 @@ int kdbus_meta_append(struct kdbus_meta *meta,
 	}
 
 	if (mask & KDBUS_ATTACH_CREDS) {
-		ret = kdbus_meta_append_cred(meta);
+		ret = kdbus_meta_append_cred(meta, current_cred(),
+					     task_pid(current),
+					     task_tgid(current),
+					     current->start_time);
 		if (ret < 0)
 			return ret;
 
@@ -513,7 +582,7 @@ int kdbus_meta_append(struct kdbus_meta *meta,
 	}
 
 	if (mask & KDBUS_ATTACH_AUXGROUPS) {
-		ret = kdbus_meta_append_auxgroups(meta);
+		ret = kdbus_meta_append_auxgroups(meta, current_cred());
 		if (ret < 0)
 			return ret;
 
@@ -550,25 +619,33 @@ int kdbus_meta_append(struct kdbus_meta *meta,
 		meta->attached |= KDBUS_ATTACH_PID_COMM;
 	}
 
-	if (mask & KDBUS_ATTACH_EXE) {
-		ret = kdbus_meta_append_exe(meta);
-		if (ret < 0)
-			return ret;
+	if (mask & (KDBUS_ATTACH_EXE | KDBUS_ATTACH_CMDLINE)) {
+		struct mm_struct *mm = get_task_mm(current);
 
-		meta->attached |= KDBUS_ATTACH_EXE;
-	}
+		if (!mm)
+			return -EFAULT;
+
+		ret = 0;
+		if (mask & KDBUS_ATTACH_EXE) {
+			ret = kdbus_meta_append_exe(meta, mm);
+			if (ret == 0)
+				meta->attached |= KDBUS_ATTACH_EXE;
+		}
+
+		if (ret == 0 && mask & KDBUS_ATTACH_CMDLINE) {
+			ret = kdbus_meta_append_cmdline(meta, mm);
+			if (ret == 0)
+				meta->attached |= KDBUS_ATTACH_CMDLINE;
+		}
 
-	if (mask & KDBUS_ATTACH_CMDLINE) {
-		ret = kdbus_meta_append_cmdline(meta);
+		mmput(mm);
 		if (ret < 0)
 			return ret;
-
-		meta->attached |= KDBUS_ATTACH_CMDLINE;
 	}
 
 	/* we always return a 4 elements, the element size is 1/4  */
 	if (mask & KDBUS_ATTACH_CAPS) {
-		ret = kdbus_meta_append_caps(meta);
+		ret = kdbus_meta_append_caps(meta, current_cred());
 		if (ret < 0)
 			return ret;
 
@@ -598,7 +675,10 @@ int kdbus_meta_append(struct kdbus_meta *meta,
 
 #ifdef CONFIG_SECURITY
 	if (mask & KDBUS_ATTACH_SECLABEL) {
-		ret = kdbus_meta_append_seclabel(meta);
+		u32 sid;
+
+		security_task_getsecid(current, &sid);
+		ret = kdbus_meta_append_seclabel(meta, sid);
 		if (ret < 0)
 			return ret;
 
@@ -617,3 +697,599 @@ int kdbus_meta_append(struct kdbus_meta *meta,
 
 	return 0;
 }
+
+/**
+ * kdbus_meta_capture() - capture metadata of the current process for later
+ * @meta:		Metadata object
+ * @which:		KDBUS_ATTACH_* flags which typ of data to attach
+ *
+ * Like kdbus_meta_append(), but for data whose serialization is expensive,
+ * only references to the credentials, PIDs and memory descriptor of the
+ * current task are taken. The items are created by kdbus_meta_collect()
+ * when they are first needed, and describe the task as it was when this
+ * function was called. The executable and command line are left out if
+ * the task's address space is gone by then, because it exited or executed
+ * another binary.
+ *
+ * Return: 0 on success, negative errno on failure.
+ */
+int kdbus_meta_capture(struct kdbus_meta *meta, u64 which)
+{
+	u64 deferred = which & KDBUS_META_DEFERRED_FLAGS;
+	struct kdbus_meta_deferred *d;
+
+	if (deferred) {
+		d = kzalloc(sizeof(*d), GFP_KERNEL);
+		if (!d)
+			return -ENOMEM;
+
+		mutex_init(&d->lock);
+		meta->deferred = d;
+
+		if (deferred & (KDBUS_ATTACH_CREDS |
+				KDBUS_ATTACH_AUXGROUPS |
+				KDBUS_ATTACH_CAPS))
+			d->cred = get_current_cred();
+
+		if (deferred & KDBUS_ATTACH_CREDS) {
+			d->pid = get_task_pid(current, PIDTYPE_PID);
+			d->tgid = get_pid(task_tgid(current));
+			d->start_time = current->start_time;
+		}
+
+		if (deferred & KDBUS_ATTACH_PID_COMM)
+			get_task_comm(d->pid_comm, current);
+
+		if (deferred & KDBUS_ATTACH_TID_COMM)
+			get_task_comm(d->tid_comm, current->group_leader);
+
+		if (deferred & (KDBUS_ATTACH_EXE | KDBUS_ATTACH_CMDLINE)) {
+			task_lock(current);
+			d->mm = current->mm;
+			if (d->mm)
+				mmgrab(d->mm);
+			task_unlock(current);
+		}
+
+#ifdef CONFIG_SECURITY
+		if (deferred & KDBUS_ATTACH_SECLABEL)
+			security_task_getsecid(current, &d->secid);
+#endif
+
+		d->which = deferred;
+	}
+
+	return kdbus_meta_append(meta, NULL, 0,
+				 which & ~KDBUS_META_DEFERRED_FLAGS);
+}
+
+/**
+ * kdbus_meta_collect() - serialize the data captured by kdbus_meta_capture()
+ * @meta:		Metadata object
+ *
+ * Turn the references taken by kdbus_meta_capture() into items, and drop
+ * them. This must be called before @meta's buffer is read; it does nothing
+ * if there is nothing left to serialize.
+ *
+ * Return: 0 on success, negative errno on failure.
+ */
+int kdbus_meta_collect(struct kdbus_meta *meta)
+{
+	struct kdbus_meta_deferred *d = meta->deferred;
+	int ret = 0;
+	u64 mask;
+
+	if (!d)
+		return 0;
+
+	mutex_lock(&d->lock);
+
+	/* items which were serialized before a failure are not redone */
+	mask = d->which & ~meta->attached;
+	if (mask == 0)
+		goto exit_unlock;
+
+	if (mask & KDBUS_ATTACH_CREDS) {
+		ret = kdbus_meta_append_cred(meta, d->cred, d->pid, d->tgid,
+					     d->start_time);
+		if (ret < 0)
+			goto exit_unlock;
+
+		meta->attached |= KDBUS_ATTACH_CREDS;
+	}
+
+	if (mask & KDBUS_ATTACH_AUXGROUPS) {
+		ret = kdbus_meta_append_auxgroups(meta, d->cred);
+		if (ret < 0)
+			goto exit_unlock;
+
+		meta->attached |= KDBUS_ATTACH_AUXGROUPS;
+	}
+
+	if (mask & KDBUS_ATTACH_TID_COMM) {
+		ret = kdbus_meta_append_str(meta, KDBUS_ITEM_TID_COMM,
+					    d->tid_comm);
+		if (ret < 0)
+			goto exit_unlock;
+
+		meta->attached |= KDBUS_ATTACH_TID_COMM;
+	}
+
+	if (mask & KDBUS_ATTACH_PID_COMM) {
+		ret = kdbus_meta_append_str(meta, KDBUS_ITEM_PID_COMM,
+					    d->pid_comm);
+		if (ret < 0)
+			goto exit_unlock;
+
+		meta->attached |= KDBUS_ATTACH_PID_COMM;
+	}
+
+	/* only pin the address space while reading from it */
+	if (mask & (KDBUS_ATTACH_EXE | KDBUS_ATTACH_CMDLINE) &&
+	    d->mm && mmget_not_zero(d->mm)) {
+		if (mask & KDBUS_ATTACH_EXE) {
+			ret = kdbus_meta_append_exe(meta, d->mm);
+			if (ret == 0)
+				meta->attached |= KDBUS_ATTACH_EXE;
+		}
+
+		if (ret == 0 && mask & KDBUS_ATTACH_CMDLINE) {
+			ret = kdbus_meta_append_cmdline(meta, d->mm);
+			if (ret == 0)
+				meta->attached |= KDBUS_ATTACH_CMDLINE;
+		}
+
+		mmput(d->mm);
+		if (ret < 0)
+			goto exit_unlock;
+	}
+
+	if (mask & KDBUS_ATTACH_CAPS) {
+		ret = kdbus_meta_append_caps(meta, d->cred);
+		if (ret < 0)
+			goto exit_unlock;
+
+		meta->attached |= KDBUS_ATTACH_CAPS;
+	}
+
+#ifdef CONFIG_SECURITY
+	if (mask & KDBUS_ATTACH_SECLABEL) {
+		ret = kdbus_meta_append_seclabel(meta, d->secid);
+		if (ret < 0)
+			goto exit_unlock;
+
+		meta->attached |= KDBUS_ATTACH_SECLABEL;
+	}
+#endif
+
+	/* everything is serialized, the references are no longer needed */
+	d->which = 0;
+	kdbus_meta_deferred_put(d);
+
+exit_unlock:
+	mutex_unlock(&d->lock);
+
+	return ret;
+}
+
+/**
+ * struct kdbus_meta_snapshot - metadata of a process, shared by its threads
+ * @kref:		Reference count, one is held by the cache
+ * @meta:		Items collected from the process
+ * @collected:		KDBUS_ATTACH_* flags @meta was collected for
+ * @leader:		Thread group leader of the process, only compared
+ * @start_time:		Start time of @leader, to detect a recycled
+ *			task_struct
+ * @cred:		Credentials the items were collected with
+ * @exec_id:		Exec generation of the process
+ * @comm:		The "comm" of @leader
+ * @epoch:		Epoch of the snapshot
+ *
+ * A snapshot is never modified once it was published in a cache; to add
+ * more items, a copy is taken.
+ */
+struct kdbus_meta_snapshot {
+	struct kref kref;
+	struct kdbus_meta *meta;
+	u64 collected;
+	const struct task_struct *leader;
+	u64 start_time;
+	const struct cred *cred;
+	u64 exec_id;
+	char comm[TASK_COMM_LEN];
+	u64 epoch;
+};
+
+static void __kdbus_meta_snapshot_free(struct kref *kref)
+{
+	struct kdbus_meta_snapshot *snap =
+		container_of(kref, struct kdbus_meta_snapshot, kref);
+
+	put_cred(snap->cred);
+	kdbus_meta_free(snap->meta);
+	kfree(snap);
+}
+
+static void kdbus_meta_snapshot_put(struct kdbus_meta_snapshot *snap)
+{
+	if (snap)
+		kref_put(&snap->kref, __kdbus_meta_snapshot_free);
+}
+
+/*
+ * Whether @snap describes the process of the current task. Credentials are
+ * never modified in place, so the same pointer means the same IDs, groups,
+ * capabilities and security label; the snapshot holds a reference to them,
+ * so the pointer cannot be recycled. exec_id changes with every execve(),
+ * which replaces the executable and command line; all threads of a process
+ * share it.
+ */
+static bool kdbus_meta_snapshot_current(const struct kdbus_meta_snapshot *snap,
+					const char *comm)
+{
+	return snap->leader == current->group_leader &&
+	       snap->start_time == current->group_leader->start_time &&
+	       snap->cred == current_cred() &&
+	       snap->exec_id == current->self_exec_id &&
+	       memcmp(snap->comm, comm, TASK_COMM_LEN) == 0;
+}
+
+/*
+ * Collect a snapshot of the current process with the items of @which. If
+ * @orig still describes the current process, its items are taken over and
+ * it keeps its epoch; otherwise the epoch is assigned when the snapshot is
+ * published. Called without the cache lock.
+ */
+static struct kdbus_meta_snapshot *
+kdbus_meta_snapshot_new(const struct kdbus_meta_snapshot *orig,
+			const char *comm, u64 which)
+{
+	struct kdbus_meta_snapshot *snap;
+	int ret;
+
+	snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+	if (!snap)
+		return ERR_PTR(-ENOMEM);
+
+	if (orig) {
+		snap->meta = kdbus_meta_dup(orig->meta);
+		snap->collected = orig->collected;
+		snap->epoch = orig->epoch;
+	} else {
+		snap->meta = kdbus_meta_new();
+	}
+
+	if (IS_ERR(snap->meta)) {
+		ret = PTR_ERR(snap->meta);
+		kfree(snap);
+		return ERR_PTR(ret);
+	}
+
+	kref_init(&snap->kref);
+	snap->leader = current->group_leader;
+	snap->start_time = current->group_leader->start_time;
+	snap->cred = get_current_cred();
+	snap->exec_id = current->self_exec_id;
+	memcpy(snap->comm, comm, TASK_COMM_LEN);
+
+	ret = kdbus_meta_append(snap->meta, NULL, 0, which);
+	if (ret < 0) {
+		kdbus_meta_snapshot_put(snap);
+		return ERR_PTR(ret);
+	}
+
+	/* flags which cannot be collected are not tried again */
+	snap->collected |= which;
+
+	return snap;
+}
+
+/**
+ * kdbus_meta_cache_new() - create a new, empty metadata cache
+ *
+ * Return: a new kdbus_meta_cache object on success, ERR_PTR on failure.
+ */
+struct kdbus_meta_cache *kdbus_meta_cache_new(void)
+{
+	struct kdbus_meta_cache *cache;
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache)
+		return ERR_PTR(-ENOMEM);
+
+	spin_lock_init(&cache->lock);
+
+	return cache;
+}
+
+/**
+ * kdbus_meta_cache_free() - release a metadata cache
+ * @cache:		Metadata cache, may be NULL
+ */
+void kdbus_meta_cache_free(struct kdbus_meta_cache *cache)
+{
+	if (!cache)
+		return;
+
+	kdbus_meta_snapshot_put(cache->snap);
+	kfree(cache);
+}
+
+/*
+ * Get a snapshot of the current process which carries the items of @which,
+ * taking a new one, and publishing it in @cache, if needed.
+ */
+static struct kdbus_meta_snapshot *
+kdbus_meta_cache_get(struct kdbus_meta_cache *cache, u64 which)
+{
+	struct kdbus_meta_snapshot *snap, *old;
+	char comm[TASK_COMM_LEN];
+
+	get_task_comm(comm, current->group_leader);
+
+	spin_lock(&cache->lock);
+	snap = cache->snap;
+	if (snap && kdbus_meta_snapshot_current(snap, comm))
+		kref_get(&snap->kref);
+	else
+		snap = NULL;
+	spin_unlock(&cache->lock);
+
+	if (snap && !(which & ~snap->collected))
+		return snap;
+
+	/* the expensive part, without the lock */
+	old = snap;
+	snap = kdbus_meta_snapshot_new(old, comm, which);
+	kdbus_meta_snapshot_put(old);
+	if (IS_ERR(snap))
+		return snap;
+
+	/* a concurrent sender might have published one as well, replace it */
+	spin_lock(&cache->lock);
+	if (snap->epoch == 0)
+		snap->epoch = ++cache->epoch;
+	old = cache->snap;
+	kref_get(&snap->kref);
+	cache->snap = snap;
+	spin_unlock(&cache->lock);
+
+	kdbus_meta_snapshot_put(old);
+
+	return snap;
+}
+
+/**
+ * kdbus_meta_item_attach_flag() - attach flag a metadata item belongs to
+ * @type:		KDBUS_ITEM_* type of the item
+ *
+ * Return: the KDBUS_ATTACH_* flag which requests items of @type, or 0 if
+ * @type is not a metadata item
+ */
+u64 kdbus_meta_item_attach_flag(u64 type)
+{
+	switch (type) {
+	case KDBUS_ITEM_TIMESTAMP:
+		return KDBUS_ATTACH_TIMESTAMP;
+	case KDBUS_ITEM_NAME:
+		return KDBUS_ATTACH_NAMES;
+	case KDBUS_ITEM_AUDIT:
+		return KDBUS_ATTACH_AUDIT;
+	case KDBUS_ITEM_CONN_DESCRIPTION:
+		return KDBUS_ATTACH_CONN_DESCRIPTION;
+	case KDBUS_ITEM_CREDS:
+		return KDBUS_ATTACH_CREDS;
+	case KDBUS_ITEM_AUXGROUPS:
+		return KDBUS_ATTACH_AUXGROUPS;
+	case KDBUS_ITEM_TID_COMM:
+		return KDBUS_ATTACH_TID_COMM;
+	case KDBUS_ITEM_PID_COMM:
+		return KDBUS_ATTACH_PID_COMM;
+	case KDBUS_ITEM_EXE:
+		return KDBUS_ATTACH_EXE;
+	case KDBUS_ITEM_CMDLINE:
+		return KDBUS_ATTACH_CMDLINE;
+	case KDBUS_ITEM_CGROUP:
+		return KDBUS_ATTACH_CGROUP;
+	case KDBUS_ITEM_CAPS:
+		return KDBUS_ATTACH_CAPS;
+	case KDBUS_ITEM_SECLABEL:
+		return KDBUS_ATTACH_SECLABEL;
+	}
+
+	return 0;
+}
+
+/**
+ * kdbus_meta_append_cached() - collect metadata, using a per-process cache
+ * @meta:		Metadata object
+ * @cache:		Snapshot of the sending process' metadata
+ * @conn:		Current connection to read names from
+ * @seq:		Message sequence number
+ * @which:		KDBUS_ATTACH_* flags which type of data to attach
+ *
+ * Like kdbus_meta_append(), but items which only depend on the process'
+ * credentials, executable and comm name are copied from @cache. A new
+ * snapshot is taken if any of these changed since the cached one was
+ * taken, or if it lacks some of the requested items. Credentials, the comm
+ * of the sending thread, timestamps, names, audit IDs, the cgroup path and
+ * the connection description are always collected freshly.
+ *
+ * Note that the command line is read once per executed binary; later
+ * modifications of the argument area by the task are not noticed.
+ *
+ * Return: 0 on success, negative errno on failure.
+ */
+int kdbus_meta_append_cached(struct kdbus_meta *meta,
+			     struct kdbus_meta_cache *cache,
+			     struct kdbus_conn *conn,
+			     u64 seq, u64 which)
+{
+	struct kdbus_meta_snapshot *snap;
+	const struct kdbus_item *item;
+	struct kdbus_item *copy;
+	size_t size;
+	u64 mask;
+	int ret = 0;
+
+	mask = which & ~meta->attached & KDBUS_META_CACHE_FLAGS;
+	if (mask == 0)
+		return kdbus_meta_append(meta, conn, seq, which);
+
+	snap = kdbus_meta_cache_get(cache, mask);
+	if (IS_ERR(snap))
+		return PTR_ERR(snap);
+
+	/* items from more than one snapshot can not be referred to */
+	if (!(meta->attached & KDBUS_META_CACHE_FLAGS))
+		meta->epoch = snap->epoch;
+	else if (meta->epoch != snap->epoch)
+		meta->epoch = 0;
+
+	KDBUS_ITEMS_FOREACH(item, snap->meta->data, snap->meta->size) {
+		if (!(kdbus_meta_item_attach_flag(item->type) & mask))
+			continue;
+
+		size = item->size - KDBUS_ITEM_HEADER_SIZE;
+		copy = kdbus_meta_append_item(meta, item->type, size);
+		if (IS_ERR(copy)) {
+			ret = PTR_ERR(copy);
+			goto exit_put;
+		}
+
+		memcpy(copy->data, item->data, size);
+	}
+
+	meta->attached |= mask & snap->meta->attached;
+
+exit_put:
+	kdbus_meta_snapshot_put(snap);
+	if (ret < 0)
+		return ret;
+
+	return kdbus_meta_append(meta, conn, seq, which);
+}
+
+/*
+ * Items collected for an attach flag the receiver did not ask for are
+ * skipped. Items which were put into the object without being accounted
+ * in its attached flags, like faked credentials supplied with HELLO, are
+ * always passed on.
+ */
+static bool kdbus_meta_item_wanted(const struct kdbus_meta *meta,
+				   const struct kdbus_item *item, u64 which)
+{
+	u64 flag = kdbus_meta_item_attach_flag(item->type);
+
+	return !(flag & meta->attached) || (flag & which);
+}
+
+/**
+ * kdbus_meta_size() - size of the items a receiver asked for
+ * @meta:		Metadata object
+ * @which:		KDBUS_ATTACH_* flags of the receiver
+ *
+ * Return: the number of bytes kdbus_meta_export() writes for @which
+ */
+size_t kdbus_meta_size(const struct kdbus_meta *meta, u64 which)
+{
+	const struct kdbus_item *item;
+	size_t size = 0;
+
+	/* fast path, the receiver wants everything that was collected */
+	if ((meta->attached & ~which) == 0)
+		return meta->size;
+
+	KDBUS_ITEMS_FOREACH(item, meta->data, meta->size)
+		if (kdbus_meta_item_wanted(meta, item, which))
+			size += KDBUS_ALIGN8(item->size);
+
+	return size;
+}
+
+/**
+ * kdbus_meta_export() - copy the items a receiver asked for into a slice
+ * @meta:		Metadata object
+ * @which:		KDBUS_ATTACH_* flags of the receiver
+ * @slice:		The slice to copy to
+ * @off:		Offset in @slice to write the items at
+ *
+ * Metadata might have been collected for several receivers at once; only
+ * the items matching @which are copied, consecutive runs of them with a
+ * single copy operation.
+ *
+ * Return: 0 on success, negative errno on failure.
+ */
+int kdbus_meta_export(const struct kdbus_meta *meta, u64 which,
+		      struct kdbus_pool_slice *slice, size_t off)
+{
+	const struct kdbus_item *item, *run = NULL;
+	size_t run_size = 0;
+	ssize_t ret;
+
+	if ((meta->attached & ~which) == 0) {
+		ret = kdbus_pool_slice_copy(slice, off, meta->data,
+					    meta->size);
+		return ret < 0 ? ret : 0;
+	}
+
+	KDBUS_ITEMS_FOREACH(item, meta->data, meta->size) {
+		if (kdbus_meta_item_wanted(meta, item, which)) {
+			if (!run)
+				run = item;
+			run_size += KDBUS_ALIGN8(item->size);
+			continue;
+		}
+
+		if (!run)
+			continue;
+
+		ret = kdbus_pool_slice_copy(slice, off, run, run_size);
+		if (ret < 0)
+			return ret;
+
+		off += run_size;
+		run = NULL;
+		run_size = 0;
+	}
+
+	if (run) {
+		ret = kdbus_pool_slice_copy(slice, off, run, run_size);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * kdbus_meta_write() - copy the items a receiver asked for into a buffer
+ * @meta:		Metadata object
+ * @which:		KDBUS_ATTACH_* flags of the receiver
+ * @buf:		Buffer of at least kdbus_meta_size(@meta, @which) bytes
+ *
+ * Return: the number of bytes written to @buf
+ */
+size_t kdbus_meta_write(const struct kdbus_meta *meta, u64 which, void *buf)
+{
+	const struct kdbus_item *item;
+	size_t size = 0;
+
+	if (meta->size == 0)
+		return 0;
+
+	if ((meta->attached & ~which) == 0) {
+		memcpy(buf, meta->data, meta->size);
+		return meta->size;
+	}
+
+	KDBUS_ITEMS_FOREACH(item, meta->data, meta->size) {
+		if (!kdbus_meta_item_wanted(meta, item, which))
+			continue;
+
+		memcpy((u8 *)buf + size, item, KDBUS_ALIGN8(item->size));
+		size += KDBUS_ALIGN8(item->size);
+	}
+
+	return size;
+}
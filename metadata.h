@@ -14,6 +14,9 @@
 #ifndef __KDBUS_METADATA_H
 #define __KDBUS_METADATA_H
 
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+
 /**
  * struct kdbus_meta - metadata buffer
  * @attached:		Flags for already attached data
@@ -21,6 +24,10 @@
  * @data:		Allocated buffer
  * @size:		Number of bytes used
  * @allocated_size:	Size of buffer
+ * @epoch:		Epoch of the sender snapshot the task items were copied
+ *			from, 0 if there is none or they are from several
+ * @deferred:		References to task data captured by kdbus_meta_capture()
+ *			but not yet turned into items, or NULL
  *
  * Used to collect and store connection metadata in a pre-compiled
  * buffer containing struct kdbus_item.
@@ -32,9 +39,51 @@ struct kdbus_meta {
 	struct kdbus_item *data;
 	size_t size;
 	size_t allocated_size;
+	u64 epoch;
+	struct kdbus_meta_deferred *deferred;
+};
+
+/*
+ * Metadata which only depends on the credentials, the executable and the
+ * comm name of the thread group leader of the sending task, and can be
+ * kept in a kdbus_meta_cache shared by all threads of a process.
+ *
+ * The credentials item carries the IDs and start time of the sending
+ * thread, and the PID_COMM item its comm; both are cheap to collect and
+ * are not cached. Neither is the cgroup path: a module cannot pin the
+ * css_set of a task, and comparing its address could match a recycled
+ * object.
+ */
+#define KDBUS_META_CACHE_FLAGS		(KDBUS_ATTACH_AUXGROUPS |	\
+					 KDBUS_ATTACH_TID_COMM |	\
+					 KDBUS_ATTACH_EXE |		\
+					 KDBUS_ATTACH_CMDLINE |		\
+					 KDBUS_ATTACH_CAPS |		\
+					 KDBUS_ATTACH_SECLABEL)
+
+struct kdbus_meta_snapshot;
+
+/**
+ * struct kdbus_meta_cache - snapshot of a sending process' metadata
+ * @lock:		Protects @snap and @epoch
+ * @snap:		The current snapshot, or NULL
+ * @epoch:		Epoch of the last snapshot taken
+ *
+ * Gathering metadata from a task is expensive. The snapshot is reused for
+ * all messages sent by the threads of one process with the same
+ * credentials, as long as the executable and the comm name of the process
+ * did not change. Snapshots are taken without holding @lock, and are never
+ * modified once published; senders only take a reference under @lock.
+ */
+struct kdbus_meta_cache {
+	spinlock_t lock;
+	struct kdbus_meta_snapshot *snap;
+	u64 epoch;
 };
 
 struct kdbus_conn;
+struct kdbus_meta_deferred;
+struct kdbus_pool_slice;
 
 struct kdbus_meta *kdbus_meta_new(void);
 struct kdbus_meta *kdbus_meta_dup(const struct kdbus_meta *orig);
@@ -44,7 +93,20 @@ int kdbus_meta_append(struct kdbus_meta *meta,
 		      struct kdbus_conn *conn,
 		      u64 seq,
 		      u64 which);
+int kdbus_meta_append_cached(struct kdbus_meta *meta,
+			     struct kdbus_meta_cache *cache,
+			     struct kdbus_conn *conn,
+			     u64 seq, u64 which);
+int kdbus_meta_capture(struct kdbus_meta *meta, u64 which);
+int kdbus_meta_collect(struct kdbus_meta *meta);
+size_t kdbus_meta_size(const struct kdbus_meta *meta, u64 which);
+int kdbus_meta_export(const struct kdbus_meta *meta, u64 which,
+		      struct kdbus_pool_slice *slice, size_t off);
+size_t kdbus_meta_write(const struct kdbus_meta *meta, u64 which, void *buf);
+u64 kdbus_meta_item_attach_flag(u64 type);
 void kdbus_meta_free(struct kdbus_meta *meta);
+struct kdbus_meta_cache *kdbus_meta_cache_new(void);
+void kdbus_meta_cache_free(struct kdbus_meta_cache *cache);
 bool kdbus_meta_ns_eq(const struct kdbus_meta *meta_a,
 		      const struct kdbus_meta *meta_b);
 #endif
@@ -0,0 +1,565 @@
+/*
+ * Copyright (C) 2013-2014 Kay Sievers
+ * Copyright (C) 2013-2014 Greg Kroah-Hartman <gregkh@linuxfoundation.org>
+ * Copyright (C) 2013-2014 Daniel Mack <daniel@zonque.org>
+ * Copyright (C) 2013-2014 David Herrmann <dh.herrmann@gmail.com>
+ * Copyright (C) 2013-2014 Linux Foundation
+ *
+ * kdbus is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ */
+
+#include <linux/capability.h>
+#include <linux/kref.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/uaccess.h>
+#include <linux/user_namespace.h>
+#include <linux/workqueue.h>
+
+#include "connection.h"
+#include "item.h"
+#include "limits.h"
+#include "message.h"
+#include "metadata.h"
+#include "monitor.h"
+#include "pool.h"
+#include "queue.h"
+
+/**
+ * struct kdbus_monitor_ring - per-CPU ring of records for a monitor
+ * @lock:		Ring lock
+ * @head:		Index of the oldest record
+ * @count:		Number of records in the ring
+ * @dropped:		Number of records dropped since the monitor's worker
+ *			looked at the ring last
+ * @records:		The records
+ */
+struct kdbus_monitor_ring {
+	spinlock_t lock;
+	unsigned int head;
+	unsigned int count;
+	u64 dropped;
+	struct kdbus_monitor_record *records[KDBUS_MONITOR_RING_SIZE];
+};
+
+/**
+ * struct kdbus_monitor - asynchronous delivery to a monitor connection
+ * @conn:		The monitor connection
+ * @rings:		Per-CPU rings of records waiting for delivery
+ * @work:		Worker moving the records into the monitor's pool
+ * @dropped:		Number of records dropped and not yet reported,
+ *			only accessed by @work
+ */
+struct kdbus_monitor {
+	struct kdbus_conn *conn;
+	struct kdbus_monitor_ring __percpu *rings;
+	struct work_struct work;
+	u64 dropped;
+};
+
+static void __kdbus_monitor_record_free(struct kref *kref)
+{
+	struct kdbus_monitor_record *rec =
+		container_of(kref, struct kdbus_monitor_record, kref);
+
+	kvfree(rec);
+}
+
+/**
+ * kdbus_monitor_record_put() - drop a reference to a record
+ * @rec:		The record, may be NULL
+ */
+void kdbus_monitor_record_put(struct kdbus_monitor_record *rec)
+{
+	if (rec)
+		kref_put(&rec->kref, __kdbus_monitor_record_free);
+}
+
+/**
+ * kdbus_monitor_record_new() - build the monitor record of a message
+ * @kmsg:		The message
+ * @attach_flags:	KDBUS_ATTACH_* flags of the metadata to include
+ * @snaplen:		Maximum number of bytes of PAYLOAD_VEC data to
+ *			include, 0 for all
+ *
+ * Copies the message, its PAYLOAD_VEC data and the requested metadata into
+ * one buffer. Passed file descriptors and memfds are not part of the record;
+ * their items are included, with all fd numbers set to -1.
+ *
+ * Return: a new record on success, ERR_PTR on failure.
+ */
+struct kdbus_monitor_record *
+kdbus_monitor_record_new(const struct kdbus_kmsg *kmsg, u64 attach_flags,
+			 size_t snaplen)
+{
+	struct kdbus_monitor_record *rec;
+	const struct kdbus_item *item;
+	size_t dst_name_len = 0;
+	size_t size, msg_size;
+	size_t vec_data, pos;
+	struct kdbus_item *it;
+	size_t left, n;
+	unsigned int i;
+
+	if (kmsg->msg.src_id == KDBUS_SRC_ID_KERNEL)
+		size = kmsg->msg.size;
+	else
+		size = offsetof(struct kdbus_msg, items);
+	msg_size = size;
+
+	if (kmsg->dst_name) {
+		dst_name_len = strlen(kmsg->dst_name) + 1;
+		msg_size += KDBUS_ITEM_SIZE(dst_name_len);
+	}
+
+	msg_size += KDBUS_ITEM_SIZE(sizeof(struct kdbus_vec)) *
+		    kmsg->vecs_count;
+	msg_size += KDBUS_ITEM_SIZE(sizeof(struct kdbus_memfd)) *
+		    kmsg->memfds_count;
+
+	if (kmsg->fds_count > 0)
+		msg_size += KDBUS_ITEM_SIZE(kmsg->fds_count * sizeof(int));
+
+	if (kmsg->meta && kmsg->meta->size > 0)
+		msg_size += kdbus_meta_size(kmsg->meta, attach_flags);
+
+	/* room for the MONITOR_TRUNCATED and MONITOR_DROPPED items */
+	vec_data = KDBUS_ALIGN8(msg_size) + 2 * KDBUS_ITEM_SIZE(sizeof(u64));
+
+	left = kmsg->vecs_size;
+	if (snaplen > 0)
+		left = min(left, snaplen);
+
+	/* the payload is cut to the snapshot length before it is copied */
+	rec = kvmalloc(sizeof(*rec) + vec_data + left, GFP_KERNEL);
+	if (!rec)
+		return ERR_PTR(-ENOMEM);
+
+	kref_init(&rec->kref);
+	rec->seq = kmsg->seq;
+	rec->meta_attached = kmsg->meta ? kmsg->meta->attached : 0;
+	rec->data_off = vec_data;
+	rec->size = vec_data + left;
+	rec->vecs_size = kmsg->vecs_size;
+	rec->privileged = ns_capable(&init_user_ns, CAP_IPC_OWNER);
+
+	/* do not leak the item padding */
+	memset(rec->data, 0, vec_data);
+
+	memcpy(rec->data, &kmsg->msg, size);
+	((struct kdbus_msg *)rec->data)->size = msg_size;
+	pos = size;
+
+	if (dst_name_len > 0) {
+		it = (struct kdbus_item *)(rec->data + pos);
+		it->size = KDBUS_ITEM_HEADER_SIZE + dst_name_len;
+		it->type = KDBUS_ITEM_DST_NAME;
+		memcpy(it->str, kmsg->dst_name, dst_name_len);
+		pos += KDBUS_ALIGN8(it->size);
+	}
+
+	KDBUS_ITEMS_FOREACH(item, kmsg->msg.items,
+			    KDBUS_ITEMS_SIZE(&kmsg->msg, items)) {
+		switch (item->type) {
+		case KDBUS_ITEM_PAYLOAD_VEC:
+			it = (struct kdbus_item *)(rec->data + pos);
+			it->size = KDBUS_ITEM_HEADER_SIZE +
+				   sizeof(struct kdbus_vec);
+			it->type = KDBUS_ITEM_PAYLOAD_OFF;
+			it->vec.size = item->vec.size;
+			pos += KDBUS_ALIGN8(it->size);
+
+			/* a \0-bytes record keeps the alignment of the data */
+			if (!KDBUS_PTR(item->vec.address)) {
+				n = min_t(size_t, item->vec.size % 8, left);
+				it->vec.offset = ~0ULL;
+				memset(rec->data + vec_data, 0, n);
+				vec_data += n;
+				left -= n;
+				break;
+			}
+
+			n = min_t(size_t, item->vec.size, left);
+			it->vec.offset = vec_data;
+			it->vec.size = n;
+			if (copy_from_user(rec->data + vec_data,
+					   KDBUS_PTR(item->vec.address), n)) {
+				kvfree(rec);
+				return ERR_PTR(-EFAULT);
+			}
+
+			vec_data += n;
+			left -= n;
+			break;
+
+		case KDBUS_ITEM_PAYLOAD_MEMFD:
+			it = (struct kdbus_item *)(rec->data + pos);
+			it->size = KDBUS_ITEM_HEADER_SIZE +
+				   sizeof(struct kdbus_memfd);
+			it->type = KDBUS_ITEM_PAYLOAD_MEMFD;
+			it->memfd.size = item->memfd.size;
+			it->memfd.fd = -1;
+			pos += KDBUS_ALIGN8(it->size);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if (kmsg->fds_count > 0) {
+		it = (struct kdbus_item *)(rec->data + pos);
+		it->size = KDBUS_ITEM_HEADER_SIZE +
+			   kmsg->fds_count * sizeof(int);
+		it->type = KDBUS_ITEM_FDS;
+		for (i = 0; i < kmsg->fds_count; i++)
+			it->fds[i] = -1;
+		pos += KDBUS_ALIGN8(it->size);
+	}
+
+	rec->meta_off = pos;
+	if (kmsg->meta && kmsg->meta->size > 0)
+		kdbus_meta_write(kmsg->meta, attach_flags, rec->data + pos);
+
+	return rec;
+}
+
+/* cut the PAYLOAD_OFF data of @msg down to @snaplen bytes */
+static size_t kdbus_monitor_snap(struct kdbus_msg *msg, size_t snaplen)
+{
+	struct kdbus_item *item;
+	size_t n, kept = 0;
+
+	KDBUS_ITEMS_FOREACH(item, msg->items, KDBUS_ITEMS_SIZE(msg, items)) {
+		if (item->type != KDBUS_ITEM_PAYLOAD_OFF)
+			continue;
+
+		if (item->vec.offset == ~0ULL) {
+			kept += min_t(size_t, item->vec.size % 8,
+				      snaplen - kept);
+			continue;
+		}
+
+		n = min_t(size_t, item->vec.size, snaplen - kept);
+		item->vec.size = n;
+		kept += n;
+	}
+
+	return kept;
+}
+
+/*
+ * Cut the metadata items of @msg which were collected for other monitors
+ * only. Like kdbus_meta_export(), items of types that were not collected,
+ * like faked credentials, are always kept.
+ */
+static void kdbus_monitor_meta_filter(struct kdbus_msg *msg,
+				      const struct kdbus_monitor_record *rec,
+				      u64 which)
+{
+	const struct kdbus_item *item;
+	size_t off, pos, n;
+	u64 flag;
+
+	if ((rec->meta_attached & ~which) == 0)
+		return;
+
+	off = pos = rec->meta_off;
+	while (off < msg->size) {
+		item = (const struct kdbus_item *)((u8 *)msg + off);
+		flag = kdbus_meta_item_attach_flag(item->type);
+		n = KDBUS_ALIGN8(item->size);
+
+		if (!(flag & rec->meta_attached) || (flag & which)) {
+			memmove((u8 *)msg + pos, item, n);
+			pos += n;
+		}
+
+		off += n;
+	}
+
+	/* do not leak the items of other monitors */
+	memset((u8 *)msg + pos, 0, off - pos);
+	msg->size = pos;
+}
+
+/* append a kernel item with a single value, in the room the record left */
+static void kdbus_monitor_item_append(struct kdbus_msg *msg, u64 type,
+				      u64 value)
+{
+	struct kdbus_item *it;
+
+	msg->size = KDBUS_ALIGN8(msg->size);
+	it = (struct kdbus_item *)((u8 *)msg + msg->size);
+	it->size = KDBUS_ITEM_HEADER_SIZE + sizeof(u64);
+	it->type = type;
+	it->data64[0] = value;
+	msg->size += it->size;
+}
+
+/* queue a record in the pool of the monitor */
+static int kdbus_monitor_deliver(struct kdbus_monitor *m,
+				 struct kdbus_monitor_record *rec)
+{
+	size_t data_size = rec->size - rec->data_off;
+	struct kdbus_conn *conn = m->conn;
+	struct kdbus_queue_entry *entry;
+	u64 snaplen = conn->monitor_filter.snaplen;
+	struct kdbus_msg *msg;
+	size_t have, want;
+	int ret;
+
+	/* the record is shared; the header is adjusted per monitor */
+	msg = kmemdup(rec->data, rec->data_off, GFP_KERNEL);
+	if (!msg)
+		return -ENOMEM;
+
+	kdbus_monitor_meta_filter(msg, rec, atomic64_read(&conn->attach_flags));
+
+	if (snaplen > 0 && data_size > snaplen)
+		data_size = kdbus_monitor_snap(msg, snaplen);
+
+	if (data_size < rec->vecs_size)
+		kdbus_monitor_item_append(msg, KDBUS_ITEM_MONITOR_TRUNCATED,
+					  rec->vecs_size);
+
+	/* let the monitor know how many records it lost before this one */
+	if (m->dropped > 0)
+		kdbus_monitor_item_append(msg, KDBUS_ITEM_MONITOR_DROPPED,
+					  m->dropped);
+
+	ret = kdbus_conn_acquire(conn);
+	if (ret < 0)
+		goto exit_free_msg;
+
+	entry = kzalloc(sizeof(*entry), GFP_KERNEL);
+	if (!entry) {
+		ret = -ENOMEM;
+		goto exit_release;
+	}
+
+	entry->user = -1;
+	entry->src_id = msg->src_id;
+	entry->cookie = msg->cookie;
+	entry->priority = msg->priority;
+
+	/* do not give out more than half of the remaining space */
+	want = rec->data_off + data_size;
+	have = kdbus_pool_remain(conn->pool);
+	if (want < have && want > have / 2) {
+		ret = -EXFULL;
+		goto exit_free;
+	}
+
+	entry->slice = kdbus_pool_slice_alloc(conn->pool, want);
+	if (IS_ERR(entry->slice)) {
+		ret = PTR_ERR(entry->slice);
+		goto exit_free;
+	}
+
+	ret = kdbus_pool_slice_copy(entry->slice, 0, msg, rec->data_off);
+	if (ret < 0)
+		goto exit_pool_free;
+
+	if (data_size > 0) {
+		ret = kdbus_pool_slice_copy(entry->slice, rec->data_off,
+					    rec->data + rec->data_off,
+					    data_size);
+		if (ret < 0)
+			goto exit_pool_free;
+	}
+
+	/* frees the entry on failure */
+	ret = kdbus_conn_queue_entry(conn, entry, rec->privileged);
+	kdbus_conn_release(conn);
+	kfree(msg);
+	return ret;
+
+exit_pool_free:
+	kdbus_pool_slice_free(entry->slice);
+exit_free:
+	kdbus_queue_entry_free(entry);
+exit_release:
+	kdbus_conn_release(conn);
+exit_free_msg:
+	kfree(msg);
+	return ret;
+}
+
+/*
+ * Take the oldest record of all rings, and collect the drop counters of
+ * the rings on the way. This only merges what is queued right now: a
+ * sender on another CPU may still append a record with a lower sequence
+ * number after a later one was taken, so the order is best-effort.
+ */
+static struct kdbus_monitor_record *kdbus_monitor_pop(struct kdbus_monitor *m)
+{
+	struct kdbus_monitor_ring *ring, *next = NULL;
+	struct kdbus_monitor_record *rec;
+	u64 seq = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		ring = per_cpu_ptr(m->rings, cpu);
+
+		spin_lock(&ring->lock);
+		m->dropped += ring->dropped;
+		ring->dropped = 0;
+
+		if (ring->count > 0 &&
+		    (!next || ring->records[ring->head]->seq < seq)) {
+			next = ring;
+			seq = ring->records[ring->head]->seq;
+		}
+		spin_unlock(&ring->lock);
+	}
+
+	if (!next)
+		return NULL;
+
+	/* only the worker removes records, the head is still the same */
+	spin_lock(&next->lock);
+	rec = next->records[next->head];
+	next->head = (next->head + 1) % KDBUS_MONITOR_RING_SIZE;
+	next->count--;
+	spin_unlock(&next->lock);
+
+	return rec;
+}
+
+static void kdbus_monitor_work(struct work_struct *work)
+{
+	struct kdbus_monitor *m = container_of(work, struct kdbus_monitor,
+					       work);
+	struct kdbus_monitor_record *rec;
+
+	while ((rec = kdbus_monitor_pop(m))) {
+		if (kdbus_monitor_deliver(m, rec) < 0)
+			m->dropped++;
+		else
+			m->dropped = 0;
+
+		kdbus_monitor_record_put(rec);
+	}
+}
+
+/**
+ * kdbus_monitor_new() - set up asynchronous delivery to a monitor
+ * @conn:		The monitor connection
+ *
+ * Return: a new kdbus_monitor on success, ERR_PTR on failure.
+ */
+struct kdbus_monitor *kdbus_monitor_new(struct kdbus_conn *conn)
+{
+	struct kdbus_monitor_ring *ring;
+	struct kdbus_monitor *m;
+	int cpu;
+
+	m = kzalloc(sizeof(*m), GFP_KERNEL);
+	if (!m)
+		return ERR_PTR(-ENOMEM);
+
+	m->rings = alloc_percpu(struct kdbus_monitor_ring);
+	if (!m->rings) {
+		kfree(m);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	for_each_possible_cpu(cpu) {
+		ring = per_cpu_ptr(m->rings, cpu);
+		spin_lock_init(&ring->lock);
+		ring->head = 0;
+		ring->count = 0;
+		ring->dropped = 0;
+	}
+
+	m->conn = conn;
+	INIT_WORK(&m->work, kdbus_monitor_work);
+
+	return m;
+}
+
+/**
+ * kdbus_monitor_free() - stop delivery and free all queued records
+ * @m:			The monitor, may be NULL
+ *
+ * The monitor connection must not be linked to the bus anymore.
+ */
+void kdbus_monitor_free(struct kdbus_monitor *m)
+{
+	struct kdbus_monitor_ring *ring;
+	int cpu;
+
+	if (!m)
+		return;
+
+	cancel_work_sync(&m->work);
+
+	for_each_possible_cpu(cpu) {
+		ring = per_cpu_ptr(m->rings, cpu);
+
+		while (ring->count > 0) {
+			kdbus_monitor_record_put(ring->records[ring->head]);
+			ring->head = (ring->head + 1) %
+				     KDBUS_MONITOR_RING_SIZE;
+			ring->count--;
+		}
+	}
+
+	free_percpu(m->rings);
+	kfree(m);
+}
+
+/**
+ * kdbus_monitor_push() - queue a record for a monitor
+ * @m:			The monitor
+ * @rec:		The record to queue
+ *
+ * Appends @rec to the ring of the local CPU and kicks the monitor's worker.
+ * If the ring is full, the record is dropped and counted; the monitor is
+ * told about it with the next record it receives.
+ */
+void kdbus_monitor_push(struct kdbus_monitor *m,
+			struct kdbus_monitor_record *rec)
+{
+	struct kdbus_monitor_ring *ring;
+	unsigned int tail;
+
+	ring = get_cpu_ptr(m->rings);
+	spin_lock(&ring->lock);
+
+	if (ring->count < KDBUS_MONITOR_RING_SIZE) {
+		tail = (ring->head + ring->count) % KDBUS_MONITOR_RING_SIZE;
+		kref_get(&rec->kref);
+		ring->records[tail] = rec;
+		ring->count++;
+	} else {
+		ring->dropped++;
+	}
+
+	spin_unlock(&ring->lock);
+	put_cpu_ptr(m->rings);
+
+	schedule_work(&m->work);
+}
+
+/**
+ * kdbus_monitor_drop() - count a record that could not be built
+ * @m:			The monitor
+ */
+void kdbus_monitor_drop(struct kdbus_monitor *m)
+{
+	struct kdbus_monitor_ring *ring;
+
+	ring = get_cpu_ptr(m->rings);
+	spin_lock(&ring->lock);
+	ring->dropped++;
+	spin_unlock(&ring->lock);
+	put_cpu_ptr(m->rings);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2013-2014 Kay Sievers
+ * Copyright (C) 2013-2014 Greg Kroah-Hartman <gregkh@linuxfoundation.org>
+ * Copyright (C) 2013-2014 Daniel Mack <daniel@zonque.org>
+ * Copyright (C) 2013-2014 David Herrmann <dh.herrmann@gmail.com>
+ * Copyright (C) 2013-2014 Linux Foundation
+ *
+ * kdbus is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ */
+
+#ifndef __KDBUS_MONITOR_H
+#define __KDBUS_MONITOR_H
+
+#include <linux/kref.h>
+
+struct kdbus_conn;
+struct kdbus_kmsg;
+struct kdbus_monitor;
+
+/**
+ * struct kdbus_monitor_record - a message as an asynchronous monitor sees it
+ * @kref:		Reference count, one per ring holding the record
+ * @seq:		Domain-global sequence number of the message
+ * @meta_off:		Offset of the metadata items in @data
+ * @meta_attached:	KDBUS_ATTACH_* flags the metadata was collected for
+ * @data_off:		Offset of the PAYLOAD_VEC data in @data
+ * @size:		Size of @data
+ * @vecs_size:		Size of the PAYLOAD_VEC data of the message, before
+ *			it was cut to the snapshot length
+ * @privileged:		The sender had CAP_IPC_OWNER, which lifts the queue
+ *			limit of the monitors
+ * @data:		The message, laid out like it is copied into a pool,
+ *			followed by the PAYLOAD_VEC data
+ *
+ * A record is built once per message, in the context of the sender, and
+ * shared by all asynchronous monitors of the bus. It carries the metadata
+ * any of them asked for; the items a monitor did not ask for are cut when
+ * the record is delivered to it. Between the message items and the payload
+ * data, room for a KDBUS_ITEM_MONITOR_TRUNCATED and a
+ * KDBUS_ITEM_MONITOR_DROPPED item is kept.
+ */
+struct kdbus_monitor_record {
+	struct kref kref;
+	u64 seq;
+	size_t meta_off;
+	u64 meta_attached;
+	size_t data_off;
+	size_t size;
+	size_t vecs_size;
+	bool privileged;
+	u8 data[0];
+};
+
+struct kdbus_monitor_record *
+kdbus_monitor_record_new(const struct kdbus_kmsg *kmsg, u64 attach_flags,
+			 size_t snaplen);
+void kdbus_monitor_record_put(struct kdbus_monitor_record *rec);
+
+struct kdbus_monitor *kdbus_monitor_new(struct kdbus_conn *conn);
+void kdbus_monitor_free(struct kdbus_monitor *m);
+void kdbus_monitor_push(struct kdbus_monitor *m,
+			struct kdbus_monitor_record *rec);
+void kdbus_monitor_drop(struct kdbus_monitor *m);
+#endif
@@ -18,37 +18,25 @@
 #include <linux/hash.h>
 #include <linux/idr.h>
 #include <linux/init.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/rwsem.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h>
 
 #include "bus.h"
 #include "connection.h"
 #include "endpoint.h"
 #include "item.h"
+#include "limits.h"
+#include "match.h"
 #include "names.h"
 #include "notify.h"
 #include "policy.h"
 
-/**
- * struct kdbus_name_queue_item - a queue item for a name
- * @conn:		The associated connection
- * @entry:		Name entry queuing up for
- * @entry_entry:	List element for the list in @entry
- * @conn_entry:		List element for the list in @conn
- * @flags:		The queuing flags
- */
-struct kdbus_name_queue_item {
-	struct kdbus_conn *conn;
-	struct kdbus_name_entry *entry;
-	struct list_head entry_entry;
-	struct list_head conn_entry;
-	u64 flags;
-};
-
 static void kdbus_name_entry_free(struct kdbus_name_entry *e)
 {
 	hash_del(&e->hentry);
@@ -71,6 +59,7 @@ void kdbus_name_registry_free(struct kdbus_name_registry *reg)
 	hash_for_each_safe(reg->entries_hash, i, tmp, e, hentry)
 		kdbus_name_entry_free(e);
 
+	vfree(reg->table);
 	kfree(reg);
 }
 
@@ -87,12 +76,184 @@ struct kdbus_name_registry *kdbus_name_registry_new(void)
 	if (!r)
 		return ERR_PTR(-ENOMEM);
 
+	r->table_size = PAGE_ALIGN(sizeof(struct kdbus_name_table) +
+				   KDBUS_NAME_TABLE_SLOTS *
+				   sizeof(struct kdbus_name_table_slot));
+	r->table = vmalloc_user(r->table_size);
+	if (!r->table) {
+		kfree(r);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	r->table->n_slots = KDBUS_NAME_TABLE_SLOTS;
+	r->table->slot_size = sizeof(struct kdbus_name_table_slot);
+
 	hash_init(r->entries_hash);
 	init_rwsem(&r->rwlock);
+	atomic64_set(&r->generation, 0);
 
 	return r;
 }
 
+/*
+ * The name table is a copy of the owners of all names that userspace can
+ * map and search without a syscall. It is only modified with the registry
+ * locked for writing, and every modification is wrapped in an update of
+ * the sequence counter, so readers can detect and retry torn reads. The
+ * hash function is part of the ABI: 32-bit FNV-1a over the name.
+ */
+static u32 kdbus_name_table_hash(const char *name)
+{
+	u32 hash = 2166136261U;
+
+	while (*name) {
+		hash ^= (u8)*name++;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static void kdbus_name_table_write_begin(struct kdbus_name_table *t)
+{
+	t->seq++;
+	smp_wmb();
+}
+
+static void kdbus_name_table_write_end(struct kdbus_name_table *t)
+{
+	smp_wmb();
+	t->seq++;
+}
+
+/* the slot holding @name, or the empty slot it would be stored at */
+static struct kdbus_name_table_slot *
+kdbus_name_table_find(struct kdbus_name_table *t, const char *name)
+{
+	u64 mask = t->n_slots - 1;
+	u64 i, pos = kdbus_name_table_hash(name) & mask;
+
+	for (i = 0; i < t->n_slots; i++, pos = (pos + 1) & mask) {
+		struct kdbus_name_table_slot *s = &t->slots[pos];
+
+		if (s->owner_id == 0 || strcmp(s->name, name) == 0)
+			return s;
+	}
+
+	return NULL;
+}
+
+static void kdbus_name_table_add(struct kdbus_name_registry *reg,
+				 struct kdbus_name_entry *e)
+{
+	struct kdbus_name_table *t = reg->table;
+	struct kdbus_name_table_slot *s;
+
+	s = kdbus_name_table_find(t, e->name);
+	if (WARN_ON(!s || s->owner_id != 0))
+		return;
+
+	kdbus_name_table_write_begin(t);
+
+	if (reg->table_count < KDBUS_NAME_TABLE_MAX_NAMES) {
+		strlcpy(s->name, e->name, sizeof(s->name));
+		s->flags = e->flags;
+		s->owner_id = e->conn->id;
+		e->in_table = true;
+		reg->table_count++;
+	} else {
+		reg->table_missing++;
+		t->flags |= KDBUS_NAME_TABLE_INCOMPLETE;
+	}
+
+	kdbus_name_table_write_end(t);
+}
+
+static void kdbus_name_table_update(struct kdbus_name_registry *reg,
+				    struct kdbus_name_entry *e)
+{
+	struct kdbus_name_table *t = reg->table;
+	struct kdbus_name_table_slot *s;
+
+	if (!e->in_table)
+		return;
+
+	s = kdbus_name_table_find(t, e->name);
+	if (WARN_ON(!s || s->owner_id == 0))
+		return;
+
+	kdbus_name_table_write_begin(t);
+	s->flags = e->flags;
+	s->owner_id = e->conn->id;
+	kdbus_name_table_write_end(t);
+}
+
+static void kdbus_name_table_remove(struct kdbus_name_registry *reg,
+				    struct kdbus_name_entry *e)
+{
+	struct kdbus_name_table *t = reg->table;
+	u64 mask = t->n_slots - 1;
+	u64 i, j, home;
+
+	if (!e->in_table) {
+		kdbus_name_table_write_begin(t);
+		if (--reg->table_missing == 0)
+			t->flags &= ~KDBUS_NAME_TABLE_INCOMPLETE;
+		kdbus_name_table_write_end(t);
+		return;
+	}
+
+	i = kdbus_name_table_find(t, e->name) - t->slots;
+	if (WARN_ON(t->slots[i].owner_id == 0))
+		return;
+
+	kdbus_name_table_write_begin(t);
+
+	/*
+	 * Backward shift deletion: move entries following the removed one
+	 * into the hole, unless that would move them before the slot they
+	 * hash to. This keeps all probe sequences free of holes without
+	 * the need for tombstones.
+	 */
+	for (j = (i + 1) & mask; t->slots[j].owner_id != 0;
+	     j = (j + 1) & mask) {
+		home = kdbus_name_table_hash(t->slots[j].name) & mask;
+
+		if (((j - home) & mask) < ((j - i) & mask))
+			continue;
+
+		t->slots[i] = t->slots[j];
+		i = j;
+	}
+
+	memset(&t->slots[i], 0, sizeof(t->slots[i]));
+	reg->table_count--;
+	e->in_table = false;
+
+	kdbus_name_table_write_end(t);
+}
+
+/**
+ * kdbus_name_table_mmap() - map the name table of a bus into a process
+ * @reg:		The name registry
+ * @vma:		passed by mmap() syscall
+ *
+ * Return: the result of the mmap() call, negative errno on failure.
+ */
+int kdbus_name_table_mmap(struct kdbus_name_registry *reg,
+			  struct vm_area_struct *vma)
+{
+	/* deny write access to the table */
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	if ((vma->vm_end - vma->vm_start) > reg->table_size)
+		return -EFAULT;
+
+	return remap_vmalloc_range(vma, reg->table, 0);
+}
+
 static struct kdbus_name_entry *
 kdbus_name_lookup(struct kdbus_name_registry *reg, u32 hash, const char *name)
 {
@@ -107,8 +268,15 @@ kdbus_name_lookup(struct kdbus_name_registry *reg, u32 hash, const char *name)
 
 static void kdbus_name_queue_item_free(struct kdbus_name_queue_item *q)
 {
+	if (q->shared)
+		q->entry->shared_count--;
+
 	list_del(&q->entry_entry);
+
+	mutex_lock(&q->conn->lock);
 	list_del(&q->conn_entry);
+	mutex_unlock(&q->conn->lock);
+
 	kfree(q);
 }
 
@@ -121,6 +289,7 @@ static void kdbus_name_entry_remove_owner(struct kdbus_name_entry *e)
 	BUG_ON(!e->conn);
 	BUG_ON(!mutex_is_locked(&e->conn->lock));
 
+	kdbus_conn_info_invalidate(e->conn);
 	atomic_dec(&e->conn->name_count);
 	list_del(&e->conn_entry);
 	e->conn = kdbus_conn_unref(e->conn);
@@ -132,6 +301,7 @@ static void kdbus_name_entry_set_owner(struct kdbus_name_entry *e,
 	BUG_ON(e->conn);
 	BUG_ON(!mutex_is_locked(&conn->lock));
 
+	kdbus_conn_info_invalidate(conn);
 	e->conn = kdbus_conn_ref(conn);
 	list_add_tail(&e->conn_entry, &e->conn->names_list);
 	atomic_inc(&conn->name_count);
@@ -170,6 +340,7 @@ static int kdbus_name_replace_owner(struct kdbus_name_entry *e,
 	kdbus_name_entry_remove_owner(e);
 	kdbus_name_entry_set_owner(e, conn);
 	e->flags = flags;
+	kdbus_name_table_update(conn->bus->name_registry, e);
 
 exit_unlock:
 	mutex_unlock(&conn_old->lock);
@@ -184,6 +355,23 @@ static int kdbus_name_entry_release(struct kdbus_name_entry *e,
 {
 	struct kdbus_conn *conn;
 
+	/* keep the name within the group of connections sharing it */
+	while (!list_empty(&e->shared_list)) {
+		struct kdbus_name_queue_item *q;
+		int ret;
+
+		q = list_first_entry(&e->shared_list,
+				     struct kdbus_name_queue_item,
+				     entry_entry);
+
+		ret = kdbus_name_replace_owner(e, q->conn, q->flags);
+		kdbus_name_queue_item_free(q);
+		if (ret < 0)
+			continue;
+
+		return 0;
+	}
+
 	/* give it to first active waiter in the queue */
 	while (!list_empty(&e->queue_list)) {
 		struct kdbus_name_queue_item *q;
@@ -232,6 +420,7 @@ exit_release:
 	mutex_unlock(&conn->lock);
 	kdbus_conn_unref(conn);
 
+	kdbus_name_table_remove(bus->name_registry, e);
 	kdbus_conn_unref(e->activator);
 	kdbus_name_entry_free(e);
 
@@ -281,6 +470,18 @@ static int kdbus_name_release(struct kdbus_name_registry *reg,
 			ret = 0;
 			break;
 		}
+
+		/* or for a membership in a shared name */
+		list_for_each_entry_safe(q, q_tmp,
+					 &e->shared_list,
+					 entry_entry) {
+			if (q->conn != conn)
+				continue;
+
+			kdbus_name_queue_item_free(q);
+			ret = 0;
+			break;
+		}
 	}
 
 	/*
@@ -288,8 +489,10 @@ static int kdbus_name_release(struct kdbus_name_registry *reg,
 	 * entries, so upon the next message, TALK access will be checked
 	 * against the names the connection actually owns.
 	 */
-	if (ret == 0)
+	if (ret == 0) {
 		kdbus_conn_purge_policy_cache(conn);
+		atomic64_inc(&reg->generation);
+	}
 
 exit_unlock:
 	up_write(&reg->rwlock);
@@ -319,6 +522,7 @@ void kdbus_name_remove_by_conn(struct kdbus_name_registry *reg,
 	down_write(&reg->rwlock);
 
 	mutex_lock(&conn->lock);
+	kdbus_conn_info_invalidate(conn);
 	list_splice_init(&conn->names_list, &names_list);
 	list_splice_init(&conn->names_queue_list, &names_queue_list);
 	mutex_unlock(&conn->lock);
@@ -332,6 +536,7 @@ void kdbus_name_remove_by_conn(struct kdbus_name_registry *reg,
 	list_for_each_entry_safe(e, e_tmp, &names_list, conn_entry)
 		kdbus_name_entry_release(e, conn->bus);
 
+	atomic64_inc(&reg->generation);
 	up_write(&reg->rwlock);
 	mutex_unlock(&conn->bus->lock);
 
@@ -396,6 +601,36 @@ struct kdbus_name_entry *kdbus_name_unlock(struct kdbus_name_registry *reg,
 	return NULL;
 }
 
+/**
+ * kdbus_name_get_owners() - look up the owners of several names at once
+ * @reg:		The name registry
+ * @names:		Names to look up, NULL entries are skipped
+ * @owners:		Array to store a reference to the owner of each name
+ *			found in, at the same index
+ * @count:		Number of entries in @names and @owners
+ *
+ * The registry lock is only taken once for all names. Entries of @owners
+ * for names which are skipped or not found are left untouched.
+ */
+void kdbus_name_get_owners(struct kdbus_name_registry *reg,
+			   const char **names, struct kdbus_conn **owners,
+			   unsigned int count)
+{
+	struct kdbus_name_entry *e;
+	unsigned int i;
+
+	down_read(&reg->rwlock);
+	for (i = 0; i < count; i++) {
+		if (!names[i])
+			continue;
+
+		e = kdbus_name_lookup(reg, kdbus_str_hash(names[i]), names[i]);
+		if (e && e->conn)
+			owners[i] = kdbus_conn_ref(e->conn);
+	}
+	up_read(&reg->rwlock);
+}
+
 static int kdbus_name_queue_conn(struct kdbus_conn *conn, u64 flags,
 				 struct kdbus_name_entry *e)
 {
@@ -410,11 +645,113 @@ static int kdbus_name_queue_conn(struct kdbus_conn *conn, u64 flags,
 	q->entry = e;
 
 	list_add_tail(&q->entry_entry, &e->queue_list);
+
+	mutex_lock(&conn->lock);
 	list_add_tail(&q->conn_entry, &conn->names_queue_list);
+	mutex_unlock(&conn->lock);
+
+	return 0;
+}
+
+static int kdbus_name_share_conn(struct kdbus_conn *conn, u64 flags,
+				 struct kdbus_name_entry *e)
+{
+	struct kdbus_name_queue_item *q;
+
+	list_for_each_entry(q, &e->shared_list, entry_entry)
+		if (q->conn == conn)
+			return -EALREADY;
+
+	q = kzalloc(sizeof(*q), GFP_KERNEL);
+	if (!q)
+		return -ENOMEM;
+
+	q->conn = conn;
+	q->flags = flags;
+	q->entry = e;
+	q->shared = true;
+
+	mutex_lock(&conn->lock);
+	if (!kdbus_conn_active(conn)) {
+		mutex_unlock(&conn->lock);
+		kfree(q);
+		return -ECONNRESET;
+	}
+	list_add_tail(&q->conn_entry, &conn->names_queue_list);
+	mutex_unlock(&conn->lock);
+
+	list_add_tail(&q->entry_entry, &e->shared_list);
+	e->shared_count++;
 
 	return 0;
 }
 
+/**
+ * kdbus_name_pick_owner() - select the connection to deliver a message to
+ * @e:			Name entry, locked with kdbus_name_lock()
+ * @id:			Connection ID requested by the sender, or
+ *			KDBUS_DST_ID_NAME
+ *
+ * A name acquired with KDBUS_NAME_SHARED can be owned by a group of
+ * connections. Messages addressed to such a name are delivered to the
+ * owner with the fewest queued messages; owners with the same load take
+ * turns. If the sender asked for a specific connection ID, the owner
+ * with that ID is returned.
+ *
+ * Return: The selected connection, or NULL if @id does not own the name.
+ */
+struct kdbus_conn *kdbus_name_pick_owner(struct kdbus_name_entry *e, u64 id)
+{
+	struct kdbus_name_queue_item *q;
+	unsigned int n, start, i, best_pos;
+	struct kdbus_conn *best;
+	size_t best_load;
+
+	if (id != KDBUS_DST_ID_NAME) {
+		if (e->conn->id == id)
+			return e->conn;
+
+		list_for_each_entry(q, &e->shared_list, entry_entry)
+			if (q->conn->id == id)
+				return q->conn;
+
+		return NULL;
+	}
+
+	if (e->shared_count == 0)
+		return e->conn;
+
+	/*
+	 * Rank the owners by load first and by their distance to a rotating
+	 * start position second, so idle groups are served round-robin.
+	 */
+	n = e->shared_count + 1;
+	start = (unsigned int)atomic_inc_return(&e->shared_next) % n;
+
+	best = e->conn;
+	best_load = kdbus_conn_msg_load(best);
+	best_pos = (n - start) % n;
+
+	i = 1;
+	list_for_each_entry(q, &e->shared_list, entry_entry) {
+		unsigned int pos = (i++ + n - start) % n;
+		size_t load;
+
+		if (!kdbus_conn_active(q->conn))
+			continue;
+
+		load = kdbus_conn_msg_load(q->conn);
+		if (load < best_load ||
+		    (load == best_load && pos < best_pos)) {
+			best = q->conn;
+			best_load = load;
+			best_pos = pos;
+		}
+	}
+
+	return best;
+}
+
 /**
  * kdbus_name_is_valid() - check if a name is valid
  * @p:			The name to check
@@ -534,9 +871,20 @@ int kdbus_name_acquire(struct kdbus_name_registry *reg,
 			goto exit_unlock;
 		}
 
-		/* take over the name if both parties agree */
+		/* join the group of connections sharing the name */
+		if ((*flags & KDBUS_NAME_SHARED) &&
+		    (e->flags & KDBUS_NAME_SHARED)) {
+			ret = kdbus_name_share_conn(conn, *flags, e);
+			goto exit_unlock;
+		}
+
+		/*
+		 * Take over the name if both parties agree; a name that is
+		 * shared by several connections cannot be replaced.
+		 */
 		if ((*flags & KDBUS_NAME_REPLACE_EXISTING) &&
-		    (e->flags & KDBUS_NAME_ALLOW_REPLACEMENT)) {
+		    (e->flags & KDBUS_NAME_ALLOW_REPLACEMENT) &&
+		    e->shared_count == 0) {
 			/*
 			 * Move name back to the queue, in case we take it away
 			 * from a connection which asked for queuing.
@@ -595,6 +943,7 @@ int kdbus_name_acquire(struct kdbus_name_registry *reg,
 
 	e->flags = *flags;
 	INIT_LIST_HEAD(&e->queue_list);
+	INIT_LIST_HEAD(&e->shared_list);
 	e->name_id = ++reg->name_seq_last;
 
 	mutex_lock(&conn->lock);
@@ -606,6 +955,7 @@ int kdbus_name_acquire(struct kdbus_name_registry *reg,
 	}
 	hash_add(reg->entries_hash, &e->hentry, hash);
 	kdbus_name_entry_set_owner(e, conn);
+	kdbus_name_table_add(reg, e);
 	mutex_unlock(&conn->lock);
 
 	kdbus_notify_name_change(e->conn->bus, KDBUS_ITEM_NAME_ADD,
@@ -613,6 +963,9 @@ int kdbus_name_acquire(struct kdbus_name_registry *reg,
 				 0, e->flags, e->name);
 
 exit_unlock:
+	if (ret == 0)
+		atomic64_inc(&reg->generation);
+
 	up_write(&reg->rwlock);
 	mutex_unlock(&conn->bus->lock);
 	kdbus_notify_flush(conn->bus);
@@ -766,67 +1119,45 @@ static int kdbus_name_list_write(struct kdbus_conn *conn,
 	return 0;
 }
 
-static int kdbus_name_list_all(struct kdbus_conn *conn, u64 flags,
-			       struct kdbus_pool_slice *slice,
-			       size_t *pos, bool write)
+static int kdbus_name_list_conn(struct kdbus_conn *conn,
+				struct kdbus_conn *c, u64 flags,
+				struct kdbus_pool_slice *slice,
+				size_t *pos, bool write)
 {
-	struct kdbus_conn *c;
 	size_t p = *pos;
-	int ret, i;
-
-	hash_for_each(conn->bus->conn_hash, i, c, hentry) {
-		bool added = false;
+	bool added = false;
+	int ret;
 
-		/* skip activators */
-		if (!(flags & KDBUS_NAME_LIST_ACTIVATORS) &&
-		    kdbus_conn_is_activator(c))
-			continue;
+	/* skip activators */
+	if (!(flags & KDBUS_NAME_LIST_ACTIVATORS) &&
+	    kdbus_conn_is_activator(c))
+		return 0;
 
-		/* all names the connection owns */
-		if (flags & (KDBUS_NAME_LIST_NAMES |
-			     KDBUS_NAME_LIST_ACTIVATORS)) {
-			struct kdbus_name_entry *e;
-
-			mutex_lock(&c->lock);
-			list_for_each_entry(e, &c->names_list, conn_entry) {
-				struct kdbus_conn *a = e->activator;
-
-				if ((flags & KDBUS_NAME_LIST_ACTIVATORS) &&
-				    a && a != c) {
-					ret = kdbus_name_list_write(conn, a,
-							slice, &p, e, write);
-					if (ret < 0) {
-						mutex_unlock(&c->lock);
-						return ret;
-					}
-
-					added = true;
-				}
+	/* all names the connection owns */
+	if (flags & (KDBUS_NAME_LIST_NAMES |
+		     KDBUS_NAME_LIST_ACTIVATORS)) {
+		struct kdbus_name_entry *e;
 
-				if (flags & KDBUS_NAME_LIST_NAMES ||
-				    kdbus_conn_is_activator(c)) {
-					ret = kdbus_name_list_write(conn, c,
-							slice, &p, e, write);
-					if (ret < 0) {
-						mutex_unlock(&c->lock);
-						return ret;
-					}
+		mutex_lock(&c->lock);
+		list_for_each_entry(e, &c->names_list, conn_entry) {
+			struct kdbus_conn *a = e->activator;
 
-					added = true;
+			if ((flags & KDBUS_NAME_LIST_ACTIVATORS) &&
+			    a && a != c) {
+				ret = kdbus_name_list_write(conn, a,
+						slice, &p, e, write);
+				if (ret < 0) {
+					mutex_unlock(&c->lock);
+					return ret;
 				}
-			}
-			mutex_unlock(&c->lock);
-		}
 
-		/* queue of names the connection is currently waiting for */
-		if (flags & KDBUS_NAME_LIST_QUEUED) {
-			struct kdbus_name_queue_item *q;
+				added = true;
+			}
 
-			mutex_lock(&c->lock);
-			list_for_each_entry(q, &c->names_queue_list,
-					    conn_entry) {
+			if (flags & KDBUS_NAME_LIST_NAMES ||
+			    kdbus_conn_is_activator(c)) {
 				ret = kdbus_name_list_write(conn, c,
-						slice, &p, q->entry, write);
+						slice, &p, e, write);
 				if (ret < 0) {
 					mutex_unlock(&c->lock);
 					return ret;
@@ -834,52 +1165,163 @@ static int kdbus_name_list_all(struct kdbus_conn *conn, u64 flags,
 
 				added = true;
 			}
-			mutex_unlock(&c->lock);
 		}
+		mutex_unlock(&c->lock);
+	}
+
+	/* shared names the connection owns together with others */
+	if (flags & KDBUS_NAME_LIST_NAMES) {
+		struct kdbus_name_queue_item *q;
+
+		mutex_lock(&c->lock);
+		list_for_each_entry(q, &c->names_queue_list,
+				    conn_entry) {
+			if (!q->shared)
+				continue;
 
-		/* nothing added so far, just add the unique ID */
-		if (!added && flags & KDBUS_NAME_LIST_UNIQUE) {
 			ret = kdbus_name_list_write(conn, c,
-					slice, &p, NULL, write);
-			if (ret < 0)
+					slice, &p, q->entry, write);
+			if (ret < 0) {
+				mutex_unlock(&c->lock);
 				return ret;
+			}
+
+			added = true;
 		}
+		mutex_unlock(&c->lock);
+	}
+
+	/* queue of names the connection is currently waiting for */
+	if (flags & KDBUS_NAME_LIST_QUEUED) {
+		struct kdbus_name_queue_item *q;
+
+		mutex_lock(&c->lock);
+		list_for_each_entry(q, &c->names_queue_list,
+				    conn_entry) {
+			if (q->shared)
+				continue;
+
+			ret = kdbus_name_list_write(conn, c,
+					slice, &p, q->entry, write);
+			if (ret < 0) {
+				mutex_unlock(&c->lock);
+				return ret;
+			}
+
+			added = true;
+		}
+		mutex_unlock(&c->lock);
+	}
+
+	/* nothing added so far, just add the unique ID */
+	if (!added && flags & KDBUS_NAME_LIST_UNIQUE) {
+		ret = kdbus_name_list_write(conn, c,
+				slice, &p, NULL, write);
+		if (ret < 0)
+			return ret;
 	}
 
 	*pos = p;
 	return 0;
 }
 
+/*
+ * Find the connection a paginated listing resumes after. If the connection
+ * the cursor points to is gone, its closest predecessor is used instead.
+ * The caller must hold the bus' conn_rwlock. Returns NULL if the listing
+ * starts at the head of the list.
+ */
+static struct kdbus_conn *kdbus_name_list_resume(struct kdbus_bus *bus,
+						 u64 cursor)
+{
+	struct kdbus_conn *c, *prev = NULL;
+
+	if (cursor == 0)
+		return NULL;
+
+	hash_for_each_possible(bus->conn_hash, c, hentry, cursor)
+		if (c->id == cursor)
+			return c;
+
+	list_for_each_entry(c, &bus->conn_list, bus_entry) {
+		if (c->id > cursor)
+			break;
+
+		prev = c;
+	}
+
+	return prev;
+}
+
 /**
  * kdbus_cmd_name_list() - list names of a connection
  * @reg:		The name registry
  * @conn:		The connection holding the name entries
  * @cmd:		The command as passed in by the ioctl
  *
+ * Connections are walked in the order of their IDs. With
+ * KDBUS_NAME_LIST_CURSOR, the walk starts after the connection ID stored
+ * in the cursor, and stops as soon as the records written exceed the chunk
+ * size; the ID of the last connection listed is returned as new cursor, or
+ * 0 if the end of the list was reached. Each chunk only holds the locks for
+ * the connections it covers.
+ *
+ * With KDBUS_NAME_LIST_SUBSCRIBE, the connection is subscribed to all name
+ * change notifications while the registry is locked, so every change that
+ * is not part of the returned list is delivered to it, tagged with a
+ * generation newer than the one returned.
+ *
  * Return: 0 on success, negative errno on failure.
  */
 int kdbus_cmd_name_list(struct kdbus_name_registry *reg,
 			struct kdbus_conn *conn,
-			struct kdbus_cmd_name_list *cmd)
+			struct kdbus_cmd_name_list_chunk *cmd)
 {
+	struct kdbus_conn *prev, *last = NULL, *c;
 	struct kdbus_policy_db *policy_db;
 	struct kdbus_name_list list = {};
 	struct kdbus_pool_slice *slice;
-	size_t pos;
+	struct kdbus_bus *bus = conn->bus;
+	size_t pos, chunk = SIZE_MAX;
 	int ret;
 
+	/* a snapshot cannot be taken in chunks */
+	if ((cmd->list.flags & KDBUS_NAME_LIST_SUBSCRIBE) &&
+	    (cmd->list.flags & KDBUS_NAME_LIST_CURSOR))
+		return -EINVAL;
+
+	if (cmd->list.flags & KDBUS_NAME_LIST_CURSOR) {
+		chunk = KDBUS_NAME_LIST_MAX_CHUNK;
+		if (cmd->chunk_size > 0 && cmd->chunk_size < chunk)
+			chunk = cmd->chunk_size;
+	}
+
 	policy_db = &conn->ep->policy_db;
 
 	/* lock order: domain -> bus -> ep -> names -> conn */
 	down_read(&reg->rwlock);
-	down_read(&conn->bus->conn_rwlock);
+	down_read(&bus->conn_rwlock);
 	down_read(&policy_db->entries_rwlock);
 
-	/* size of header + records */
+	prev = NULL;
+	if (cmd->list.flags & KDBUS_NAME_LIST_CURSOR)
+		prev = kdbus_name_list_resume(bus, cmd->cursor);
+
+	/* size of header + records, and the last connection to list */
 	pos = sizeof(struct kdbus_name_list);
-	ret = kdbus_name_list_all(conn, cmd->flags, NULL, &pos, false);
-	if (ret < 0)
-		goto exit_unlock;
+	c = list_prepare_entry(prev, &bus->conn_list, bus_entry);
+	list_for_each_entry_continue(c, &bus->conn_list, bus_entry) {
+		ret = kdbus_name_list_conn(conn, c, cmd->list.flags,
+					   NULL, &pos, false);
+		if (ret < 0)
+			goto exit_unlock;
+
+		if (pos >= chunk &&
+		    !list_is_last(&c->bus_entry, &bus->conn_list)) {
+			last = c;
+			break;
+		}
+	}
 
 	slice = kdbus_pool_slice_alloc(conn->pool, pos);
 	if (IS_ERR(slice)) {
@@ -894,12 +1336,22 @@ int kdbus_cmd_name_list(struct kdbus_name_registry *reg,
 		goto exit_pool_free;
 
 	/* copy the records */
+	ret = 0;
 	pos = sizeof(struct kdbus_name_list);
-	ret = kdbus_name_list_all(conn, cmd->flags, slice, &pos, true);
-	if (ret < 0)
-		goto exit_pool_free;
+	c = list_prepare_entry(prev, &bus->conn_list, bus_entry);
+	list_for_each_entry_continue(c, &bus->conn_list, bus_entry) {
+		ret = kdbus_name_list_conn(conn, c, cmd->list.flags,
+					   slice, &pos, true);
+		if (ret < 0)
+			goto exit_pool_free;
 
-	cmd->offset = kdbus_pool_slice_offset(slice);
+		if (c == last)
+			break;
+	}
+
+	cmd->list.offset = kdbus_pool_slice_offset(slice);
+	cmd->cursor = last ? last->id : 0;
+	cmd->generation = atomic64_read(&reg->generation);
 	kdbus_pool_slice_flush(slice);
 	kdbus_pool_slice_make_public(slice);
 
@@ -908,7 +1360,19 @@ exit_pool_free:
 		kdbus_pool_slice_free(slice);
 exit_unlock:
 	up_read(&policy_db->entries_rwlock);
-	up_read(&conn->bus->conn_rwlock);
+	up_read(&bus->conn_rwlock);
+
+	/*
+	 * Changes are queued with the registry locked for writing, so
+	 * everything queued from now on is delivered to the subscriber.
+	 * The match index is locked after the policy, which notification
+	 * delivery takes while holding the index.
+	 */
+	if (ret == 0 && (cmd->list.flags & KDBUS_NAME_LIST_SUBSCRIBE)) {
+		conn->name_subscribed = true;
+		kdbus_match_db_subscribe_names(conn->match_db);
+	}
+
 	up_read(&reg->rwlock);
 	return ret;
 }
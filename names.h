@@ -14,6 +14,7 @@
 #ifndef __KDBUS_NAMES_H
 #define __KDBUS_NAMES_H
 
+#include <linux/atomic.h>
 #include <linux/hashtable.h>
 #include <linux/rwsem.h>
 
@@ -22,11 +23,23 @@
  * @entries_hash:	Map of entries
  * @lock:		Registry data lock
  * @name_seq_last:	Last used sequence number to assign to a name entry
+ * @generation:		Bumped on every change of names or connections,
+ *			to let paginated KDBUS_CMD_NAME_LIST callers
+ *			detect changes between chunks
+ * @table:		Name table connections can map read-only
+ * @table_size:		Allocated size of @table
+ * @table_count:	Number of names in @table
+ * @table_missing:	Number of names that did not fit into @table
  */
 struct kdbus_name_registry {
 	DECLARE_HASHTABLE(entries_hash, 8);
 	struct rw_semaphore rwlock;
 	u64 name_seq_last;
+	atomic64_t generation;
+	struct kdbus_name_table *table;
+	size_t table_size;
+	unsigned int table_count;
+	unsigned int table_missing;
 };
 
 /**
@@ -36,20 +49,47 @@ struct kdbus_name_registry {
  *			identify a name over its registration lifetime
  * @flags:		KDBUS_NAME_* flags
  * @queue_list:		List of queued waiters for the well-known name
+ * @shared_list:	List of connections sharing the name with @conn
+ * @shared_count:	Number of entries in @shared_list
+ * @shared_next:	Round-robin position to start the owner selection at
  * @conn_entry:		Entry in connection
  * @hentry:		Entry in registry map
  * @conn:		Connection owning the name
  * @activator:		Connection of the activator queuing incoming messages
+ * @in_table:		The name has a slot in the registry's name table
  */
 struct kdbus_name_entry {
 	char *name;
 	u64 name_id;
 	u64 flags;
 	struct list_head queue_list;
+	struct list_head shared_list;
+	unsigned int shared_count;
+	atomic_t shared_next;
 	struct list_head conn_entry;
 	struct hlist_node hentry;
 	struct kdbus_conn *conn;
 	struct kdbus_conn *activator;
+	bool in_table;
+};
+
+/**
+ * struct kdbus_name_queue_item - a queue item for a name
+ * @conn:		The associated connection
+ * @entry:		Name entry queuing up for
+ * @entry_entry:	List element for the list in @entry
+ * @conn_entry:		List element for the list in @conn
+ * @flags:		The queuing flags
+ * @shared:		The item is a co-owner of a KDBUS_NAME_SHARED name,
+ *			linked into the entry's shared_list
+ */
+struct kdbus_name_queue_item {
+	struct kdbus_conn *conn;
+	struct kdbus_name_entry *entry;
+	struct list_head entry_entry;
+	struct list_head conn_entry;
+	u64 flags;
+	bool shared;
 };
 
 struct kdbus_name_registry *kdbus_name_registry_new(void);
@@ -66,15 +106,22 @@ int kdbus_cmd_name_release(struct kdbus_name_registry *reg,
 			   const struct kdbus_cmd_name *cmd);
 int kdbus_cmd_name_list(struct kdbus_name_registry *reg,
 			struct kdbus_conn *conn,
-			struct kdbus_cmd_name_list *cmd);
+			struct kdbus_cmd_name_list_chunk *cmd);
 
 struct kdbus_name_entry *kdbus_name_lock(struct kdbus_name_registry *reg,
 					 const char *name);
 struct kdbus_name_entry *kdbus_name_unlock(struct kdbus_name_registry *reg,
 					   struct kdbus_name_entry *entry);
 
+struct kdbus_conn *kdbus_name_pick_owner(struct kdbus_name_entry *e, u64 id);
+void kdbus_name_get_owners(struct kdbus_name_registry *reg,
+			   const char **names, struct kdbus_conn **owners,
+			   unsigned int count);
+
 void kdbus_name_remove_by_conn(struct kdbus_name_registry *reg,
 			       struct kdbus_conn *conn);
 
 bool kdbus_name_is_valid(const char *p, bool allow_wildcard);
+int kdbus_name_table_mmap(struct kdbus_name_registry *reg,
+			  struct vm_area_struct *vma);
 #endif
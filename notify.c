@@ -14,18 +14,85 @@
 #include <linux/device.h>
 #include <linux/fs.h>
 #include <linux/init.h>
+#include <linux/list_sort.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
 #include <linux/spinlock.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/wait.h>
 
 #include "bus.h"
 #include "connection.h"
 #include "endpoint.h"
 #include "item.h"
+#include "limits.h"
 #include "message.h"
+#include "names.h"
 #include "notify.h"
+#include "trace.h"
+
+/**
+ * struct kdbus_notify_cpu - per-CPU list of pending notifications
+ * @lock:		List lock
+ * @list:		Notifications queued on this CPU, in sequence order
+ */
+struct kdbus_notify_cpu {
+	spinlock_t lock;
+	struct list_head list;
+};
+
+/**
+ * kdbus_notify_init() - initialize the notification queues of a bus
+ * @bus:		Bus to initialize
+ *
+ * Return: 0 on success, negative errno on failure.
+ */
+int kdbus_notify_init(struct kdbus_bus *bus)
+{
+	struct kdbus_notify_cpu *n;
+	int cpu;
+
+	bus->notify_cpu = alloc_percpu(struct kdbus_notify_cpu);
+	if (!bus->notify_cpu)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		n = per_cpu_ptr(bus->notify_cpu, cpu);
+		spin_lock_init(&n->lock);
+		INIT_LIST_HEAD(&n->list);
+	}
+
+	atomic64_set(&bus->notify_seq_last, 0);
+	bus->notify_seq_next = 1;
+	atomic_set(&bus->notify_pending, 0);
+	INIT_LIST_HEAD(&bus->notify_backlog);
+	mutex_init(&bus->notify_flush_lock);
+	atomic64_set(&bus->notify_flush_count, 0);
+	init_waitqueue_head(&bus->notify_flush_wait);
+
+	return 0;
+}
+
+/*
+ * Stage a notification on the list of the local CPU. The sequence number
+ * is taken under the list lock, so a flush which collected a message has
+ * all earlier ones either collected too, or can collect them with one
+ * more pass over the CPUs.
+ */
+static void kdbus_notify_queue(struct kdbus_bus *bus, struct kdbus_kmsg *kmsg)
+{
+	struct kdbus_notify_cpu *n;
+
+	n = get_cpu_ptr(bus->notify_cpu);
+	spin_lock(&n->lock);
+	kmsg->notify_seq = atomic64_inc_return(&bus->notify_seq_last);
+	atomic_inc(&bus->notify_pending);
+	list_add_tail(&kmsg->queue_entry, &n->list);
+	spin_unlock(&n->lock);
+	put_cpu_ptr(bus->notify_cpu);
+}
 
 static int kdbus_notify_reply(struct kdbus_bus *bus, u64 id,
 			      u64 cookie, u64 msg_type)
@@ -50,9 +117,7 @@ static int kdbus_notify_reply(struct kdbus_bus *bus, u64 id,
 	kmsg->msg.cookie_reply = cookie;
 	kmsg->msg.items[0].type = msg_type;
 
-	spin_lock(&bus->notify_lock);
-	list_add_tail(&kmsg->queue_entry, &bus->notify_list);
-	spin_unlock(&bus->notify_lock);
+	kdbus_notify_queue(bus, kmsg);
 	return 0;
 }
 
@@ -99,6 +164,11 @@ int kdbus_notify_reply_dead(struct kdbus_bus *bus, u64 id, u64 cookie)
  *			the new owner
  * @name:		The name that was removed or assigned to a new owner
  *
+ * The notification carries a KDBUS_ITEM_NAME_GENERATION item with a
+ * fresh registry generation, so subscribers can tell whether a change
+ * is covered by a KDBUS_CMD_NAME_LIST snapshot they took. The caller
+ * must hold the registry lock for writing.
+ *
  * Return: 0 on success, negative errno on failure.
  */
 int kdbus_notify_name_change(struct kdbus_bus *bus, u64 type,
@@ -108,10 +178,11 @@ int kdbus_notify_name_change(struct kdbus_bus *bus, u64 type,
 {
 	struct kdbus_kmsg *kmsg = NULL;
 	size_t name_len, extra_size;
+	struct kdbus_item *item;
 
 	name_len = strlen(name) + 1;
 	extra_size = sizeof(struct kdbus_notify_name_change) + name_len;
-	kmsg = kdbus_kmsg_new(extra_size);
+	kmsg = kdbus_kmsg_new(extra_size + KDBUS_ITEM_SIZE(sizeof(u64)));
 	if (IS_ERR(kmsg))
 		return PTR_ERR(kmsg);
 
@@ -129,9 +200,15 @@ int kdbus_notify_name_change(struct kdbus_bus *bus, u64 type,
 	memcpy(kmsg->msg.items[0].name_change.name, name, name_len);
 	kmsg->notify_name = kmsg->msg.items[0].name_change.name;
 
-	spin_lock(&bus->notify_lock);
-	list_add_tail(&kmsg->queue_entry, &bus->notify_list);
-	spin_unlock(&bus->notify_lock);
+	/* the generation follows the name change item */
+	kmsg->msg.items[0].size = KDBUS_ITEM_SIZE(extra_size);
+	item = KDBUS_ITEM_NEXT(kmsg->msg.items);
+	item->size = KDBUS_ITEM_HEADER_SIZE + sizeof(u64);
+	item->type = KDBUS_ITEM_NAME_GENERATION;
+	item->name_generation =
+		atomic64_inc_return(&bus->name_registry->generation);
+
+	kdbus_notify_queue(bus, kmsg);
 	return 0;
 }
 
@@ -175,23 +252,98 @@ int kdbus_notify_id_change(struct kdbus_bus *bus, u64 type, u64 id, u64 flags)
 	kmsg->msg.items[0].id_change.id = id;
 	kmsg->msg.items[0].id_change.flags = flags;
 
-	spin_lock(&bus->notify_lock);
-	list_add_tail(&kmsg->queue_entry, &bus->notify_list);
-	spin_unlock(&bus->notify_lock);
+	kdbus_notify_queue(bus, kmsg);
 	return 0;
 }
 
-/**
- * kdbus_notify_flush() - send a list of collected messages
- * @bus:		Bus which queues the messages
- *
- * The list is empty after sending the messages.
+static bool kdbus_notify_is_name_change(const struct kdbus_kmsg *kmsg)
+{
+	switch (kmsg->notify_type) {
+	case KDBUS_ITEM_NAME_ADD:
+	case KDBUS_ITEM_NAME_REMOVE:
+	case KDBUS_ITEM_NAME_CHANGE:
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Move the next messages to send from @list to @batch: either a single
+ * message, or a run of up to KDBUS_NOTIFY_BATCH_MAX name changes that were
+ * queued in a row, like the ones of a connection releasing all its names.
  */
-void kdbus_notify_flush(struct kdbus_bus *bus)
+static unsigned int kdbus_notify_next_batch(struct list_head *list,
+					    struct list_head *batch)
+{
+	struct kdbus_kmsg *kmsg, *tmp;
+	unsigned int count = 0;
+
+	list_for_each_entry_safe(kmsg, tmp, list, queue_entry) {
+		if (count > 0 && (count == KDBUS_NOTIFY_BATCH_MAX ||
+				  !kdbus_notify_is_name_change(kmsg)))
+			break;
+
+		list_move_tail(&kmsg->queue_entry, batch);
+		count++;
+
+		if (!kdbus_notify_is_name_change(kmsg))
+			break;
+	}
+
+	return count;
+}
+
+static int kdbus_notify_seq_cmp(void *priv, struct list_head *a,
+				struct list_head *b)
+{
+	struct kdbus_kmsg *ka = list_entry(a, struct kdbus_kmsg, queue_entry);
+	struct kdbus_kmsg *kb = list_entry(b, struct kdbus_kmsg, queue_entry);
+
+	if (ka->notify_seq < kb->notify_seq)
+		return -1;
+	if (ka->notify_seq > kb->notify_seq)
+		return 1;
+	return 0;
+}
+
+/*
+ * Collect the messages of all CPUs into the backlog, and move the ones
+ * which are next in sequence to @list. Messages stay in the backlog while
+ * an earlier one is still about to be added to the list of its CPU.
+ */
+static void kdbus_notify_collect(struct kdbus_bus *bus,
+				 struct list_head *list)
+{
+	struct kdbus_notify_cpu *n;
+	struct kdbus_kmsg *kmsg, *tmp;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		n = per_cpu_ptr(bus->notify_cpu, cpu);
+
+		spin_lock(&n->lock);
+		list_splice_tail_init(&n->list, &bus->notify_backlog);
+		spin_unlock(&n->lock);
+	}
+
+	list_sort(NULL, &bus->notify_backlog, kdbus_notify_seq_cmp);
+
+	list_for_each_entry_safe(kmsg, tmp, &bus->notify_backlog,
+				 queue_entry) {
+		if (kmsg->notify_seq != bus->notify_seq_next)
+			break;
+
+		list_move_tail(&kmsg->queue_entry, list);
+		bus->notify_seq_next++;
+	}
+}
+
+static void kdbus_notify_flush_locked(struct kdbus_bus *bus)
 {
-	LIST_HEAD(notify_list);
 	struct kdbus_kmsg *kmsg, *tmp;
 	struct kdbus_ep *ep = NULL;
+	unsigned int sent = 0;
 
 	/* bus->ep is only valid as long as the bus is alive */
 	mutex_lock(&bus->lock);
@@ -199,34 +351,107 @@ void kdbus_notify_flush(struct kdbus_bus *bus)
 		ep = kdbus_ep_ref(bus->ep);
 	mutex_unlock(&bus->lock);
 
-	mutex_lock(&bus->notify_flush_lock);
+	do {
+		LIST_HEAD(notify_list);
 
-	spin_lock(&bus->notify_lock);
-	list_splice_init(&bus->notify_list, &notify_list);
-	spin_unlock(&bus->notify_lock);
+		kdbus_notify_collect(bus, &notify_list);
 
-	list_for_each_entry_safe(kmsg, tmp, &notify_list, queue_entry) {
-		if (ep)
-			kdbus_conn_kmsg_send(ep, NULL, kmsg);
-		list_del(&kmsg->queue_entry);
-		kdbus_kmsg_free(kmsg);
-	}
+		while (!list_empty(&notify_list)) {
+			LIST_HEAD(batch);
+			unsigned int count;
+
+			count = kdbus_notify_next_batch(&notify_list, &batch);
+			kmsg = list_first_entry(&batch, struct kdbus_kmsg,
+						queue_entry);
+
+			if (ep && count > 1)
+				kdbus_conn_kmsg_send_batch(ep, &batch);
+			else if (ep)
+				kdbus_conn_kmsg_send(ep, NULL, kmsg);
 
-	mutex_unlock(&bus->notify_flush_lock);
+			list_for_each_entry_safe(kmsg, tmp, &batch,
+						 queue_entry) {
+				list_del(&kmsg->queue_entry);
+				kdbus_kmsg_free(kmsg);
+			}
 
+			atomic_sub(count, &bus->notify_pending);
+			sent += count;
+		}
+	} while (!list_empty(&bus->notify_backlog));
+
+	trace_kdbus_notify_flush(bus->id, sent);
 	kdbus_ep_unref(ep);
 }
 
 /**
- * kdbus_notify_free() - free a list of collected messages
+ * kdbus_notify_flush() - send the collected messages
+ * @bus:		Bus which queues the messages
+ *
+ * Messages are sent in the order they were queued in, no matter on which
+ * CPU. Name changes queued in a row are sent in a single walk over the bus,
+ * see kdbus_conn_kmsg_send_batch().
+ *
+ * If nothing is pending, this returns without taking any lock. Only one
+ * thread sends at a time; all others wait until a flush which started
+ * after they got here has sent their messages along with its own, instead
+ * of queueing up on the flushing lock one after another.
+ */
+void kdbus_notify_flush(struct kdbus_bus *bus)
+{
+	u64 count;
+
+	if (atomic_read(&bus->notify_pending) == 0)
+		return;
+
+	/*
+	 * A flush already in progress might have collected the messages
+	 * before ours were queued, the one after it has all of them.
+	 */
+	count = atomic64_read(&bus->notify_flush_count) + 2;
+
+	for (;;) {
+		if (mutex_trylock(&bus->notify_flush_lock)) {
+			kdbus_notify_flush_locked(bus);
+			atomic64_inc(&bus->notify_flush_count);
+			mutex_unlock(&bus->notify_flush_lock);
+			wake_up_all(&bus->notify_flush_wait);
+			return;
+		}
+
+		wait_event(bus->notify_flush_wait,
+			   atomic64_read(&bus->notify_flush_count) >= count ||
+			   !mutex_is_locked(&bus->notify_flush_lock));
+
+		if (atomic64_read(&bus->notify_flush_count) >= count)
+			return;
+	}
+}
+
+/**
+ * kdbus_notify_free() - free all collected messages
  * @bus:		Bus which queues the messages
  */
 void kdbus_notify_free(struct kdbus_bus *bus)
 {
+	struct kdbus_notify_cpu *n;
 	struct kdbus_kmsg *kmsg, *tmp;
+	int cpu;
+
+	if (!bus->notify_cpu)
+		return;
 
-	list_for_each_entry_safe(kmsg, tmp, &bus->notify_list, queue_entry) {
+	for_each_possible_cpu(cpu) {
+		n = per_cpu_ptr(bus->notify_cpu, cpu);
+		list_splice_tail_init(&n->list, &bus->notify_backlog);
+	}
+
+	list_for_each_entry_safe(kmsg, tmp, &bus->notify_backlog,
+				 queue_entry) {
 		list_del(&kmsg->queue_entry);
 		kdbus_kmsg_free(kmsg);
 	}
+
+	free_percpu(bus->notify_cpu);
+	bus->notify_cpu = NULL;
 }
@@ -16,6 +16,7 @@
 
 struct kdbus_bus;
 
+int kdbus_notify_init(struct kdbus_bus *bus);
 int kdbus_notify_id_change(struct kdbus_bus *bus, u64 type, u64 id, u64 flags);
 int kdbus_notify_reply_timeout(struct kdbus_bus *bus, u64 id, u64 cookie);
 int kdbus_notify_reply_dead(struct kdbus_bus *bus, u64 id, u64 cookie);
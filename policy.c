@@ -298,6 +298,28 @@ int kdbus_policy_check_talk_access(struct kdbus_policy_db *db,
 			break;
 		}
 	}
+
+	/* names the connection owns together with others */
+	if (ret < 0) {
+		struct kdbus_name_queue_item *q;
+
+		list_for_each_entry(q, &conn_dst->names_queue_list,
+				    conn_entry) {
+			u32 hash = kdbus_str_hash(q->entry->name);
+			const struct kdbus_policy_db_entry *e;
+
+			if (!q->shared)
+				continue;
+
+			e = kdbus_policy_lookup(db, q->entry->name, hash, true);
+			if (kdbus_policy_check_access(e, conn_src->cred,
+						      KDBUS_POLICY_TALK) == 0) {
+				owner = e->owner;
+				ret = 0;
+				break;
+			}
+		}
+	}
 	mutex_unlock(&conn_dst->lock);
 
 	if (ret >= 0) {
@@ -27,6 +27,7 @@
 #include <linux/uaccess.h>
 
 #include "pool.h"
+#include "trace.h"
 #include "util.h"
 
 /**
@@ -248,6 +249,7 @@ struct kdbus_pool_slice *kdbus_pool_slice_alloc(struct kdbus_pool *pool,
 	s->free = false;
 	s->public = false;
 	pool->busy += s->size;
+	trace_kdbus_pool_slice_alloc(pool, s->off, s->size, pool->busy);
 	mutex_unlock(&pool->lock);
 
 	return s;
@@ -265,6 +267,7 @@ static void __kdbus_pool_slice_free(struct kdbus_pool_slice *slice)
 
 	rb_erase(&slice->rb_node, &pool->slices_busy);
 	pool->busy -= slice->size;
+	trace_kdbus_pool_slice_free(pool, slice->off, slice->size, pool->busy);
 
 	/* merge with the next free slice */
 	if (!list_is_last(&slice->entry, &pool->slices)) {
@@ -12,12 +12,14 @@
  */
 
 #include <linux/audit.h>
+#include <linux/bitmap.h>
 #include <linux/device.h>
 #include <linux/file.h>
 #include <linux/fs.h>
 #include <linux/hashtable.h>
 #include <linux/idr.h>
 #include <linux/init.h>
+#include <linux/llist.h>
 #include <linux/math64.h>
 #include <linux/mm.h>
 #include <linux/module.h>
@@ -27,6 +29,7 @@
 #include <linux/sizes.h>
 #include <linux/slab.h>
 #include <linux/syscalls.h>
+#include <linux/wait.h>
 
 #include "connection.h"
 #include "item.h"
@@ -34,8 +37,10 @@
 #include "metadata.h"
 #include "util.h"
 #include "queue.h"
+#include "trace.h"
 
-static int kdbus_queue_entry_fds_install(struct kdbus_queue_entry *entry)
+static int kdbus_queue_entry_fds_install(struct kdbus_conn *conn,
+					 struct kdbus_queue_entry *entry)
 {
 	unsigned int i;
 	int ret, *fds;
@@ -91,6 +96,9 @@ static int kdbus_queue_entry_fds_install(struct kdbus_queue_entry *entry)
 			fd_install(fds[o + i], get_file(entry->memfds_fp[i]));
 	}
 
+	trace_kdbus_fd_install(entry->src_id, conn->id, entry->cookie,
+			       entry->fds_count, entry->memfds_count);
+
 	kfree(fds);
 	return 0;
 
@@ -113,6 +121,7 @@ exit_remove_unused:
 /**
  * kdbus_queue_entry_install() - install message components into the
  *				 receiver's process
+ * @conn:	The receiving connection
  * @entry:	The queue entry to install
  *
  * This function will install file descriptors into 'current'.
@@ -122,13 +131,14 @@ exit_remove_unused:
  *
  * Return: 0 on success.
  */
-int kdbus_queue_entry_install(struct kdbus_queue_entry *entry)
+int kdbus_queue_entry_install(struct kdbus_conn *conn,
+			      struct kdbus_queue_entry *entry)
 {
 	int *memfds = NULL;
 	int *fds = NULL;
 	int ret = 0;
 
-	ret = kdbus_queue_entry_fds_install(entry);
+	ret = kdbus_queue_entry_fds_install(conn, entry);
 	if (ret < 0)
 		return ret;
 
@@ -140,7 +150,8 @@ int kdbus_queue_entry_install(struct kdbus_queue_entry *entry)
 
 static int kdbus_queue_entry_payload_add(struct kdbus_queue_entry *entry,
 					 const struct kdbus_kmsg *kmsg,
-					 size_t items, size_t vec_data)
+					 size_t items, size_t vec_data,
+					 size_t snaplen)
 {
 	const struct kdbus_item *item;
 	int ret;
@@ -164,17 +175,21 @@ static int kdbus_queue_entry_payload_add(struct kdbus_queue_entry *entry,
 			char tmp[KDBUS_ITEM_HEADER_SIZE +
 				 sizeof(struct kdbus_vec)];
 			struct kdbus_item *it = (struct kdbus_item *)tmp;
+			size_t size = item->vec.size;
 
 			/* add item */
 			it->type = KDBUS_ITEM_PAYLOAD_OFF;
 			it->size = sizeof(tmp);
 
 			/* a NULL address specifies a \0-bytes record */
-			if (KDBUS_PTR(item->vec.address))
+			if (KDBUS_PTR(item->vec.address)) {
+				/* monitors may only want the first bytes */
+				size = min(size, snaplen);
 				it->vec.offset = vec_data;
-			else
+			} else {
 				it->vec.offset = ~0ULL;
-			it->vec.size = item->vec.size;
+			}
+			it->vec.size = size;
 			ret = kdbus_pool_slice_copy(entry->slice, items,
 						    it, it->size);
 			if (ret < 0)
@@ -183,7 +198,7 @@ static int kdbus_queue_entry_payload_add(struct kdbus_queue_entry *entry,
 
 			/* \0-bytes record */
 			if (!KDBUS_PTR(item->vec.address)) {
-				size_t l = item->vec.size % 8;
+				size_t l = min(size % 8, snaplen);
 				const char *n = "\0\0\0\0\0\0\0";
 
 				if (l == 0)
@@ -201,16 +216,21 @@ static int kdbus_queue_entry_payload_add(struct kdbus_queue_entry *entry,
 					return ret;
 
 				vec_data += l;
+				snaplen -= l;
 				break;
 			}
 
+			if (size == 0)
+				break;
+
 			/* copy kdbus_vec data from sender to receiver */
 			ret = kdbus_pool_slice_copy_user(entry->slice, vec_data,
-				KDBUS_PTR(item->vec.address), item->vec.size);
+				KDBUS_PTR(item->vec.address), size);
 			if (ret < 0)
 				return ret;
 
-			vec_data += item->vec.size;
+			vec_data += size;
+			snaplen -= size;
 			break;
 		}
 
@@ -251,22 +271,20 @@ static int kdbus_queue_entry_payload_add(struct kdbus_queue_entry *entry,
 	return 0;
 }
 
-/**
- * kdbus_queue_entry_add() - Add an queue entry to a queue
- * @queue:	The queue to attach the item to
- * @entry:	The entry to attach
- *
- * Adds a previously allocated queue item to a queue, and maintains the
- * priority r/b tree.
- */
-/* add queue entry to connection, maintain priority queue */
-void kdbus_queue_entry_add(struct kdbus_queue *queue,
-			   struct kdbus_queue_entry *entry)
+/* whether a priority is handled by the bucket array instead of the tree */
+static bool kdbus_queue_prio_in_buckets(s64 priority)
+{
+	return priority >= KDBUS_QUEUE_PRIO_MIN &&
+	       priority < KDBUS_QUEUE_PRIO_MIN + KDBUS_QUEUE_PRIO_BUCKETS;
+}
+
+/* sort an entry with an outlier priority into the priority tree */
+static void kdbus_queue_prio_tree_add(struct kdbus_queue *queue,
+				      struct kdbus_queue_entry *entry)
 {
 	struct rb_node **n, *pn = NULL;
 	bool highest = true;
 
-	/* sort into priority entry tree */
 	n = &queue->msg_prio_queue.rb_node;
 	while (*n) {
 		struct kdbus_queue_entry *e;
@@ -277,7 +295,7 @@ void kdbus_queue_entry_add(struct kdbus_queue *queue,
 		/* existing node for this priority, add to its list */
 		if (likely(entry->priority == e->priority)) {
 			list_add_tail(&entry->prio_entry, &e->prio_entry);
-			goto prio_done;
+			return;
 		}
 
 		if (entry->priority < e->priority) {
@@ -296,11 +314,247 @@ void kdbus_queue_entry_add(struct kdbus_queue *queue,
 	rb_link_node(&entry->prio_node, pn, n);
 	rb_insert_color(&entry->prio_node, &queue->msg_prio_queue);
 	INIT_LIST_HEAD(&entry->prio_entry);
+}
+
+static void kdbus_queue_prio_tree_remove(struct kdbus_queue *queue,
+					 struct kdbus_queue_entry *entry)
+{
+	if (list_empty(&entry->prio_entry)) {
+		/*
+		 * Single entry for this priority, update cached
+		 * highest-priority entry, remove the tree node.
+		 */
+		if (queue->msg_prio_highest == &entry->prio_node)
+			queue->msg_prio_highest = rb_next(&entry->prio_node);
+
+		rb_erase(&entry->prio_node, &queue->msg_prio_queue);
+	} else {
+		struct kdbus_queue_entry *q;
+
+		/*
+		 * Multiple entries for this priority entry, get next one in
+		 * the list. Update cached highest-priority entry, store the
+		 * new one as the tree node.
+		 */
+		q = list_first_entry(&entry->prio_entry,
+				     struct kdbus_queue_entry, prio_entry);
+		list_del(&entry->prio_entry);
+
+		if (queue->msg_prio_highest == &entry->prio_node)
+			queue->msg_prio_highest = &q->prio_node;
+
+		rb_replace_node(&entry->prio_node, &q->prio_node,
+				&queue->msg_prio_queue);
+	}
+}
+
+/* find the entry with the highest priority, the queue must not be empty */
+static struct kdbus_queue_entry *
+kdbus_queue_prio_highest(struct kdbus_queue *queue)
+{
+	struct kdbus_queue_entry *e = NULL;
+	unsigned long bucket;
+
+	if (queue->msg_prio_highest) {
+		e = rb_entry(queue->msg_prio_highest,
+			     struct kdbus_queue_entry, prio_node);
+
+		/* outliers below the bucket range beat all buckets */
+		if (e->priority < KDBUS_QUEUE_PRIO_MIN)
+			return e;
+	}
+
+	bucket = find_first_bit(queue->msg_prio_map,
+				KDBUS_QUEUE_PRIO_BUCKETS);
+	if (bucket < KDBUS_QUEUE_PRIO_BUCKETS)
+		return list_first_entry(&queue->msg_prio_bucket[bucket],
+					struct kdbus_queue_entry, prio_entry);
+
+	return e;
+}
+
+/* link an entry into the lists of a queue, the caller holds queue->lock */
+static void __kdbus_queue_entry_add(struct kdbus_queue *queue,
+				    struct kdbus_queue_entry *entry)
+{
+	if (likely(kdbus_queue_prio_in_buckets(entry->priority))) {
+		unsigned int bucket = entry->priority - KDBUS_QUEUE_PRIO_MIN;
+
+		list_add_tail(&entry->prio_entry,
+			      &queue->msg_prio_bucket[bucket]);
+		__set_bit(bucket, queue->msg_prio_map);
+	} else {
+		kdbus_queue_prio_tree_add(queue, entry);
+	}
 
-prio_done:
 	/* add to unsorted fifo list */
 	list_add_tail(&entry->entry, &queue->msg_list);
 	queue->msg_count++;
+	entry->queue = queue;
+}
+
+/*
+ * Link the entries a lock-free receiver took off the pending list but did
+ * not receive yet, and then all entries still pending, in FIFO order. The
+ * caller holds queue->lock.
+ */
+static unsigned int __kdbus_queue_drain(struct kdbus_queue *queue)
+{
+	struct kdbus_queue_entry *entry, *tmp;
+	struct llist_node *first;
+	unsigned int count = 0;
+
+	llist_for_each_entry_safe(entry, tmp, queue->msg_ready, pending_node) {
+		__kdbus_queue_entry_add(queue, entry);
+		count++;
+	}
+	queue->msg_ready = NULL;
+
+	if (llist_empty(&queue->msg_pending))
+		return count;
+
+	/* the pending list is newest-first, restore FIFO order */
+	first = llist_reverse_order(llist_del_all(&queue->msg_pending));
+	llist_for_each_entry_safe(entry, tmp, first, pending_node) {
+		__kdbus_queue_entry_add(queue, entry);
+		count++;
+	}
+
+	return count;
+}
+
+/**
+ * kdbus_queue_entry_add() - Add an queue entry to a queue
+ * @queue:	The queue to attach the item to
+ * @entry:	The entry to attach
+ *
+ * Adds a previously allocated queue item to a queue, and maintains the
+ * priority buckets, or the priority r/b tree for priorities outside of the
+ * range covered by the buckets. Entries pushed before are linked first, so
+ * they keep their place in the FIFO order. The caller must hold the
+ * connection lock.
+ *
+ * Return: the number of pushed entries linked on the way
+ */
+unsigned int kdbus_queue_entry_add(struct kdbus_queue *queue,
+				   struct kdbus_queue_entry *entry)
+{
+	unsigned int count;
+
+	spin_lock(&queue->lock);
+	count = __kdbus_queue_drain(queue);
+	__kdbus_queue_entry_add(queue, entry);
+	spin_unlock(&queue->lock);
+
+	return count;
+}
+
+/**
+ * kdbus_queue_entry_push() - Append an entry without the connection lock
+ * @queue:	The queue to append the entry to
+ * @entry:	The entry to append
+ *
+ * Lock-free append for messages which do not need any accounting that is
+ * protected by the connection lock; multiple senders can push concurrently
+ * without blocking each other. Pushed entries are either taken by a
+ * receiver with kdbus_queue_entry_pop(), or linked into the queue's lists
+ * by kdbus_queue_drain(), which must be called by the consumer before it
+ * looks at the lists.
+ *
+ * The caller must hold an active reference to the connection, and must
+ * have made sure the connection's queue limits cannot apply to the entry,
+ * see kdbus_conn_entry_push().
+ */
+void kdbus_queue_entry_push(struct kdbus_queue *queue,
+			    struct kdbus_queue_entry *entry)
+{
+	llist_add(&entry->pending_node, &queue->msg_pending);
+}
+
+/**
+ * kdbus_queue_drain() - Link all pushed entries into the queue
+ * @queue:	The queue to drain
+ *
+ * Moves all entries appended by kdbus_queue_entry_push() and not yet
+ * received into the queue's lists, preserving their order. The caller must
+ * hold the connection lock.
+ *
+ * Return: the number of entries linked
+ */
+unsigned int kdbus_queue_drain(struct kdbus_queue *queue)
+{
+	unsigned int count;
+
+	if (!ACCESS_ONCE(queue->msg_ready) && llist_empty(&queue->msg_pending))
+		return 0;
+
+	spin_lock(&queue->lock);
+	count = __kdbus_queue_drain(queue);
+	spin_unlock(&queue->lock);
+
+	return count;
+}
+
+/**
+ * kdbus_queue_entry_pop() - Take the oldest pushed entry off a queue
+ * @queue:	The queue
+ *
+ * Receive path for FIFO receivers which does not need the connection lock.
+ * As long as no entry is linked into the queue's lists, the pushed entries
+ * are taken off the pending list in one go, and handed out one by one in
+ * FIFO order. Once the lists hold an entry, the caller has to fall back to
+ * kdbus_queue_drain() and kdbus_queue_entry_peek() under the connection
+ * lock, so the order is kept.
+ *
+ * Pushed entries never carry a reply tracker or a user quota, so the
+ * returned entry is owned by the caller and only needs to be freed.
+ *
+ * Return: the entry, or NULL if there is none or the lists must be used
+ */
+struct kdbus_queue_entry *kdbus_queue_entry_pop(struct kdbus_queue *queue)
+{
+	struct kdbus_queue_entry *entry = NULL;
+	struct llist_node *first;
+
+	spin_lock(&queue->lock);
+
+	/*
+	 * Linked entries are older than all pushed ones, and entries are
+	 * only linked after the ones taken off the pending list, so this
+	 * list is never refilled while the lists are in use.
+	 */
+	if (!queue->msg_ready && ACCESS_ONCE(queue->msg_count) == 0 &&
+	    !llist_empty(&queue->msg_pending)) {
+		first = llist_del_all(&queue->msg_pending);
+		queue->msg_ready = llist_reverse_order(first);
+	}
+
+	first = queue->msg_ready;
+	if (first) {
+		queue->msg_ready = first->next;
+		entry = llist_entry(first, struct kdbus_queue_entry,
+				    pending_node);
+	}
+
+	spin_unlock(&queue->lock);
+
+	return entry;
+}
+
+/**
+ * kdbus_queue_empty() - Check whether a queue has any messages
+ * @queue:	The queue to check
+ *
+ * This does not require the connection lock, but the result is only a
+ * snapshot unless the lock is held.
+ *
+ * Return: true if there are neither linked nor pushed entries
+ */
+bool kdbus_queue_empty(struct kdbus_queue *queue)
+{
+	return ACCESS_ONCE(queue->msg_count) == 0 &&
+	       !ACCESS_ONCE(queue->msg_ready) &&
+	       llist_empty(&queue->msg_pending);
 }
 
 /**
@@ -328,8 +582,7 @@ int kdbus_queue_entry_peek(struct kdbus_queue *queue,
 
 	if (use_priority) {
 		/* get next entry with highest priority */
-		e = rb_entry(queue->msg_prio_highest,
-			     struct kdbus_queue_entry, prio_node);
+		e = kdbus_queue_prio_highest(queue);
 
 		/* no entry with the requested priority */
 		if (e->priority > priority)
@@ -350,16 +603,21 @@ int kdbus_queue_entry_peek(struct kdbus_queue *queue,
  * @conn:	The connection containing the queue
  * @entry:	The entry to remove
  *
- * Remove an entry from both the queue's list and the priority r/b tree.
+ * Remove an entry from both the queue's list and its priority bucket or the
+ * priority r/b tree.
  */
 void kdbus_queue_entry_remove(struct kdbus_conn *conn,
 			      struct kdbus_queue_entry *entry)
 {
-	struct kdbus_queue *queue = &conn->queue;
+	struct kdbus_queue *queue = entry->queue;
 
 	list_del(&entry->entry);
 	queue->msg_count--;
 
+	trace_kdbus_queue_entry_remove(entry->src_id, conn->id, entry->cookie,
+				       entry->priority,
+				       kdbus_conn_msg_load(conn));
+
 	/* user quota */
 	if (entry->user >= 0) {
 		BUG_ON(conn->msg_users[entry->user] == 0);
@@ -367,39 +625,21 @@ void kdbus_queue_entry_remove(struct kdbus_conn *conn,
 		entry->user = -1;
 	}
 
-	/* the queue is empty, remove the user quota accounting */
-	if (queue->msg_count == 0 && conn->msg_users_max > 0) {
+	/* all queues are empty, remove the user quota accounting */
+	if (conn->msg_users_max > 0 && kdbus_conn_msg_count(conn) == 0) {
 		kfree(conn->msg_users);
 		conn->msg_users = NULL;
 		conn->msg_users_max = 0;
 	}
 
-	if (list_empty(&entry->prio_entry)) {
-		/*
-		 * Single entry for this priority, update cached
-		 * highest-priority entry, remove the tree node.
-		 */
-		if (queue->msg_prio_highest == &entry->prio_node)
-			queue->msg_prio_highest = rb_next(&entry->prio_node);
+	if (likely(kdbus_queue_prio_in_buckets(entry->priority))) {
+		unsigned int bucket = entry->priority - KDBUS_QUEUE_PRIO_MIN;
 
-		rb_erase(&entry->prio_node, &queue->msg_prio_queue);
-	} else {
-		struct kdbus_queue_entry *q;
-
-		/*
-		 * Multiple entries for this priority entry, get next one in
-		 * the list. Update cached highest-priority entry, store the
-		 * new one as the tree node.
-		 */
-		q = list_first_entry(&entry->prio_entry,
-				     struct kdbus_queue_entry, prio_entry);
 		list_del(&entry->prio_entry);
-
-		if (queue->msg_prio_highest == &entry->prio_node)
-			queue->msg_prio_highest = &q->prio_node;
-
-		rb_replace_node(&entry->prio_node, &q->prio_node,
-				&queue->msg_prio_queue);
+		if (list_empty(&queue->msg_prio_bucket[bucket]))
+			__clear_bit(bucket, queue->msg_prio_map);
+	} else {
+		kdbus_queue_prio_tree_remove(queue, entry);
 	}
 }
 
@@ -412,6 +652,11 @@ void kdbus_queue_entry_remove(struct kdbus_conn *conn,
  * Allocates a queue entry based on a given kmsg and allocate space for
  * the message payload and the requested metadata in the connection's pool.
  * The entry is not actually added to the queue's lists at this point.
+ *
+ * The connection lock does not need to be held; the pool serializes its
+ * own allocations, and the slice stays private until it is received.
+ *
+ * Return: 0 on success, negative errno on failure.
  */
 int kdbus_queue_entry_alloc(struct kdbus_conn *conn,
 			    const struct kdbus_kmsg *kmsg,
@@ -425,6 +670,11 @@ int kdbus_queue_entry_alloc(struct kdbus_conn *conn,
 	size_t payloads = 0;
 	size_t fds = 0;
 	size_t meta_off = 0;
+	size_t meta_size = 0;
+	size_t epoch_off = 0;
+	size_t trunc_off = 0;
+	u64 attach_flags = 0;
+	size_t vecs_size;
 	size_t vec_data;
 	size_t want, have;
 	int ret = 0;
@@ -451,6 +701,7 @@ int kdbus_queue_entry_alloc(struct kdbus_conn *conn,
 		dst_name_len = strlen(kmsg->dst_name) + 1;
 		msg_size += KDBUS_ITEM_SIZE(dst_name_len);
 		entry->dst_name_id = kmsg->dst_name_id;
+		entry->dst_name_hash = kdbus_str_hash(kmsg->dst_name);
 	}
 
 	/* space for PAYLOAD items */
@@ -473,18 +724,58 @@ int kdbus_queue_entry_alloc(struct kdbus_conn *conn,
 		msg_size += KDBUS_ITEM_SIZE(kmsg->fds_count * sizeof(int));
 	}
 
-	/* space for metadata/credential items */
+	/* space for the metadata/credential items the receiver asked for */
 	if (kmsg->meta && kmsg->meta->size > 0 &&
 	    kdbus_meta_ns_eq(kmsg->meta, conn->meta)) {
-		meta_off = msg_size;
-		msg_size += kmsg->meta->size;
+		const struct kdbus_meta *meta = kmsg->meta;
+		u64 snapshot;
+
+		attach_flags = atomic64_read(&conn->attach_flags);
+		snapshot = attach_flags & meta->attached &
+			   KDBUS_META_CACHE_FLAGS;
+
+		/*
+		 * Receivers which opted in get the items of an unchanged
+		 * sender snapshot only until they received them once; after
+		 * that, a META_EPOCH item refers to them.
+		 */
+		if ((conn->flags & KDBUS_HELLO_META_EPOCH) &&
+		    meta->epoch > 0 && snapshot) {
+			if (kdbus_conn_meta_epoch_seen(conn, kmsg->msg.src_id,
+						       meta->epoch, snapshot))
+				attach_flags &= ~KDBUS_META_CACHE_FLAGS;
+			else
+				entry->meta_epoch_flags = snapshot;
+
+			entry->meta_epoch = meta->epoch;
+		}
+
+		meta_size = kdbus_meta_size(meta, attach_flags);
+		if (meta_size > 0) {
+			meta_off = msg_size;
+			msg_size += meta_size;
+		}
+
+		if (entry->meta_epoch > 0) {
+			epoch_off = msg_size;
+			msg_size += KDBUS_ITEM_SIZE(sizeof(u64));
+		}
+	}
+
+	/* monitors with a snapshot length get a cut-off payload */
+	vecs_size = kmsg->vecs_size;
+	if (conn->monitor_filter.snaplen > 0 &&
+	    vecs_size > conn->monitor_filter.snaplen) {
+		vecs_size = conn->monitor_filter.snaplen;
+		trunc_off = msg_size;
+		msg_size += KDBUS_ITEM_SIZE(sizeof(u64));
 	}
 
 	/* data starts after the message */
 	vec_data = KDBUS_ALIGN8(msg_size);
 
 	/* do not give out more than half of the remaining space */
-	want = vec_data + kmsg->vecs_size;
+	want = vec_data + vecs_size;
 	have = kdbus_pool_remain(conn->pool);
 	if (want < have && want > have / 2) {
 		ret = -EXFULL;
@@ -524,8 +815,8 @@ int kdbus_queue_entry_alloc(struct kdbus_conn *conn,
 
 	/* add PAYLOAD items */
 	if (payloads > 0) {
-		ret = kdbus_queue_entry_payload_add(entry, kmsg,
-						    payloads, vec_data);
+		ret = kdbus_queue_entry_payload_add(entry, kmsg, payloads,
+						    vec_data, vecs_size);
 		if (ret < 0)
 			goto exit_pool_free;
 	}
@@ -559,14 +850,49 @@ int kdbus_queue_entry_alloc(struct kdbus_conn *conn,
 
 	/* append message metadata/credential items */
 	if (meta_off > 0) {
-		ret = kdbus_pool_slice_copy(entry->slice, meta_off,
-					    kmsg->meta->data,
-					    kmsg->meta->size);
+		ret = kdbus_meta_export(kmsg->meta, attach_flags,
+					entry->slice, meta_off);
+		if (ret < 0)
+			goto exit_pool_free;
+	}
+
+	/* append the epoch of the sender's metadata snapshot */
+	if (epoch_off > 0) {
+		char tmp[KDBUS_ITEM_HEADER_SIZE + sizeof(u64)];
+
+		it = (struct kdbus_item *)tmp;
+		it->size = KDBUS_ITEM_HEADER_SIZE + sizeof(u64);
+		it->type = KDBUS_ITEM_META_EPOCH;
+		it->meta_epoch = entry->meta_epoch;
+
+		ret = kdbus_pool_slice_copy(entry->slice, epoch_off,
+					    it, it->size);
+		if (ret < 0)
+			goto exit_pool_free;
+	}
+
+	/* tell the monitor how much payload there was before the cut */
+	if (trunc_off > 0) {
+		char tmp[KDBUS_ITEM_HEADER_SIZE + sizeof(u64)];
+
+		it = (struct kdbus_item *)tmp;
+		it->size = KDBUS_ITEM_HEADER_SIZE + sizeof(u64);
+		it->type = KDBUS_ITEM_MONITOR_TRUNCATED;
+		it->monitor_truncated = kmsg->vecs_size;
+
+		ret = kdbus_pool_slice_copy(entry->slice, trunc_off,
+					    it, it->size);
 		if (ret < 0)
 			goto exit_pool_free;
 	}
 
 	entry->priority = kmsg->msg.priority;
+
+	trace_kdbus_queue_entry_alloc(kmsg->msg.src_id, conn->id,
+				      kmsg->msg.cookie,
+				      kdbus_pool_slice_offset(entry->slice),
+				      msg_size, vecs_size, meta_size);
+
 	*e = entry;
 	return 0;
 
@@ -599,6 +925,15 @@ void kdbus_queue_entry_free(struct kdbus_queue_entry *entry)
  */
 void kdbus_queue_init(struct kdbus_queue *queue)
 {
+	unsigned int i;
+
 	INIT_LIST_HEAD(&queue->msg_list);
+	init_waitqueue_head(&queue->wait);
+	for (i = 0; i < KDBUS_QUEUE_PRIO_BUCKETS; i++)
+		INIT_LIST_HEAD(&queue->msg_prio_bucket[i]);
+	bitmap_zero(queue->msg_prio_map, KDBUS_QUEUE_PRIO_BUCKETS);
 	queue->msg_prio_queue = RB_ROOT;
+	spin_lock_init(&queue->lock);
+	init_llist_head(&queue->msg_pending);
+	queue->msg_ready = NULL;
 }
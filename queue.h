@@ -14,18 +14,59 @@
 #ifndef __KDBUS_QUEUE_H
 #define __KDBUS_QUEUE_H
 
+#include <linux/atomic.h>
+#include <linux/bitmap.h>
+#include <linux/llist.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+/*
+ * Message priorities in the range [KDBUS_QUEUE_PRIO_MIN,
+ * KDBUS_QUEUE_PRIO_MIN + KDBUS_QUEUE_PRIO_BUCKETS) are kept in a fixed array
+ * of per-priority lists, all others in a r/b tree.
+ */
+#define KDBUS_QUEUE_PRIO_MIN		(-16)
+#define KDBUS_QUEUE_PRIO_BUCKETS	32
+
+/**
+ * struct kdbus_queue - a connection's message queue
+ * @msg_count:		Number of linked messages, protected by the
+ *			connection lock; it is only increased with @lock held
+ * @msg_list:		List of linked messages, in FIFO order
+ * @msg_prio_bucket:	Lists of messages, one per priority in the bucket range
+ * @msg_prio_map:	Bitmap of non-empty lists in @msg_prio_bucket
+ * @msg_prio_queue:	Tree of messages with a priority outside of the
+ *			bucket range, sorted by priority
+ * @msg_prio_highest:	Cached pointer to the highest-priority tree node
+ * @lock:		Protects @msg_ready, and the linking of messages into
+ *			the lists
+ * @msg_pending:	Lock-free list of messages appended by senders
+ *			without taking the connection lock, newest first
+ * @msg_ready:		Messages taken off @msg_pending by a receiver which
+ *			did not take the connection lock, oldest first
+ * @wait:		Wake up receivers waiting on this queue
+ */
 struct kdbus_queue {
 	size_t msg_count;
 	struct list_head msg_list;
+	struct list_head msg_prio_bucket[KDBUS_QUEUE_PRIO_BUCKETS];
+	DECLARE_BITMAP(msg_prio_map, KDBUS_QUEUE_PRIO_BUCKETS);
 	struct rb_root msg_prio_queue;
 	struct rb_node *msg_prio_highest;
+	spinlock_t lock;
+	struct llist_head msg_pending;
+	struct llist_node *msg_ready;
+	wait_queue_head_t wait;
 };
 
 /**
  * struct kdbus_queue_entry - messages waiting to be read
  * @entry:		Entry in the connection's list
+ * @pending_node:	Entry in the queue's lock-free pending list, or in
+ *			its list of messages ready to be received
  * @prio_node:		Entry in the priority queue tree
- * @prio_entry:		Queue tree node entry in the list of one priority
+ * @prio_entry:		Entry in the priority bucket, or in the list of one
+ *			priority of the priority queue tree
  * @priority:		Queueing priority of the message
  * @slice:		Allocated slice in the receiver's pool
  * @memfds:		Arrays of offsets where to update the installed
@@ -39,11 +80,18 @@ struct kdbus_queue {
  * @cookie:		Message cookie, used for replies
  * @dst_name_id:	The sequence number of the name this message is
  *			addressed to, 0 for messages sent to an ID
+ * @dst_name_hash:	Hash of the name this message is addressed to, used
+ *			to steer the message to a receive queue
+ * @queue:		The receive queue the entry is linked to
  * @reply:		The reply block if a reply to this message is expected.
  * @user:		Index in per-user message counter, -1 for unused
+ * @meta_epoch:		Epoch of the sender's metadata snapshot, 0 if none
+ * @meta_epoch_flags:	KDBUS_ATTACH_* flags of the snapshot items carried in
+ *			full by this message, 0 if they were left out
  */
 struct kdbus_queue_entry {
 	struct list_head entry;
+	struct llist_node pending_node;
 	struct rb_node prio_node;
 	struct list_head prio_entry;
 	s64 priority;
@@ -57,8 +105,12 @@ struct kdbus_queue_entry {
 	u64 src_id;
 	u64 cookie;
 	u64 dst_name_id;
+	unsigned int dst_name_hash;
+	struct kdbus_queue *queue;
 	struct kdbus_conn_reply *reply;
 	int user;
+	u64 meta_epoch;
+	u64 meta_epoch_flags;
 };
 
 struct kdbus_kmsg;
@@ -70,13 +122,19 @@ int kdbus_queue_entry_alloc(struct kdbus_conn *conn,
 			    struct kdbus_queue_entry **e);
 void kdbus_queue_entry_free(struct kdbus_queue_entry *entry);
 
-void kdbus_queue_entry_add(struct kdbus_queue *queue,
-			   struct kdbus_queue_entry *entry);
+unsigned int kdbus_queue_entry_add(struct kdbus_queue *queue,
+				   struct kdbus_queue_entry *entry);
+void kdbus_queue_entry_push(struct kdbus_queue *queue,
+			    struct kdbus_queue_entry *entry);
+unsigned int kdbus_queue_drain(struct kdbus_queue *queue);
+struct kdbus_queue_entry *kdbus_queue_entry_pop(struct kdbus_queue *queue);
+bool kdbus_queue_empty(struct kdbus_queue *queue);
 void kdbus_queue_entry_remove(struct kdbus_conn *conn,
 			      struct kdbus_queue_entry *entry);
 int kdbus_queue_entry_peek(struct kdbus_queue *queue,
 			   s64 priority, bool use_priority,
 			   struct kdbus_queue_entry **entry);
-int kdbus_queue_entry_install(struct kdbus_queue_entry *entry);
+int kdbus_queue_entry_install(struct kdbus_conn *conn,
+			      struct kdbus_queue_entry *entry);
 
 #endif /* __KDBUS_QUEUE_H */
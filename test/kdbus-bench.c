@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2013-2014 Kay Sievers
+ *
+ * kdbus is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "kdbus-util.h"
+#include "kdbus-bench.h"
+
+uint64_t kdbus_bench_now(void)
+{
+	struct timespec spec;
+
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	return spec.tv_sec * 1000ULL * 1000ULL * 1000ULL + spec.tv_nsec;
+}
+
+void kdbus_bench_hist_init(struct kdbus_bench_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+static unsigned int hist_index(uint64_t v)
+{
+	unsigned int msb;
+
+	if (v < (1ULL << KDBUS_BENCH_HIST_BITS))
+		return v;
+
+	msb = 63 - __builtin_clzll(v);
+
+	return ((msb - KDBUS_BENCH_HIST_BITS + 1) << KDBUS_BENCH_HIST_BITS) +
+	       ((v >> (msb - KDBUS_BENCH_HIST_BITS)) &
+		((1ULL << KDBUS_BENCH_HIST_BITS) - 1));
+}
+
+/* the middle of the range of values counted in a bucket */
+static uint64_t hist_value(unsigned int index)
+{
+	unsigned int e = index >> KDBUS_BENCH_HIST_BITS;
+	uint64_t m = index & ((1ULL << KDBUS_BENCH_HIST_BITS) - 1);
+
+	if (e == 0)
+		return index;
+
+	return (((1ULL << KDBUS_BENCH_HIST_BITS) + m) << (e - 1)) +
+	       ((1ULL << (e - 1)) >> 1);
+}
+
+void kdbus_bench_hist_add(struct kdbus_bench_hist *h, uint64_t ns)
+{
+	h->count++;
+	h->sum += ns;
+	h->buckets[hist_index(ns)]++;
+
+	if (h->min > ns)
+		h->min = ns;
+
+	if (h->max < ns)
+		h->max = ns;
+}
+
+void kdbus_bench_hist_merge(struct kdbus_bench_hist *h,
+			    const struct kdbus_bench_hist *from)
+{
+	unsigned int i;
+
+	h->count += from->count;
+	h->sum += from->sum;
+
+	if (h->min > from->min)
+		h->min = from->min;
+
+	if (h->max < from->max)
+		h->max = from->max;
+
+	for (i = 0; i < KDBUS_BENCH_HIST_BUCKETS; i++)
+		h->buckets[i] += from->buckets[i];
+}
+
+uint64_t kdbus_bench_hist_percentile(const struct kdbus_bench_hist *h,
+				     double p)
+{
+	uint64_t rank, seen = 0;
+	unsigned int i;
+
+	if (h->count == 0)
+		return 0;
+
+	rank = p / 100.0 * h->count;
+	if (rank >= h->count)
+		return h->max;
+
+	for (i = 0; i < KDBUS_BENCH_HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen > rank)
+			break;
+	}
+
+	/* the bucket midpoint can be off the observed range */
+	if (hist_value(i) < h->min)
+		return h->min;
+
+	if (hist_value(i) > h->max)
+		return h->max;
+
+	return hist_value(i);
+}
+
+/*
+ * Benchmark parameters are passed as "key=value,key=value", where a value
+ * may list several settings separated by ':'. Look up @key, fall back to
+ * @def, and return a copy of its value.
+ */
+static char *arg_value(const char *args, const char *key, const char *def)
+{
+	size_t key_len = strlen(key);
+	const char *p = args;
+
+	while (p && *p) {
+		if (strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+			p += key_len + 1;
+			return strndup(p, strcspn(p, ","));
+		}
+
+		p = strchr(p, ',');
+		if (p)
+			p++;
+	}
+
+	return strdup(def);
+}
+
+/* parse a list of numbers with an optional K or M suffix */
+unsigned int kdbus_bench_arg_u64(const char *args, const char *key,
+				 const char *def, uint64_t *vals,
+				 unsigned int max)
+{
+	char *value, *tok, *end, *save = NULL;
+	unsigned int n = 0;
+
+	value = arg_value(args, key, def);
+	if (!value)
+		return 0;
+
+	for (tok = strtok_r(value, ":", &save); tok;
+	     tok = strtok_r(NULL, ":", &save)) {
+		if (n == max)
+			goto exit_invalid;
+
+		errno = 0;
+		vals[n] = strtoull(tok, &end, 0);
+		if (errno != 0 || end == tok)
+			goto exit_invalid;
+
+		if (*end == 'K' || *end == 'k') {
+			vals[n] *= 1024ULL;
+			end++;
+		} else if (*end == 'M' || *end == 'm') {
+			vals[n] *= 1024ULL * 1024ULL;
+			end++;
+		}
+
+		if (*end != '\0')
+			goto exit_invalid;
+
+		n++;
+	}
+
+	free(value);
+	return n;
+
+exit_invalid:
+	fprintf(stderr, "Invalid benchmark parameter '%s=%s'\n", key, tok);
+	free(value);
+	return 0;
+}
+
+/* parse a list of settings out of the NULL-terminated @names */
+unsigned int kdbus_bench_arg_enum(const char *args, const char *key,
+				  const char *def, const char * const *names,
+				  unsigned int *vals, unsigned int max)
+{
+	char *value, *tok, *save = NULL;
+	unsigned int i, n = 0;
+
+	value = arg_value(args, key, def);
+	if (!value)
+		return 0;
+
+	for (tok = strtok_r(value, ":", &save); tok;
+	     tok = strtok_r(NULL, ":", &save)) {
+		for (i = 0; names[i]; i++)
+			if (strcmp(tok, names[i]) == 0)
+				break;
+
+		if (!names[i] || n == max) {
+			fprintf(stderr, "Invalid benchmark parameter '%s=%s'\n",
+				key, tok);
+			free(value);
+			return 0;
+		}
+
+		vals[n++] = i;
+	}
+
+	free(value);
+	return n;
+}
+
+/*
+ * Print the result of a benchmark run. @params describes the run as
+ * space separated key=value pairs; the same format is used for the line
+ * appended to @out, one line per run, for regression tracking.
+ */
+void kdbus_bench_report(FILE *out, const char *bench, const char *params,
+			uint64_t msgs, uint64_t bytes, uint64_t ns,
+			const struct kdbus_bench_hist *h)
+{
+	double secs = ns / 1e9;
+	uint64_t p50, p99, p999;
+
+	p50 = kdbus_bench_hist_percentile(h, 50);
+	p99 = kdbus_bench_hist_percentile(h, 99);
+	p999 = kdbus_bench_hist_percentile(h, 99.9);
+
+	kdbus_printf("%s %s: %'.0f msgs/s %'.1f MB/s, latency (usecs) p50/p99/p999/max %.1f // %.1f // %.1f // %.1f\n",
+		     bench, params,
+		     secs > 0 ? msgs / secs : 0,
+		     secs > 0 ? bytes / secs / 1e6 : 0,
+		     p50 / 1e3, p99 / 1e3, p999 / 1e3,
+		     h->count > 0 ? h->max / 1e3 : 0);
+
+	if (!out)
+		return;
+
+	fprintf(out, "bench=%s %s msgs=%llu bytes=%llu ns=%llu msgs_per_sec=%.0f mb_per_sec=%.3f samples=%llu p50_ns=%llu p99_ns=%llu p999_ns=%llu max_ns=%llu\n",
+		bench, params,
+		(unsigned long long) msgs,
+		(unsigned long long) bytes,
+		(unsigned long long) ns,
+		secs > 0 ? msgs / secs : 0,
+		secs > 0 ? bytes / secs / 1e6 : 0,
+		(unsigned long long) h->count,
+		(unsigned long long) p50,
+		(unsigned long long) p99,
+		(unsigned long long) p999,
+		(unsigned long long) (h->count > 0 ? h->max : 0));
+	fflush(out);
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2013-2014 Kay Sievers
+ *
+ * kdbus is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ */
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Latency histogram with logarithmic buckets; each power of two is split
+ * into 2^KDBUS_BENCH_HIST_BITS linear buckets, which keeps the error of a
+ * percentile below 1/32. Histograms are kept per thread and merged.
+ */
+#define KDBUS_BENCH_HIST_BITS		5
+#define KDBUS_BENCH_HIST_BUCKETS	((65 - KDBUS_BENCH_HIST_BITS) << \
+					 KDBUS_BENCH_HIST_BITS)
+
+struct kdbus_bench_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[KDBUS_BENCH_HIST_BUCKETS];
+};
+
+uint64_t kdbus_bench_now(void);
+
+void kdbus_bench_hist_init(struct kdbus_bench_hist *h);
+void kdbus_bench_hist_add(struct kdbus_bench_hist *h, uint64_t ns);
+void kdbus_bench_hist_merge(struct kdbus_bench_hist *h,
+			    const struct kdbus_bench_hist *from);
+uint64_t kdbus_bench_hist_percentile(const struct kdbus_bench_hist *h,
+				     double p);
+
+unsigned int kdbus_bench_arg_u64(const char *args, const char *key,
+				 const char *def, uint64_t *vals,
+				 unsigned int max);
+unsigned int kdbus_bench_arg_enum(const char *args, const char *key,
+				  const char *def, const char * const *names,
+				  unsigned int *vals, unsigned int max);
+
+void kdbus_bench_report(FILE *out, const char *bench, const char *params,
+			uint64_t msgs, uint64_t bytes, uint64_t ns,
+			const struct kdbus_bench_hist *h);
@@ -43,7 +43,9 @@ TABLE(CMD) = {
 	ENUM(KDBUS_CMD_HELLO),
 	ENUM(KDBUS_CMD_MSG_SEND),
 	ENUM(KDBUS_CMD_MSG_RECV),
+	ENUM(KDBUS_CMD_MSG_RECV_QUEUE),
 	ENUM(KDBUS_CMD_NAME_LIST),
+	ENUM(KDBUS_CMD_NAME_LIST_CHUNK),
 	ENUM(KDBUS_CMD_NAME_RELEASE),
 	ENUM(KDBUS_CMD_CONN_INFO),
 	ENUM(KDBUS_CMD_MATCH_ADD),
@@ -60,6 +62,8 @@ TABLE(MSG) = {
 	ENUM(KDBUS_ITEM_BLOOM_PARAMETER),
 	ENUM(KDBUS_ITEM_BLOOM_FILTER),
 	ENUM(KDBUS_ITEM_DST_NAME),
+	ENUM(KDBUS_ITEM_MONITOR_FILTER),
+	ENUM(KDBUS_ITEM_DST_ID),
 	ENUM(KDBUS_ITEM_CREDS),
 	ENUM(KDBUS_ITEM_AUXGROUPS),
 	ENUM(KDBUS_ITEM_PID_COMM),
@@ -71,6 +75,7 @@ TABLE(MSG) = {
 	ENUM(KDBUS_ITEM_SECLABEL),
 	ENUM(KDBUS_ITEM_AUDIT),
 	ENUM(KDBUS_ITEM_CONN_DESCRIPTION),
+	ENUM(KDBUS_ITEM_META_EPOCH),
 	ENUM(KDBUS_ITEM_NAME),
 	ENUM(KDBUS_ITEM_TIMESTAMP),
 	ENUM(KDBUS_ITEM_NAME_ADD),
@@ -80,6 +85,10 @@ TABLE(MSG) = {
 	ENUM(KDBUS_ITEM_ID_REMOVE),
 	ENUM(KDBUS_ITEM_REPLY_TIMEOUT),
 	ENUM(KDBUS_ITEM_REPLY_DEAD),
+	ENUM(KDBUS_ITEM_NAME_GENERATION),
+	ENUM(KDBUS_ITEM_NAME_BATCH),
+	ENUM(KDBUS_ITEM_MONITOR_DROPPED),
+	ENUM(KDBUS_ITEM_MONITOR_TRUNCATED),
 };
 LOOKUP(MSG);
 
@@ -75,6 +75,18 @@ static const struct kdbus_test tests[] = {
 		.func	= kdbus_test_monitor,
 		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
 	},
+	{
+		.name	= "monitor-async",
+		.desc	= "asynchronous monitor delivery",
+		.func	= kdbus_test_monitor_async,
+		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
+	},
+	{
+		.name	= "monitor-filter",
+		.desc	= "monitor match rules, sampling and snapshot length",
+		.func	= kdbus_test_monitor_filter,
+		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
+	},
 	{
 		.name	= "name-basics",
 		.desc	= "basic name registry functions",
@@ -93,6 +105,30 @@ static const struct kdbus_test tests[] = {
 		.func	= kdbus_test_name_queue,
 		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
 	},
+	{
+		.name	= "name-shared",
+		.desc	= "sharing of names between connections",
+		.func	= kdbus_test_name_shared,
+		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
+	},
+	{
+		.name	= "name-list-cursor",
+		.desc	= "listing names in chunks",
+		.func	= kdbus_test_name_list_cursor,
+		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
+	},
+	{
+		.name	= "name-list-subscribe",
+		.desc	= "snapshot of the registry followed by changes",
+		.func	= kdbus_test_name_list_subscribe,
+		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
+	},
+	{
+		.name	= "name-table",
+		.desc	= "resolving names through the mapped name table",
+		.func	= kdbus_test_name_table,
+		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
+	},
 	{
 		.name	= "message-basic",
 		.desc	= "basic message handling",
@@ -111,6 +147,24 @@ static const struct kdbus_test tests[] = {
 		.func	= kdbus_test_message_quota,
 		.flags	= TEST_CREATE_BUS,
 	},
+	{
+		.name	= "message-queues",
+		.desc	= "steering of messages to multiple receive queues",
+		.func	= kdbus_test_message_queues,
+		.flags	= TEST_CREATE_BUS,
+	},
+	{
+		.name	= "message-broadcast-attach",
+		.desc	= "per-receiver metadata of broadcast messages",
+		.func	= kdbus_test_message_broadcast_attach,
+		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
+	},
+	{
+		.name	= "message-meta-epoch",
+		.desc	= "unchanged sender metadata sent by epoch reference",
+		.func	= kdbus_test_message_meta_epoch,
+		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
+	},
 	{
 		.name	= "timeout",
 		.desc	= "timeout",
@@ -147,6 +201,24 @@ static const struct kdbus_test tests[] = {
 		.func	= kdbus_test_conn_update,
 		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
 	},
+	{
+		.name	= "connection-meta-cache",
+		.desc	= "invalidation of cached sender metadata",
+		.func	= kdbus_test_conn_meta_cache,
+		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
+	},
+	{
+		.name	= "connection-info-names",
+		.desc	= "names in repeated connection information queries",
+		.func	= kdbus_test_conn_info_names,
+		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
+	},
+	{
+		.name	= "connection-info-list",
+		.desc	= "retrieving information on several connections",
+		.func	= kdbus_test_conn_info_list,
+		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
+	},
 	{
 		.name	= "writable-pool",
 		.desc	= "verifying pools are never writable",
@@ -207,6 +279,18 @@ static const struct kdbus_test tests[] = {
 		.func	= kdbus_test_match_name_change,
 		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
 	},
+	{
+		.name	= "match-name-batch",
+		.desc	= "batched name change notifications",
+		.func	= kdbus_test_match_name_batch,
+		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
+	},
+	{
+		.name	= "match-index",
+		.desc	= "notification dispatch by type and name",
+		.func	= kdbus_test_match_index,
+		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
+	},
 	{
 		.name	= "match-bloom",
 		.desc	= "matching with bloom filters",
@@ -231,6 +315,30 @@ static const struct kdbus_test tests[] = {
 		.func	= kdbus_test_benchmark,
 		.flags	= TEST_CREATE_BUS,
 	},
+	{
+		.name	= "benchmark-senders",
+		.desc	= "benchmark multiple senders into one receiver",
+		.func	= kdbus_test_benchmark_senders,
+		.flags	= TEST_CREATE_BUS,
+	},
+	{
+		.name	= "benchmark-throughput",
+		.desc	= "benchmark N senders and M receivers",
+		.func	= kdbus_test_benchmark_throughput,
+		.flags	= TEST_CREATE_BUS,
+	},
+	{
+		.name	= "benchmark-broadcast",
+		.desc	= "benchmark broadcast scaling",
+		.func	= kdbus_test_benchmark_broadcast,
+		.flags	= TEST_CREATE_BUS,
+	},
+	{
+		.name	= "benchmark-call",
+		.desc	= "benchmark method call round-trips",
+		.func	= kdbus_test_benchmark_call,
+		.flags	= TEST_CREATE_BUS,
+	},
 	{
 		.name	= "race-byebye",
 		.desc	= "race multiple byebyes",
@@ -246,6 +354,10 @@ static const struct kdbus_test tests[] = {
 	{ NULL } /* sentinel */
 };
 
+/* benchmark parameters and results, see --args and --output */
+static const char *test_args;
+static FILE *test_output;
+
 static int test_prepare_env(const struct kdbus_test *t,
 			    struct kdbus_test_env *env,
 			    const char *busname)
@@ -301,7 +413,10 @@ void test_unprepare_env(const struct kdbus_test *t, struct kdbus_test_env *env)
 static int test_run(const struct kdbus_test *t, const char *busname, int wait)
 {
 	int ret;
-	struct kdbus_test_env env = {};
+	struct kdbus_test_env env = {
+		.args = test_args,
+		.output = test_output,
+	};
 
 	ret = test_prepare_env(t, &env, busname);
 	if (ret != TEST_OK)
@@ -346,7 +461,7 @@ static int run_all_tests(const char *busname)
 
 	for (t = tests; t->name; t++) {
 		printf("Testing %s (%s) ", t->desc, t->name);
-		for (i = 0; i < 60 - strlen(t->desc) - strlen(t->name); i++)
+		for (i = strlen(t->desc) + strlen(t->name); i < 60; i++)
 			printf(".");
 		printf(" ");
 
@@ -385,6 +500,8 @@ static void usage(const char *argv0)
 	       "\t-t, --test <test-id>	Run one specific test only, in verbose mode\n"
 	       "\t-b, --bus <busname>	Instead of generating a random bus name, take <busname>.\n"
 	       "\t-w, --wait <secs>	Wait <secs> before actually starting test\n"
+	       "\t-a, --args <params>	Pass key=value,... parameters to benchmarks\n"
+	       "\t-o, --output <file>	Append benchmark results to <file>\n"
 	       "\n", argv0);
 
 	printf("By default, all test are run once, and a summary is printed.\n"
@@ -420,10 +537,13 @@ int main(int argc, char *argv[])
 		{ "test",	required_argument,	NULL, 't' },
 		{ "bus",	required_argument,	NULL, 'b' },
 		{ "wait",	required_argument,	NULL, 'w' },
+		{ "args",	required_argument,	NULL, 'a' },
+		{ "output",	required_argument,	NULL, 'o' },
 		{}
 	};
 
-	while ((t = getopt_long(argc, argv, "hxt:b:w:", options, NULL)) >= 0) {
+	while ((t = getopt_long(argc, argv, "hxt:b:w:a:o:",
+				options, NULL)) >= 0) {
 		switch (t) {
 		case 'x':
 			arg_loop = 1;
@@ -441,6 +561,18 @@ int main(int argc, char *argv[])
 			arg_wait = strtol(optarg, NULL, 10);
 			break;
 
+		case 'a':
+			test_args = optarg;
+			break;
+
+		case 'o':
+			test_output = fopen(optarg, "a");
+			if (!test_output) {
+				printf("Unable to open '%s': %m\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+
 		default:
 		case 'h':
 			usage(argv[0]);
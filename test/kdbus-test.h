@@ -5,6 +5,8 @@ struct kdbus_test_env {
 	char *buspath;
 	int control_fd;
 	struct kdbus_conn *conn;
+	const char *args;
+	FILE *output;
 };
 
 enum {
@@ -42,11 +44,18 @@ enum {
 
 int kdbus_test_activator(struct kdbus_test_env *env);
 int kdbus_test_benchmark(struct kdbus_test_env *env);
+int kdbus_test_benchmark_broadcast(struct kdbus_test_env *env);
+int kdbus_test_benchmark_call(struct kdbus_test_env *env);
+int kdbus_test_benchmark_senders(struct kdbus_test_env *env);
+int kdbus_test_benchmark_throughput(struct kdbus_test_env *env);
 int kdbus_test_bus_make(struct kdbus_test_env *env);
 int kdbus_test_byebye(struct kdbus_test_env *env);
 int kdbus_test_chat(struct kdbus_test_env *env);
 int kdbus_test_conn_info(struct kdbus_test_env *env);
 int kdbus_test_conn_update(struct kdbus_test_env *env);
+int kdbus_test_conn_meta_cache(struct kdbus_test_env *env);
+int kdbus_test_conn_info_names(struct kdbus_test_env *env);
+int kdbus_test_conn_info_list(struct kdbus_test_env *env);
 int kdbus_test_daemon(struct kdbus_test_env *env);
 int kdbus_test_domain_make(struct kdbus_test_env *env);
 int kdbus_test_custom_endpoint(struct kdbus_test_env *env);
@@ -59,14 +68,25 @@ int kdbus_test_match_id_remove(struct kdbus_test_env *env);
 int kdbus_test_match_name_add(struct kdbus_test_env *env);
 int kdbus_test_match_name_change(struct kdbus_test_env *env);
 int kdbus_test_match_name_remove(struct kdbus_test_env *env);
+int kdbus_test_match_name_batch(struct kdbus_test_env *env);
+int kdbus_test_match_index(struct kdbus_test_env *env);
 int kdbus_test_message_basic(struct kdbus_test_env *env);
 int kdbus_test_message_prio(struct kdbus_test_env *env);
 int kdbus_test_message_quota(struct kdbus_test_env *env);
+int kdbus_test_message_queues(struct kdbus_test_env *env);
+int kdbus_test_message_broadcast_attach(struct kdbus_test_env *env);
+int kdbus_test_message_meta_epoch(struct kdbus_test_env *env);
 int kdbus_test_metadata_ns(struct kdbus_test_env *env);
 int kdbus_test_monitor(struct kdbus_test_env *env);
+int kdbus_test_monitor_async(struct kdbus_test_env *env);
+int kdbus_test_monitor_filter(struct kdbus_test_env *env);
 int kdbus_test_name_basic(struct kdbus_test_env *env);
 int kdbus_test_name_conflict(struct kdbus_test_env *env);
 int kdbus_test_name_queue(struct kdbus_test_env *env);
+int kdbus_test_name_shared(struct kdbus_test_env *env);
+int kdbus_test_name_list_cursor(struct kdbus_test_env *env);
+int kdbus_test_name_list_subscribe(struct kdbus_test_env *env);
+int kdbus_test_name_table(struct kdbus_test_env *env);
 int kdbus_test_policy(struct kdbus_test_env *env);
 int kdbus_test_policy_ns(struct kdbus_test_env *env);
 int kdbus_test_policy_priv(struct kdbus_test_env *env);
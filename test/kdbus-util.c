@@ -59,6 +59,12 @@
 int kdbus_util_verbose = true;
 
 int kdbus_create_bus(int control_fd, const char *name, char **path)
+{
+	return kdbus_create_bus_bloom(control_fd, name, 64, path);
+}
+
+int kdbus_create_bus_bloom(int control_fd, const char *name,
+			   uint64_t bloom_size, char **path)
 {
 	struct {
 		struct kdbus_cmd_make head;
@@ -82,7 +88,7 @@ int kdbus_create_bus(int control_fd, const char *name, char **path)
 	memset(&bus_make, 0, sizeof(bus_make));
 	bus_make.bp.size = sizeof(bus_make.bp);
 	bus_make.bp.type = KDBUS_ITEM_BLOOM_PARAMETER;
-	bus_make.bp.bloom.size = 64;
+	bus_make.bp.bloom.size = bloom_size;
 	bus_make.bp.bloom.n_hash = 1;
 
 	snprintf(bus_make.name.str, sizeof(bus_make.name.str),
@@ -650,6 +656,45 @@ int kdbus_msg_dump(const struct kdbus_conn *conn, const struct kdbus_msg *msg)
 			       (unsigned long long)item->timestamp.monotonic_ns);
 			break;
 
+		case KDBUS_ITEM_META_EPOCH:
+			kdbus_printf("  +%s (%llu bytes) epoch=%llu\n",
+				     enum_MSG(item->type), item->size,
+				     (unsigned long long)item->meta_epoch);
+			break;
+
+		case KDBUS_ITEM_NAME_GENERATION:
+			kdbus_printf("  +%s (%llu bytes) generation=%llu\n",
+				     enum_MSG(item->type), item->size,
+				     (unsigned long long)item->name_generation);
+			break;
+
+		case KDBUS_ITEM_MONITOR_TRUNCATED:
+			kdbus_printf("  +%s (%llu bytes) payload=%llu\n",
+				     enum_MSG(item->type), item->size,
+				     (unsigned long long)item->monitor_truncated);
+			break;
+
+		case KDBUS_ITEM_MONITOR_DROPPED:
+			kdbus_printf("  +%s (%llu bytes) dropped=%llu\n",
+				     enum_MSG(item->type), item->size,
+				     (unsigned long long)item->monitor_dropped);
+			break;
+
+		case KDBUS_ITEM_NAME_BATCH: {
+			struct kdbus_item *it, *end;
+			unsigned int n = 0;
+
+			end = (struct kdbus_item *)((char *)item + item->size);
+			for (it = (struct kdbus_item *)item->data; it < end;
+			     it = KDBUS_ITEM_NEXT(it))
+				if (it->type != KDBUS_ITEM_NAME_GENERATION)
+					n++;
+
+			kdbus_printf("  +%s (%llu bytes) changes=%u\n",
+				     enum_MSG(item->type), item->size, n);
+			break;
+		}
+
 		case KDBUS_ITEM_REPLY_TIMEOUT:
 			kdbus_printf("  +%s (%llu bytes) cookie=%llu\n",
 			       enum_MSG(item->type), item->size,
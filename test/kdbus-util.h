@@ -109,6 +109,8 @@ int kdbus_free(const struct kdbus_conn *conn, uint64_t offset);
 int kdbus_msg_dump(const struct kdbus_conn *conn,
 		   const struct kdbus_msg *msg);
 int kdbus_create_bus(int control_fd, const char *name, char **path);
+int kdbus_create_bus_bloom(int control_fd, const char *name,
+			   uint64_t bloom_size, char **path);
 int kdbus_msg_send(const struct kdbus_conn *conn, const char *name,
 		   uint64_t cookie, uint64_t flags, uint64_t timeout,
 		   int64_t priority, uint64_t dst_id);
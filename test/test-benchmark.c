@@ -11,6 +11,8 @@
 #include <errno.h>
 #include <assert.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -19,6 +21,7 @@
 #include "kdbus-test.h"
 #include "kdbus-util.h"
 #include "kdbus-enum.h"
+#include "kdbus-bench.h"
 
 #define SERVICE_NAME "foo.bar.echo"
 
@@ -415,3 +418,1383 @@ int kdbus_test_benchmark(struct kdbus_test_env *env)
 
 	return (stats.count > 1) ? TEST_OK : TEST_ERR;
 }
+
+/*
+ * Multi-sender benchmark: a number of sender threads, each on its own
+ * connection, flood a single receiver. This exercises the contention on
+ * the receiver's queue, and verifies that messages of each individual
+ * sender are received in the order they were sent.
+ */
+
+#define MPSC_MAX_SENDERS 8
+
+struct mpsc_sender {
+	pthread_t thread;
+	struct kdbus_conn *conn;
+	uint64_t dst_id;
+	uint64_t sent;
+	uint64_t received;
+	int ret;
+};
+
+static volatile bool mpsc_stop;
+
+static uint64_t now_wall(void)
+{
+	struct timespec spec;
+
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	return spec.tv_sec * 1000ULL * 1000ULL * 1000ULL + spec.tv_nsec;
+}
+
+static void *mpsc_sender_thread(void *data)
+{
+	struct mpsc_sender *s = data;
+	struct kdbus_msg *msg;
+	int ret;
+
+	ret = setup_simple_kdbus_msg(s->conn, s->dst_id, &msg);
+	if (ret < 0) {
+		s->ret = ret;
+		return NULL;
+	}
+
+	while (!mpsc_stop) {
+		msg->cookie = s->sent + 1;
+
+		ret = ioctl(s->conn->fd, KDBUS_CMD_MSG_SEND, msg);
+		if (ret < 0 && (errno == ENOBUFS || errno == EXFULL)) {
+			/* receiver's queue is full, let it catch up */
+			sched_yield();
+			continue;
+		}
+
+		if (ret < 0) {
+			s->ret = -errno;
+			break;
+		}
+
+		s->sent++;
+	}
+
+	free(msg);
+	return NULL;
+}
+
+static int mpsc_recv(struct kdbus_conn *conn, struct mpsc_sender *senders,
+		     unsigned int n_senders)
+{
+	struct kdbus_cmd_recv recv = {};
+	struct kdbus_msg *msg;
+	unsigned int i;
+	int ret;
+
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+	if (ret < 0 && errno == EAGAIN)
+		return -EAGAIN;
+
+	ASSERT_RETURN_VAL(ret == 0, -errno);
+
+	msg = (struct kdbus_msg *)(conn->buf + recv.offset);
+
+	for (i = 0; i < n_senders; i++)
+		if (senders[i].conn->id == msg->src_id)
+			break;
+
+	ASSERT_RETURN_VAL(i < n_senders, -EINVAL);
+
+	/* messages of one sender must not be reordered */
+	ASSERT_RETURN_VAL(msg->cookie == senders[i].received + 1, -EINVAL);
+	senders[i].received++;
+
+	ret = kdbus_free(conn, recv.offset);
+	ASSERT_RETURN_VAL(ret == 0, -errno);
+
+	return 0;
+}
+
+static int mpsc_run(struct kdbus_test_env *env, unsigned int n_senders)
+{
+	struct mpsc_sender senders[MPSC_MAX_SENDERS] = {};
+	uint64_t start, diff, sent = 0, received = 0;
+	struct kdbus_conn *conn;
+	struct pollfd fd;
+	unsigned int i;
+	int ret;
+
+	conn = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(conn);
+
+	if (attach_none) {
+		ret = kdbus_conn_update_attach_flags(conn, 0);
+		ASSERT_RETURN(ret == 0);
+	}
+
+	mpsc_stop = false;
+
+	for (i = 0; i < n_senders; i++) {
+		senders[i].conn = kdbus_hello(env->buspath, 0, NULL, 0);
+		ASSERT_RETURN(senders[i].conn);
+		senders[i].dst_id = conn->id;
+	}
+
+	start = now_wall();
+
+	for (i = 0; i < n_senders; i++) {
+		ret = pthread_create(&senders[i].thread, NULL,
+				     mpsc_sender_thread, &senders[i]);
+		ASSERT_RETURN(ret == 0);
+	}
+
+	fd.fd = conn->fd;
+	fd.events = POLLIN;
+
+	do {
+		ret = poll(&fd, 1, 10);
+		ASSERT_RETURN(ret >= 0);
+
+		while ((ret = mpsc_recv(conn, senders, n_senders)) == 0)
+			received++;
+
+		/* anything but a drained queue is an error, like reordering */
+		ASSERT_RETURN(ret == -EAGAIN);
+
+		diff = now_wall() - start;
+	} while (diff < 500000000ULL);
+
+	mpsc_stop = true;
+
+	for (i = 0; i < n_senders; i++) {
+		pthread_join(senders[i].thread, NULL);
+		ASSERT_RETURN(senders[i].ret == 0);
+		sent += senders[i].sent;
+	}
+
+	/* fetch what is left in the queue */
+	while ((ret = mpsc_recv(conn, senders, n_senders)) == 0)
+		received++;
+
+	ASSERT_RETURN(ret == -EAGAIN);
+	ASSERT_RETURN(received == sent);
+
+	kdbus_printf("stats (KDBUS): %u sender(s), %'llu messages received, %'llu msgs/s\n",
+		     n_senders, (unsigned long long) received,
+		     (unsigned long long) (received * 1000000000ULL / diff));
+
+	for (i = 0; i < n_senders; i++)
+		kdbus_conn_free(senders[i].conn);
+
+	kdbus_conn_free(conn);
+
+	return TEST_OK;
+}
+
+int kdbus_test_benchmark_senders(struct kdbus_test_env *env)
+{
+	unsigned int n;
+	int ret;
+
+	setlocale(LC_ALL, "");
+
+	for (n = 1; n <= MPSC_MAX_SENDERS; n *= 2) {
+		ret = mpsc_run(env, n);
+		ASSERT_RETURN(ret == TEST_OK);
+	}
+
+	return TEST_OK;
+}
+
+/*
+ * Throughput benchmark: N sender threads send to M receiver threads, each
+ * on its own connection, round-robin over the receivers. Every message
+ * carries its CLOCK_MONOTONIC send time in the cookie, so the receivers
+ * can record the delivery latency without looking at the payload.
+ *
+ * Each parameter takes a ':'-separated list, and every combination is run:
+ *
+ *   size=BYTES		payload size, up to 2M; 0 sends no payload
+ *   payload=vec|memfd	how the payload is passed
+ *   senders=N		sender threads
+ *   receivers=M	receiver threads
+ *   dst=id|name	address the receivers by unique ID or well-known name
+ *   attach=none|timestamp|creds|names|all
+ *			metadata the receivers ask for
+ *   duration=MS	time to send, per combination
+ */
+
+#define TPUT_MAX_THREADS	64
+#define TPUT_MAX_VALUES		16
+
+enum {
+	TPUT_PAYLOAD_VEC,
+	TPUT_PAYLOAD_MEMFD,
+};
+
+enum {
+	TPUT_DST_ID,
+	TPUT_DST_NAME,
+};
+
+static const char * const tput_payload_names[] = { "vec", "memfd", NULL };
+static const char * const tput_dst_names[] = { "id", "name", NULL };
+static const char * const tput_attach_names[] = {
+	"none", "timestamp", "creds", "names", "all", NULL
+};
+
+static const uint64_t tput_attach_flags[] = {
+	0,
+	KDBUS_ATTACH_TIMESTAMP,
+	KDBUS_ATTACH_CREDS,
+	KDBUS_ATTACH_NAMES,
+	_KDBUS_ATTACH_ALL,
+};
+
+struct tput_config {
+	uint64_t size;
+	unsigned int payload;
+	unsigned int dst;
+	unsigned int attach;
+	uint64_t senders;
+	uint64_t receivers;
+	uint64_t duration_ms;
+};
+
+struct tput_receiver {
+	pthread_t thread;
+	struct kdbus_conn *conn;
+	char name[32];
+	struct kdbus_bench_hist hist;
+	uint64_t received;
+	uint64_t bytes;
+	int ret;
+};
+
+struct tput_sender {
+	pthread_t thread;
+	struct kdbus_conn *conn;
+	const struct tput_config *cfg;
+	struct tput_receiver *receivers;
+	uint64_t sent;
+	uint64_t busy;
+	int ret;
+};
+
+static volatile bool tput_stop_senders;
+static volatile bool tput_stop_receivers;
+
+static struct kdbus_msg *tput_msg_new(const struct tput_config *cfg,
+				      const struct tput_receiver *r,
+				      const void *data, int memfd)
+{
+	struct kdbus_msg *msg;
+	struct kdbus_item *item;
+	uint64_t size;
+
+	size = sizeof(struct kdbus_msg);
+	if (cfg->size > 0 && cfg->payload == TPUT_PAYLOAD_VEC)
+		size += KDBUS_ITEM_SIZE(sizeof(struct kdbus_vec));
+	if (cfg->size > 0 && cfg->payload == TPUT_PAYLOAD_MEMFD)
+		size += KDBUS_ITEM_SIZE(sizeof(struct kdbus_memfd));
+	if (cfg->dst == TPUT_DST_NAME)
+		size += KDBUS_ITEM_SIZE(strlen(r->name) + 1);
+
+	msg = malloc(size);
+	if (!msg)
+		return NULL;
+
+	memset(msg, 0, size);
+	msg->size = size;
+	msg->payload_type = KDBUS_PAYLOAD_DBUS;
+	msg->dst_id = cfg->dst == TPUT_DST_NAME ? KDBUS_DST_ID_NAME :
+						  r->conn->id;
+
+	item = msg->items;
+
+	if (cfg->size > 0 && cfg->payload == TPUT_PAYLOAD_VEC) {
+		item->type = KDBUS_ITEM_PAYLOAD_VEC;
+		item->size = KDBUS_ITEM_HEADER_SIZE + sizeof(struct kdbus_vec);
+		item->vec.address = (uintptr_t) data;
+		item->vec.size = cfg->size;
+		item = KDBUS_ITEM_NEXT(item);
+	}
+
+	if (cfg->size > 0 && cfg->payload == TPUT_PAYLOAD_MEMFD) {
+		item->type = KDBUS_ITEM_PAYLOAD_MEMFD;
+		item->size = KDBUS_ITEM_HEADER_SIZE +
+			     sizeof(struct kdbus_memfd);
+		item->memfd.size = cfg->size;
+		item->memfd.fd = memfd;
+		item = KDBUS_ITEM_NEXT(item);
+	}
+
+	if (cfg->dst == TPUT_DST_NAME) {
+		item->type = KDBUS_ITEM_DST_NAME;
+		item->size = KDBUS_ITEM_HEADER_SIZE + strlen(r->name) + 1;
+		strcpy(item->str, r->name);
+	}
+
+	return msg;
+}
+
+static void *tput_sender_thread(void *data)
+{
+	struct tput_sender *s = data;
+	const struct tput_config *cfg = s->cfg;
+	struct kdbus_msg *msgs[TPUT_MAX_THREADS] = {};
+	void *payload = NULL;
+	int memfd = -1;
+	unsigned int i;
+	int ret;
+
+	if (cfg->size > 0 && cfg->payload == TPUT_PAYLOAD_VEC) {
+		payload = calloc(1, cfg->size);
+		if (!payload) {
+			s->ret = -ENOMEM;
+			return NULL;
+		}
+	}
+
+	/* one sealed memfd, passed with every message */
+	if (cfg->size > 0 && cfg->payload == TPUT_PAYLOAD_MEMFD) {
+		memfd = sys_memfd_create("benchmark", cfg->size);
+		if (memfd < 0 || sys_memfd_seal_set(memfd) < 0) {
+			s->ret = -errno;
+			goto exit;
+		}
+	}
+
+	for (i = 0; i < cfg->receivers; i++) {
+		msgs[i] = tput_msg_new(cfg, &s->receivers[i], payload, memfd);
+		if (!msgs[i]) {
+			s->ret = -ENOMEM;
+			goto exit;
+		}
+	}
+
+	for (i = 0; !tput_stop_senders; i = (i + 1) % cfg->receivers) {
+		msgs[i]->cookie = kdbus_bench_now();
+
+		ret = ioctl(s->conn->fd, KDBUS_CMD_MSG_SEND, msgs[i]);
+		if (ret < 0 && (errno == ENOBUFS || errno == EXFULL)) {
+			/* receiver's queue or pool is full, let it catch up */
+			s->busy++;
+			sched_yield();
+			continue;
+		}
+
+		if (ret < 0) {
+			s->ret = -errno;
+			break;
+		}
+
+		s->sent++;
+	}
+
+exit:
+	for (i = 0; i < cfg->receivers; i++)
+		free(msgs[i]);
+
+	if (memfd >= 0)
+		close(memfd);
+
+	free(payload);
+	return NULL;
+}
+
+static int tput_recv(struct tput_receiver *r)
+{
+	struct kdbus_cmd_recv recv = {};
+	const struct kdbus_item *item;
+	struct kdbus_msg *msg;
+	uint64_t now_ns;
+	int ret;
+
+	ret = ioctl(r->conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+	if (ret < 0 && errno == EAGAIN)
+		return -EAGAIN;
+
+	ASSERT_RETURN_VAL(ret == 0, -errno);
+
+	now_ns = kdbus_bench_now();
+	msg = (struct kdbus_msg *)(r->conn->buf + recv.offset);
+
+	KDBUS_ITEM_FOREACH(item, msg, items) {
+		switch (item->type) {
+		case KDBUS_ITEM_PAYLOAD_OFF:
+			if (item->vec.offset != ~0ULL)
+				r->bytes += item->vec.size;
+			break;
+
+		case KDBUS_ITEM_PAYLOAD_MEMFD:
+			r->bytes += item->memfd.size;
+			close(item->memfd.fd);
+			break;
+		}
+	}
+
+	if (msg->src_id != KDBUS_SRC_ID_KERNEL) {
+		kdbus_bench_hist_add(&r->hist, now_ns - msg->cookie);
+		r->received++;
+	}
+
+	ret = kdbus_free(r->conn, recv.offset);
+	ASSERT_RETURN_VAL(ret == 0, -errno);
+
+	return 0;
+}
+
+static void *tput_receiver_thread(void *data)
+{
+	struct tput_receiver *r = data;
+	struct pollfd fd;
+	bool stop;
+	int ret;
+
+	fd.fd = r->conn->fd;
+	fd.events = POLLIN;
+
+	do {
+		/* sample the flag first, the queue is drained once more */
+		stop = tput_stop_receivers;
+
+		ret = poll(&fd, 1, 10);
+		if (ret < 0) {
+			r->ret = -errno;
+			break;
+		}
+
+		while ((ret = tput_recv(r)) == 0)
+			;
+
+		if (ret != -EAGAIN) {
+			r->ret = ret;
+			break;
+		}
+	} while (!stop);
+
+	return NULL;
+}
+
+static int tput_run(struct kdbus_test_env *env, const struct tput_config *cfg)
+{
+	struct tput_receiver *receivers;
+	struct tput_sender *senders;
+	struct kdbus_bench_hist hist;
+	uint64_t start, diff, sent = 0, busy = 0, received = 0, bytes = 0;
+	char params[256];
+	unsigned int i;
+	int ret;
+
+	receivers = calloc(cfg->receivers, sizeof(*receivers));
+	senders = calloc(cfg->senders, sizeof(*senders));
+	ASSERT_RETURN(receivers && senders);
+
+	tput_stop_senders = false;
+	tput_stop_receivers = false;
+
+	for (i = 0; i < cfg->receivers; i++) {
+		struct tput_receiver *r = &receivers[i];
+
+		r->conn = kdbus_hello(env->buspath, 0, NULL, 0);
+		ASSERT_RETURN(r->conn);
+
+		ret = kdbus_conn_update_attach_flags(r->conn,
+					tput_attach_flags[cfg->attach]);
+		ASSERT_RETURN(ret == 0);
+
+		snprintf(r->name, sizeof(r->name),
+			 "foo.bar.benchmark.r%u", i);
+
+		if (cfg->dst == TPUT_DST_NAME) {
+			ret = kdbus_name_acquire(r->conn, r->name, NULL);
+			ASSERT_RETURN(ret == 0);
+		}
+
+		kdbus_bench_hist_init(&r->hist);
+	}
+
+	for (i = 0; i < cfg->senders; i++) {
+		senders[i].conn = kdbus_hello(env->buspath, 0, NULL, 0);
+		ASSERT_RETURN(senders[i].conn);
+		senders[i].cfg = cfg;
+		senders[i].receivers = receivers;
+	}
+
+	for (i = 0; i < cfg->receivers; i++) {
+		ret = pthread_create(&receivers[i].thread, NULL,
+				     tput_receiver_thread, &receivers[i]);
+		ASSERT_RETURN(ret == 0);
+	}
+
+	start = kdbus_bench_now();
+
+	for (i = 0; i < cfg->senders; i++) {
+		ret = pthread_create(&senders[i].thread, NULL,
+				     tput_sender_thread, &senders[i]);
+		ASSERT_RETURN(ret == 0);
+	}
+
+	usleep(cfg->duration_ms * 1000);
+	tput_stop_senders = true;
+
+	for (i = 0; i < cfg->senders; i++) {
+		pthread_join(senders[i].thread, NULL);
+		ASSERT_RETURN(senders[i].ret == 0);
+		sent += senders[i].sent;
+		busy += senders[i].busy;
+	}
+
+	tput_stop_receivers = true;
+	kdbus_bench_hist_init(&hist);
+
+	for (i = 0; i < cfg->receivers; i++) {
+		pthread_join(receivers[i].thread, NULL);
+		ASSERT_RETURN(receivers[i].ret == 0);
+		received += receivers[i].received;
+		bytes += receivers[i].bytes;
+		kdbus_bench_hist_merge(&hist, &receivers[i].hist);
+	}
+
+	diff = kdbus_bench_now() - start;
+
+	ASSERT_RETURN(received == sent);
+
+	snprintf(params, sizeof(params),
+		 "size=%llu payload=%s senders=%llu receivers=%llu dst=%s attach=%s busy=%llu",
+		 (unsigned long long) cfg->size,
+		 tput_payload_names[cfg->payload],
+		 (unsigned long long) cfg->senders,
+		 (unsigned long long) cfg->receivers,
+		 tput_dst_names[cfg->dst],
+		 tput_attach_names[cfg->attach],
+		 (unsigned long long) busy);
+
+	kdbus_bench_report(env->output, "throughput", params,
+			   received, bytes, diff, &hist);
+
+	for (i = 0; i < cfg->senders; i++)
+		kdbus_conn_free(senders[i].conn);
+
+	for (i = 0; i < cfg->receivers; i++)
+		kdbus_conn_free(receivers[i].conn);
+
+	free(senders);
+	free(receivers);
+
+	return TEST_OK;
+}
+
+int kdbus_test_benchmark_throughput(struct kdbus_test_env *env)
+{
+	uint64_t sizes[TPUT_MAX_VALUES], senders[TPUT_MAX_VALUES];
+	uint64_t receivers[TPUT_MAX_VALUES], duration;
+	unsigned int payloads[TPUT_MAX_VALUES], dsts[TPUT_MAX_VALUES];
+	unsigned int attach[TPUT_MAX_VALUES];
+	unsigned int n_sizes, n_payloads, n_senders, n_receivers;
+	unsigned int n_dsts, n_attach, n, i, k;
+	struct tput_config cfg;
+	int ret;
+
+	setlocale(LC_ALL, "");
+
+	n_sizes = kdbus_bench_arg_u64(env->args, "size", "0:4K:2M",
+				      sizes, TPUT_MAX_VALUES);
+	n_payloads = kdbus_bench_arg_enum(env->args, "payload", "vec:memfd",
+					  tput_payload_names, payloads,
+					  TPUT_MAX_VALUES);
+	n_senders = kdbus_bench_arg_u64(env->args, "senders", "1:4",
+					senders, TPUT_MAX_VALUES);
+	n_receivers = kdbus_bench_arg_u64(env->args, "receivers", "1:4",
+					  receivers, TPUT_MAX_VALUES);
+	n_dsts = kdbus_bench_arg_enum(env->args, "dst", "id",
+				      tput_dst_names, dsts, TPUT_MAX_VALUES);
+	n_attach = kdbus_bench_arg_enum(env->args, "attach", "none",
+					tput_attach_names, attach,
+					TPUT_MAX_VALUES);
+	ASSERT_RETURN(n_sizes && n_payloads && n_senders && n_receivers &&
+		      n_dsts && n_attach);
+	ASSERT_RETURN(kdbus_bench_arg_u64(env->args, "duration", "100",
+					  &duration, 1) == 1);
+
+	n = n_sizes * n_payloads * n_senders * n_receivers * n_dsts * n_attach;
+
+	/* walk all combinations, the last parameter changes fastest */
+	for (i = 0; i < n; i++) {
+		k = i;
+		cfg.attach = attach[k % n_attach];
+		k /= n_attach;
+		cfg.dst = dsts[k % n_dsts];
+		k /= n_dsts;
+		cfg.receivers = receivers[k % n_receivers];
+		k /= n_receivers;
+		cfg.senders = senders[k % n_senders];
+		k /= n_senders;
+		cfg.payload = payloads[k % n_payloads];
+		k /= n_payloads;
+		cfg.size = sizes[k];
+		cfg.duration_ms = duration;
+
+		/* memfds are not worth sending without a payload */
+		if (cfg.size == 0 && cfg.payload == TPUT_PAYLOAD_MEMFD)
+			continue;
+
+		ASSERT_RETURN(cfg.size <= 2 * 1024 * 1024);
+		ASSERT_RETURN(cfg.senders > 0 &&
+			      cfg.senders <= TPUT_MAX_THREADS);
+		ASSERT_RETURN(cfg.receivers > 0 &&
+			      cfg.receivers <= TPUT_MAX_THREADS);
+
+		ret = tput_run(env, &cfg);
+		ASSERT_RETURN(ret == TEST_OK);
+	}
+
+	return TEST_OK;
+}
+
+/*
+ * Broadcast benchmark: K connections with R bloom mask rules each, of which
+ * only a fraction subscribes to the broadcasts that are sent; the matching
+ * rule of a subscriber is its last one. The time the sender spends in the
+ * ioctl shows the cost of walking all connections and rules, the receivers
+ * record the delivery latency. Broadcasts are sent one at a time, the next
+ * one once all subscribers received the previous one. The receivers do
+ * not ask for metadata, to leave only the matching to measure.
+ *
+ * Each parameter takes a ':'-separated list, and every combination is run:
+ *
+ *   conns=K		receiving connections
+ *   rules=R		bloom mask rules per connection
+ *   subscribers=PCT	percentage of connections with a matching rule
+ *   bloom=BYTES	bloom filter size of the bus, 8 to 4K
+ *   size=BYTES		payload size
+ *   count=N		broadcasts to send, per combination
+ */
+
+#define BCAST_MAX_CONNS		250
+#define BCAST_MAX_VALUES	16
+
+struct bcast_config {
+	uint64_t conns;
+	uint64_t rules;
+	uint64_t subscribers;
+	uint64_t bloom;
+	uint64_t size;
+	uint64_t count;
+};
+
+struct bcast_receivers {
+	pthread_t thread;
+	struct kdbus_conn *conns[BCAST_MAX_CONNS];
+	unsigned int n_conns;
+	struct kdbus_bench_hist hist;
+	uint64_t delivered;
+	uint64_t bytes;
+	bool stop;
+	int ret;
+};
+
+static int bcast_match_add(struct kdbus_conn *conn, uint64_t cookie,
+			   uint64_t bloom_size, unsigned int bit)
+{
+	struct kdbus_cmd_match *cmd;
+	struct kdbus_item *item;
+	uint64_t size;
+	int ret;
+
+	size = sizeof(*cmd) + KDBUS_ITEM_SIZE(bloom_size);
+
+	cmd = calloc(1, size);
+	ASSERT_RETURN_VAL(cmd, -ENOMEM);
+
+	cmd->size = size;
+	cmd->cookie = cookie;
+
+	item = cmd->items;
+	item->type = KDBUS_ITEM_BLOOM_MASK;
+	item->size = KDBUS_ITEM_HEADER_SIZE + bloom_size;
+	item->data[bit / 8] |= 1 << (bit % 8);
+
+	ret = ioctl(conn->fd, KDBUS_CMD_MATCH_ADD, cmd);
+	free(cmd);
+	ASSERT_RETURN_VAL(ret == 0, -errno);
+
+	return 0;
+}
+
+static int bcast_recv(struct bcast_receivers *r, struct kdbus_conn *conn)
+{
+	struct kdbus_cmd_recv recv = {};
+	const struct kdbus_item *item;
+	struct kdbus_msg *msg;
+	uint64_t now_ns;
+	int ret;
+
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+	if (ret < 0 && errno == EAGAIN)
+		return -EAGAIN;
+
+	ASSERT_RETURN_VAL(ret == 0, -errno);
+
+	now_ns = kdbus_bench_now();
+	msg = (struct kdbus_msg *)(conn->buf + recv.offset);
+
+	KDBUS_ITEM_FOREACH(item, msg, items)
+		if (item->type == KDBUS_ITEM_PAYLOAD_OFF &&
+		    item->vec.offset != ~0ULL)
+			r->bytes += item->vec.size;
+
+	kdbus_bench_hist_add(&r->hist, now_ns - msg->cookie);
+
+	ret = kdbus_free(conn, recv.offset);
+	ASSERT_RETURN_VAL(ret == 0, -errno);
+
+	__atomic_add_fetch(&r->delivered, 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+static void *bcast_receiver_thread(void *data)
+{
+	struct bcast_receivers *r = data;
+	struct pollfd fds[BCAST_MAX_CONNS];
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < r->n_conns; i++) {
+		fds[i].fd = r->conns[i]->fd;
+		fds[i].events = POLLIN;
+	}
+
+	while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) {
+		ret = poll(fds, r->n_conns, 10);
+		if (ret < 0) {
+			r->ret = -errno;
+			break;
+		}
+
+		for (i = 0; ret > 0 && i < r->n_conns; i++) {
+			if (!(fds[i].revents & POLLIN))
+				continue;
+
+			while ((ret = bcast_recv(r, r->conns[i])) == 0)
+				;
+
+			if (ret != -EAGAIN) {
+				r->ret = ret;
+				return NULL;
+			}
+
+			ret = 1;
+		}
+	}
+
+	return NULL;
+}
+
+static struct kdbus_msg *bcast_msg_new(const struct bcast_config *cfg,
+				       const void *data)
+{
+	struct kdbus_msg *msg;
+	struct kdbus_item *item;
+	uint64_t size;
+
+	size = sizeof(struct kdbus_msg);
+	size += KDBUS_ITEM_SIZE(sizeof(struct kdbus_bloom_filter) +
+				cfg->bloom);
+	if (cfg->size > 0)
+		size += KDBUS_ITEM_SIZE(sizeof(struct kdbus_vec));
+
+	msg = calloc(1, size);
+	if (!msg)
+		return NULL;
+
+	msg->size = size;
+	msg->dst_id = KDBUS_DST_ID_BROADCAST;
+	msg->payload_type = KDBUS_PAYLOAD_DBUS;
+
+	/* bit 0 is what the subscribers' last rule asks for */
+	item = msg->items;
+	item->type = KDBUS_ITEM_BLOOM_FILTER;
+	item->size = KDBUS_ITEM_HEADER_SIZE +
+		     sizeof(struct kdbus_bloom_filter) + cfg->bloom;
+	item->bloom_filter.data[0] = 1;
+	item = KDBUS_ITEM_NEXT(item);
+
+	if (cfg->size > 0) {
+		item->type = KDBUS_ITEM_PAYLOAD_VEC;
+		item->size = KDBUS_ITEM_HEADER_SIZE + sizeof(struct kdbus_vec);
+		item->vec.address = (uintptr_t) data;
+		item->vec.size = cfg->size;
+	}
+
+	return msg;
+}
+
+static int bcast_run(struct kdbus_test_env *env,
+		     const struct bcast_config *cfg, unsigned int run)
+{
+	struct bcast_receivers r = {};
+	struct kdbus_bench_hist send_hist;
+	uint64_t start, now_ns, sent_ns, expected = 0;
+	unsigned int i, j, n_subscribers;
+	struct kdbus_conn *sender;
+	struct kdbus_msg *msg;
+	char name[32], params[256];
+	char *buspath = NULL;
+	void *payload;
+	int control_fd;
+	int ret;
+
+	/* the bloom size is a property of the bus, make one for this run */
+	control_fd = open("/dev/" KBUILD_MODNAME "/control", O_RDWR);
+	ASSERT_RETURN(control_fd >= 0);
+
+	snprintf(name, sizeof(name), "bench-bcast-%u-%u", getpid(), run);
+	ret = kdbus_create_bus_bloom(control_fd, name, cfg->bloom, &buspath);
+	ASSERT_RETURN(ret == 0);
+
+	sender = kdbus_hello(buspath, 0, NULL, 0);
+	ASSERT_RETURN(sender);
+
+	n_subscribers = (cfg->conns * cfg->subscribers + 50) / 100;
+	r.n_conns = cfg->conns;
+
+	for (i = 0; i < r.n_conns; i++) {
+		r.conns[i] = kdbus_hello(buspath, 0, NULL, 0);
+		ASSERT_RETURN(r.conns[i]);
+
+		ret = kdbus_conn_update_attach_flags(r.conns[i], 0);
+		ASSERT_RETURN(ret == 0);
+
+		/*
+		 * All rules but the last one of a subscriber ask for bits
+		 * the broadcasts never carry.
+		 */
+		for (j = 0; j < cfg->rules; j++) {
+			bool last = j == cfg->rules - 1;
+
+			ret = bcast_match_add(r.conns[i], j, cfg->bloom,
+					      last && i < n_subscribers ? 0 :
+					      1 + j % (cfg->bloom * 8 - 1));
+			ASSERT_RETURN(ret == 0);
+		}
+	}
+
+	payload = calloc(1, cfg->size ?: 1);
+	msg = bcast_msg_new(cfg, payload);
+	ASSERT_RETURN(payload && msg);
+
+	kdbus_bench_hist_init(&r.hist);
+	kdbus_bench_hist_init(&send_hist);
+
+	ret = pthread_create(&r.thread, NULL, bcast_receiver_thread, &r);
+	ASSERT_RETURN(ret == 0);
+
+	start = kdbus_bench_now();
+
+	for (i = 0; i < cfg->count; i++) {
+		sent_ns = kdbus_bench_now();
+		msg->cookie = sent_ns;
+
+		ret = ioctl(sender->fd, KDBUS_CMD_MSG_SEND, msg);
+		ASSERT_BREAK(ret == 0);
+
+		now_ns = kdbus_bench_now();
+		kdbus_bench_hist_add(&send_hist, now_ns - sent_ns);
+
+		/* wait for all subscribers, so queues never pile up */
+		expected += n_subscribers;
+		while (__atomic_load_n(&r.delivered, __ATOMIC_ACQUIRE) <
+		       expected && !r.ret &&
+		       kdbus_bench_now() - sent_ns < 1000000000ULL)
+			sched_yield();
+
+		ASSERT_BREAK(r.delivered == expected);
+	}
+
+	now_ns = kdbus_bench_now();
+
+	__atomic_store_n(&r.stop, true, __ATOMIC_RELEASE);
+	pthread_join(r.thread, NULL);
+
+	ASSERT_RETURN(i == cfg->count);
+	ASSERT_RETURN(r.ret == 0);
+	ASSERT_RETURN(r.delivered == expected);
+
+	snprintf(params, sizeof(params),
+		 "conns=%llu rules=%llu subscribers=%u bloom=%llu size=%llu",
+		 (unsigned long long) cfg->conns,
+		 (unsigned long long) cfg->rules,
+		 n_subscribers,
+		 (unsigned long long) cfg->bloom,
+		 (unsigned long long) cfg->size);
+
+	kdbus_bench_report(env->output, "broadcast-send", params,
+			   cfg->count, cfg->count * cfg->size,
+			   now_ns - start, &send_hist);
+	kdbus_bench_report(env->output, "broadcast-deliver", params,
+			   r.delivered, r.bytes, now_ns - start, &r.hist);
+
+	free(msg);
+	free(payload);
+
+	for (i = 0; i < r.n_conns; i++)
+		kdbus_conn_free(r.conns[i]);
+
+	kdbus_conn_free(sender);
+	free(buspath);
+	close(control_fd);
+
+	return TEST_OK;
+}
+
+int kdbus_test_benchmark_broadcast(struct kdbus_test_env *env)
+{
+	uint64_t conns[BCAST_MAX_VALUES], rules[BCAST_MAX_VALUES];
+	uint64_t subscribers[BCAST_MAX_VALUES], blooms[BCAST_MAX_VALUES];
+	uint64_t sizes[BCAST_MAX_VALUES], count;
+	unsigned int n_conns, n_rules, n_subscribers, n_blooms, n_sizes;
+	unsigned int n, i, k;
+	struct bcast_config cfg;
+	int ret;
+
+	setlocale(LC_ALL, "");
+
+	n_conns = kdbus_bench_arg_u64(env->args, "conns", "16:128",
+				      conns, BCAST_MAX_VALUES);
+	n_rules = kdbus_bench_arg_u64(env->args, "rules", "1:16",
+				      rules, BCAST_MAX_VALUES);
+	n_subscribers = kdbus_bench_arg_u64(env->args, "subscribers", "10:100",
+					    subscribers, BCAST_MAX_VALUES);
+	n_blooms = kdbus_bench_arg_u64(env->args, "bloom", "8:64:4K",
+				       blooms, BCAST_MAX_VALUES);
+	n_sizes = kdbus_bench_arg_u64(env->args, "size", "64",
+				      sizes, BCAST_MAX_VALUES);
+	ASSERT_RETURN(n_conns && n_rules && n_subscribers && n_blooms &&
+		      n_sizes);
+	ASSERT_RETURN(kdbus_bench_arg_u64(env->args, "count", "200",
+					  &count, 1) == 1);
+
+	n = n_conns * n_rules * n_subscribers * n_blooms * n_sizes;
+
+	/* walk all combinations, the last parameter changes fastest */
+	for (i = 0; i < n; i++) {
+		k = i;
+		cfg.size = sizes[k % n_sizes];
+		k /= n_sizes;
+		cfg.bloom = blooms[k % n_blooms];
+		k /= n_blooms;
+		cfg.subscribers = subscribers[k % n_subscribers];
+		k /= n_subscribers;
+		cfg.rules = rules[k % n_rules];
+		k /= n_rules;
+		cfg.conns = conns[k];
+		cfg.count = count;
+
+		ASSERT_RETURN(cfg.conns > 0 && cfg.conns <= BCAST_MAX_CONNS);
+		ASSERT_RETURN(cfg.rules > 0 && cfg.rules <= 256);
+		ASSERT_RETURN(cfg.subscribers <= 100);
+		ASSERT_RETURN(cfg.bloom >= 8 && cfg.bloom <= 4096 &&
+			      cfg.bloom % 8 == 0);
+
+		ret = bcast_run(env, &cfg, i);
+		ASSERT_RETURN(ret == TEST_OK);
+	}
+
+	return TEST_OK;
+}
+
+/*
+ * Method call benchmark: caller threads, each on its own connection, call
+ * a service whose connection is served by a pool of threads, and record
+ * the round-trip time of every call. Calls are either synchronous, with
+ * KDBUS_MSG_FLAGS_SYNC_REPLY, or asynchronous, with the caller polling for
+ * the reply; either way, each caller has one call in flight.
+ *
+ * Each parameter takes a ':'-separated list, and every combination is run:
+ *
+ *   mode=sync|async	how the reply is waited for
+ *   callers=N		caller threads
+ *   servers=N		threads serving the service
+ *   size=BYTES		payload size of calls and replies
+ *   attach=none|timestamp|creds|names|all
+ *			metadata the service and the callers ask for
+ *   duration=MS	time to call, per combination
+ */
+
+#define CALL_SERVICE		"foo.bar.benchmark.call"
+#define CALL_MAX_THREADS	64
+#define CALL_MAX_VALUES		16
+
+enum {
+	CALL_MODE_SYNC,
+	CALL_MODE_ASYNC,
+};
+
+static const char * const call_mode_names[] = { "sync", "async", NULL };
+
+struct call_config {
+	unsigned int mode;
+	uint64_t callers;
+	uint64_t servers;
+	uint64_t size;
+	unsigned int attach;
+	uint64_t duration_ms;
+};
+
+struct call_thread {
+	pthread_t thread;
+	struct kdbus_conn *conn;
+	const struct call_config *cfg;
+	struct kdbus_bench_hist hist;
+	uint64_t calls;
+	int ret;
+};
+
+static volatile bool call_stop_callers;
+static volatile bool call_stop_servers;
+
+static struct kdbus_msg *call_msg_new(const struct call_config *cfg,
+				      const char *name, const void *data)
+{
+	struct kdbus_msg *msg;
+	struct kdbus_item *item;
+	uint64_t size;
+
+	size = sizeof(struct kdbus_msg);
+	if (name)
+		size += KDBUS_ITEM_SIZE(strlen(name) + 1);
+	if (cfg->size > 0)
+		size += KDBUS_ITEM_SIZE(sizeof(struct kdbus_vec));
+
+	msg = calloc(1, size);
+	if (!msg)
+		return NULL;
+
+	msg->size = size;
+	msg->payload_type = KDBUS_PAYLOAD_DBUS;
+
+	item = msg->items;
+
+	if (name) {
+		msg->dst_id = KDBUS_DST_ID_NAME;
+		item->type = KDBUS_ITEM_DST_NAME;
+		item->size = KDBUS_ITEM_HEADER_SIZE + strlen(name) + 1;
+		strcpy(item->str, name);
+		item = KDBUS_ITEM_NEXT(item);
+	}
+
+	if (cfg->size > 0) {
+		item->type = KDBUS_ITEM_PAYLOAD_VEC;
+		item->size = KDBUS_ITEM_HEADER_SIZE + sizeof(struct kdbus_vec);
+		item->vec.address = (uintptr_t) data;
+		item->vec.size = cfg->size;
+	}
+
+	return msg;
+}
+
+/* wait for the reply to an asynchronous call, and free it */
+static int call_wait_reply(struct kdbus_conn *conn, uint64_t cookie)
+{
+	struct kdbus_cmd_recv recv = {};
+	struct kdbus_msg *msg;
+	struct pollfd fd;
+	bool found;
+	int ret;
+
+	fd.fd = conn->fd;
+	fd.events = POLLIN;
+
+	do {
+		ret = poll(&fd, 1, 1000);
+		ASSERT_RETURN_VAL(ret > 0, -ETIMEDOUT);
+
+		ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+		if (ret < 0 && errno == EAGAIN)
+			continue;
+
+		ASSERT_RETURN_VAL(ret == 0, -errno);
+
+		msg = (struct kdbus_msg *)(conn->buf + recv.offset);
+		found = msg->cookie_reply == cookie;
+
+		ret = kdbus_free(conn, recv.offset);
+		ASSERT_RETURN_VAL(ret == 0, -errno);
+	} while (!found);
+
+	return 0;
+}
+
+static void *call_caller_thread(void *data)
+{
+	struct call_thread *c = data;
+	const struct call_config *cfg = c->cfg;
+	struct kdbus_msg *msg;
+	uint64_t start, cookie = 0;
+	void *payload;
+	int ret;
+
+	payload = calloc(1, cfg->size ?: 1);
+	msg = call_msg_new(cfg, CALL_SERVICE, payload);
+	if (!payload || !msg) {
+		c->ret = -ENOMEM;
+		goto exit;
+	}
+
+	msg->flags = KDBUS_MSG_FLAGS_EXPECT_REPLY;
+	if (cfg->mode == CALL_MODE_SYNC)
+		msg->flags |= KDBUS_MSG_FLAGS_SYNC_REPLY;
+
+	while (!call_stop_callers) {
+		start = kdbus_bench_now();
+		msg->cookie = ++cookie;
+		msg->timeout_ns = start + 1000000000ULL;
+
+		ret = ioctl(c->conn->fd, KDBUS_CMD_MSG_SEND, msg);
+		if (ret < 0) {
+			c->ret = -errno;
+			break;
+		}
+
+		/* a synchronous call returns with the reply in the pool */
+		if (cfg->mode == CALL_MODE_SYNC)
+			ret = kdbus_free(c->conn, msg->offset_reply);
+		else
+			ret = call_wait_reply(c->conn, cookie);
+
+		if (ret < 0) {
+			c->ret = ret;
+			break;
+		}
+
+		kdbus_bench_hist_add(&c->hist, kdbus_bench_now() - start);
+		c->calls++;
+	}
+
+exit:
+	free(msg);
+	free(payload);
+	return NULL;
+}
+
+static void *call_server_thread(void *data)
+{
+	struct call_thread *s = data;
+	struct kdbus_cmd_recv recv = {};
+	struct kdbus_msg *msg, *reply;
+	struct pollfd fd;
+	void *payload;
+	int ret;
+
+	payload = calloc(1, s->cfg->size ?: 1);
+	reply = call_msg_new(s->cfg, NULL, payload);
+	if (!payload || !reply) {
+		s->ret = -ENOMEM;
+		goto exit;
+	}
+
+	/* all threads serve the same connection */
+	fd.fd = s->conn->fd;
+	fd.events = POLLIN;
+
+	while (!call_stop_servers) {
+		ret = poll(&fd, 1, 10);
+		if (ret <= 0)
+			continue;
+
+		recv.offset = 0;
+		ret = ioctl(s->conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+		if (ret < 0 && errno == EAGAIN)
+			continue;
+
+		if (ret < 0) {
+			s->ret = -errno;
+			break;
+		}
+
+		msg = (struct kdbus_msg *)(s->conn->buf + recv.offset);
+		reply->dst_id = msg->src_id;
+		reply->cookie_reply = msg->cookie;
+
+		ret = kdbus_free(s->conn, recv.offset);
+		if (ret < 0) {
+			s->ret = ret;
+			break;
+		}
+
+		ret = ioctl(s->conn->fd, KDBUS_CMD_MSG_SEND, reply);
+		if (ret < 0) {
+			s->ret = -errno;
+			break;
+		}
+
+		s->calls++;
+	}
+
+exit:
+	free(reply);
+	free(payload);
+	return NULL;
+}
+
+static int call_run(struct kdbus_test_env *env, const struct call_config *cfg)
+{
+	struct call_thread *callers, *servers;
+	struct kdbus_bench_hist hist;
+	struct kdbus_conn *service;
+	uint64_t start, diff, calls = 0, served = 0;
+	char params[256];
+	unsigned int i;
+	int ret;
+
+	callers = calloc(cfg->callers, sizeof(*callers));
+	servers = calloc(cfg->servers, sizeof(*servers));
+	ASSERT_RETURN(callers && servers);
+
+	call_stop_callers = false;
+	call_stop_servers = false;
+
+	service = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(service);
+
+	ret = kdbus_conn_update_attach_flags(service,
+					     tput_attach_flags[cfg->attach]);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_name_acquire(service, CALL_SERVICE, NULL);
+	ASSERT_RETURN(ret == 0);
+
+	for (i = 0; i < cfg->callers; i++) {
+		callers[i].conn = kdbus_hello(env->buspath, 0, NULL, 0);
+		ASSERT_RETURN(callers[i].conn);
+
+		ret = kdbus_conn_update_attach_flags(callers[i].conn,
+					tput_attach_flags[cfg->attach]);
+		ASSERT_RETURN(ret == 0);
+
+		callers[i].cfg = cfg;
+		kdbus_bench_hist_init(&callers[i].hist);
+	}
+
+	for (i = 0; i < cfg->servers; i++) {
+		servers[i].conn = service;
+		servers[i].cfg = cfg;
+
+		ret = pthread_create(&servers[i].thread, NULL,
+				     call_server_thread, &servers[i]);
+		ASSERT_RETURN(ret == 0);
+	}
+
+	start = kdbus_bench_now();
+
+	for (i = 0; i < cfg->callers; i++) {
+		ret = pthread_create(&callers[i].thread, NULL,
+				     call_caller_thread, &callers[i]);
+		ASSERT_RETURN(ret == 0);
+	}
+
+	usleep(cfg->duration_ms * 1000);
+	call_stop_callers = true;
+
+	kdbus_bench_hist_init(&hist);
+
+	for (i = 0; i < cfg->callers; i++) {
+		pthread_join(callers[i].thread, NULL);
+		ASSERT_RETURN(callers[i].ret == 0);
+		calls += callers[i].calls;
+		kdbus_bench_hist_merge(&hist, &callers[i].hist);
+	}
+
+	diff = kdbus_bench_now() - start;
+
+	/* every call was answered before its caller stopped */
+	call_stop_servers = true;
+
+	for (i = 0; i < cfg->servers; i++) {
+		pthread_join(servers[i].thread, NULL);
+		ASSERT_RETURN(servers[i].ret == 0);
+		served += servers[i].calls;
+	}
+
+	ASSERT_RETURN(served == calls);
+
+	snprintf(params, sizeof(params),
+		 "callers=%llu servers=%llu size=%llu attach=%s",
+		 (unsigned long long) cfg->callers,
+		 (unsigned long long) cfg->servers,
+		 (unsigned long long) cfg->size,
+		 tput_attach_names[cfg->attach]);
+
+	kdbus_bench_report(env->output,
+			   cfg->mode == CALL_MODE_SYNC ? "sync-call" :
+							 "async-call",
+			   params, calls, calls * cfg->size * 2, diff, &hist);
+
+	for (i = 0; i < cfg->callers; i++)
+		kdbus_conn_free(callers[i].conn);
+
+	kdbus_conn_free(service);
+	free(servers);
+	free(callers);
+
+	return TEST_OK;
+}
+
+int kdbus_test_benchmark_call(struct kdbus_test_env *env)
+{
+	uint64_t callers[CALL_MAX_VALUES], servers[CALL_MAX_VALUES];
+	uint64_t sizes[CALL_MAX_VALUES], duration;
+	unsigned int modes[CALL_MAX_VALUES], attach[CALL_MAX_VALUES];
+	unsigned int n_modes, n_callers, n_servers, n_sizes, n_attach;
+	unsigned int n, i, k;
+	struct call_config cfg;
+	int ret;
+
+	setlocale(LC_ALL, "");
+
+	n_modes = kdbus_bench_arg_enum(env->args, "mode", "sync:async",
+				       call_mode_names, modes,
+				       CALL_MAX_VALUES);
+	n_callers = kdbus_bench_arg_u64(env->args, "callers", "1:4",
+					callers, CALL_MAX_VALUES);
+	n_servers = kdbus_bench_arg_u64(env->args, "servers", "1:4",
+					servers, CALL_MAX_VALUES);
+	n_sizes = kdbus_bench_arg_u64(env->args, "size", "0:4K",
+				      sizes, CALL_MAX_VALUES);
+	n_attach = kdbus_bench_arg_enum(env->args, "attach", "none:all",
+					tput_attach_names, attach,
+					CALL_MAX_VALUES);
+	ASSERT_RETURN(n_modes && n_callers && n_servers && n_sizes &&
+		      n_attach);
+	ASSERT_RETURN(kdbus_bench_arg_u64(env->args, "duration", "100",
+					  &duration, 1) == 1);
+
+	n = n_modes * n_callers * n_servers * n_sizes * n_attach;
+
+	/* walk all combinations, the last parameter changes fastest */
+	for (i = 0; i < n; i++) {
+		k = i;
+		cfg.attach = attach[k % n_attach];
+		k /= n_attach;
+		cfg.size = sizes[k % n_sizes];
+		k /= n_sizes;
+		cfg.servers = servers[k % n_servers];
+		k /= n_servers;
+		cfg.callers = callers[k % n_callers];
+		k /= n_callers;
+		cfg.mode = modes[k];
+		cfg.duration_ms = duration;
+
+		ASSERT_RETURN(cfg.size <= 2 * 1024 * 1024);
+		ASSERT_RETURN(cfg.callers > 0 &&
+			      cfg.callers <= CALL_MAX_THREADS);
+		ASSERT_RETURN(cfg.servers > 0 &&
+			      cfg.servers <= CALL_MAX_THREADS);
+
+		ret = call_run(env, &cfg);
+		ASSERT_RETURN(ret == TEST_OK);
+	}
+
+	return TEST_OK;
+}
@@ -11,6 +11,7 @@
 #include <sys/capability.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/prctl.h>
 #include <stdbool.h>
 
 #include "kdbus-util.h"
@@ -318,6 +319,64 @@ int kdbus_test_conn_update(struct kdbus_test_env *env)
 	return TEST_OK;
 }
 
+static int conn_recv_pid_comm(struct kdbus_conn *conn, char *comm)
+{
+	struct kdbus_item *item;
+	struct kdbus_msg *msg;
+	bool found = false;
+	int ret;
+
+	ret = kdbus_msg_recv(conn, &msg, NULL);
+	ASSERT_RETURN(ret == 0);
+
+	KDBUS_ITEM_FOREACH(item, msg, items)
+		if (item->type == KDBUS_ITEM_PID_COMM) {
+			strncpy(comm, item->str, 16);
+			found = true;
+		}
+
+	kdbus_msg_free(msg);
+
+	return found ? 0 : -ENOENT;
+}
+
+int kdbus_test_conn_meta_cache(struct kdbus_test_env *env)
+{
+	char comm[16], old_comm[16], new_comm[16] = "kdbus-meta";
+	struct kdbus_conn *conn;
+	int ret;
+
+	conn = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(conn);
+
+	ret = prctl(PR_GET_NAME, old_comm, 0, 0, 0);
+	ASSERT_RETURN(ret == 0);
+
+	/* the metadata of the sender is collected and cached */
+	ret = kdbus_msg_send(env->conn, NULL, 0x1000, 0, 0, 0, conn->id);
+	ASSERT_RETURN(ret == 0);
+
+	ret = conn_recv_pid_comm(conn, comm);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(strncmp(comm, old_comm, sizeof(comm)) == 0);
+
+	/* a changed comm name must not be served from the cache */
+	ret = prctl(PR_SET_NAME, new_comm, 0, 0, 0);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_msg_send(env->conn, NULL, 0x1001, 0, 0, 0, conn->id);
+	ASSERT_RETURN(ret == 0);
+
+	ret = conn_recv_pid_comm(conn, comm);
+	prctl(PR_SET_NAME, old_comm, 0, 0, 0);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(strncmp(comm, new_comm, sizeof(comm)) == 0);
+
+	kdbus_conn_free(conn);
+
+	return TEST_OK;
+}
+
 int kdbus_test_writable_pool(struct kdbus_test_env *env)
 {
 	struct kdbus_cmd_hello hello;
@@ -354,3 +413,152 @@ int kdbus_test_writable_pool(struct kdbus_test_env *env)
 
 	return TEST_OK;
 }
+
+static int conn_info_count_names(struct kdbus_conn *conn, uint64_t id,
+				 uint64_t flags, const char *name)
+{
+	const struct kdbus_item *item;
+	struct kdbus_info *info;
+	uint64_t offset;
+	int ret, found = 0;
+
+	ret = kdbus_info(conn, id, NULL, flags, &offset);
+	ASSERT_RETURN_VAL(ret == 0, -1);
+
+	info = (struct kdbus_info *)(conn->buf + offset);
+	ASSERT_RETURN_VAL(info->id == id, -1);
+
+	KDBUS_ITEM_FOREACH(item, info, items)
+		if (item->type == KDBUS_ITEM_NAME &&
+		    strcmp(item->name.name, name) == 0)
+			found++;
+
+	kdbus_free(conn, offset);
+
+	return found;
+}
+
+int kdbus_test_conn_info_names(struct kdbus_test_env *env)
+{
+	static const char *name = "foo.bar.info";
+	struct kdbus_conn *conn;
+	int ret;
+
+	conn = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(conn);
+
+	ret = conn_info_count_names(env->conn, conn->id,
+				    KDBUS_ATTACH_NAMES, name);
+	ASSERT_RETURN(ret == 0);
+
+	/* repeated queries must see names acquired in between */
+	ret = kdbus_name_acquire(conn, name, NULL);
+	ASSERT_RETURN(ret == 0);
+
+	ret = conn_info_count_names(env->conn, conn->id,
+				    KDBUS_ATTACH_NAMES, name);
+	ASSERT_RETURN(ret == 1);
+
+	ret = conn_info_count_names(env->conn, conn->id, 0, name);
+	ASSERT_RETURN(ret == 0);
+
+	ret = conn_info_count_names(env->conn, conn->id,
+				    KDBUS_ATTACH_NAMES, name);
+	ASSERT_RETURN(ret == 1);
+
+	/* ... and released ones */
+	ret = kdbus_name_release(conn, name);
+	ASSERT_RETURN(ret == 0);
+
+	ret = conn_info_count_names(env->conn, conn->id,
+				    KDBUS_ATTACH_NAMES, name);
+	ASSERT_RETURN(ret == 0);
+
+	kdbus_conn_free(conn);
+
+	return TEST_OK;
+}
+
+static struct kdbus_item *info_list_add_id(struct kdbus_item *item, uint64_t id)
+{
+	item->size = KDBUS_ITEM_HEADER_SIZE + sizeof(uint64_t);
+	item->type = KDBUS_ITEM_ID;
+	item->id = id;
+
+	return KDBUS_ITEM_NEXT(item);
+}
+
+static struct kdbus_item *info_list_add_name(struct kdbus_item *item,
+					     const char *name)
+{
+	item->size = KDBUS_ITEM_HEADER_SIZE + strlen(name) + 1;
+	item->type = KDBUS_ITEM_NAME;
+	strcpy(item->str, name);
+
+	return KDBUS_ITEM_NEXT(item);
+}
+
+int kdbus_test_conn_info_list(struct kdbus_test_env *env)
+{
+	static const char *name = "foo.bar.list";
+	uint64_t expected[4], buf[128];
+	struct kdbus_cmd_info_list *cmd;
+	struct kdbus_info_list *list;
+	struct kdbus_info *info;
+	struct kdbus_item *item;
+	struct kdbus_conn *conn;
+	unsigned int i;
+	int ret;
+
+	conn = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(conn);
+
+	ret = kdbus_name_acquire(conn, name, NULL);
+	ASSERT_RETURN(ret == 0);
+
+	memset(buf, 0, sizeof(buf));
+	cmd = (struct kdbus_cmd_info_list *)buf;
+	cmd->flags = KDBUS_ATTACH_NAMES;
+
+	/* two known connections, an unknown ID and an unknown name */
+	item = info_list_add_id(cmd->items, env->conn->id);
+	item = info_list_add_name(item, name);
+	item = info_list_add_id(item, 0x7fffffff);
+	item = info_list_add_name(item, "foo.bar.unknown");
+	cmd->size = (uint8_t *)item - (uint8_t *)cmd;
+
+	expected[0] = env->conn->id;
+	expected[1] = conn->id;
+	expected[2] = 0;
+	expected[3] = 0;
+
+	ret = ioctl(env->conn->fd, KDBUS_CMD_CONN_INFO_LIST, cmd);
+	ASSERT_RETURN(ret == 0);
+
+	list = (struct kdbus_info_list *)(env->conn->buf + cmd->offset);
+	info = list->infos;
+	for (i = 0; i < 4; i++) {
+		ASSERT_RETURN((uint8_t *)info < (uint8_t *)list + list->size);
+		ASSERT_RETURN(info->id == expected[i]);
+		if (expected[i] == 0)
+			ASSERT_RETURN(info->size == sizeof(*info));
+
+		info = (struct kdbus_info *)((uint8_t *)info + info->size);
+	}
+
+	ASSERT_RETURN((uint8_t *)info == (uint8_t *)list + list->size);
+
+	kdbus_free(env->conn, cmd->offset);
+
+	/* only IDs and names may be queried */
+	item = cmd->items;
+	item->size = KDBUS_ITEM_HEADER_SIZE + sizeof(uint64_t);
+	item->type = KDBUS_ITEM_ATTACH_FLAGS;
+	cmd->size = sizeof(*cmd) + item->size;
+	ret = ioctl(env->conn->fd, KDBUS_CMD_CONN_INFO_LIST, cmd);
+	ASSERT_RETURN(ret == -1 && errno == EINVAL);
+
+	kdbus_conn_free(conn);
+
+	return TEST_OK;
+}
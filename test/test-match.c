@@ -256,6 +256,236 @@ int kdbus_test_match_name_change(struct kdbus_test_env *env)
 	return TEST_OK;
 }
 
+/* match the removal of any name */
+static int add_match_name_remove(struct kdbus_conn *conn)
+{
+	struct {
+		struct kdbus_cmd_match cmd;
+		struct {
+			uint64_t size;
+			uint64_t type;
+			struct kdbus_notify_name_change chg;
+		} item;
+	} buf;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.item.type = KDBUS_ITEM_NAME_REMOVE;
+	buf.item.chg.old_id.id = KDBUS_MATCH_ID_ANY;
+	buf.item.chg.new_id.id = KDBUS_MATCH_ID_ANY;
+	buf.item.size = sizeof(buf.item);
+	buf.cmd.size = sizeof(buf.cmd) + buf.item.size;
+
+	return ioctl(conn->fd, KDBUS_CMD_MATCH_ADD, &buf);
+}
+
+#define BATCH_NAMES 4
+
+int kdbus_test_match_name_batch(struct kdbus_test_env *env)
+{
+	struct kdbus_conn *batched, *owner;
+	struct kdbus_item *item, *end;
+	uint64_t generation = 0;
+	struct kdbus_msg *msg;
+	unsigned int i, count = 0;
+	char name[64];
+	int ret;
+
+	batched = kdbus_hello(env->buspath, KDBUS_HELLO_NOTIFY_BATCH, NULL, 0);
+	ASSERT_RETURN(batched);
+
+	owner = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(owner);
+
+	ret = add_match_name_remove(batched);
+	ASSERT_RETURN(ret == 0);
+
+	ret = add_match_name_remove(env->conn);
+	ASSERT_RETURN(ret == 0);
+
+	for (i = 0; i < BATCH_NAMES; i++) {
+		snprintf(name, sizeof(name), "foo.batch.n%u", i);
+		ret = kdbus_name_acquire(owner, name, NULL);
+		ASSERT_RETURN(ret == 0);
+	}
+
+	/* the owner releases all its names at once when it disconnects */
+	kdbus_conn_free(owner);
+
+	ret = kdbus_msg_recv(batched, &msg, NULL);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(msg->items[0].type == KDBUS_ITEM_NAME_BATCH);
+
+	item = (struct kdbus_item *)msg->items[0].data;
+	end = (struct kdbus_item *)((uint8_t *)msg->items +
+				    msg->items[0].size);
+	for (; item < end; item = KDBUS_ITEM_NEXT(item)) {
+		switch (item->type) {
+		case KDBUS_ITEM_NAME_REMOVE:
+			ASSERT_RETURN(strncmp(item->name_change.name,
+					      "foo.batch.", 10) == 0);
+			count++;
+			break;
+
+		case KDBUS_ITEM_NAME_GENERATION:
+			ASSERT_RETURN(item->name_generation > generation);
+			generation = item->name_generation;
+			break;
+
+		default:
+			ASSERT_RETURN(0);
+		}
+	}
+
+	ASSERT_RETURN(count == BATCH_NAMES);
+
+	ret = kdbus_msg_recv(batched, NULL, NULL);
+	ASSERT_RETURN(ret == -EAGAIN);
+
+	/* connections that did not opt in get one message per name */
+	for (i = 0; i < BATCH_NAMES; i++) {
+		ret = kdbus_msg_recv(env->conn, &msg, NULL);
+		ASSERT_RETURN(ret == 0);
+		ASSERT_RETURN(msg->items[0].type == KDBUS_ITEM_NAME_REMOVE);
+	}
+
+	ret = kdbus_msg_recv(env->conn, NULL, NULL);
+	ASSERT_RETURN(ret == -EAGAIN);
+
+	kdbus_conn_free(batched);
+
+	return TEST_OK;
+}
+
+/* match name additions of @name, or of any name if NULL */
+static int add_match_name_add(struct kdbus_conn *conn, uint64_t cookie,
+			      const char *name)
+{
+	struct {
+		struct kdbus_cmd_match cmd;
+		struct {
+			uint64_t size;
+			uint64_t type;
+			struct kdbus_notify_name_change chg;
+		} item;
+		char name[64];
+	} buf;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.item.type = KDBUS_ITEM_NAME_ADD;
+	buf.item.chg.old_id.id = KDBUS_MATCH_ID_ANY;
+	buf.item.chg.new_id.id = KDBUS_MATCH_ID_ANY;
+	buf.item.size = sizeof(buf.item);
+	if (name) {
+		strncpy(buf.name, name, sizeof(buf.name) - 1);
+		buf.item.size += strlen(buf.name) + 1;
+	}
+	buf.cmd.size = sizeof(buf.cmd) + buf.item.size;
+	buf.cmd.cookie = cookie;
+
+	return ioctl(conn->fd, KDBUS_CMD_MATCH_ADD, &buf);
+}
+
+int kdbus_test_match_index(struct kdbus_test_env *env)
+{
+	struct {
+		struct kdbus_cmd_match cmd;
+		struct {
+			uint64_t size;
+			uint64_t type;
+			struct kdbus_notify_id_change chg;
+		} item;
+	} buf;
+	struct kdbus_cmd_match cmd;
+	struct kdbus_conn *conn, *any;
+	struct kdbus_item *item;
+	struct kdbus_msg *msg;
+	int ret;
+
+	/* a match for one specific name only sees changes of that name */
+	ret = add_match_name_add(env->conn, 1, "foo.index.a");
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_name_acquire(env->conn, "foo.index.b", NULL);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_msg_recv(env->conn, NULL, NULL);
+	ASSERT_RETURN(ret == -EAGAIN);
+
+	ret = kdbus_name_acquire(env->conn, "foo.index.a", NULL);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_msg_recv(env->conn, &msg, NULL);
+	ASSERT_RETURN(ret == 0);
+	item = msg->items;
+	ASSERT_RETURN(item->type == KDBUS_ITEM_NAME_ADD);
+	ASSERT_RETURN(strcmp(item->name_change.name, "foo.index.a") == 0);
+	kdbus_msg_free(msg);
+
+	/* a match by type sees all notifications of that type */
+	memset(&buf, 0, sizeof(buf));
+	buf.cmd.size = sizeof(buf);
+	buf.cmd.cookie = 2;
+	buf.item.size = sizeof(buf.item);
+	buf.item.type = KDBUS_ITEM_ID_ADD;
+	buf.item.chg.id = KDBUS_MATCH_ID_ANY;
+
+	ret = ioctl(env->conn->fd, KDBUS_CMD_MATCH_ADD, &buf);
+	ASSERT_RETURN(ret == 0);
+
+	conn = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(conn);
+
+	ret = kdbus_msg_recv(env->conn, &msg, NULL);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(msg->items[0].type == KDBUS_ITEM_ID_ADD);
+	ASSERT_RETURN(msg->items[0].id_change.id == conn->id);
+	kdbus_msg_free(msg);
+
+	kdbus_conn_free(conn);
+
+	ret = kdbus_msg_recv(env->conn, NULL, NULL);
+	ASSERT_RETURN(ret == -EAGAIN);
+
+	/* removed matches are gone from the index */
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.size = sizeof(cmd);
+	cmd.cookie = 2;
+
+	ret = ioctl(env->conn->fd, KDBUS_CMD_MATCH_REMOVE, &cmd);
+	ASSERT_RETURN(ret == 0);
+
+	/* a match without rules sees every notification */
+	any = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(any);
+
+	ret = kdbus_msg_recv(env->conn, NULL, NULL);
+	ASSERT_RETURN(ret == -EAGAIN);
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.size = sizeof(cmd);
+	cmd.cookie = 3;
+
+	ret = ioctl(any->fd, KDBUS_CMD_MATCH_ADD, &cmd);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_name_release(env->conn, "foo.index.b");
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_msg_recv(any, &msg, NULL);
+	ASSERT_RETURN(ret == 0);
+	item = msg->items;
+	ASSERT_RETURN(item->type == KDBUS_ITEM_NAME_REMOVE);
+	ASSERT_RETURN(strcmp(item->name_change.name, "foo.index.b") == 0);
+	kdbus_msg_free(msg);
+
+	ret = kdbus_msg_recv(env->conn, NULL, NULL);
+	ASSERT_RETURN(ret == -EAGAIN);
+
+	kdbus_conn_free(any);
+
+	return TEST_OK;
+}
+
 static int send_bloom_filter(const struct kdbus_conn *conn,
 			     uint64_t cookie,
 			     const uint8_t *filter,
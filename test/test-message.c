@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <errno.h>
 #include <assert.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <stdbool.h>
 
@@ -118,6 +119,13 @@ int kdbus_test_message_prio(struct kdbus_test_env *env)
 	ASSERT_RETURN(msg_recv_prio(a, -400, -600) == -ENOMSG);
 	ASSERT_RETURN(msg_recv_prio(a, 10, -150) == 0);
 	ASSERT_RETURN(msg_recv_prio(a, 10, -100) == 0);
+	ASSERT_RETURN(msg_recv_prio(a, 10, -35) == 0);
+	ASSERT_RETURN(msg_recv_prio(a, 10, -15) == 0);
+	ASSERT_RETURN(msg_recv_prio(a, 10, -10) == 0);
+	ASSERT_RETURN(msg_recv_prio(a, 10, 10) == 0);
+	ASSERT_RETURN(msg_recv_prio(a, 10, 10) == 0);
+	ASSERT_RETURN(msg_recv_prio(a, 10, 20) == -ENOMSG);
+	ASSERT_RETURN(msg_recv_prio(a, 20, 20) == 0);
 
 	kdbus_printf("--- get priority (all)\n");
 	ASSERT_RETURN(kdbus_msg_recv(a, NULL, NULL) == 0);
@@ -157,3 +165,291 @@ int kdbus_test_message_quota(struct kdbus_test_env *env)
 
 	return TEST_OK;
 }
+
+struct recv_waiter {
+	pthread_t thread;
+	struct kdbus_conn *conn;
+	uint64_t queue;
+	uint64_t cookie;
+	volatile bool done;
+	int ret;
+};
+
+static void *recv_waiter_thread(void *data)
+{
+	struct recv_waiter *w = data;
+	struct kdbus_cmd_recv_queue recv = {
+		.recv.flags = KDBUS_RECV_WAIT,
+		.queue = w->queue,
+	};
+	struct kdbus_msg *msg;
+
+	if (ioctl(w->conn->fd, KDBUS_CMD_MSG_RECV_QUEUE, &recv) < 0) {
+		w->ret = -errno;
+	} else {
+		msg = (struct kdbus_msg *)(w->conn->buf + recv.recv.offset);
+		w->cookie = msg->cookie;
+		kdbus_msg_free(msg);
+		w->ret = kdbus_free(w->conn, recv.recv.offset);
+	}
+
+	w->done = true;
+	return NULL;
+}
+
+int kdbus_test_message_queues(struct kdbus_test_env *env)
+{
+	struct {
+		uint64_t size;
+		uint64_t type;
+		struct kdbus_recv_queues queues;
+	} item = {
+		.size = sizeof(item),
+		.type = KDBUS_ITEM_RECV_QUEUES,
+		.queues = {
+			.count = 4,
+			.steering = KDBUS_QUEUE_STEER_SRC_ID,
+		},
+	};
+	struct kdbus_conn *conn, *senders[3];
+	int64_t sender_queue[3] = { -1, -1, -1 };
+	struct recv_waiter waiters[2] = {};
+	struct kdbus_cmd_recv_queue recv = {};
+	unsigned int received = 0;
+	uint64_t cookie = 0;
+	struct kdbus_msg *msg;
+	unsigned int i, j;
+	int ret;
+
+	conn = kdbus_hello(env->buspath, 0, (struct kdbus_item *) &item,
+			   sizeof(item));
+	ASSERT_RETURN(conn);
+
+	for (i = 0; i < 3; i++) {
+		senders[i] = kdbus_hello(env->buspath, 0, NULL, 0);
+		ASSERT_RETURN(senders[i]);
+	}
+
+	for (j = 0; j < 3; j++)
+		for (i = 0; i < 3; i++) {
+			ret = kdbus_msg_send(senders[i], NULL, ++cookie,
+					     0, 0, 0, conn->id);
+			ASSERT_RETURN(ret == 0);
+		}
+
+	/* all messages of one sender end up in the same queue */
+	for (recv.queue = 0; recv.queue < 4; recv.queue++) {
+		uint64_t last_cookie = 0;
+
+		for (;;) {
+			ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV_QUEUE, &recv);
+			if (ret < 0 && errno == EAGAIN)
+				break;
+			ASSERT_RETURN(ret == 0);
+
+			msg = (struct kdbus_msg *)(conn->buf +
+						   recv.recv.offset);
+
+			for (i = 0; i < 3; i++)
+				if (senders[i]->id == msg->src_id)
+					break;
+			ASSERT_RETURN(i < 3);
+
+			if (sender_queue[i] < 0)
+				sender_queue[i] = recv.queue;
+			ASSERT_RETURN(sender_queue[i] == (int64_t) recv.queue);
+
+			/* FIFO order is kept within the queue */
+			ASSERT_RETURN(msg->cookie > last_cookie);
+			last_cookie = msg->cookie;
+
+			kdbus_msg_free(msg);
+			ret = kdbus_free(conn, recv.recv.offset);
+			ASSERT_RETURN(ret == 0);
+			received++;
+		}
+	}
+
+	ASSERT_RETURN(received == 9);
+
+	/* a non-existing queue */
+	recv.queue = 4;
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV_QUEUE, &recv);
+	ASSERT_RETURN(ret < 0 && errno == EINVAL);
+
+	/* waiting on a queue that has a message returns immediately */
+	ret = kdbus_msg_send(senders[0], NULL, ++cookie, 0, 0, 0, conn->id);
+	ASSERT_RETURN(ret == 0);
+
+	recv.queue = sender_queue[0];
+	recv.recv.flags = KDBUS_RECV_WAIT;
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV_QUEUE, &recv);
+	ASSERT_RETURN(ret == 0);
+
+	msg = (struct kdbus_msg *)(conn->buf + recv.recv.offset);
+	ASSERT_RETURN(msg->cookie == cookie);
+	kdbus_msg_free(msg);
+	ret = kdbus_free(conn, recv.recv.offset);
+	ASSERT_RETURN(ret == 0);
+
+	/*
+	 * Two receivers block on the same empty queue. Both are woken up
+	 * by the first message; the one which does not get it must go
+	 * back to sleep rather than fail, and receive the second one.
+	 */
+	for (i = 0; i < 2; i++) {
+		waiters[i].conn = conn;
+		waiters[i].queue = sender_queue[0];
+		ret = pthread_create(&waiters[i].thread, NULL,
+				     recv_waiter_thread, &waiters[i]);
+		ASSERT_RETURN(ret == 0);
+	}
+
+	usleep(100 * 1000);
+	ASSERT_RETURN(!waiters[0].done && !waiters[1].done);
+
+	ret = kdbus_msg_send(senders[0], NULL, ++cookie, 0, 0, 0, conn->id);
+	ASSERT_RETURN(ret == 0);
+
+	usleep(100 * 1000);
+	ASSERT_RETURN(waiters[0].done != waiters[1].done);
+
+	ret = kdbus_msg_send(senders[0], NULL, ++cookie, 0, 0, 0, conn->id);
+	ASSERT_RETURN(ret == 0);
+
+	for (i = 0; i < 2; i++) {
+		pthread_join(waiters[i].thread, NULL);
+		ASSERT_RETURN(waiters[i].ret == 0);
+	}
+
+	ASSERT_RETURN(waiters[0].cookie + waiters[1].cookie ==
+		      2 * cookie - 1);
+
+	for (i = 0; i < 3; i++)
+		kdbus_conn_free(senders[i]);
+
+	kdbus_conn_free(conn);
+
+	return TEST_OK;
+}
+
+static bool msg_has_item(const struct kdbus_msg *msg, uint64_t type)
+{
+	const struct kdbus_item *item;
+
+	KDBUS_ITEM_FOREACH(item, msg, items)
+		if (item->type == type)
+			return true;
+
+	return false;
+}
+
+int kdbus_test_message_broadcast_attach(struct kdbus_test_env *env)
+{
+	struct kdbus_conn *conn_a, *conn_b;
+	struct kdbus_msg *msg;
+	uint64_t offset;
+	int ret;
+
+	conn_a = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(conn_a);
+
+	conn_b = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(conn_b);
+
+	ret = kdbus_conn_update_attach_flags(conn_b, KDBUS_ATTACH_TIMESTAMP);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_add_match_empty(conn_a);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_add_match_empty(conn_b);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_msg_send(env->conn, NULL, 0x5000, 0, 0, 0,
+			     KDBUS_DST_ID_BROADCAST);
+	ASSERT_RETURN(ret == 0);
+
+	/* the 1st receiver asked for all metadata */
+	ret = kdbus_msg_recv_poll(conn_a, 100, &msg, &offset);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(msg_has_item(msg, KDBUS_ITEM_TIMESTAMP));
+	ASSERT_RETURN(msg_has_item(msg, KDBUS_ITEM_CREDS));
+	kdbus_msg_free(msg);
+	kdbus_free(conn_a, offset);
+
+	/* the 2nd one must not see the items collected for the 1st */
+	ret = kdbus_msg_recv_poll(conn_b, 100, &msg, &offset);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(msg_has_item(msg, KDBUS_ITEM_TIMESTAMP));
+	ASSERT_RETURN(!msg_has_item(msg, KDBUS_ITEM_CREDS));
+	ASSERT_RETURN(!msg_has_item(msg, KDBUS_ITEM_PID_COMM));
+	kdbus_msg_free(msg);
+	kdbus_free(conn_b, offset);
+
+	kdbus_conn_free(conn_b);
+	kdbus_conn_free(conn_a);
+
+	return TEST_OK;
+}
+
+static uint64_t msg_meta_epoch(const struct kdbus_msg *msg)
+{
+	const struct kdbus_item *item;
+
+	KDBUS_ITEM_FOREACH(item, msg, items)
+		if (item->type == KDBUS_ITEM_META_EPOCH)
+			return item->meta_epoch;
+
+	return 0;
+}
+
+int kdbus_test_message_meta_epoch(struct kdbus_test_env *env)
+{
+	struct kdbus_conn *conn;
+	struct kdbus_msg *msg;
+	uint64_t offset, epoch;
+	int ret;
+
+	conn = kdbus_hello(env->buspath, KDBUS_HELLO_META_EPOCH, NULL, 0);
+	ASSERT_RETURN(conn);
+
+	/* the 1st message carries the sender's metadata in full */
+	ret = kdbus_msg_send(env->conn, NULL, 0x6000, 0, 0, 0, conn->id);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_msg_recv_poll(conn, 100, &msg, &offset);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(msg_has_item(msg, KDBUS_ITEM_CREDS));
+	epoch = msg_meta_epoch(msg);
+	ASSERT_RETURN(epoch > 0);
+	kdbus_msg_free(msg);
+	kdbus_free(conn, offset);
+
+	/* the 2nd one only refers to it */
+	ret = kdbus_msg_send(env->conn, NULL, 0x6001, 0, 0, 0, conn->id);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_msg_recv_poll(conn, 100, &msg, &offset);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(msg_meta_epoch(msg) == epoch);
+	ASSERT_RETURN(msg_has_item(msg, KDBUS_ITEM_TIMESTAMP));
+	ASSERT_RETURN(!msg_has_item(msg, KDBUS_ITEM_CREDS));
+	kdbus_msg_free(msg);
+	kdbus_free(conn, offset);
+
+	/* connections which did not opt in still get everything */
+	ret = kdbus_msg_send(conn, NULL, 0x6002, 0, 0, 0, env->conn->id);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_msg_recv_poll(env->conn, 100, &msg, &offset);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(msg_has_item(msg, KDBUS_ITEM_CREDS));
+	ASSERT_RETURN(msg_meta_epoch(msg) == 0);
+	kdbus_msg_free(msg);
+	kdbus_free(env->conn, offset);
+
+	kdbus_conn_free(conn);
+
+	return TEST_OK;
+}
@@ -154,3 +154,209 @@ int kdbus_test_monitor(struct kdbus_test_env *env)
 
 	return TEST_OK;
 }
+
+int kdbus_test_monitor_async(struct kdbus_test_env *env)
+{
+	struct kdbus_conn *monitor, *conn, *other;
+	unsigned int cookie = 0xdeadbeef;
+	struct kdbus_msg *msg;
+	uint64_t offset = 0;
+	int ret;
+
+	/* asynchronous delivery is only valid for monitors */
+	conn = kdbus_hello(env->buspath, KDBUS_HELLO_MONITOR_ASYNC, NULL, 0);
+	ASSERT_RETURN(conn == NULL);
+
+	monitor = kdbus_hello(env->buspath,
+			      KDBUS_HELLO_MONITOR | KDBUS_HELLO_MONITOR_ASYNC,
+			      NULL, 0);
+	ASSERT_RETURN(monitor);
+
+	conn = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(conn);
+
+	ret = kdbus_msg_send(env->conn, NULL, cookie, 0, 0, 0, conn->id);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_msg_recv(conn, NULL, NULL);
+	ASSERT_RETURN(ret == 0);
+
+	/* the monitor gets the message from its worker */
+	ret = kdbus_msg_recv_poll(monitor, 100, &msg, &offset);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(msg->cookie == cookie);
+	ASSERT_RETURN(msg->src_id == env->conn->id);
+	ASSERT_RETURN(msg->dst_id == conn->id);
+
+	ret = kdbus_item_in_message(msg, KDBUS_ITEM_MONITOR_DROPPED);
+	ASSERT_RETURN(ret == 0);
+
+	kdbus_msg_free(msg);
+	kdbus_free(monitor, offset);
+
+	/* broadcasts need a match, like for synchronous monitors */
+	ret = kdbus_add_match_empty(monitor);
+	ASSERT_RETURN(ret == 0);
+
+	cookie++;
+	ret = kdbus_msg_send(env->conn, NULL, cookie, 0, 0, 0,
+			     KDBUS_DST_ID_BROADCAST);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_msg_recv_poll(monitor, 100, &msg, &offset);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(msg->cookie == cookie);
+
+	kdbus_msg_free(msg);
+	kdbus_free(monitor, offset);
+
+	/*
+	 * The record is shared with a monitor which wants the timestamp;
+	 * this one must still only get the metadata it asked for.
+	 */
+	other = kdbus_hello(env->buspath,
+			    KDBUS_HELLO_MONITOR | KDBUS_HELLO_MONITOR_ASYNC,
+			    NULL, 0);
+	ASSERT_RETURN(other);
+
+	ret = kdbus_conn_update_attach_flags(other, KDBUS_ATTACH_TIMESTAMP);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_conn_update_attach_flags(monitor, 0);
+	ASSERT_RETURN(ret == 0);
+
+	cookie++;
+	ret = kdbus_msg_send(env->conn, NULL, cookie, 0, 0, 0, conn->id);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_msg_recv(conn, NULL, NULL);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_msg_recv_poll(other, 100, &msg, &offset);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(msg->cookie == cookie);
+
+	ret = kdbus_item_in_message(msg, KDBUS_ITEM_TIMESTAMP);
+	ASSERT_RETURN(ret == 1);
+
+	kdbus_msg_free(msg);
+	kdbus_free(other, offset);
+
+	ret = kdbus_msg_recv_poll(monitor, 100, &msg, &offset);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(msg->cookie == cookie);
+
+	ret = kdbus_item_in_message(msg, KDBUS_ITEM_TIMESTAMP);
+	ASSERT_RETURN(ret == 0);
+
+	kdbus_msg_free(msg);
+	kdbus_free(monitor, offset);
+
+	kdbus_conn_free(other);
+	kdbus_conn_free(monitor);
+	kdbus_conn_free(conn);
+
+	return TEST_OK;
+}
+
+int kdbus_test_monitor_filter(struct kdbus_test_env *env)
+{
+	struct {
+		uint64_t size;
+		uint64_t type;
+		struct kdbus_monitor_filter filter;
+	} item = {
+		.size = sizeof(item),
+		.type = KDBUS_ITEM_MONITOR_FILTER,
+		.filter = {
+			.flags = KDBUS_MONITOR_FILTER_MATCH,
+			.sample = 2,
+			.snaplen = 64,
+		},
+	};
+	struct {
+		struct kdbus_cmd_match cmd;
+		struct {
+			uint64_t size;
+			uint64_t type;
+			uint64_t id;
+		} item;
+	} buf;
+	struct kdbus_conn *monitor, *conn, *other;
+	unsigned int cookie = 0xdeadbeef;
+	const struct kdbus_item *it;
+	uint64_t payload, truncated;
+	struct kdbus_msg *msg;
+	uint64_t offset = 0;
+	unsigned int i;
+	int ret;
+
+	/* a filter is only valid for monitors */
+	conn = kdbus_hello(env->buspath, 0, (struct kdbus_item *) &item,
+			   sizeof(item));
+	ASSERT_RETURN(conn == NULL);
+
+	monitor = kdbus_hello(env->buspath, KDBUS_HELLO_MONITOR,
+			      (struct kdbus_item *) &item, sizeof(item));
+	ASSERT_RETURN(monitor);
+
+	conn = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(conn);
+
+	other = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(other);
+
+	/* only watch the traffic addressed to conn */
+	memset(&buf, 0, sizeof(buf));
+	buf.cmd.size = sizeof(buf);
+	buf.cmd.cookie = 0xdeadbeef;
+	buf.item.size = sizeof(buf.item);
+	buf.item.type = KDBUS_ITEM_DST_ID;
+	buf.item.id = conn->id;
+
+	ret = ioctl(monitor->fd, KDBUS_CMD_MATCH_ADD, &buf);
+	ASSERT_RETURN(ret == 0);
+
+	for (i = 0; i < 4; i++) {
+		ret = kdbus_msg_send(env->conn, NULL, cookie + i, 0, 0, 0,
+				     conn->id);
+		ASSERT_RETURN(ret == 0);
+
+		ret = kdbus_msg_send(env->conn, NULL, cookie + i, 0, 0, 0,
+				     other->id);
+		ASSERT_RETURN(ret == 0);
+	}
+
+	/* every second message to conn, with a cut payload */
+	for (i = 1; i < 4; i += 2) {
+		ret = kdbus_msg_recv_poll(monitor, 100, &msg, &offset);
+		ASSERT_RETURN(ret == 0);
+		ASSERT_RETURN(msg->cookie == cookie + i);
+		ASSERT_RETURN(msg->dst_id == conn->id);
+
+		payload = 0;
+		truncated = 0;
+		KDBUS_ITEM_FOREACH(it, msg, items) {
+			if (it->type == KDBUS_ITEM_PAYLOAD_OFF &&
+			    it->vec.offset != ~0ULL)
+				payload += it->vec.size;
+			else if (it->type == KDBUS_ITEM_MONITOR_TRUNCATED)
+				truncated = it->monitor_truncated;
+		}
+
+		ASSERT_RETURN(payload == 64);
+		ASSERT_RETURN(truncated > 64);
+
+		kdbus_msg_free(msg);
+		kdbus_free(monitor, offset);
+	}
+
+	ret = kdbus_msg_recv_poll(monitor, 100, NULL, NULL);
+	ASSERT_RETURN(ret == -ETIMEDOUT);
+
+	kdbus_conn_free(other);
+	kdbus_conn_free(conn);
+	kdbus_conn_free(monitor);
+
+	return TEST_OK;
+}
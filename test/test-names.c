@@ -10,6 +10,7 @@
 #include <assert.h>
 #include <limits.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <getopt.h>
 #include <stdbool.h>
 
@@ -182,3 +183,388 @@ int kdbus_test_name_queue(struct kdbus_test_env *env)
 
 	return TEST_OK;
 }
+
+static unsigned int conn_drain_msgs(struct kdbus_conn *conn)
+{
+	unsigned int count = 0;
+
+	while (kdbus_msg_recv(conn, NULL, NULL) == 0)
+		count++;
+
+	return count;
+}
+
+int kdbus_test_name_shared(struct kdbus_test_env *env)
+{
+	struct kdbus_conn *conn, *sender;
+	const char *name;
+	uint64_t flags;
+	unsigned int i;
+	int ret;
+
+	name = "foo.bla.blaz";
+
+	conn = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(conn != NULL);
+
+	sender = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(sender != NULL);
+
+	/* acquire a shared name from the 1st connection */
+	flags = KDBUS_NAME_SHARED;
+	ret = kdbus_name_acquire(env->conn, name, &flags);
+	ASSERT_RETURN(ret == 0);
+
+	/* the 2nd connection joins the group */
+	flags = KDBUS_NAME_SHARED;
+	ret = kdbus_name_acquire(conn, name, &flags);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(!(flags & KDBUS_NAME_IN_QUEUE));
+
+	flags = KDBUS_NAME_SHARED;
+	ret = kdbus_name_acquire(conn, name, &flags);
+	ASSERT_RETURN(ret == -EALREADY);
+
+	ret = conn_is_name_owner(env->conn, name);
+	ASSERT_RETURN(ret == 0);
+
+	ret = conn_is_name_owner(conn, name);
+	ASSERT_RETURN(ret == 0);
+
+	/* without the flag, the name is busy */
+	ret = kdbus_name_acquire(sender, name, NULL);
+	ASSERT_RETURN(ret == -EEXIST);
+
+	/* messages to the name are spread over both owners */
+	for (i = 0; i < 4; i++) {
+		ret = kdbus_msg_send(sender, name, 0xc0000000 + i, 0, 0, 0,
+				     KDBUS_DST_ID_NAME);
+		ASSERT_RETURN(ret == 0);
+	}
+
+	ASSERT_RETURN(conn_drain_msgs(env->conn) == 2);
+	ASSERT_RETURN(conn_drain_msgs(conn) == 2);
+
+	/* a specific owner can still be addressed by its ID */
+	ret = kdbus_msg_send(sender, name, 0xc0000010, 0, 0, 0, conn->id);
+	ASSERT_RETURN(ret == 0);
+
+	ASSERT_RETURN(conn_drain_msgs(env->conn) == 0);
+	ASSERT_RETURN(conn_drain_msgs(conn) == 1);
+
+	ret = kdbus_msg_send(sender, name, 0xc0000011, 0, 0, 0, sender->id);
+	ASSERT_RETURN(ret == -EREMCHG);
+
+	/* the group member takes over when the primary owner leaves */
+	ret = kdbus_name_release(env->conn, name);
+	ASSERT_RETURN(ret == 0);
+
+	ret = conn_is_name_owner(env->conn, name);
+	ASSERT_RETURN(ret != 0);
+
+	ret = conn_is_name_owner(conn, name);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_name_release(conn, name);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_name_release(conn, name);
+	ASSERT_RETURN(ret == -ESRCH);
+
+	kdbus_conn_free(sender);
+	kdbus_conn_free(conn);
+
+	return TEST_OK;
+}
+
+#define CURSOR_CONNS 16
+
+/* count the names with the given prefix in one chunk of a paginated list */
+static int name_list_chunk(struct kdbus_conn *conn, const char *prefix,
+			   uint64_t *cursor, uint64_t *generation)
+{
+	struct kdbus_cmd_name_list_chunk cmd_list = {};
+	struct kdbus_name_list *list;
+	struct kdbus_name_info *name;
+	int ret, count = 0;
+
+	cmd_list.list.flags = KDBUS_NAME_LIST_NAMES | KDBUS_NAME_LIST_CURSOR;
+	cmd_list.cursor = *cursor;
+	cmd_list.chunk_size = 64;
+
+	ret = ioctl(conn->fd, KDBUS_CMD_NAME_LIST_CHUNK, &cmd_list);
+	ASSERT_RETURN_VAL(ret == 0, -1);
+
+	list = (struct kdbus_name_list *)(conn->buf + cmd_list.list.offset);
+	KDBUS_ITEM_FOREACH(name, list, names) {
+		struct kdbus_item *item;
+
+		KDBUS_ITEM_FOREACH(item, name, items)
+			if (item->type == KDBUS_ITEM_NAME &&
+			    strncmp(item->str, prefix, strlen(prefix)) == 0)
+				count++;
+	}
+
+	ret = kdbus_free(conn, cmd_list.list.offset);
+	ASSERT_RETURN_VAL(ret == 0, -1);
+
+	*cursor = cmd_list.cursor;
+	*generation = cmd_list.generation;
+
+	return count;
+}
+
+int kdbus_test_name_list_cursor(struct kdbus_test_env *env)
+{
+	struct kdbus_conn *conns[CURSOR_CONNS];
+	uint64_t cursor, generation, gen;
+	unsigned int i, chunks;
+	char name[64];
+	int ret, count;
+
+	for (i = 0; i < CURSOR_CONNS; i++) {
+		conns[i] = kdbus_hello(env->buspath, 0, NULL, 0);
+		ASSERT_RETURN(conns[i]);
+
+		snprintf(name, sizeof(name), "foo.cursor.n%u", i);
+		ret = kdbus_name_acquire(conns[i], name, NULL);
+		ASSERT_RETURN(ret == 0);
+	}
+
+	/* walk the list in small chunks, every name shows up once */
+	cursor = 0;
+	count = 0;
+	chunks = 0;
+	do {
+		ret = name_list_chunk(env->conn, "foo.cursor.", &cursor, &gen);
+		ASSERT_RETURN(ret >= 0);
+
+		if (chunks > 0)
+			ASSERT_RETURN(gen == generation);
+
+		generation = gen;
+		count += ret;
+		chunks++;
+	} while (cursor != 0);
+
+	ASSERT_RETURN(count == CURSOR_CONNS);
+	ASSERT_RETURN(chunks > 1);
+
+	/* a name change between two chunks is reflected in the generation */
+	cursor = 0;
+	ret = name_list_chunk(env->conn, "foo.cursor.", &cursor, &generation);
+	ASSERT_RETURN(ret >= 0 && cursor != 0);
+
+	ret = kdbus_name_acquire(env->conn, "foo.cursor.late", NULL);
+	ASSERT_RETURN(ret == 0);
+
+	ret = name_list_chunk(env->conn, "foo.cursor.", &cursor, &gen);
+	ASSERT_RETURN(ret >= 0);
+	ASSERT_RETURN(gen != generation);
+
+	for (i = 0; i < CURSOR_CONNS; i++)
+		kdbus_conn_free(conns[i]);
+
+	return TEST_OK;
+}
+
+/* receive a name change notification, and return its generation */
+static int name_change_recv(struct kdbus_conn *conn, uint64_t type,
+			    const char *name, uint64_t *generation)
+{
+	struct kdbus_item *item;
+	struct kdbus_msg *msg;
+	uint64_t offset;
+	int ret;
+
+	ret = kdbus_msg_recv(conn, &msg, &offset);
+	ASSERT_RETURN(ret == 0);
+
+	/* the name change is the first item */
+	item = msg->items;
+	ASSERT_RETURN(item->type == type);
+	ASSERT_RETURN(strcmp(item->name_change.name, name) == 0);
+
+	*generation = 0;
+	KDBUS_ITEM_FOREACH(item, msg, items)
+		if (item->type == KDBUS_ITEM_NAME_GENERATION)
+			*generation = item->name_generation;
+
+	kdbus_msg_free(msg);
+	ret = kdbus_free(conn, offset);
+	ASSERT_RETURN(ret == 0);
+
+	return TEST_OK;
+}
+
+int kdbus_test_name_list_subscribe(struct kdbus_test_env *env)
+{
+	struct kdbus_cmd_name_list_chunk cmd_list = {};
+	uint64_t generation, gen_add, gen_remove;
+	struct kdbus_conn *conn;
+	int ret;
+
+	conn = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(conn);
+
+	ret = kdbus_name_acquire(conn, "foo.sub.early", NULL);
+	ASSERT_RETURN(ret == 0);
+
+	/* the generation is only returned with the chunk command */
+	cmd_list.list.flags = KDBUS_NAME_LIST_NAMES |
+			      KDBUS_NAME_LIST_SUBSCRIBE;
+	ret = ioctl(env->conn->fd, KDBUS_CMD_NAME_LIST, &cmd_list.list);
+	ASSERT_RETURN(ret == -1 && errno == EINVAL);
+
+	/* snapshots can not be taken in chunks */
+	cmd_list.list.flags = KDBUS_NAME_LIST_NAMES |
+			      KDBUS_NAME_LIST_SUBSCRIBE |
+			      KDBUS_NAME_LIST_CURSOR;
+	ret = ioctl(env->conn->fd, KDBUS_CMD_NAME_LIST_CHUNK, &cmd_list);
+	ASSERT_RETURN(ret == -1 && errno == EINVAL);
+
+	cmd_list.list.flags = KDBUS_NAME_LIST_NAMES |
+			      KDBUS_NAME_LIST_SUBSCRIBE;
+	ret = ioctl(env->conn->fd, KDBUS_CMD_NAME_LIST_CHUNK, &cmd_list);
+	ASSERT_RETURN(ret == 0);
+
+	generation = cmd_list.generation;
+	ret = kdbus_free(env->conn, cmd_list.list.offset);
+	ASSERT_RETURN(ret == 0);
+
+	/* the name owned before is part of the snapshot only */
+	ret = conn_is_name_owner(conn, "foo.sub.early");
+	ASSERT_RETURN(ret == 0);
+
+	/* later changes are delivered without any match installed */
+	ret = kdbus_name_acquire(conn, "foo.sub.late", NULL);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_name_release(conn, "foo.sub.late");
+	ASSERT_RETURN(ret == 0);
+
+	ret = name_change_recv(env->conn, KDBUS_ITEM_NAME_ADD,
+			       "foo.sub.late", &gen_add);
+	ASSERT_RETURN(ret == TEST_OK);
+	ASSERT_RETURN(gen_add > generation);
+
+	ret = name_change_recv(env->conn, KDBUS_ITEM_NAME_REMOVE,
+			       "foo.sub.late", &gen_remove);
+	ASSERT_RETURN(ret == TEST_OK);
+	ASSERT_RETURN(gen_remove > gen_add);
+
+	ret = kdbus_msg_recv(env->conn, NULL, NULL);
+	ASSERT_RETURN(ret == -EAGAIN);
+
+	/* connections that did not subscribe are not affected */
+	ret = kdbus_msg_recv(conn, NULL, NULL);
+	ASSERT_RETURN(ret == -EAGAIN);
+
+	kdbus_conn_free(conn);
+
+	return TEST_OK;
+}
+
+static uint32_t name_table_hash(const char *name)
+{
+	uint32_t hash = 2166136261U;
+
+	while (*name) {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/* resolve a name through the mapped name table, 0 if not found */
+static uint64_t name_table_lookup(const struct kdbus_name_table *t,
+				  const char *name)
+{
+	uint64_t seq, id, i, pos, mask = t->n_slots - 1;
+
+	do {
+		seq = t->seq;
+		__sync_synchronize();
+
+		id = 0;
+		pos = name_table_hash(name) & mask;
+		for (i = 0; i < t->n_slots; i++, pos = (pos + 1) & mask) {
+			const struct kdbus_name_table_slot *s = &t->slots[pos];
+
+			if (s->owner_id == 0)
+				break;
+
+			if (strcmp(s->name, name) == 0) {
+				id = s->owner_id;
+				break;
+			}
+		}
+
+		__sync_synchronize();
+	} while ((seq & 1) || seq != t->seq);
+
+	return id;
+}
+
+int kdbus_test_name_table(struct kdbus_test_env *env)
+{
+	static const char *name = "foo.table.a";
+	struct kdbus_name_table *table;
+	struct kdbus_conn *conn;
+	size_t size;
+	void *p;
+	int ret;
+
+	size = sysconf(_SC_PAGESIZE);
+	p = mmap(NULL, size, PROT_READ, MAP_SHARED, env->conn->fd,
+		 KDBUS_NAME_TABLE_OFFSET);
+	ASSERT_RETURN(p != MAP_FAILED);
+
+	table = p;
+	ASSERT_RETURN(table->n_slots > 0);
+	ASSERT_RETURN((table->n_slots & (table->n_slots - 1)) == 0);
+	ASSERT_RETURN(table->slot_size == sizeof(struct kdbus_name_table_slot));
+
+	size = sizeof(*table) + table->n_slots * table->slot_size;
+	munmap(p, sysconf(_SC_PAGESIZE));
+
+	p = mmap(NULL, size, PROT_READ, MAP_SHARED, env->conn->fd,
+		 KDBUS_NAME_TABLE_OFFSET);
+	ASSERT_RETURN(p != MAP_FAILED);
+	table = p;
+
+	/* the table can not be written to */
+	ASSERT_RETURN(mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   env->conn->fd, KDBUS_NAME_TABLE_OFFSET) ==
+		      MAP_FAILED);
+
+	ASSERT_RETURN(name_table_lookup(table, name) == 0);
+
+	ret = kdbus_name_acquire(env->conn, name, NULL);
+	ASSERT_RETURN(ret == 0);
+
+	ASSERT_RETURN(name_table_lookup(table, name) == env->conn->id);
+	ASSERT_RETURN(!(table->flags & KDBUS_NAME_TABLE_INCOMPLETE));
+
+	/* send by the resolved ID, with the name checked by the kernel */
+	conn = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(conn);
+
+	ret = kdbus_msg_send(conn, name, 0xdeadbeef, 0, 0, 0,
+			     name_table_lookup(table, name));
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_msg_recv(env->conn, NULL, NULL);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_name_release(env->conn, name);
+	ASSERT_RETURN(ret == 0);
+
+	ASSERT_RETURN(name_table_lookup(table, name) == 0);
+
+	munmap(p, size);
+	kdbus_conn_free(conn);
+
+	return TEST_OK;
+}
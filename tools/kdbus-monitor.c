@@ -9,11 +9,15 @@
 #include <stdbool.h>
 #include <errno.h>
 #include <assert.h>
+#include <getopt.h>
+#include <limits.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 
 #include "../kdbus.h"
 
@@ -28,6 +32,13 @@
 	     (uint8_t *)(item) < (uint8_t *)(head) + (head)->size;	\
 	     item = KDBUS_ITEM_NEXT(item))
 
+#define DEFAULT_POOL_SIZE	(16 * 1024LU * 1024LU)
+#define DEFAULT_BATCH		256
+#define DEFAULT_RING		8
+
+/* iovecs per batch; one writev() per batch */
+#define BATCH_IOV_MAX		1024
+
 struct conn {
 	int fd;
 	uint64_t id;
@@ -53,22 +64,144 @@ struct pcap_entry {
 	uint8_t		data[0];
 };
 
+/*
+ * A batch of received messages, written out with a single writev() straight
+ * from the pool, then handed back to the kernel with KDBUS_CMD_FREE.
+ */
+struct batch {
+	struct iovec iov[BATCH_IOV_MAX];
+	unsigned int n_iov;
+	struct pcap_entry *entries;
+	uint64_t *offsets;
+	unsigned int n_msgs;
+	uint64_t bytes;
+};
+
+/*
+ * Ring of batches between the receiving main thread and the writer thread.
+ * The main thread fills the batch at @head, the writer drains the one at
+ * @tail.
+ */
+struct ring {
+	struct batch *batches;
+	unsigned int size;
+	unsigned int head;
+	unsigned int tail;
+	unsigned int count;
+	bool done;
+	pthread_mutex_t lock;
+	pthread_cond_t filled;
+	pthread_cond_t drained;
+	struct conn *conn;
+	int output_fd;
+	int error;
+
+	/* statistics, protected by @lock */
+	uint64_t written;
+};
+
+struct stats {
+	uint64_t msgs;
+	uint64_t dropped;
+	uint64_t truncated;
+	uint64_t stalls;
+};
+
+static const char *padding = "\0\0\0\0\0\0\0";
+
+static const struct {
+	const char *name;
+	uint64_t flag;
+} attach_names[] = {
+	{ "timestamp",		KDBUS_ATTACH_TIMESTAMP },
+	{ "creds",		KDBUS_ATTACH_CREDS },
+	{ "auxgroups",		KDBUS_ATTACH_AUXGROUPS },
+	{ "names",		KDBUS_ATTACH_NAMES },
+	{ "tid_comm",		KDBUS_ATTACH_TID_COMM },
+	{ "pid_comm",		KDBUS_ATTACH_PID_COMM },
+	{ "exe",		KDBUS_ATTACH_EXE },
+	{ "cmdline",		KDBUS_ATTACH_CMDLINE },
+	{ "cgroup",		KDBUS_ATTACH_CGROUP },
+	{ "caps",		KDBUS_ATTACH_CAPS },
+	{ "seclabel",		KDBUS_ATTACH_SECLABEL },
+	{ "audit",		KDBUS_ATTACH_AUDIT },
+	{ "conn_description",	KDBUS_ATTACH_CONN_DESCRIPTION },
+	{ "all",		_KDBUS_ATTACH_ALL },
+};
+
 static void usage(const char *argv0)
 {
-	fprintf(stderr, "Usage: %s <bus-node> <output-file>\n", argv0);
+	fprintf(stderr, "Usage: %s [options] <bus-node> <output-file>\n", argv0);
 	fprintf(stderr, "       bus-node        The device node to connect to\n");
 	fprintf(stderr, "       output-file     The output file to write to\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -a, --attach=LIST     Metadata to attach, a comma separated list of\n");
+	fprintf(stderr, "                        timestamp, creds, auxgroups, names, tid_comm,\n");
+	fprintf(stderr, "                        pid_comm, exe, cmdline, cgroup, caps, seclabel,\n");
+	fprintf(stderr, "                        audit, conn_description or all (default: none)\n");
+	fprintf(stderr, "  -A, --async           Decouple the monitor from the senders, and drop\n");
+	fprintf(stderr, "                        messages when it falls behind\n");
+	fprintf(stderr, "  -s, --snaplen=BYTES   Capture at most BYTES of payload per message\n");
+	fprintf(stderr, "  -S, --sample=N        Capture only one in N messages\n");
+	fprintf(stderr, "  -b, --batch=N         Messages per write (default: %u)\n",
+		DEFAULT_BATCH);
+	fprintf(stderr, "  -r, --ring=N          Batches in flight to the writer (default: %u)\n",
+		DEFAULT_RING);
+	fprintf(stderr, "  -p, --pool-size=MB    Size of the receive pool (default: %lu)\n",
+		DEFAULT_POOL_SIZE / (1024 * 1024));
+	fprintf(stderr, "  -q, --quiet           Do not print live statistics\n");
+}
+
+static int parse_attach_flags(const char *arg, uint64_t *flags)
+{
+	char *s, *tok, *save = NULL;
+	unsigned int i;
+
+	s = strdup(arg);
+	if (!s)
+		return -ENOMEM;
+
+	*flags = 0;
+	for (tok = strtok_r(s, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < sizeof(attach_names) / sizeof(attach_names[0]);
+		     i++)
+			if (strcmp(tok, attach_names[i].name) == 0)
+				break;
+
+		if (i == sizeof(attach_names) / sizeof(attach_names[0])) {
+			fprintf(stderr, "Unknown metadata '%s'\n", tok);
+			free(s);
+			return -EINVAL;
+		}
+
+		*flags |= attach_names[i].flag;
+	}
+
+	free(s);
+	return 0;
 }
 
-#define POOL_SIZE (16 * 1024LU * 1024LU)
-static struct conn *kdbus_hello(const char *path, uint64_t flags)
+static struct conn *kdbus_hello(const char *path, uint64_t flags,
+				uint64_t attach_flags, size_t pool_size,
+				uint64_t snaplen, uint64_t sample)
 {
 	int fd, ret;
 	struct {
 		struct kdbus_cmd_hello hello;
-		uint64_t size;
-		uint64_t type;
-		char comm[8];
+
+		struct {
+			uint64_t size;
+			uint64_t type;
+			char comm[8];
+		} name;
+
+		struct {
+			uint64_t size;
+			uint64_t type;
+			struct kdbus_monitor_filter filter;
+		} filter;
 	} h;
 	struct conn *conn;
 
@@ -82,13 +215,18 @@ static struct conn *kdbus_hello(const char *path, uint64_t flags)
 	}
 
 	h.hello.flags = flags | KDBUS_HELLO_ACCEPT_FD;
-	h.hello.attach_flags = _KDBUS_ATTACH_ALL;
-	h.type = KDBUS_ITEM_CONN_DESCRIPTION;
-	strncpy(h.comm, "monitor", sizeof(h.comm) - 1);
-	h.size = KDBUS_ITEM_HEADER_SIZE + strlen(h.comm) + 1;
+	h.hello.attach_flags = attach_flags;
+	h.name.type = KDBUS_ITEM_CONN_DESCRIPTION;
+	strncpy(h.name.comm, "monitor", sizeof(h.name.comm) - 1);
+	h.name.size = KDBUS_ITEM_HEADER_SIZE + strlen(h.name.comm) + 1;
+
+	h.filter.size = sizeof(h.filter);
+	h.filter.type = KDBUS_ITEM_MONITOR_FILTER;
+	h.filter.filter.snaplen = snaplen;
+	h.filter.filter.sample = sample;
 
 	h.hello.size = sizeof(h);
-	h.hello.pool_size = POOL_SIZE;
+	h.hello.pool_size = pool_size;
 
 	ret = ioctl(fd, KDBUS_CMD_HELLO, &h.hello);
 	if (ret < 0) {
@@ -102,7 +240,7 @@ static struct conn *kdbus_hello(const char *path, uint64_t flags)
 		return NULL;
 	}
 
-	conn->buf = mmap(NULL, POOL_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+	conn->buf = mmap(NULL, pool_size, PROT_READ, MAP_PRIVATE, fd, 0);
 	if (conn->buf == MAP_FAILED) {
 		free(conn);
 		fprintf(stderr, "--- error mmap (%m)\n");
@@ -111,90 +249,308 @@ static struct conn *kdbus_hello(const char *path, uint64_t flags)
 
 	conn->fd = fd;
 	conn->id = h.hello.id;
+	conn->size = pool_size;
 
 	return conn;
 }
 
-static int dump_packet(struct conn *conn, int fd)
+static int batch_init(struct batch *b, unsigned int max_msgs)
 {
-	int ret;
-	struct kdbus_cmd_recv recv = {};
-	uint64_t size;
-	struct kdbus_msg *msg;
+	b->entries = calloc(max_msgs, sizeof(*b->entries));
+	b->offsets = calloc(max_msgs, sizeof(*b->offsets));
+	if (!b->entries || !b->offsets)
+		return -ENOMEM;
+
+	b->n_iov = 0;
+	b->n_msgs = 0;
+	b->bytes = 0;
+
+	return 0;
+}
+
+static void batch_add_iov(struct batch *b, const void *data, size_t len)
+{
+	b->iov[b->n_iov].iov_base = (void *) data;
+	b->iov[b->n_iov].iov_len = len;
+	b->n_iov++;
+	b->bytes += len;
+}
+
+/*
+ * Queue the pcap record of the message at @offset in the pool; nothing is
+ * copied, the iovecs point into the pool. Returns -ENOSPC if the message
+ * does not fit into the batch anymore.
+ */
+static int batch_add(struct batch *b, struct conn *conn, uint64_t offset,
+		     const struct timeval *now, struct stats *stats)
+{
+	struct kdbus_msg *msg = (struct kdbus_msg *)(conn->buf + offset);
 	const struct kdbus_item *item;
-	struct timeval now;
-	struct pcap_entry entry;
-	uint64_t to_write;
-	void *data_to_write;
+	unsigned int n_iov = 2;
+	uint64_t len, total_len;
+	struct pcap_entry *entry;
 
-	gettimeofday(&now, NULL);
-	entry.tv_sec = now.tv_sec;
-	entry.tv_usec = now.tv_usec;
+	len = msg->size;
+	total_len = 0;
 
-	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
-	if (ret < 0) {
-		fprintf(stderr, "error receiving message: %d (%m)\n", ret);
-		return EXIT_FAILURE;
+	KDBUS_ITEM_FOREACH(item, msg, items) {
+		switch (item->type) {
+		case KDBUS_ITEM_PAYLOAD_OFF:
+			n_iov++;
+			if (item->vec.offset != ~0ULL)
+				len += KDBUS_ALIGN8(item->vec.size);
+			else
+				len += item->vec.size % 8;
+			break;
+
+		case KDBUS_ITEM_MONITOR_TRUNCATED:
+			total_len = item->monitor_truncated;
+			break;
+		}
 	}
 
-	msg = (struct kdbus_msg *)(conn->buf + recv.offset);
-	item = msg->items;
-	size = msg->size;
+	if (b->n_iov + n_iov > BATCH_IOV_MAX)
+		return -ENOSPC;
 
-	/* collect length of oob payloads */
-	KDBUS_ITEM_FOREACH(item, msg, items)
-		if (item->type == KDBUS_ITEM_PAYLOAD_OFF)
-			size += KDBUS_ALIGN8(item->vec.size);
+	/* the payload the message had before it was cut */
+	if (total_len > 0) {
+		uint64_t captured = 0;
 
-	entry.len = size;
-	entry.total_len = size;
+		KDBUS_ITEM_FOREACH(item, msg, items)
+			if (item->type == KDBUS_ITEM_PAYLOAD_OFF &&
+			    item->vec.offset != ~0ULL)
+				captured += item->vec.size;
 
-	size = write(fd, &entry, sizeof(entry));
-	if (size != sizeof(entry)) {
-		fprintf(stderr, "Unable to write: %m\n");
-		return EXIT_FAILURE;
+		total_len = len + total_len - captured;
+		stats->truncated++;
+	} else {
+		total_len = len;
 	}
 
-	size = write(fd, msg, msg->size);
-	if (size != msg->size) {
-		fprintf(stderr, "Unable to write: %m\n");
-		return EXIT_FAILURE;
-	}
+	entry = &b->entries[b->n_msgs];
+	entry->tv_sec = now->tv_sec;
+	entry->tv_usec = now->tv_usec;
+	entry->len = len;
+	entry->total_len = total_len;
+
+	batch_add_iov(b, entry, sizeof(*entry));
+	batch_add_iov(b, msg, msg->size);
 
 	KDBUS_ITEM_FOREACH(item, msg, items) {
 		switch (item->type) {
-		/* close all memfds */
+		case KDBUS_ITEM_PAYLOAD_OFF:
+			if (item->vec.offset != ~0ULL)
+				batch_add_iov(b,
+					      (void *) msg + item->vec.offset,
+					      KDBUS_ALIGN8(item->vec.size));
+			else
+				/* add data padding to file */
+				batch_add_iov(b, padding, item->vec.size % 8);
+			break;
+
+		/* close all passed fds, they are of no use in a capture */
 		case KDBUS_ITEM_PAYLOAD_MEMFD:
-			close(item->memfd.fd);
+			if (item->memfd.fd >= 0)
+				close(item->memfd.fd);
 			break;
-		case KDBUS_ITEM_PAYLOAD_OFF:
-			if (item->vec.offset != ~0ULL) {
-				to_write = KDBUS_ALIGN8(item->vec.size);
-				data_to_write = (void *) msg + item->vec.offset;
-			} else {
-				/*add data padding to file*/
-				to_write = item->vec.size % 8;
-				data_to_write = "\0\0\0\0\0\0\0";
-			}
 
-			size = write(fd, data_to_write, to_write);
-			if (size != to_write) {
-				fprintf(stderr, "Unable to write: %m\n");
-				return EXIT_FAILURE;
-			}
+		case KDBUS_ITEM_FDS: {
+			unsigned int i, n;
+
+			n = (item->size - KDBUS_ITEM_HEADER_SIZE) / sizeof(int);
+			for (i = 0; i < n; i++)
+				if (item->fds[i] >= 0)
+					close(item->fds[i]);
+			break;
+		}
+
+		case KDBUS_ITEM_MONITOR_DROPPED:
+			stats->dropped += item->monitor_dropped;
 			break;
 		}
 	}
 
-	ret = ioctl(conn->fd, KDBUS_CMD_FREE, &recv.offset);
-	if (ret < 0) {
-		fprintf(stderr, "error free message: %d (%m)\n", ret);
-		return EXIT_FAILURE;
+	b->offsets[b->n_msgs++] = offset;
+	stats->msgs++;
+
+	return 0;
+}
+
+/* write a batch out, and give its messages back to the pool */
+static int batch_flush(struct batch *b, struct conn *conn, int output_fd)
+{
+	struct iovec *iov = b->iov;
+	unsigned int n_iov = b->n_iov;
+	unsigned int i;
+	ssize_t size;
+	int ret;
+
+	while (n_iov > 0) {
+		size = writev(output_fd, iov, n_iov);
+		if (size < 0) {
+			if (errno == EINTR)
+				continue;
+
+			fprintf(stderr, "Unable to write: %m\n");
+			return -errno;
+		}
+
+		/* skip what was written in case of a short write */
+		while (n_iov > 0 && (size_t) size >= iov->iov_len) {
+			size -= iov->iov_len;
+			iov++;
+			n_iov--;
+		}
+
+		if (n_iov > 0) {
+			iov->iov_base += size;
+			iov->iov_len -= size;
+		}
+	}
+
+	for (i = 0; i < b->n_msgs; i++) {
+		ret = ioctl(conn->fd, KDBUS_CMD_FREE, &b->offsets[i]);
+		if (ret < 0) {
+			fprintf(stderr, "error free message: %d (%m)\n", ret);
+			return -errno;
+		}
 	}
 
+	b->n_iov = 0;
+	b->n_msgs = 0;
+	b->bytes = 0;
+
 	return 0;
 }
 
+static void *writer_thread(void *data)
+{
+	struct ring *r = data;
+	struct batch *b;
+	uint64_t bytes;
+	int ret;
+
+	pthread_mutex_lock(&r->lock);
+	for (;;) {
+		while (r->count == 0 && !r->done)
+			pthread_cond_wait(&r->filled, &r->lock);
+
+		if (r->count == 0)
+			break;
+
+		b = &r->batches[r->tail];
+		pthread_mutex_unlock(&r->lock);
+
+		bytes = b->bytes;
+		ret = batch_flush(b, r->conn, r->output_fd);
+
+		pthread_mutex_lock(&r->lock);
+		if (ret < 0) {
+			r->error = ret;
+			r->done = true;
+		}
+
+		r->written += bytes;
+		r->tail = (r->tail + 1) % r->size;
+		r->count--;
+		pthread_cond_signal(&r->drained);
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	return NULL;
+}
+
+/* hand the batch at the head to the writer, and wait for a free one */
+static struct batch *ring_commit(struct ring *r, struct stats *stats)
+{
+	pthread_mutex_lock(&r->lock);
+
+	if (r->batches[r->head].n_msgs > 0) {
+		r->head = (r->head + 1) % r->size;
+		r->count++;
+		pthread_cond_signal(&r->filled);
+	}
+
+	if (r->count == r->size)
+		stats->stalls++;
+
+	while (r->count == r->size && !r->done)
+		pthread_cond_wait(&r->drained, &r->lock);
+
+	pthread_mutex_unlock(&r->lock);
+
+	return &r->batches[r->head];
+}
+
+/*
+ * Receive everything that is queued, up to one batch, without waiting.
+ * Returns the number of messages received, or a negative errno.
+ */
+static int receive_batch(struct ring *r, struct batch **b,
+			 unsigned int max_msgs, struct stats *stats)
+{
+	struct kdbus_cmd_recv recv = {};
+	struct timeval now;
+	int ret, n = 0;
+
+	gettimeofday(&now, NULL);
+
+	while ((*b)->n_msgs < max_msgs) {
+		recv.offset = 0;
+		ret = ioctl(r->conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+		if (ret < 0) {
+			if (errno == EAGAIN)
+				break;
+
+			fprintf(stderr, "error receiving message: %d (%m)\n",
+				ret);
+			return -errno;
+		}
+
+		ret = batch_add(*b, r->conn, recv.offset, &now, stats);
+		if (ret == -ENOSPC) {
+			*b = ring_commit(r, stats);
+			ret = batch_add(*b, r->conn, recv.offset, &now, stats);
+		}
+
+		if (ret < 0) {
+			fprintf(stderr, "message too large for a batch\n");
+			return ret;
+		}
+
+		n++;
+	}
+
+	return n;
+}
+
+static double timeval_diff(const struct timeval *a, const struct timeval *b)
+{
+	return (a->tv_sec - b->tv_sec) + (a->tv_usec - b->tv_usec) / 1e6;
+}
+
+static void print_stats(struct ring *r, const struct stats *stats,
+			struct stats *last, uint64_t *last_written,
+			double secs)
+{
+	uint64_t written;
+
+	pthread_mutex_lock(&r->lock);
+	written = r->written;
+	pthread_mutex_unlock(&r->lock);
+
+	fprintf(stderr,
+		"\r%10.0f msg/s %8.2f MiB/s  dropped %llu  truncated %llu  stalls %llu   ",
+		(stats->msgs - last->msgs) / secs,
+		(written - *last_written) / secs / (1024 * 1024),
+		(unsigned long long) stats->dropped,
+		(unsigned long long) stats->truncated,
+		(unsigned long long) stats->stalls);
+
+	*last = *stats;
+	*last_written = written;
+}
+
 static bool do_exit = false;
 
 static void sig_handler(int foo)
@@ -204,23 +560,90 @@ static void sig_handler(int foo)
 
 int main(int argc, char **argv)
 {
-	unsigned long long count = 0;
+	static const struct option options[] = {
+		{ "attach",	required_argument,	NULL, 'a' },
+		{ "async",	no_argument,		NULL, 'A' },
+		{ "snaplen",	required_argument,	NULL, 's' },
+		{ "sample",	required_argument,	NULL, 'S' },
+		{ "batch",	required_argument,	NULL, 'b' },
+		{ "ring",	required_argument,	NULL, 'r' },
+		{ "pool-size",	required_argument,	NULL, 'p' },
+		{ "quiet",	no_argument,		NULL, 'q' },
+		{}
+	};
+	unsigned int max_msgs = DEFAULT_BATCH;
+	size_t pool_size = DEFAULT_POOL_SIZE;
+	uint64_t hello_flags = KDBUS_HELLO_MONITOR;
+	uint64_t attach_flags = 0;
+	uint64_t snaplen = 0, sample = 0;
+	struct stats stats = {}, last = {};
+	uint64_t last_written = 0;
+	struct timeval now, last_tv;
 	struct sigaction act = {};
 	struct pcap_header header;
-	struct conn *conn;
+	struct ring ring = {};
+	pthread_t writer;
+	bool quiet = false;
+	struct batch *b;
 	struct pollfd fd;
 	char *bus, *file;
+	unsigned int i;
 	sigset_t mask;
 	int output_fd;
-	int ret;
+	int ret, c;
+
+	while ((c = getopt_long(argc, argv, "a:As:S:b:r:p:q",
+				options, NULL)) >= 0) {
+		switch (c) {
+		case 'a':
+			if (parse_attach_flags(optarg, &attach_flags) < 0)
+				return EXIT_FAILURE;
+			break;
+
+		case 'A':
+			hello_flags |= KDBUS_HELLO_MONITOR_ASYNC;
+			break;
+
+		case 's':
+			snaplen = strtoull(optarg, NULL, 0);
+			break;
+
+		case 'S':
+			sample = strtoull(optarg, NULL, 0);
+			break;
+
+		case 'b':
+			max_msgs = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'r':
+			ring.size = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'p':
+			pool_size = strtoul(optarg, NULL, 0) * 1024 * 1024;
+			break;
+
+		case 'q':
+			quiet = true;
+			break;
 
-	if (argc < 3) {
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind < 2 || max_msgs == 0 || pool_size == 0) {
 		usage(argv[0]);
 		return EXIT_FAILURE;
 	}
 
-	bus = argv[1];
-	file = argv[2];
+	if (ring.size == 0)
+		ring.size = DEFAULT_RING;
+
+	bus = argv[optind];
+	file = argv[optind + 1];
 
 	output_fd = open(file, O_CREAT | O_WRONLY | O_TRUNC, 0644);
 	if (output_fd < 0) {
@@ -228,17 +651,38 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
-	conn = kdbus_hello(bus, KDBUS_HELLO_MONITOR);
-	if (!conn) {
+	ring.conn = kdbus_hello(bus, hello_flags, attach_flags, pool_size,
+				snaplen, sample);
+	if (!ring.conn) {
 		fprintf(stderr, "Unable to connect as monitor: %m\n");
 		return EXIT_FAILURE;
 	}
 
+	ring.batches = calloc(ring.size, sizeof(*ring.batches));
+	if (!ring.batches) {
+		fprintf(stderr, "unable to malloc()!?\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < ring.size; i++) {
+		ret = batch_init(&ring.batches[i], max_msgs);
+		if (ret < 0) {
+			fprintf(stderr, "unable to malloc()!?\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	ring.output_fd = output_fd;
+	pthread_mutex_init(&ring.lock, NULL);
+	pthread_cond_init(&ring.filled, NULL);
+	pthread_cond_init(&ring.drained, NULL);
+
 	memset(&header, 0, sizeof(header));
 	header.magic = 0xa1b2c3d4;
 	header.major = 2;
 	header.minor = 4;
-	header.snapshot_len = 0xffffffff;
+	header.snapshot_len = snaplen > 0 && snaplen < 0xffffffff ?
+			      snaplen : 0xffffffff;
 	header.header_type = 0x12345678;			/* FIXME */
 
 	ret = write(output_fd, &header, sizeof(header));
@@ -247,6 +691,12 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+	ret = pthread_create(&writer, NULL, writer_thread, &ring);
+	if (ret != 0) {
+		fprintf(stderr, "Unable to start the writer thread\n");
+		return EXIT_FAILURE;
+	}
+
 	act.sa_handler = sig_handler;
 	act.sa_flags = SA_RESTART;
 	sigaction(SIGINT, &act, NULL);
@@ -259,35 +709,59 @@ int main(int argc, char **argv)
 
 	fprintf(stderr, "Capturing. Press ^C to stop ...\n");
 
-	fd.fd = conn->fd;
+	fd.fd = ring.conn->fd;
+	b = &ring.batches[ring.head];
+	gettimeofday(&last_tv, NULL);
 
-	while (!do_exit) {
+	while (!do_exit && !ring.error) {
 		fd.events = POLLIN | POLLPRI | POLLHUP;
 		fd.revents = 0;
 
-		ret = poll(&fd, 1, -1);
-		if (ret < 0)
+		/* flush a partial batch instead of sleeping on it */
+		ret = poll(&fd, 1, b->n_msgs > 0 ? 0 : 1000);
+		if (ret < 0 && errno != EINTR)
 			break;
 
 		if (fd.revents & POLLIN) {
-			ret = dump_packet(conn, output_fd);
-			if (ret != 0) {
-				fprintf(stderr, "Unable to dump packet '%s': %m\n", file);
-				return EXIT_FAILURE;
+			ret = receive_batch(&ring, &b, max_msgs, &stats);
+			if (ret < 0) {
+				fprintf(stderr, "Unable to dump packets to '%s'\n",
+					file);
+				break;
 			}
 
-			count++;
+			if (b->n_msgs >= max_msgs)
+				b = ring_commit(&ring, &stats);
+		} else if (b->n_msgs > 0) {
+			b = ring_commit(&ring, &stats);
 		}
 
 		if (fd.revents & (POLLHUP | POLLERR))
 			do_exit = true;
+
+		gettimeofday(&now, NULL);
+		if (!quiet && timeval_diff(&now, &last_tv) >= 1.0) {
+			print_stats(&ring, &stats, &last, &last_written,
+				    timeval_diff(&now, &last_tv));
+			last_tv = now;
+		}
 	}
 
-	fprintf(stderr, "\n%llu packets received and dumped.\n", count);
+	/* hand over what is left and let the writer finish */
+	ring_commit(&ring, &stats);
+	pthread_mutex_lock(&ring.lock);
+	ring.done = true;
+	pthread_cond_signal(&ring.filled);
+	pthread_mutex_unlock(&ring.lock);
+	pthread_join(writer, NULL);
+
+	fprintf(stderr, "\n%llu packets received and dumped, %llu dropped by the kernel.\n",
+		(unsigned long long) stats.msgs,
+		(unsigned long long) stats.dropped);
 	fprintf(stderr, "-- closing bus connections\n");
 	close(output_fd);
-	close(conn->fd);
-	free(conn);
+	close(ring.conn->fd);
+	free(ring.conn);
 
-	return 0;
+	return ring.error ? EXIT_FAILURE : 0;
 }
@@ -0,0 +1,938 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../kdbus.h"
+
+#define KDBUS_ALIGN8(l) (((l) + 7) & ~7)
+#define KDBUS_ITEM_HEADER_SIZE offsetof(struct kdbus_item, data)
+#define KDBUS_ITEM_SIZE(s) KDBUS_ALIGN8((s) + KDBUS_ITEM_HEADER_SIZE)
+
+#define KDBUS_ITEM_NEXT(item) \
+	(typeof(item))(((uint8_t *)item) + KDBUS_ALIGN8((item)->size))
+#define KDBUS_ITEM_FOREACH(item, head, first)				\
+	for (item = (head)->first;					\
+	     (uint8_t *)(item) < (uint8_t *)(head) + (head)->size;	\
+	     item = KDBUS_ITEM_NEXT(item))
+
+#define DEFAULT_POOL_SIZE	(16 * 1024LU * 1024LU)
+
+/* time to wait for stragglers after the last message was sent */
+#define DRAIN_TIMEOUT_MS	1000
+
+struct conn {
+	int fd;
+	uint64_t id;
+	void *buf;
+	size_t size;
+};
+
+struct pcap_header {
+	uint32_t	magic;
+	uint16_t	major;
+	uint16_t	minor;
+	uint32_t	tz_offset;
+	uint32_t	ts_accurancy;
+	uint32_t	snapshot_len;
+	uint32_t	header_type;
+};
+
+struct pcap_entry {
+	uint32_t	tv_sec;
+	uint32_t	tv_usec;
+	uint32_t	len;
+	uint32_t	total_len;
+	uint8_t		data[0];
+};
+
+/*
+ * A connection seen in the capture, and the connection standing in for it
+ * on the replay bus. Peers which only ever show up as the owner of a
+ * well-known name have an @orig_id of 0.
+ */
+struct peer {
+	uint64_t orig_id;
+	struct conn *conn;
+};
+
+struct name {
+	char *name;
+	uint64_t owner_id;
+};
+
+/* a captured message, rebuilt to be sent again */
+struct replay_msg {
+	uint64_t ts_ns;
+	struct peer *src;
+	struct kdbus_msg *msg;
+	uint64_t payload;
+};
+
+struct replay {
+	struct peer *peers;
+	unsigned int n_peers;
+	struct name *names;
+	unsigned int n_names;
+	struct replay_msg *msgs;
+	unsigned int n_msgs;
+
+	/* CLOCK_MONOTONIC send time of each message, indexed by cookie - 1 */
+	uint64_t *sent_ns;
+
+	/* written by the receiver thread only */
+	uint64_t *latencies;
+	uint64_t n_latencies;
+	uint64_t max_latencies;
+	uint64_t recv_bytes;
+
+	bool sending_done;
+	int error;
+};
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [options] <input-file>\n", argv0);
+	fprintf(stderr, "       input-file      A capture written by kdbus-monitor\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -b, --bus=PATH        Replay on an existing bus instead of creating one\n");
+	fprintf(stderr, "  -s, --speed=FACTOR    Scale the captured timing; 2 replays twice as\n");
+	fprintf(stderr, "                        fast, 0 as fast as possible (default: 1)\n");
+	fprintf(stderr, "  -p, --pool-size=MB    Size of the receive pool of each connection\n");
+	fprintf(stderr, "                        (default: %lu)\n",
+		DEFAULT_POOL_SIZE / (1024 * 1024));
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int make_bus(int *control_fd, char **path)
+{
+	struct {
+		struct kdbus_cmd_make head;
+
+		struct {
+			uint64_t size;
+			uint64_t type;
+			struct kdbus_bloom_parameter bloom;
+		} bp;
+
+		struct {
+			uint64_t size;
+			uint64_t type;
+			char str[64];
+		} name;
+	} bus_make;
+	int ret;
+
+	*control_fd = open("/dev/" KBUILD_MODNAME "/control",
+			   O_RDWR|O_CLOEXEC);
+	if (*control_fd < 0) {
+		fprintf(stderr, "--- error opening control node: %m\n");
+		return -errno;
+	}
+
+	memset(&bus_make, 0, sizeof(bus_make));
+	bus_make.bp.size = sizeof(bus_make.bp);
+	bus_make.bp.type = KDBUS_ITEM_BLOOM_PARAMETER;
+	bus_make.bp.bloom.size = 64;
+	bus_make.bp.bloom.n_hash = 1;
+
+	snprintf(bus_make.name.str, sizeof(bus_make.name.str),
+		 "%u-replay-%u", getuid(), getpid());
+
+	bus_make.name.type = KDBUS_ITEM_MAKE_NAME;
+	bus_make.name.size = KDBUS_ITEM_HEADER_SIZE +
+			     strlen(bus_make.name.str) + 1;
+
+	bus_make.head.flags = KDBUS_MAKE_ACCESS_WORLD;
+	bus_make.head.size = sizeof(bus_make.head) +
+			     sizeof(bus_make.bp) +
+			     bus_make.name.size;
+
+	ret = ioctl(*control_fd, KDBUS_CMD_BUS_MAKE, &bus_make);
+	if (ret < 0) {
+		fprintf(stderr, "--- error creating bus: %d (%m)\n", ret);
+		return -errno;
+	}
+
+	if (asprintf(path, "/dev/" KBUILD_MODNAME "/%s/bus",
+		     bus_make.name.str) < 0)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static struct conn *kdbus_hello(const char *path, uint64_t orig_id,
+				size_t pool_size, uint64_t *bloom_size)
+{
+	int fd, ret;
+	struct {
+		struct kdbus_cmd_hello hello;
+
+		struct {
+			uint64_t size;
+			uint64_t type;
+			char str[32];
+		} name;
+	} h;
+	struct {
+		struct kdbus_cmd_match cmd;
+		struct kdbus_item item;
+	} match;
+	struct conn *conn;
+
+	memset(&h, 0, sizeof(h));
+
+	fd = open(path, O_RDWR|O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "--- error %d (%m)\n", fd);
+		return NULL;
+	}
+
+	h.name.type = KDBUS_ITEM_CONN_DESCRIPTION;
+	snprintf(h.name.str, sizeof(h.name.str), "replay-%llu",
+		 (unsigned long long) orig_id);
+	h.name.size = KDBUS_ITEM_HEADER_SIZE + strlen(h.name.str) + 1;
+
+	h.hello.size = sizeof(h);
+	h.hello.pool_size = pool_size;
+
+	ret = ioctl(fd, KDBUS_CMD_HELLO, &h.hello);
+	if (ret < 0) {
+		fprintf(stderr, "--- error when saying hello: %d (%m)\n", ret);
+		return NULL;
+	}
+
+	/* every peer receives all broadcasts, bloom filters are not replayed */
+	memset(&match, 0, sizeof(match));
+	match.item.size = sizeof(uint64_t) * 3;
+	match.item.type = KDBUS_ITEM_ID;
+	match.item.id = KDBUS_MATCH_ID_ANY;
+	match.cmd.size = sizeof(match.cmd) + match.item.size;
+
+	ret = ioctl(fd, KDBUS_CMD_MATCH_ADD, &match);
+	if (ret < 0) {
+		fprintf(stderr, "--- error adding conn match: %d (%m)\n", ret);
+		return NULL;
+	}
+
+	conn = malloc(sizeof(*conn));
+	if (!conn) {
+		fprintf(stderr, "unable to malloc()!?\n");
+		return NULL;
+	}
+
+	conn->buf = mmap(NULL, pool_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (conn->buf == MAP_FAILED) {
+		free(conn);
+		fprintf(stderr, "--- error mmap (%m)\n");
+		return NULL;
+	}
+
+	conn->fd = fd;
+	conn->id = h.hello.id;
+	conn->size = pool_size;
+	*bloom_size = h.hello.bloom.size;
+
+	return conn;
+}
+
+static int name_acquire(struct conn *conn, const char *name)
+{
+	struct kdbus_cmd_name *cmd_name;
+	size_t name_len = strlen(name) + 1;
+	uint64_t size = sizeof(*cmd_name) + KDBUS_ITEM_SIZE(name_len);
+	struct kdbus_item *item;
+	int ret;
+
+	cmd_name = alloca(size);
+	memset(cmd_name, 0, size);
+
+	item = cmd_name->items;
+	item->size = KDBUS_ITEM_HEADER_SIZE + name_len;
+	item->type = KDBUS_ITEM_NAME;
+	strcpy(item->str, name);
+
+	cmd_name->size = size;
+
+	ret = ioctl(conn->fd, KDBUS_CMD_NAME_ACQUIRE, cmd_name);
+	if (ret < 0) {
+		fprintf(stderr, "--- error acquiring name '%s': %m\n", name);
+		return -errno;
+	}
+
+	return 0;
+}
+
+static struct peer *peer_find(struct replay *r, uint64_t orig_id)
+{
+	unsigned int i;
+
+	for (i = 0; i < r->n_peers; i++)
+		if (r->peers[i].orig_id == orig_id)
+			return &r->peers[i];
+
+	return NULL;
+}
+
+static int peer_add(struct replay *r, uint64_t orig_id)
+{
+	struct peer *p;
+
+	if (orig_id != 0 && peer_find(r, orig_id))
+		return 0;
+
+	p = realloc(r->peers, (r->n_peers + 1) * sizeof(*p));
+	if (!p)
+		return -ENOMEM;
+
+	r->peers = p;
+	r->peers[r->n_peers].orig_id = orig_id;
+	r->peers[r->n_peers].conn = NULL;
+	r->n_peers++;
+
+	return 0;
+}
+
+/* remember a name; its owner is resolved once all peers are known */
+static int name_add(struct replay *r, const char *name, uint64_t owner_id)
+{
+	struct name *n;
+	unsigned int i;
+
+	for (i = 0; i < r->n_names; i++) {
+		if (strcmp(r->names[i].name, name) != 0)
+			continue;
+
+		/* the first owner seen in the capture keeps the name */
+		if (r->names[i].owner_id == 0)
+			r->names[i].owner_id = owner_id;
+
+		return 0;
+	}
+
+	n = realloc(r->names, (r->n_names + 1) * sizeof(*n));
+	if (!n)
+		return -ENOMEM;
+
+	r->names = n;
+	r->names[r->n_names].name = strdup(name);
+	if (!r->names[r->n_names].name)
+		return -ENOMEM;
+
+	r->names[r->n_names].owner_id = owner_id;
+	r->n_names++;
+
+	return 0;
+}
+
+/*
+ * Iterate over the records of the capture, and check that each one is
+ * complete. Returns the next record, NULL at the end of the capture, or
+ * ERR via @ret.
+ */
+static struct pcap_entry *capture_next(const uint8_t *buf, size_t size,
+				       size_t *pos, int *ret)
+{
+	struct pcap_entry *entry;
+	struct kdbus_msg *msg;
+
+	*ret = 0;
+
+	if (*pos == size)
+		return NULL;
+
+	if (size - *pos < sizeof(*entry))
+		goto exit_truncated;
+
+	entry = (struct pcap_entry *)(buf + *pos);
+	if (size - *pos - sizeof(*entry) < entry->len ||
+	    entry->len < sizeof(*msg))
+		goto exit_truncated;
+
+	msg = (struct kdbus_msg *) entry->data;
+	if (msg->size < sizeof(*msg) || msg->size > entry->len)
+		goto exit_truncated;
+
+	*pos += sizeof(*entry) + entry->len;
+	return entry;
+
+exit_truncated:
+	fprintf(stderr, "Capture is truncated or corrupt at offset %zu\n",
+		*pos);
+	*ret = -EBADMSG;
+	return NULL;
+}
+
+/* learn the connections and names the capture refers to */
+static int capture_scan(struct replay *r, const uint8_t *buf, size_t size)
+{
+	const struct kdbus_item *item;
+	struct pcap_entry *entry;
+	struct kdbus_msg *msg;
+	size_t pos = sizeof(struct pcap_header);
+	int ret;
+
+	while ((entry = capture_next(buf, size, &pos, &ret))) {
+		msg = (struct kdbus_msg *) entry->data;
+
+		/* kernel notifications are generated by the replay bus */
+		if (msg->src_id == KDBUS_SRC_ID_KERNEL)
+			continue;
+
+		ret = peer_add(r, msg->src_id);
+		if (ret < 0)
+			return ret;
+
+		if (msg->dst_id != KDBUS_DST_ID_NAME &&
+		    msg->dst_id != KDBUS_DST_ID_BROADCAST) {
+			ret = peer_add(r, msg->dst_id);
+			if (ret < 0)
+				return ret;
+		}
+
+		KDBUS_ITEM_FOREACH(item, msg, items) {
+			if (item->size < KDBUS_ITEM_HEADER_SIZE ||
+			    (uint8_t *) item + item->size >
+			    (uint8_t *) msg + msg->size) {
+				fprintf(stderr, "Corrupt item in capture\n");
+				return -EBADMSG;
+			}
+
+			switch (item->type) {
+			case KDBUS_ITEM_NAME:
+				/* names attached as metadata of the sender */
+				ret = name_add(r, item->name.name,
+					       msg->src_id);
+				break;
+
+			case KDBUS_ITEM_DST_NAME:
+				ret = name_add(r, item->str, 0);
+				break;
+
+			default:
+				ret = 0;
+				break;
+			}
+
+			if (ret < 0)
+				return ret;
+		}
+
+		r->n_msgs++;
+	}
+
+	return ret;
+}
+
+/* connect one stand-in per peer, and let them own the captured names */
+static int replay_connect(struct replay *r, const char *bus, size_t pool_size,
+			  uint64_t *bloom_size)
+{
+	unsigned int i;
+	int ret;
+
+	/* names without a known owner get a connection of their own */
+	for (i = 0; i < r->n_names; i++) {
+		if (r->names[i].owner_id != 0 &&
+		    peer_find(r, r->names[i].owner_id))
+			continue;
+
+		ret = peer_add(r, 0);
+		if (ret < 0)
+			return ret;
+
+		r->names[i].owner_id = 0;
+	}
+
+	for (i = 0; i < r->n_peers; i++) {
+		r->peers[i].conn = kdbus_hello(bus, r->peers[i].orig_id,
+					       pool_size, bloom_size);
+		if (!r->peers[i].conn)
+			return -EIO;
+	}
+
+	/* the anonymous peers follow the ones seen in the capture */
+	for (i = 0; i < r->n_peers && r->peers[i].orig_id != 0; i++)
+		;
+
+	for (ret = 0; ret == 0 && r->n_names > 0; r->n_names--) {
+		struct name *n = &r->names[r->n_names - 1];
+		struct peer *p;
+
+		if (n->owner_id != 0)
+			p = peer_find(r, n->owner_id);
+		else
+			p = &r->peers[i++];
+
+		ret = name_acquire(p->conn, n->name);
+		free(n->name);
+	}
+
+	free(r->names);
+	r->names = NULL;
+
+	return ret;
+}
+
+/*
+ * Rebuild a captured message for sending: PAYLOAD_OFF items become
+ * PAYLOAD_VEC items pointing into the capture, connection IDs are mapped
+ * to the stand-ins, and broadcasts carry an empty bloom filter.
+ */
+static struct kdbus_msg *msg_rebuild(struct replay *r,
+				     const struct pcap_entry *entry,
+				     uint64_t cookie, uint64_t bloom_size,
+				     uint64_t *payload)
+{
+	const struct kdbus_msg *cmsg = (struct kdbus_msg *) entry->data;
+	const uint8_t *data = entry->data + cmsg->size;
+	const uint8_t *end = entry->data + entry->len;
+	const struct kdbus_item *citem;
+	struct kdbus_item *item;
+	struct kdbus_msg *msg;
+	struct peer *dst;
+	size_t size;
+
+	size = sizeof(*msg);
+	KDBUS_ITEM_FOREACH(citem, cmsg, items) {
+		switch (citem->type) {
+		case KDBUS_ITEM_PAYLOAD_OFF:
+			size += KDBUS_ITEM_SIZE(sizeof(struct kdbus_vec));
+			break;
+
+		case KDBUS_ITEM_DST_NAME:
+			size += KDBUS_ALIGN8(citem->size);
+			break;
+		}
+	}
+
+	if (cmsg->dst_id == KDBUS_DST_ID_BROADCAST)
+		size += KDBUS_ITEM_SIZE(sizeof(struct kdbus_bloom_filter) +
+					bloom_size);
+
+	msg = calloc(1, size);
+	if (!msg)
+		return NULL;
+
+	msg->size = size;
+	msg->priority = cmsg->priority;
+	msg->payload_type = cmsg->payload_type;
+	msg->cookie = cookie;
+
+	/*
+	 * Replies are sent as plain messages; the calls they answer were
+	 * not tracked by the replay bus.
+	 */
+	msg->flags = cmsg->flags & KDBUS_MSG_FLAGS_NO_AUTO_START;
+
+	if (cmsg->dst_id == KDBUS_DST_ID_NAME ||
+	    cmsg->dst_id == KDBUS_DST_ID_BROADCAST) {
+		msg->dst_id = cmsg->dst_id;
+	} else {
+		dst = peer_find(r, cmsg->dst_id);
+		msg->dst_id = dst->conn->id;
+	}
+
+	*payload = 0;
+	item = msg->items;
+	KDBUS_ITEM_FOREACH(citem, cmsg, items) {
+		switch (citem->type) {
+		case KDBUS_ITEM_PAYLOAD_OFF:
+			item->type = KDBUS_ITEM_PAYLOAD_VEC;
+			item->size = KDBUS_ITEM_HEADER_SIZE +
+				     sizeof(struct kdbus_vec);
+			item->vec.size = citem->vec.size;
+
+			if (citem->vec.offset != ~0ULL) {
+				if ((size_t)(end - data) <
+				    KDBUS_ALIGN8(citem->vec.size))
+					goto exit_free;
+
+				item->vec.address = (uintptr_t) data;
+				data += KDBUS_ALIGN8(citem->vec.size);
+				*payload += citem->vec.size;
+			} else {
+				/* only the padding of \0-bytes is stored */
+				data += citem->vec.size % 8;
+			}
+
+			item = KDBUS_ITEM_NEXT(item);
+			break;
+
+		case KDBUS_ITEM_DST_NAME:
+			memcpy(item, citem, citem->size);
+			item = KDBUS_ITEM_NEXT(item);
+			break;
+		}
+	}
+
+	if (cmsg->dst_id == KDBUS_DST_ID_BROADCAST) {
+		item->type = KDBUS_ITEM_BLOOM_FILTER;
+		item->size = KDBUS_ITEM_HEADER_SIZE +
+			     sizeof(struct kdbus_bloom_filter) + bloom_size;
+	}
+
+	return msg;
+
+exit_free:
+	fprintf(stderr, "Payload of message %llu is truncated\n",
+		(unsigned long long) cookie);
+	free(msg);
+	return NULL;
+}
+
+static int capture_load(struct replay *r, const uint8_t *buf, size_t size,
+			uint64_t bloom_size)
+{
+	const struct kdbus_item *item;
+	struct pcap_entry *entry;
+	struct replay_msg *m;
+	struct kdbus_msg *msg;
+	size_t pos = sizeof(struct pcap_header);
+	int ret;
+
+	r->msgs = calloc(r->n_msgs, sizeof(*r->msgs));
+	r->sent_ns = calloc(r->n_msgs, sizeof(*r->sent_ns));
+	if (!r->msgs || !r->sent_ns)
+		return -ENOMEM;
+
+	r->n_msgs = 0;
+	while ((entry = capture_next(buf, size, &pos, &ret))) {
+		msg = (struct kdbus_msg *) entry->data;
+		if (msg->src_id == KDBUS_SRC_ID_KERNEL)
+			continue;
+
+		m = &r->msgs[r->n_msgs];
+		m->src = peer_find(r, msg->src_id);
+		m->ts_ns = entry->tv_sec * 1000000000ULL +
+			   entry->tv_usec * 1000ULL;
+
+		/* the send time is more accurate than the capture time */
+		KDBUS_ITEM_FOREACH(item, msg, items)
+			if (item->type == KDBUS_ITEM_TIMESTAMP)
+				m->ts_ns = item->timestamp.realtime_ns;
+
+		m->msg = msg_rebuild(r, entry, r->n_msgs + 1, bloom_size,
+				     &m->payload);
+		if (!m->msg)
+			return -EBADMSG;
+
+		r->n_msgs++;
+	}
+
+	return ret;
+}
+
+static void latency_add(struct replay *r, uint64_t ns)
+{
+	uint64_t *l;
+
+	if (r->n_latencies == r->max_latencies) {
+		r->max_latencies = r->max_latencies * 2 ?: 4096;
+		l = realloc(r->latencies, r->max_latencies * sizeof(*l));
+		if (!l) {
+			r->error = -ENOMEM;
+			return;
+		}
+
+		r->latencies = l;
+	}
+
+	r->latencies[r->n_latencies++] = ns;
+}
+
+static int receive_all(struct replay *r, struct conn *conn)
+{
+	struct kdbus_cmd_recv recv = {};
+	struct kdbus_msg *msg;
+	uint64_t sent, now;
+	int ret;
+
+	for (;;) {
+		recv.offset = 0;
+		ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+		if (ret < 0) {
+			if (errno == EAGAIN)
+				return 0;
+
+			fprintf(stderr, "error receiving message: %d (%m)\n",
+				ret);
+			return -errno;
+		}
+
+		now = now_ns();
+		msg = (struct kdbus_msg *)(conn->buf + recv.offset);
+
+		if (msg->src_id != KDBUS_SRC_ID_KERNEL &&
+		    msg->cookie > 0 && msg->cookie <= r->n_msgs) {
+			sent = __atomic_load_n(&r->sent_ns[msg->cookie - 1],
+					       __ATOMIC_ACQUIRE);
+			latency_add(r, now - sent);
+			r->recv_bytes += msg->size;
+		}
+
+		ret = ioctl(conn->fd, KDBUS_CMD_FREE, &recv.offset);
+		if (ret < 0) {
+			fprintf(stderr, "error free message: %d (%m)\n", ret);
+			return -errno;
+		}
+	}
+}
+
+static void *receiver_thread(void *data)
+{
+	struct replay *r = data;
+	struct pollfd *fds;
+	unsigned int i;
+	bool done;
+	int ret;
+
+	fds = calloc(r->n_peers, sizeof(*fds));
+	if (!fds) {
+		r->error = -ENOMEM;
+		return NULL;
+	}
+
+	for (i = 0; i < r->n_peers; i++) {
+		fds[i].fd = r->peers[i].conn->fd;
+		fds[i].events = POLLIN;
+	}
+
+	while (!r->error) {
+		/* sample the flag first, so that nothing sent is missed */
+		done = __atomic_load_n(&r->sending_done, __ATOMIC_ACQUIRE);
+
+		ret = poll(fds, r->n_peers, done ? DRAIN_TIMEOUT_MS : 100);
+		if (ret < 0 && errno != EINTR) {
+			r->error = -errno;
+			break;
+		}
+
+		if (ret == 0 && done)
+			break;
+
+		for (i = 0; ret > 0 && i < r->n_peers; i++) {
+			if (!(fds[i].revents & POLLIN))
+				continue;
+
+			ret = receive_all(r, r->peers[i].conn);
+			if (ret < 0) {
+				r->error = ret;
+				break;
+			}
+			ret = 1;
+		}
+	}
+
+	free(fds);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const struct replay *r, double p)
+{
+	uint64_t i;
+
+	if (r->n_latencies == 0)
+		return 0;
+
+	i = p / 100.0 * (r->n_latencies - 1) + 0.5;
+	return r->latencies[i] / 1000.0;
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] = {
+		{ "bus",	required_argument,	NULL, 'b' },
+		{ "speed",	required_argument,	NULL, 's' },
+		{ "pool-size",	required_argument,	NULL, 'p' },
+		{}
+	};
+	size_t pool_size = DEFAULT_POOL_SIZE;
+	uint64_t sent = 0, failed = 0, payload = 0;
+	uint64_t start, target, bloom_size = 0;
+	struct pcap_header *header;
+	struct replay r = {};
+	struct timespec ts;
+	char *bus = NULL;
+	double speed = 1.0, secs;
+	pthread_t receiver;
+	int control_fd = -1;
+	unsigned int i;
+	struct stat st;
+	uint8_t *buf;
+	int fd, ret, c;
+
+	while ((c = getopt_long(argc, argv, "b:s:p:", options, NULL)) >= 0) {
+		switch (c) {
+		case 'b':
+			bus = optarg;
+			break;
+
+		case 's':
+			speed = strtod(optarg, NULL);
+			break;
+
+		case 'p':
+			pool_size = strtoul(optarg, NULL, 0) * 1024 * 1024;
+			break;
+
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind < 1 || speed < 0 || pool_size == 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	fd = open(argv[optind], O_RDONLY|O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "Unable to open '%s': %m\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	if ((size_t) st.st_size < sizeof(*header)) {
+		fprintf(stderr, "'%s' is not a capture\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED) {
+		fprintf(stderr, "Unable to map '%s': %m\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	header = (struct pcap_header *) buf;
+	if (header->magic != 0xa1b2c3d4) {
+		fprintf(stderr, "'%s' is not a capture\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	ret = capture_scan(&r, buf, st.st_size);
+	if (ret < 0)
+		return EXIT_FAILURE;
+
+	if (!bus) {
+		ret = make_bus(&control_fd, &bus);
+		if (ret < 0)
+			return EXIT_FAILURE;
+	}
+
+	printf("-- replaying %u messages between %u connections on %s\n",
+	       r.n_msgs, r.n_peers, bus);
+
+	ret = replay_connect(&r, bus, pool_size, &bloom_size);
+	if (ret < 0)
+		return EXIT_FAILURE;
+
+	ret = capture_load(&r, buf, st.st_size, bloom_size);
+	if (ret < 0)
+		return EXIT_FAILURE;
+
+	ret = pthread_create(&receiver, NULL, receiver_thread, &r);
+	if (ret != 0) {
+		fprintf(stderr, "Unable to start the receiver thread\n");
+		return EXIT_FAILURE;
+	}
+
+	start = now_ns();
+	for (i = 0; i < r.n_msgs && !r.error; i++) {
+		struct replay_msg *m = &r.msgs[i];
+
+		if (speed > 0) {
+			target = start + (m->ts_ns > r.msgs[0].ts_ns ?
+				 (m->ts_ns - r.msgs[0].ts_ns) / speed : 0);
+			ts.tv_sec = target / 1000000000ULL;
+			ts.tv_nsec = target % 1000000000ULL;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					&ts, NULL);
+		}
+
+		__atomic_store_n(&r.sent_ns[i], now_ns(), __ATOMIC_RELEASE);
+
+		ret = ioctl(m->src->conn->fd, KDBUS_CMD_MSG_SEND, m->msg);
+		if (ret < 0) {
+			failed++;
+			continue;
+		}
+
+		sent++;
+		payload += m->payload;
+	}
+
+	secs = (now_ns() - start) / 1e9;
+
+	__atomic_store_n(&r.sending_done, true, __ATOMIC_RELEASE);
+	pthread_join(receiver, NULL);
+
+	if (r.error) {
+		fprintf(stderr, "Replay failed: %s\n", strerror(-r.error));
+		return EXIT_FAILURE;
+	}
+
+	qsort(r.latencies, r.n_latencies, sizeof(*r.latencies), cmp_u64);
+
+	printf("%llu messages sent, %llu failed, in %.3f s\n",
+	       (unsigned long long) sent, (unsigned long long) failed, secs);
+	printf("%10.0f msg/s %8.2f MiB/s payload\n",
+	       secs > 0 ? sent / secs : 0,
+	       secs > 0 ? payload / secs / (1024 * 1024) : 0);
+	printf("%llu messages delivered, %llu bytes\n",
+	       (unsigned long long) r.n_latencies,
+	       (unsigned long long) r.recv_bytes);
+	printf("latency usec: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+	       percentile_us(&r, 50), percentile_us(&r, 90),
+	       percentile_us(&r, 99), percentile_us(&r, 99.9),
+	       percentile_us(&r, 100));
+
+	printf("-- closing bus connections\n");
+	for (i = 0; i < r.n_peers; i++) {
+		close(r.peers[i].conn->fd);
+		free(r.peers[i].conn);
+	}
+
+	for (i = 0; i < r.n_msgs; i++)
+		free(r.msgs[i].msg);
+
+	free(r.msgs);
+	free(r.sent_ns);
+	free(r.latencies);
+	free(r.peers);
+	munmap(buf, st.st_size);
+	close(fd);
+
+	if (control_fd >= 0)
+		close(control_fd);
+
+	return 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2013-2014 Kay Sievers
+ * Copyright (C) 2013-2014 Greg Kroah-Hartman <gregkh@linuxfoundation.org>
+ * Copyright (C) 2013-2014 Daniel Mack <daniel@zonque.org>
+ * Copyright (C) 2013-2014 David Herrmann <dh.herrmann@gmail.com>
+ * Copyright (C) 2013-2014 Linux Foundation
+ *
+ * kdbus is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ */
+
+/*
+ * Tracepoints along the path of a message, from the copy-in of the sender
+ * to the install in the receiver. All events of a message carry its
+ * cookie and the connection IDs involved, so the stages of a message can
+ * be matched up from a trace. Kernel-generated messages have a source ID
+ * of 0.
+ *
+ * The events only take plain values, so this header does not depend on
+ * the layout of any kdbus object.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM kdbus
+
+#if !defined(__KDBUS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define __KDBUS_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* a message was copied in from the sender and validated */
+TRACE_EVENT(kdbus_kmsg_new,
+	TP_PROTO(u64 src_id, u64 dst_id, u64 cookie, u64 size, u64 flags),
+	TP_ARGS(src_id, dst_id, cookie, size, flags),
+	TP_STRUCT__entry(
+		__field(u64, src_id)
+		__field(u64, dst_id)
+		__field(u64, cookie)
+		__field(u64, size)
+		__field(u64, flags)
+	),
+	TP_fast_assign(
+		__entry->src_id = src_id;
+		__entry->dst_id = dst_id;
+		__entry->cookie = cookie;
+		__entry->size = size;
+		__entry->flags = flags;
+	),
+	TP_printk("src=%llu dst=%llu cookie=%llu size=%llu flags=0x%llx",
+		  __entry->src_id, __entry->dst_id, __entry->cookie,
+		  __entry->size, __entry->flags)
+);
+
+/*
+ * The destination connection of a unicast message was looked up; @name_id
+ * is the ID of the well-known name it was addressed to, or 0.
+ */
+TRACE_EVENT(kdbus_msg_resolve,
+	TP_PROTO(u64 src_id, u64 dst_id, u64 cookie, u64 name_id),
+	TP_ARGS(src_id, dst_id, cookie, name_id),
+	TP_STRUCT__entry(
+		__field(u64, src_id)
+		__field(u64, dst_id)
+		__field(u64, cookie)
+		__field(u64, name_id)
+	),
+	TP_fast_assign(
+		__entry->src_id = src_id;
+		__entry->dst_id = dst_id;
+		__entry->cookie = cookie;
+		__entry->name_id = name_id;
+	),
+	TP_printk("src=%llu dst=%llu cookie=%llu name_id=%llu",
+		  __entry->src_id, __entry->dst_id, __entry->cookie,
+		  __entry->name_id)
+);
+
+/* metadata of the sender was collected for a receiver */
+TRACE_EVENT(kdbus_kmsg_attach_metadata,
+	TP_PROTO(u64 src_id, u64 cookie, u64 attach_flags, int ret),
+	TP_ARGS(src_id, cookie, attach_flags, ret),
+	TP_STRUCT__entry(
+		__field(u64, src_id)
+		__field(u64, cookie)
+		__field(u64, attach_flags)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__entry->src_id = src_id;
+		__entry->cookie = cookie;
+		__entry->attach_flags = attach_flags;
+		__entry->ret = ret;
+	),
+	TP_printk("src=%llu cookie=%llu attach=0x%llx ret=%d",
+		  __entry->src_id, __entry->cookie, __entry->attach_flags,
+		  __entry->ret)
+);
+
+/* a message was copied into a slice of the receiver's pool */
+TRACE_EVENT(kdbus_queue_entry_alloc,
+	TP_PROTO(u64 src_id, u64 dst_id, u64 cookie, size_t off,
+		 size_t msg_size, size_t vecs_size, size_t meta_size),
+	TP_ARGS(src_id, dst_id, cookie, off, msg_size, vecs_size, meta_size),
+	TP_STRUCT__entry(
+		__field(u64, src_id)
+		__field(u64, dst_id)
+		__field(u64, cookie)
+		__field(size_t, off)
+		__field(size_t, msg_size)
+		__field(size_t, vecs_size)
+		__field(size_t, meta_size)
+	),
+	TP_fast_assign(
+		__entry->src_id = src_id;
+		__entry->dst_id = dst_id;
+		__entry->cookie = cookie;
+		__entry->off = off;
+		__entry->msg_size = msg_size;
+		__entry->vecs_size = vecs_size;
+		__entry->meta_size = meta_size;
+	),
+	TP_printk("src=%llu dst=%llu cookie=%llu off=%zu msg_size=%zu vecs_size=%zu meta_size=%zu",
+		  __entry->src_id, __entry->dst_id, __entry->cookie,
+		  __entry->off, __entry->msg_size, __entry->vecs_size,
+		  __entry->meta_size)
+);
+
+/*
+ * Pools do not know about connections or messages; the offset of a slice
+ * matches the one reported by kdbus_queue_entry_alloc.
+ */
+DECLARE_EVENT_CLASS(kdbus_pool_slice,
+	TP_PROTO(const void *pool, size_t off, size_t size, size_t busy),
+	TP_ARGS(pool, off, size, busy),
+	TP_STRUCT__entry(
+		__field(const void *, pool)
+		__field(size_t, off)
+		__field(size_t, size)
+		__field(size_t, busy)
+	),
+	TP_fast_assign(
+		__entry->pool = pool;
+		__entry->off = off;
+		__entry->size = size;
+		__entry->busy = busy;
+	),
+	TP_printk("pool=%p off=%zu size=%zu busy=%zu",
+		  __entry->pool, __entry->off, __entry->size, __entry->busy)
+);
+
+DEFINE_EVENT(kdbus_pool_slice, kdbus_pool_slice_alloc,
+	TP_PROTO(const void *pool, size_t off, size_t size, size_t busy),
+	TP_ARGS(pool, off, size, busy)
+);
+
+DEFINE_EVENT(kdbus_pool_slice, kdbus_pool_slice_free,
+	TP_PROTO(const void *pool, size_t off, size_t size, size_t busy),
+	TP_ARGS(pool, off, size, busy)
+);
+
+/*
+ * A message was queued for, or taken off the queue of the receiver; @count
+ * is the number of messages in all receive queues of the receiver after.
+ */
+DECLARE_EVENT_CLASS(kdbus_queue_entry,
+	TP_PROTO(u64 src_id, u64 dst_id, u64 cookie, s64 priority,
+		 size_t count),
+	TP_ARGS(src_id, dst_id, cookie, priority, count),
+	TP_STRUCT__entry(
+		__field(u64, src_id)
+		__field(u64, dst_id)
+		__field(u64, cookie)
+		__field(s64, priority)
+		__field(size_t, count)
+	),
+	TP_fast_assign(
+		__entry->src_id = src_id;
+		__entry->dst_id = dst_id;
+		__entry->cookie = cookie;
+		__entry->priority = priority;
+		__entry->count = count;
+	),
+	TP_printk("src=%llu dst=%llu cookie=%llu priority=%lld count=%zu",
+		  __entry->src_id, __entry->dst_id, __entry->cookie,
+		  __entry->priority, __entry->count)
+);
+
+DEFINE_EVENT(kdbus_queue_entry, kdbus_queue_entry_add,
+	TP_PROTO(u64 src_id, u64 dst_id, u64 cookie, s64 priority,
+		 size_t count),
+	TP_ARGS(src_id, dst_id, cookie, priority, count)
+);
+
+DEFINE_EVENT(kdbus_queue_entry, kdbus_queue_entry_remove,
+	TP_PROTO(u64 src_id, u64 dst_id, u64 cookie, s64 priority,
+		 size_t count),
+	TP_ARGS(src_id, dst_id, cookie, priority, count)
+);
+
+/* file descriptors of a message were installed in the receiver */
+TRACE_EVENT(kdbus_fd_install,
+	TP_PROTO(u64 src_id, u64 dst_id, u64 cookie,
+		 unsigned int fds, unsigned int memfds),
+	TP_ARGS(src_id, dst_id, cookie, fds, memfds),
+	TP_STRUCT__entry(
+		__field(u64, src_id)
+		__field(u64, dst_id)
+		__field(u64, cookie)
+		__field(unsigned int, fds)
+		__field(unsigned int, memfds)
+	),
+	TP_fast_assign(
+		__entry->src_id = src_id;
+		__entry->dst_id = dst_id;
+		__entry->cookie = cookie;
+		__entry->fds = fds;
+		__entry->memfds = memfds;
+	),
+	TP_printk("src=%llu dst=%llu cookie=%llu fds=%u memfds=%u",
+		  __entry->src_id, __entry->dst_id, __entry->cookie,
+		  __entry->fds, __entry->memfds)
+);
+
+/*
+ * A synchronous caller was woken up, by the reply or an error. @dst_id
+ * is the caller, which is the destination of the reply.
+ */
+TRACE_EVENT(kdbus_reply_wake,
+	TP_PROTO(u64 dst_id, u64 cookie, int err),
+	TP_ARGS(dst_id, cookie, err),
+	TP_STRUCT__entry(
+		__field(u64, dst_id)
+		__field(u64, cookie)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->dst_id = dst_id;
+		__entry->cookie = cookie;
+		__entry->err = err;
+	),
+	TP_printk("dst=%llu cookie=%llu err=%d",
+		  __entry->dst_id, __entry->cookie, __entry->err)
+);
+
+/*
+ * A reply did not arrive in time. @src_id is the connection which was
+ * expected to reply, @dst_id the one waiting for it.
+ */
+TRACE_EVENT(kdbus_reply_timeout,
+	TP_PROTO(u64 src_id, u64 dst_id, u64 cookie, bool sync),
+	TP_ARGS(src_id, dst_id, cookie, sync),
+	TP_STRUCT__entry(
+		__field(u64, src_id)
+		__field(u64, dst_id)
+		__field(u64, cookie)
+		__field(bool, sync)
+	),
+	TP_fast_assign(
+		__entry->src_id = src_id;
+		__entry->dst_id = dst_id;
+		__entry->cookie = cookie;
+		__entry->sync = sync;
+	),
+	TP_printk("src=%llu dst=%llu cookie=%llu sync=%d",
+		  __entry->src_id, __entry->dst_id, __entry->cookie,
+		  __entry->sync)
+);
+
+/* pending kernel notifications of a bus were sent out */
+TRACE_EVENT(kdbus_notify_flush,
+	TP_PROTO(u64 bus_id, unsigned int count),
+	TP_ARGS(bus_id, count),
+	TP_STRUCT__entry(
+		__field(u64, bus_id)
+		__field(unsigned int, count)
+	),
+	TP_fast_assign(
+		__entry->bus_id = bus_id;
+		__entry->count = count;
+	),
+	TP_printk("bus=%llu count=%u", __entry->bus_id, __entry->count)
+);
+
+#endif /* __KDBUS_TRACE_H */
+
+/* this part must be outside the header guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+#include <trace/define_trace.h>
@@ -56,6 +56,22 @@
 	copy_to_user(_sz, _s, sizeof(__u64));				\
 })
 
+/**
+ * kdbus_member_set_user - write a 64 bit member variable to user memory
+ * @_s:			Variable
+ * @_b:			Buffer to write to
+ * @_t:			Structure, @_m is a member of
+ * @_m:			Member to write
+ *
+ * Return: the result of copy_to_user()
+ */
+#define kdbus_member_set_user(_s, _b, _t, _m)				\
+({									\
+	u64 __user *_sz =						\
+		(void __user *)((u8 __user *)(_b) + offsetof(_t, _m));	\
+	copy_to_user(_sz, _s, sizeof(__u64));				\
+})
+
 /**
  * kdbus_str_hash - calculate a hash
  * @str:		String